@@ -0,0 +1,164 @@
+//
+// Minimal microbenchmark harness in the spirit of Google Benchmark, kept in tree so the suite builds
+// without extra dependencies. A benchmark is a function taking a State and looping while keepRunning():
+//
+//   void BM_Example(bench::State &state) {
+//       while (state.keepRunning())
+//           bench::doNotOptimize(work());
+//   }
+//   BENCHMARK(BM_Example);
+//
+// The runner grows the iteration count until one run takes at least --min-time seconds, then reports
+// the median of --repetitions runs.
+//
+
+#ifndef PROJECT_BASE_BENCH_H
+#define PROJECT_BASE_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+// keeps the compiler from optimizing away the computation of `value`
+template<typename T>
+inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// forces pending writes to memory to be treated as observable
+inline void clobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+class State {
+public:
+    explicit State(size_t iterations) : m_iterations(iterations), m_remaining(iterations) {}
+
+    bool keepRunning() {
+        if (m_remaining > 0) {
+            if (m_remaining-- == m_iterations)
+                resumeTiming();
+            return true;
+        }
+        pauseTiming();
+        return false;
+    }
+
+    // excludes setup inside the loop from the measurement
+    void pauseTiming() {
+        if (m_running)
+            m_elapsed += std::chrono::steady_clock::now() - m_start;
+        m_running = false;
+    }
+
+    void resumeTiming() {
+        m_start = std::chrono::steady_clock::now();
+        m_running = true;
+    }
+
+    size_t iterations() const { return m_iterations; }
+
+    // items (vertices, instances, bytes, ...) one iteration handles, reported as a rate
+    void setItemsProcessed(size_t items) { m_items = items; }
+
+    // marks the benchmark as not runnable, e.g. because an asset is missing
+    void skip(const std::string &reason) {
+        m_skipped = reason;
+        m_remaining = 0;
+    }
+
+    double seconds() const { return std::chrono::duration<double>(m_elapsed).count(); }
+    size_t items() const { return m_items; }
+    const std::string &skipped() const { return m_skipped; }
+
+private:
+    size_t m_iterations;
+    size_t m_remaining;
+    size_t m_items = 0;
+    bool m_running = false;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::duration m_elapsed = std::chrono::steady_clock::duration::zero();
+    std::string m_skipped;
+};
+
+struct Case {
+    const char *name;
+    void (*function)(State &);
+};
+
+inline std::vector<Case> &registry() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+struct Registrar {
+    Registrar(const char *name, void (*function)(State &)) { registry().push_back({name, function}); }
+};
+
+#define BENCHMARK(function) static bench::Registrar function##_registrar(#function, function)
+
+// runs every registered benchmark whose name contains the filter argument
+inline int runAll(int argc, char **argv) {
+    double minTime = 0.2;
+    int repetitions = 5;
+    const char *filter = "";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            minTime = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        else
+            filter = argv[i];
+    }
+
+    std::printf("%-36s %14s %14s %12s %16s\n", "benchmark", "median", "min", "iterations", "items/s");
+    for (const Case &benchmark : registry()) {
+        if (!std::strstr(benchmark.name, filter))
+            continue;
+        size_t iterations = 1;
+        std::string skipped;
+        for (;;) {
+            State state(iterations);
+            benchmark.function(state);
+            if (!state.skipped().empty()) {
+                skipped = state.skipped();
+                break;
+            }
+            if (state.seconds() >= minTime || iterations >= ((size_t)1 << 40))
+                break;
+            // aim a bit past the minimum, never growing more than 10x at once
+            double growth = state.seconds() > 0.0 ? minTime * 1.4 / state.seconds() : 10.0;
+            iterations = (size_t)std::max((double)iterations + 1, iterations * std::min(std::max(growth, 1.5), 10.0));
+        }
+        if (!skipped.empty()) {
+            std::printf("%-36s skipped: %s\n", benchmark.name, skipped.c_str());
+            continue;
+        }
+
+        std::vector<double> perIteration;
+        size_t items = 0;
+        for (int r = 0; r < repetitions; ++r) {
+            State state(iterations);
+            benchmark.function(state);
+            perIteration.push_back(state.seconds() / iterations);
+            items = state.items();
+        }
+        std::sort(perIteration.begin(), perIteration.end());
+        double median = perIteration[perIteration.size() / 2];
+        char rate[32] = "";
+        if (items && median > 0.0)
+            std::snprintf(rate, sizeof(rate), "%.3gM", items / median / 1.0e6);
+        std::printf("%-36s %11.1f ns %11.1f ns %12zu %16s\n", benchmark.name, median * 1.0e9,
+                    perIteration.front() * 1.0e9, iterations, rate);
+    }
+    return 0;
+}
+
+};
+#endif //PROJECT_BASE_BENCH_H
@@ -0,0 +1,263 @@
+//
+// Microbenchmarks of the CPU side hot spots, none of them needs a GL context:
+// mesh import conversion and optimization, tree placement, matrix composition, frustum culling,
+// texture decoding, the binary mesh cache and the scene file.
+//
+// usage: forest_bench [--min-time seconds] [--repetitions N] [name filter]
+//
+
+#include "bench.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <stb_image.h>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <learnopengl/filesystem.h>
+#include <learnopengl/model.h>
+#include <rg/Culling.h>
+#include <rg/MeshCache.h>
+#include <rg/MeshOptimize.h>
+#include <rg/Scene.h>
+#include <rg/TreePlacement.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char *const TREE_MODEL = "resources/objects/Tree/Tree.obj";
+const char *const ARENA_SCENE = "resources/scenes/arena.scene";
+
+// the tree imported once with the app's post processing, null when the asset isn't there
+const aiScene *treeScene() {
+    static Assimp::Importer importer;
+    static const aiScene *scene = importer.ReadFile(FileSystem::getPath(TREE_MODEL),
+            aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    return scene && !(scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) ? scene : nullptr;
+}
+
+void BM_ConvertMesh(bench::State &state) {
+    const aiScene *scene = treeScene();
+    if (!scene)
+        return state.skip(std::string(TREE_MODEL) + " not found");
+    size_t vertexCount = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+        vertexCount += scene->mMeshes[m]->mNumVertices;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    while (state.keepRunning()) {
+        for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+            vertices.clear();
+            indices.clear();
+            Model::ConvertMesh(scene->mMeshes[m], vertices, indices);
+            bench::doNotOptimize(vertices.data());
+        }
+    }
+    state.setItemsProcessed(vertexCount);
+}
+BENCHMARK(BM_ConvertMesh);
+
+// the optimizations processMesh runs after converting
+void BM_OptimizeMesh(bench::State &state) {
+    const aiScene *scene = treeScene();
+    if (!scene)
+        return state.skip(std::string(TREE_MODEL) + " not found");
+    std::vector<std::vector<Vertex>> sourceVertices(scene->mNumMeshes);
+    std::vector<std::vector<unsigned int>> sourceIndices(scene->mNumMeshes);
+    size_t triangleCount = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+        Model::ConvertMesh(scene->mMeshes[m], sourceVertices[m], sourceIndices[m]);
+        triangleCount += sourceIndices[m].size() / 3;
+    }
+    while (state.keepRunning()) {
+        for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+            state.pauseTiming();
+            std::vector<Vertex> vertices = sourceVertices[m];
+            std::vector<unsigned int> indices = sourceIndices[m];
+            state.resumeTiming();
+            rg::weldVertices(vertices, indices);
+            rg::optimizeVertexCache(indices, vertices.size());
+            rg::optimizeOverdraw(indices, vertices);
+            rg::optimizeVertexFetch(vertices, indices);
+            bench::doNotOptimize(indices.data());
+        }
+    }
+    state.setItemsProcessed(triangleCount);
+}
+BENCHMARK(BM_OptimizeMesh);
+
+template<int TreeCount>
+void BM_TreePlacement(bench::State &state) {
+    std::vector<glm::mat4> transforms(TreeCount);
+    while (state.keepRunning()) {
+        rg::buildTreeTransforms(TreeCount, transforms.data());
+        bench::clobberMemory();
+    }
+    state.setItemsProcessed(TreeCount);
+}
+void BM_TreePlacement_100(bench::State &state) { BM_TreePlacement<100>(state); }
+void BM_TreePlacement_100k(bench::State &state) { BM_TreePlacement<100000>(state); }
+BENCHMARK(BM_TreePlacement_100);
+BENCHMARK(BM_TreePlacement_100k);
+
+// one translate * rotate * scale, as every tree transform is built
+void BM_MatrixCompose(bench::State &state) {
+    glm::vec3 position(1.0f, -3.2f, 2.0f);
+    float angle = 0.3f;
+    while (state.keepRunning()) {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+        transform = glm::rotate(transform, angle, glm::vec3(0.0f, 1.0f, 0.0f));
+        transform = glm::scale(transform, glm::vec3(4.5f));
+        bench::doNotOptimize(transform);
+        angle += 0.001f;
+    }
+    state.setItemsProcessed(1);
+}
+BENCHMARK(BM_MatrixCompose);
+
+// the instance matrices of 100k placements, with the portable loop and with the kernel picked for this CPU
+void BM_ComposeTransforms(bench::State &state, rg::transforms::ComposeFunction compose) {
+    const int treeCount = 100000;
+    rg::InstanceStore store;
+    rg::placeTrees(treeCount, store);
+    std::vector<glm::mat4> transforms(treeCount);
+    while (state.keepRunning()) {
+        compose(store, 0, store.size(), transforms.data());
+        bench::clobberMemory();
+    }
+    state.setItemsProcessed(treeCount);
+}
+void BM_ComposeScalar_100k(bench::State &state) { BM_ComposeTransforms(state, rg::transforms::composeScalar); }
+void BM_ComposeSimd_100k(bench::State &state) {
+    static bool reported = false;
+    if (!reported) {
+        std::printf("# compose kernel: %s\n", rg::transforms::selected().name);
+        reported = true;
+    }
+    BM_ComposeTransforms(state, rg::transforms::selected().compose);
+}
+BENCHMARK(BM_ComposeScalar_100k);
+BENCHMARK(BM_ComposeSimd_100k);
+
+// a 100k tree forest culled from a camera turning on the spot, as the frame loop does it
+void BM_FrustumCull(bench::State &state) {
+    const int treeCount = 100000;
+    std::vector<glm::mat4> transforms(treeCount);
+    rg::buildTreeTransforms(treeCount, transforms.data());
+    rg::InstanceGrid grid;
+    // roughly the tree's local bounds
+    grid.build(transforms.data(), treeCount, glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 3.0f, 1.0f), 15.0f);
+    glm::mat4 projection = glm::perspective(45.0f, 800.0f / 600.0f, 0.1f, 250.0f);
+    std::vector<unsigned int> visible;
+    visible.reserve(treeCount);
+    rg::CullStats stats;
+    float yaw = 0.0f;
+    while (state.keepRunning()) {
+        glm::vec3 front(std::cos(yaw), 0.0f, std::sin(yaw));
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), front, glm::vec3(0.0f, 1.0f, 0.0f));
+        grid.cullIndices(rg::Frustum::fromMatrix(projection * view), visible, stats);
+        bench::doNotOptimize(visible.data());
+        yaw += 0.01f;
+    }
+    state.setItemsProcessed(treeCount);
+}
+BENCHMARK(BM_FrustumCull);
+
+// decoding every texture the scene and the tree load
+void BM_StbLoad(bench::State &state) {
+    const char *const textures[] = {
+            "resources/textures/floor.jpeg", "resources/textures/cloud.jpeg", "resources/textures/mountain.jpeg",
+            "resources/textures/its3.png", "resources/textures/not3.png", "resources/textures/real3.png",
+            "resources/objects/Tree/DB2X2_L01.png", "resources/objects/Tree/DB2X2_L02.png",
+            "resources/objects/Tree/DB2X2_L02_NRM.png", "resources/objects/Tree/bark_0004.jpg",
+    };
+    size_t pixels = 0;
+    while (state.keepRunning()) {
+        pixels = 0;
+        for (const char *path : textures) {
+            int width, height, components;
+            unsigned char *data = stbi_load(FileSystem::getPath(path).c_str(), &width, &height, &components, 0);
+            if (!data)
+                return state.skip(std::string(path) + ": " + stbi_failure_reason());
+            pixels += (size_t)width * height;
+            stbi_image_free(data);
+        }
+    }
+    state.setItemsProcessed(pixels);
+}
+BENCHMARK(BM_StbLoad);
+
+// validating and indexing the tree's cache file, which the app writes on its first run
+void BM_MeshCacheOpen(bench::State &state) {
+    std::string source = FileSystem::getPath(TREE_MODEL);
+    std::string cache = source + ".meshcache";
+    {
+        rg::MeshCacheReader probe;
+        if (!probe.open(cache, source))
+            return state.skip("no up to date " + cache + ", run project_base once");
+    }
+    size_t vertexCount = 0;
+    while (state.keepRunning()) {
+        rg::MeshCacheReader reader;
+        reader.open(cache, source);
+        vertexCount = 0;
+        for (const rg::MeshCacheEntry &entry : reader.meshes())
+            vertexCount += entry.vertexCount;
+        bench::doNotOptimize(vertexCount);
+    }
+    state.setItemsProcessed(vertexCount);
+}
+BENCHMARK(BM_MeshCacheOpen);
+
+// the content hash the cache falls back to when the source's timestamp changed
+void BM_MeshCacheHash(bench::State &state) {
+    rg::MappedFile file;
+    if (!file.open(FileSystem::getPath(TREE_MODEL)))
+        return state.skip(std::string(TREE_MODEL) + " not found");
+    while (state.keepRunning())
+        bench::doNotOptimize(rg::hashBytes(file.data(), file.size()));
+    state.setItemsProcessed(file.size());
+}
+BENCHMARK(BM_MeshCacheHash);
+
+// the text of the arena compiled into its binary form
+void BM_SceneCompile(bench::State &state) {
+    std::string source = FileSystem::getPath(ARENA_SCENE);
+    std::string binary = source + "bin.bench";
+    while (state.keepRunning()) {
+        if (!rg::compileScene(source, binary))
+            return state.skip(std::string(ARENA_SCENE) + " does not compile");
+    }
+    std::remove(binary.c_str());
+}
+BENCHMARK(BM_SceneCompile);
+
+// mapping the compiled arena, what startup pays once the binary is up to date
+void BM_SceneLoad(bench::State &state) {
+    std::string source = FileSystem::getPath(ARENA_SCENE);
+    {
+        rg::Scene scene;
+        if (!scene.load(source))
+            return state.skip(std::string(ARENA_SCENE) + " does not load");
+    }
+    uint32_t statics = 0;
+    while (state.keepRunning()) {
+        rg::Scene scene;
+        scene.load(source);
+        statics = scene.count(rg::SCENE_STATICS);
+        bench::doNotOptimize(statics);
+    }
+    state.setItemsProcessed(statics);
+}
+BENCHMARK(BM_SceneLoad);
+
+}
+
+int main(int argc, char **argv) {
+    return bench::runAll(argc, argv);
+}
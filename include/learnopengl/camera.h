@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <functional>
 #include <vector>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
@@ -45,6 +46,12 @@ public:
     float bobbingSize           = BOBBING_SIZE;
     float bobbingSpeed          = BOBBING_SPEED;
     glm::vec3 previousBobbing   = BOBBING_VEC;
+    // seconds driving the bobbing, advanced by the application so benchmark runs can pin it to a fixed timestep
+    float Clock                 = 0.0f;
+    // half the side of the square the camera can walk in, just inside the arena walls by default
+    float Bounds                = 74.0f;
+    // height of the eye over (x, z) before bobbing, level at 0 when the application doesn't set it
+    std::function<float(float, float)> EyeHeight;
 
     // constructor with vectors
     Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY)
@@ -77,7 +84,7 @@ public:
         float velocity = MovementSpeed * deltaTime;
 
         // calculating camera bobbing
-        float time = glfwGetTime();
+        float time = Clock;
         float cosBobbing = cos(time*bobbingSpeed)*bobbingSize;
         float sinBobbing = glm::abs(sin(time*bobbingSpeed)*bobbingSize);
         glm::vec3 bobbing = glm::vec3 (cosBobbing*sin(glm::radians(Yaw)),sinBobbing,(1-cosBobbing)*cos(glm::radians(Yaw)));
@@ -93,15 +100,15 @@ public:
         if (direction == RIGHT)
             Position += Right * velocity + deltaBobbing;
         // camera position boundaries
-        if(Position.x > 74.0f)
-            Position.x = 74.0f;
-        if(Position.x < -74.0f)
-            Position.x = -74.0f;
-        if(Position.z > 74.0f)
-            Position.z = 74.0f;
-        if(Position.z < -74.0f)
-            Position.z = -74.0f;
-        Position.y = 0.0f + previousBobbing.y;
+        if(Position.x > Bounds)
+            Position.x = Bounds;
+        if(Position.x < -Bounds)
+            Position.x = -Bounds;
+        if(Position.z > Bounds)
+            Position.z = Bounds;
+        if(Position.z < -Bounds)
+            Position.z = -Bounds;
+        Position.y = (EyeHeight ? EyeHeight(Position.x, Position.z) : 0.0f) + previousBobbing.y;
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -126,6 +133,14 @@ public:
         updateCameraVectors();
     }
 
+    // points the camera along the given euler angles (in degrees)
+    void SetOrientation(float yaw, float pitch)
+    {
+        Yaw = yaw;
+        Pitch = pitch;
+        updateCameraVectors();
+    }
+
     // changing to running/walking speed
     void speedUp(){
         MovementSpeed = SPEED * 2.5f;
@@ -5,10 +5,16 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
-#include <learnopengl/shader.h>
+#include <learnopengl/shader_m.h>
+#include <rg/MaterialArray.h>
+#include <rg/RenderQueue.h>
 
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 using namespace std;
 
@@ -26,6 +32,51 @@ struct Vertex {
 };
 
 
+// what the GPU gets for shaders that don't read the bitangent: 20 instead of 56 bytes per vertex.
+// attribute locations are the same as Vertex, the shaders read them as the same float vectors
+struct PackedVertex {
+    // half floats, w is padding
+    uint16_t Position[4];
+    // signed normalized 10:10:10:2
+    uint32_t Normal;
+    // signed normalized 10:10:10:2, w is the handedness the bitangent is rebuilt with
+    uint32_t Tangent;
+    // half floats, so repeating coordinates outside [0, 1] survive
+    uint16_t TexCoords[2];
+};
+
+enum class VertexLayout {
+    Full,
+    Packed
+};
+
+const unsigned int BITANGENT_LOCATION = 4;
+
+// the packed layout is used unless a shader drawing the mesh reads the bitangent;
+// attributeMask is the union of Shader::activeAttributeMask() over those shaders
+inline VertexLayout vertexLayoutFor(unsigned int attributeMask)
+{
+    return attributeMask & (1u << BITANGENT_LOCATION) ? VertexLayout::Full : VertexLayout::Packed;
+}
+
+inline PackedVertex packVertex(const Vertex &vertex)
+{
+    PackedVertex packed;
+    for(int i = 0; i < 3; i++)
+        packed.Position[i] = glm::packHalf1x16(vertex.Position[i]);
+    packed.Position[3] = 0;
+    packed.Normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.Normal, 0.0f));
+    float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+    packed.Tangent = glm::packSnorm3x10_1x2(glm::vec4(vertex.Tangent, handedness));
+    packed.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+    packed.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+    return packed;
+}
+
+// first attribute location of the per-instance model matrix (locations 0-4 are used by Vertex)
+const unsigned int INSTANCE_MATRIX_LOCATION = 5;
+// layer in the material array of meshes drawn from one, after the instance matrix
+const unsigned int MATERIAL_LAYER_LOCATION = 9;
 
 struct Texture {
     unsigned int id;
@@ -33,40 +84,277 @@ struct Texture {
     string path;
 };
 
+// a level of detail is a range of the mesh's index buffer, all levels share the vertices
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+};
+
 class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    // lods[0] is the full detail mesh, further entries are progressively decimated
+    vector<MeshLod>      lods;
 
     unsigned int VAO;
-    std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // format of the vertex buffer, the CPU copy in `vertices` is always the full Vertex
+    VertexLayout layout;
+    // GL_UNSIGNED_SHORT for meshes with fewer than 65536 vertices, the CPU copy in `indices` is always 32 bit
+    GLenum indexType = GL_UNSIGNED_INT;
+    // local space bounding box of the vertices
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // what the GPU buffers hold, with or without a CPU copy
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    // where the mesh starts in the buffers its VAO reads: 0 and 0 for buffers of its own, its ranges in the model's
+    // buffers after UseSharedBuffers
+    GLint baseVertex = 0;
+    unsigned int firstIndex = 0;
+    // constructor, the arrays are moved in when the caller hands them over with std::move. They stay as the CPU
+    // copy until ReleaseCpuData, after which the mesh can't get new LODs.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures,
+         VertexLayout layout = VertexLayout::Full)
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), layout(layout)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        lods.push_back({0, (unsigned int)this->indices.size()});
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+        buildSamplerNames();
+        computeBounds();
+    }
+
+    // constructs the mesh from arrays owned by someone else (e.g. a memory mapped cache file), uploading them
+    // straight to the GPU. A CPU copy is only kept with keepCpuData, without it the mesh can't get new LODs.
+    Mesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount,
+         vector<Texture> textures, vector<MeshLod> lods, glm::vec3 boundsMin, glm::vec3 boundsMax, bool keepCpuData,
+         VertexLayout layout = VertexLayout::Full)
+        : textures(std::move(textures)), lods(std::move(lods)), layout(layout), boundsMin(boundsMin), boundsMax(boundsMax)
+    {
+        if (keepCpuData)
+        {
+            vertices.assign(vertexData, vertexData + vertexCount);
+            indices.assign(indexData, indexData + indexCount);
+        }
+        if (this->lods.empty())
+            this->lods.push_back({0, (unsigned int)indexCount});
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
+        buildSamplerNames();
+    }
+
+    // prefix of the sampler uniforms in the shader, e.g. "material." for material.texture_diffuse1
+    void SetShaderTextureNamePrefix(const std::string &prefix)
+    {
+        glslIdentifierPrefix = prefix;
+        buildSamplerNames();
     }
 
     // render the mesh
     void Draw(Shader &shader)
     {
-        // bind appropriate textures
+        rg::RenderQueue queue;
+        Submit(queue, shader);
+        queue.flush();
+    }
+
+    // render `count` copies of the mesh at the given level of detail in a single call, one per matrix in the instance buffer
+    void DrawInstanced(Shader &shader, unsigned int count, unsigned int lod = 0)
+    {
+        rg::RenderQueue queue;
+        Submit(queue, shader, count, lod);
+        queue.flush();
+    }
+
+    // queues the draw instead of issuing it. With an instanceVBO the draw reads its transforms from there starting
+    // at firstInstance, without one it uses whatever SetInstanceBuffer attached; instanceCount 0 draws uninstanced.
+    void Submit(rg::RenderQueue &queue, Shader &shader, unsigned int instanceCount = 0, unsigned int lod = 0,
+                unsigned int instanceVBO = 0, unsigned int firstInstance = 0)
+    {
+        rg::DrawItem item = MakeDrawItem(shader);
+        const MeshLod &range = lods[lod < lods.size() ? lod : lods.size() - 1];
+        item.first = (size_t)(firstIndex + range.firstIndex) * indexSize();
+        item.count = range.indexCount;
+        item.instanceCount = instanceCount;
+        item.instanceBuffer = instanceVBO;
+        item.firstInstance = firstInstance;
+        queue.submit(item);
+    }
+
+    // state of a draw of this mesh (program, VAO, textures) for items filled in outside the mesh (e.g. indirect draws)
+    rg::DrawItem MakeDrawItem(Shader &shader) const
+    {
+        rg::DrawItem item;
+        item.shader = &shader;
+        item.vertexArray = VAO;
+        if(materialArray)
+            item.addTexture(GL_TEXTURE_2D_ARRAY, materialArray->texture());
+        else
+            for(const Texture &texture : textures)
+                item.addTexture(GL_TEXTURE_2D, texture.id);
+        item.samplerNames = &samplerNames;
+        item.indexType = indexType;
+        item.baseVertex = baseVertex;
+        item.instanceLocation = INSTANCE_MATRIX_LOCATION;
+        return item;
+    }
+
+    // appends a decimated index list as the next level of detail and re-uploads the index buffer, only for
+    // meshes that have buffers of their own. A mesh too small to decimate that far (an empty list) repeats
+    // the level before instead of drawing nothing
+    void AddLod(const vector<unsigned int> &lodIndices)
+    {
+        if(sharedBuffers)
+            return;
+        if(lodIndices.empty())
+        {
+            lods.push_back(lods.back());
+            return;
+        }
+        lods.push_back({(unsigned int)indices.size(), (unsigned int)lodIndices.size()});
+        indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+        glBindVertexArray(VAO);
+        uploadIndices(indices.data(), indices.size());
+        glBindVertexArray(0);
+    }
+
+    // frees the CPU copy of the vertices and indices, the GPU buffers and the bounds stay
+    void ReleaseCpuData()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+    }
+
+    // deletes the mesh's own vertex array and buffers, shared ones belong to whoever made them
+    void ReleaseBuffers()
+    {
+        if(!sharedBuffers)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+        }
+        VAO = VBO = EBO = 0;
+    }
+
+    // bytes per index in the element buffer
+    unsigned int indexSize() const
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+    }
+
+    // the vertex and index buffers this mesh draws from, to be copied into shared ones
+    unsigned int VertexBuffer() const { return VBO; }
+    unsigned int IndexBuffer() const { return EBO; }
+
+    // Moves the mesh onto buffers shared with other meshes, its vertices at `baseVertex` of the shared vertex
+    // buffer and its indices at `firstIndex` of the shared index buffer, both read through `sharedVAO`. Its own
+    // buffers are deleted, the contents have to be copied over before.
+    void UseSharedBuffers(unsigned int sharedVAO, GLint sharedBaseVertex, unsigned int sharedFirstIndex)
+    {
+        if(!sharedBuffers)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+        }
+        VAO = sharedVAO;
+        VBO = EBO = 0;
+        baseVertex = sharedBaseVertex;
+        firstIndex = sharedFirstIndex;
+        sharedBuffers = true;
+    }
+
+    // the vertex attribute pointers of `layout` for the vertex buffer bound to GL_ARRAY_BUFFER, into the bound VAO
+    static void SetVertexAttributes(VertexLayout layout)
+    {
+        if(layout == VertexLayout::Packed)
+        {
+            // the 2_10_10_10 formats need all four components, shaders reading a vec3 just ignore w
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+            return;
+        }
+
+        // set the vertex attribute pointers
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
+
+    // bytes per vertex in the vertex buffer
+    static unsigned int VertexSize(VertexLayout layout)
+    {
+        return layout == VertexLayout::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    }
+
+    // Draws with `array` bound as the diffuse sampler instead of the mesh's own textures, which go unused. The
+    // vertex array must feed the mesh's layer at MATERIAL_LAYER_LOCATION, see Model::UseMaterialArray.
+    void UseMaterialArray(rg::MaterialArray *array)
+    {
+        materialArray = array;
+        buildSamplerNames();
+    }
+
+    // attaches a buffer of glm::mat4 instance transforms to this mesh's VAO, the first instance read is `firstInstance`.
+    // a mat4 attribute takes up 4 consecutive locations (one per column), starting at INSTANCE_MATRIX_LOCATION.
+    void SetInstanceBuffer(unsigned int instanceVBO, unsigned int firstInstance = 0)
+    {
+        glBindVertexArray(VAO);
+        rg::attachInstanceBuffer(instanceVBO, firstInstance, INSTANCE_MATRIX_LOCATION);
+        glBindVertexArray(0);
+    }
+
+private:
+    // render data
+    unsigned int VBO, EBO;
+    // set by UseSharedBuffers, the buffers then belong to the model
+    bool sharedBuffers = false;
+    rg::MaterialArray *materialArray = nullptr;
+
+    std::string glslIdentifierPrefix;
+    // full sampler uniform name of every texture, built once instead of on every draw
+    vector<string> samplerNames;
+
+    // names the samplers following the texture_diffuseN / texture_specularN / ... convention
+    void buildSamplerNames()
+    {
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        samplerNames.clear();
+        if(materialArray)
+        {
+            samplerNames.push_back(glslIdentifierPrefix + "texture_diffuse1");
+            return;
+        }
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
-            string name = textures[i].type;
+            const string &name = textures[i].type;
             if(name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if(name == "texture_specular")
@@ -75,30 +363,37 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplerNames.push_back(glslIdentifierPrefix + name + number);
         }
+    }
 
-
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    void computeBounds()
+    {
+        boundsMin = glm::vec3(vertices.empty() ? 0.0f : INFINITY);
+        boundsMax = glm::vec3(vertices.empty() ? 0.0f : -INFINITY);
+        for(const Vertex &vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+    // (re)fills the element buffer of the bound VAO in indexType
+    void uploadIndices(const unsigned int *indexData, size_t indexCount)
+    {
+        this->indexCount = indexCount;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if(indexType == GL_UNSIGNED_SHORT)
+        {
+            vector<uint16_t> shortIndices(indexData, indexData + indexCount);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+        }
+        else
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+    }
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
@@ -108,31 +403,26 @@ private:
         glBindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        if(layout == VertexLayout::Packed)
+        {
+            vector<PackedVertex> packed(vertexCount);
+            for(size_t i = 0; i < vertexCount; i++)
+                packed[i] = packVertex(vertexData[i]);
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            // A great thing about structs is that their memory layout is sequential for all its items.
+            // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+            // again translates to 3/2 floats which translates to a byte array.
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
+        }
 
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        this->vertexCount = vertexCount;
+        indexType = vertexCount < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        uploadIndices(indexData, indexCount);
 
+        SetVertexAttributes(layout);
         glBindVertexArray(0);
     }
 };
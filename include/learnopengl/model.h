@@ -11,13 +11,21 @@
 #include <assimp/postprocess.h>
 
 #include <learnopengl/mesh.h>
-#include <learnopengl/shader.h>
+#include <learnopengl/shader_m.h>
+#include <rg/MeshSimplify.h>
+#include <rg/MeshOptimize.h>
+#include <rg/MeshCache.h>
+#include <rg/RenderQueue.h>
+#include <rg/TextureCache.h>
+#include <rg/Trace.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
@@ -33,71 +41,250 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
-
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // local space bounding box of all meshes
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    // constructor, expects a filepath to a 3D model. attributeMask is the union of Shader::activeAttributeMask()
+    // of the shaders that will draw the model, it decides whether the meshes upload a packed vertex layout.
+    // Without keepCpuData the meshes keep no vertices and indices of their own once they are uploaded (and
+    // cached): the cache file stays mapped until ReleaseCpuData, which GenerateLods reads them back from
+    Model(string const &path, bool gamma = false, unsigned int attributeMask = ~0u, bool keepCpuData = false)
+        : gammaCorrection(gamma), vertexLayout(vertexLayoutFor(attributeMask)), keepCpuData(keepCpuData)
     {
         loadModel(path);
     }
 
     // draws the model, and thus all its meshes
     void Draw(Shader &shader)
+    {
+        rg::RenderQueue queue;
+        Submit(queue, shader);
+        queue.flush();
+    }
+
+    // draws `count` instances of the model, taking transforms from the buffer given to SetInstanceBuffer
+    void DrawInstanced(Shader &shader, unsigned int count, unsigned int lod = 0)
+    {
+        rg::RenderQueue queue;
+        Submit(queue, shader, count, lod);
+        queue.flush();
+    }
+
+    // queues the draws of all meshes, see Mesh::Submit
+    void Submit(rg::RenderQueue &queue, Shader &shader, unsigned int instanceCount = 0, unsigned int lod = 0,
+                unsigned int instanceVBO = 0, unsigned int firstInstance = 0)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            meshes[i].Submit(queue, shader, instanceCount, lod, instanceVBO, firstInstance);
     }
 
-    void SetShaderTextureNamePrefix(std::string prefix) {
-        for (Mesh& mesh: meshes) {
-            mesh.glslIdentifierPrefix = prefix;
-        }
+    // shares one buffer of per-instance glm::mat4 transforms between all meshes of the model
+    void SetInstanceBuffer(unsigned int instanceVBO, unsigned int firstInstance = 0)
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].SetInstanceBuffer(instanceVBO, firstInstance);
     }
-private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+
+    // builds one decimated level of detail per entry of `ratios` (fraction of the full triangle count) for every mesh
+    void GenerateLods(const vector<float> &ratios)
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        // the shared index buffer has no room to grow into
+        if(packedVAO)
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            cout << "ERROR::MODEL:: levels of detail have to be generated before PackBuffers" << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
+        bool missing = false;
+        for(const Mesh &mesh : meshes)
+            missing = missing || mesh.lods.size() - 1 < ratios.size();
+        if(!missing)
+            return;
+        // meshes that were uploaded straight from the mapped cache copy their arrays out of it only now
+        const vector<rg::MeshCacheEntry> &cached = cacheFile.meshes();
+        for(size_t i = 0; i < meshes.size() && i < cached.size(); i++)
+        {
+            if(!meshes[i].indices.empty())
+                continue;
+            meshes[i].vertices.assign(cached[i].vertices, cached[i].vertices + cached[i].vertexCount);
+            meshes[i].indices.assign(cached[i].indices, cached[i].indices + cached[i].indexCount);
+        }
+        bool added = false;
+        for(Mesh &mesh : meshes)
+        {
+            // meshes uploaded without a CPU copy can't be simplified
+            if(mesh.indices.empty())
+                continue;
+            // levels that are already there (e.g. from a previous call or the mesh cache) are kept
+            for(size_t level = mesh.lods.size() - 1; level < ratios.size(); level++)
+            {
+                vector<unsigned int> lodIndices = rg::simplifyIndices(mesh.vertices, &mesh.indices[0], mesh.lods[0].indexCount, ratios[level]);
+                rg::optimizeVertexCache(lodIndices, mesh.vertices.size());
+                mesh.AddLod(lodIndices);
+                added = true;
+            }
+        }
+        // the cache stores the levels too, so the simplification only runs once per asset
+        if(added)
+            writeCache();
+        if(!keepCpuData)
+            releaseToCache();
+    }
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+    // number of levels every mesh of the model has
+    unsigned int LodCount() const
+    {
+        unsigned int count = meshes.empty() ? 1 : (unsigned int)meshes[0].lods.size();
+        for(const Mesh &mesh : meshes)
+            count = std::min(count, (unsigned int)mesh.lods.size());
+        return count;
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // frees the CPU copy of every mesh, for models that get no more LODs: drawing only needs the GPU buffers
+    void ReleaseCpuData()
     {
-        // process each mesh located at the current node
-        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        for(Mesh &mesh : meshes)
+            mesh.ReleaseCpuData();
+        cacheFile.close();
+        keepCpuData = false;
+    }
+
+    // Moves all meshes into one vertex buffer and one index buffer read through one vertex array, each mesh
+    // drawing its range of them with a base vertex, so the meshes' draws don't switch buffers in between and
+    // the render queue can merge them. The copies are made on the GPU, so this works without the CPU data too,
+    // but the levels of detail have to be there already. Meshes of different index types can't share an index
+    // buffer and stay as they are, which returns false.
+    bool PackBuffers()
+    {
+        if(packedVAO || meshes.empty())
+            return packedVAO != 0;
+        GLenum indexType = meshes[0].indexType;
+        GLsizeiptr vertexBytes = 0, indexBytes = 0;
+        for(const Mesh &mesh : meshes)
         {
-            // the node object only contains indices to index the actual objects in the scene.
-            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            if(mesh.indexType != indexType)
+            {
+                cout << "ERROR::MODEL:: meshes of " << directory << " mix index types, keeping their own buffers" << endl;
+                return false;
+            }
+            vertexBytes += (GLsizeiptr)(mesh.vertexCount * Mesh::VertexSize(vertexLayout));
+            indexBytes += (GLsizeiptr)(mesh.indexCount * mesh.indexSize());
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-        for(unsigned int i = 0; i < node->mNumChildren; i++)
+
+        glGenVertexArrays(1, &packedVAO);
+        glGenBuffers(1, &packedVBO);
+        glGenBuffers(1, &packedEBO);
+        glBindVertexArray(packedVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, packedVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packedEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+        Mesh::SetVertexAttributes(vertexLayout);
+        glBindVertexArray(0);
+
+        GLint baseVertex = 0;
+        unsigned int firstIndex = 0;
+        for(Mesh &mesh : meshes)
         {
-            processNode(node->mChildren[i], scene);
+            GLsizeiptr meshVertexBytes = (GLsizeiptr)(mesh.vertexCount * Mesh::VertexSize(vertexLayout));
+            GLsizeiptr meshIndexBytes = (GLsizeiptr)(mesh.indexCount * mesh.indexSize());
+            glBindBuffer(GL_COPY_READ_BUFFER, mesh.VertexBuffer());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, packedVBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                                (GLintptr)baseVertex * Mesh::VertexSize(vertexLayout), meshVertexBytes);
+            glBindBuffer(GL_COPY_READ_BUFFER, mesh.IndexBuffer());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, packedEBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                                (GLintptr)firstIndex * mesh.indexSize(), meshIndexBytes);
+            mesh.UseSharedBuffers(packedVAO, baseVertex, firstIndex);
+            baseVertex += (GLint)mesh.vertexCount;
+            firstIndex += (unsigned int)mesh.indexCount;
         }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return true;
+    }
 
+    // Moves the diffuse textures of all meshes into layers of `array` and feeds every vertex its mesh's layer,
+    // so all meshes bind the same texture and their draws differ in nothing but their ranges. Shaders drawing
+    // the model then have to be built with TEXTURE_ARRAY. Needs PackBuffers first, the layer attribute is
+    // one more stream of the shared vertex array; without it, or with a mesh lacking a diffuse texture, the
+    // meshes keep their textures and this returns false.
+    bool UseMaterialArray(rg::MaterialArray &array)
+    {
+        if(!packedVAO)
+        {
+            cout << "ERROR::MODEL:: material arrays need the buffers of " << directory << " packed" << endl;
+            return false;
+        }
+        vector<const Texture*> diffuse;
+        size_t vertexCount = 0;
+        for(const Mesh &mesh : meshes)
+        {
+            auto found = std::find_if(mesh.textures.begin(), mesh.textures.end(),
+                                      [](const Texture &texture) { return texture.type == "texture_diffuse"; });
+            if(found == mesh.textures.end())
+            {
+                cout << "ERROR::MODEL:: a mesh of " << directory << " has no diffuse texture for the material array" << endl;
+                return false;
+            }
+            diffuse.push_back(&*found);
+            vertexCount += mesh.vertexCount;
+        }
+
+        // one float per vertex, the shaders read it as a vec2 whose y (the clamp flag) defaults to 0
+        vector<float> layers;
+        layers.reserve(vertexCount);
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            layers.insert(layers.end(), meshes[i].vertexCount, (float)array.add(diffuse[i]->id));
+        if(!packedMaterialVBO)
+            glGenBuffers(1, &packedMaterialVBO);
+        glBindVertexArray(packedVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, packedMaterialVBO);
+        glBufferData(GL_ARRAY_BUFFER, layers.size() * sizeof(float), layers.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(MATERIAL_LAYER_LOCATION);
+        glVertexAttribPointer(MATERIAL_LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for(Mesh &mesh : meshes)
+            mesh.UseMaterialArray(&array);
+        return true;
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    void SetShaderTextureNamePrefix(std::string prefix) {
+        for (Mesh& mesh: meshes) {
+            mesh.SetShaderTextureNamePrefix(prefix);
+        }
+    }
+
+    // hands the model's textures back to the shared cache, must be called while the context is alive
+    void ReleaseTextures()
     {
-        // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        for(const Texture &texture : textures_loaded)
+            rg::TextureCache::instance().release(texture.id);
+        textures_loaded.clear();
+        textureIndex.clear();
+    }
+
+    // deletes the GPU buffers of the meshes and the shared ones of PackBuffers and UseMaterialArray, must be
+    // called while the context is alive
+    void ReleaseBuffers()
+    {
+        for(Mesh &mesh : meshes)
+            mesh.ReleaseBuffers();
+        glDeleteVertexArrays(1, &packedVAO);
+        glDeleteBuffers(1, &packedVBO);
+        glDeleteBuffers(1, &packedEBO);
+        glDeleteBuffers(1, &packedMaterialVBO);
+        packedVAO = packedVBO = packedEBO = packedMaterialVBO = 0;
+    }
 
+    // copies the vertices and the triangle indices of an imported mesh, everything the GPU needs except the textures
+    static void ConvertMesh(const aiMesh *mesh, vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        // sized up front, the import triangulates so every face has three indices
+        vertices.reserve(vertices.size() + mesh->mNumVertices);
+        indices.reserve(indices.size() + (size_t)mesh->mNumFaces * 3);
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
@@ -151,6 +338,142 @@ private:
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
+    }
+
+private:
+    VertexLayout vertexLayout;
+    bool keepCpuData;
+    // the buffers all meshes draw from after PackBuffers
+    unsigned int packedVAO = 0, packedVBO = 0, packedEBO = 0;
+    // the material layer of every vertex after UseMaterialArray
+    unsigned int packedMaterialVBO = 0;
+    string sourcePath;
+    // the cache the meshes were built from, mapped while they hold no CPU copy and may still need one
+    rg::MeshCacheReader cacheFile;
+    // texture path -> position in textures_loaded
+    unordered_map<string, size_t> textureIndex;
+
+    // the processed meshes are cached next to the source asset
+    string cachePath() const
+    {
+        return sourcePath + ".meshcache";
+    }
+
+    void writeCache()
+    {
+        // meshes that freed their CPU copy have nothing to write
+        for(const Mesh &mesh : meshes)
+            if(mesh.vertices.empty())
+                return;
+        if(!rg::writeMeshCache(cachePath(), sourcePath, meshes))
+            cout << "WARNING::MODEL:: could not write mesh cache " << cachePath() << endl;
+    }
+
+    // frees the meshes' CPU copy in favour of a mapping of the cache they were just written to, when there is one
+    void releaseToCache()
+    {
+        if(!cacheFile.open(cachePath(), sourcePath))
+            return;
+        for(Mesh &mesh : meshes)
+            mesh.ReleaseCpuData();
+    }
+
+    // builds the meshes from an up to date cache file, returns false if there is none
+    bool loadCache()
+    {
+        rg::MeshCacheReader &cache = cacheFile;
+        if(!cache.open(cachePath(), sourcePath))
+            return false;
+        meshes.reserve(cache.meshes().size());
+        for(const rg::MeshCacheEntry &entry : cache.meshes())
+        {
+            vector<Texture> textures;
+            textures.reserve(entry.textures.size());
+            for(const rg::MeshCacheTexture &texture : entry.textures)
+                textures.push_back(loadTexture(texture.path.c_str(), texture.type));
+            // vertex and index data are uploaded straight from the mapping
+            meshes.emplace_back(entry.vertices, entry.vertexCount, entry.indices, entry.indexCount, std::move(textures),
+                                entry.lods, entry.boundsMin, entry.boundsMax, keepCpuData, vertexLayout);
+        }
+        if(keepCpuData)
+            cache.close();
+        return true;
+    }
+
+    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    void loadModel(string const &path)
+    {
+        rg::TraceScope trace("model import", path);
+        sourcePath = path;
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        if(!loadCache())
+        {
+            meshes.clear();
+            ReleaseTextures();
+            if(!importModel(path))
+                return;
+            writeCache();
+            if(!keepCpuData)
+                releaseToCache();
+        }
+
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            boundsMin = i == 0 ? meshes[i].boundsMin : glm::min(boundsMin, meshes[i].boundsMin);
+            boundsMax = i == 0 ? meshes[i].boundsMax : glm::max(boundsMax, meshes[i].boundsMax);
+        }
+    }
+
+    // runs the ASSIMP import, only needed when the mesh cache is missing or stale
+    bool importModel(string const &path)
+    {
+        // read file via ASSIMP
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        // check for errors
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            return false;
+        }
+
+        // process ASSIMP's root node recursively, most files reference every mesh once
+        meshes.reserve(scene->mNumMeshes);
+        processNode(scene->mRootNode, scene);
+        return true;
+    }
+
+    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
+    void processNode(aiNode *node, const aiScene *scene)
+    {
+        // process each mesh located at the current node
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            // the node object only contains indices to index the actual objects in the scene.
+            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            processMesh(mesh, scene);
+        }
+        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene);
+        }
+
+    }
+
+    // appends the mesh to `meshes`, its arrays are moved into it and never copied
+    void processMesh(aiMesh *mesh, const aiScene *scene)
+    {
+        // data to fill
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        vector<Texture> textures;
+
+        ConvertMesh(mesh, vertices, indices);
+        optimizeMesh(mesh->mName.C_Str(), vertices, indices);
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -163,102 +486,72 @@ private:
         material->Get(AI_MATKEY_COLOR_AMBIENT, color);
 
 
+        textures.reserve(material->GetTextureCount(aiTextureType_DIFFUSE) + material->GetTextureCount(aiTextureType_SPECULAR) +
+                         material->GetTextureCount(aiTextureType_HEIGHT) + material->GetTextureCount(aiTextureType_AMBIENT));
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        appendMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        appendMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        appendMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
+        appendMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
 
+        // the mesh keeps its CPU copy until the cache is written, loadModel frees it after that when asked to
+        meshes.emplace_back(std::move(vertices), std::move(indices), std::move(textures), vertexLayout);
+    }
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+    // welds the vertices and reorders triangles and vertices for the post-transform cache, overdraw and fetch locality
+    void optimizeMesh(const char *name, vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        size_t importedVertices = vertices.size();
+        float acmrBefore = rg::acmr(indices.data(), indices.size(), vertices.size());
+        rg::weldVertices(vertices, indices);
+        rg::optimizeVertexCache(indices, vertices.size());
+        rg::optimizeOverdraw(indices, vertices);
+        rg::optimizeVertexFetch(vertices, indices);
+        float acmrAfter = rg::acmr(indices.data(), indices.size(), vertices.size());
+        cout << "MODEL::OPTIMIZE:: " << name << ": " << importedVertices << " -> " << vertices.size()
+             << " vertices, ACMR " << acmrBefore << " -> " << acmrAfter << endl;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // the required info is appended to `textures` as Texture structs.
+    void appendMaterialTextures(aiMaterial *mat, aiTextureType type, const string &typeName, vector<Texture> &textures)
     {
-        vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory, gammaCorrection);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(loadTexture(str.C_Str(), typeName));
         }
-        return textures;
+    }
+
+    // loads the texture at `path` (relative to the model's directory), unless this model loaded it before.
+    // Textures shared with other models come from rg::TextureCache, which holds one reference per model.
+    Texture loadTexture(const char *path, const string &typeName)
+    {
+        auto loaded = textureIndex.find(path);
+        if(loaded != textureIndex.end())
+            return textures_loaded[loaded->second];
+        Texture texture;
+        texture.id = TextureFromFile(path, this->directory, gammaCorrection);
+        texture.type = typeName;
+        texture.path = path;
+        textureIndex[texture.path] = textures_loaded.size();
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
     }
 };
 
 
+// the texture is decoded in the background, it shows a placeholder until rg::TextureLoader::pump() uploads it.
+// The returned reference to the shared texture is given back with rg::TextureCache::release.
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum dataFormat;
-        GLenum internalFormat;
-        if (nrComponents == 1)
-            internalFormat = dataFormat = GL_RED;
-        else if (nrComponents == 3) {
-            internalFormat = gamma ? GL_SRGB : GL_RGB;
-            dataFormat = GL_RGB;
-        }
-        else if (nrComponents == 4){
-            internalFormat = gamma ? GL_SRGB_ALPHA : GL_RGBA;
-            dataFormat = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // for this tutorial: use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return rg::TextureCache::instance().acquire(filename, gamma);
 }
 #endif
@@ -8,74 +8,109 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 #include <common.h>
+#include <rg/ProgramCache.h>
+#include <rg/Trace.h>
+
+// cheap reference to a uniform of one Shader, obtained once through Shader::getUniformHandle
+// and then used by the set* overloads without any name lookup
+struct UniformHandle
+{
+    int index = -1;
+};
+
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly, every entry of `defines` (e.g. "TEXTURE_ARRAY" or
+    // "CASCADES 4") becomes a #define in both stages so one source can be built in several variants.
+    // A line `#include "file"` in either stage is replaced by that file from the shader folder
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string> &defines = {})
+        : vertexSourcePath(vertexPath), fragmentSourcePath(fragmentPath), defineList(defines)
     {
-        std::string vertexPathString(vertexPath);
-        std::string fragmentPathString(fragmentPath);
-        appendShaderFolderIfNotPresent(vertexPathString);
-        appendShaderFolderIfNotPresent(fragmentPathString);
-        vertexPath = vertexPathString.c_str();
-        fragmentPath = fragmentPathString.c_str();
+        rg::TraceScope trace("shader compile", std::string(vertexPath) + " + " + fragmentPath);
+        appendShaderFolderIfNotPresent(vertexSourcePath);
+        appendShaderFolderIfNotPresent(fragmentSourcePath);
 
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-        }
-        catch (std::ifstream::failure& e)
-        {
+        if (!readSource(vertexSourcePath, vertexCode) || !readSource(fragmentSourcePath, fragmentCode))
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        // 2. compile shaders, or load the program the last run linked from the same sources
+        buildProgram(vertexCode, fragmentCode, ID);
+        cacheUniformLocations();
+        cacheActiveAttributes();
+    }
+    // replaces the program with one built from new sources (without the defines, they are added again).
+    // A program that fails to compile or link is thrown away and the current one stays in use.
+    // ------------------------------------------------------------------------
+    bool rebuild(const std::string &vertexSource, const std::string &fragmentSource)
+    {
+        unsigned int program = 0;
+        if (!buildProgram(vertexSource, fragmentSource, program))
+        {
+            glDeleteProgram(program);
+            return false;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        glDeleteProgram(ID);
+        ID = program;
+        cacheUniformLocations();
+        cacheActiveAttributes();
+        // handles and block bindings belong to the old program, they are carried over by name
+        for (size_t i = 0; i < handleLocations.size(); i++)
+            handleLocations[i] = getUniformLocation(handleNames[i]);
+        for (const auto &block : blockBindings)
+            applyUniformBlock(block.first.c_str(), block.second);
+        return true;
+    }
+    // rebuilds the program from its files as another variant, e.g. without a define the data can't feed.
+    // On failure the current program and defines stay.
+    // ------------------------------------------------------------------------
+    bool rebuildWithDefines(const std::vector<std::string> &defines)
+    {
+        std::string vertexCode, fragmentCode;
+        if (!readSource(vertexSourcePath, vertexCode) || !readSource(fragmentSourcePath, fragmentCode))
+            return false;
+        std::vector<std::string> previous = defineList;
+        defineList = defines;
+        if (rebuild(vertexCode, fragmentCode))
+            return true;
+        defineList = previous;
+        return false;
+    }
+    const std::vector<std::string> &defines() const
+    {
+        return defineList;
+    }
+    const std::string &vertexPath() const
+    {
+        return vertexSourcePath;
+    }
+    const std::string &fragmentPath() const
+    {
+        return fragmentSourcePath;
+    }
+    // the files the last build included, for watching them along with the stages
+    const std::vector<std::string> &includes() const
+    {
+        return includeList;
+    }
+    // whole file into `code`, false when it can't be read
+    // ------------------------------------------------------------------------
+    static bool readSource(const std::string &path, std::string &code)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        code = stream.str();
+        return true;
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -83,69 +118,313 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // connects a uniform block of the program to a buffer binding point, blocks that aren't used are ignored
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const char *blockName, GLuint binding)
+    {
+        blockBindings.emplace_back(blockName, binding);
+        applyUniformBlock(blockName, binding);
+    }
+    // location of a uniform, served from the cache that was filled after linking
+    // ------------------------------------------------------------------------
+    GLint getUniformLocation(const std::string &name) const
+    {
+        auto it = uniformLocations.find(name);
+        if (it != uniformLocations.end())
+            return it->second;
+        // names that weren't enumerated (e.g. array elements past [0]) are asked once and remembered
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        uniformLocations.emplace(name, location);
+        return location;
+    }
+    // resolves the uniform once, the returned handle stays valid for the lifetime of the shader
+    // ------------------------------------------------------------------------
+    UniformHandle getUniformHandle(const std::string &name)
+    {
+        UniformHandle handle;
+        handle.index = (int)handleLocations.size();
+        handleLocations.push_back(getUniformLocation(name));
+        handleNames.push_back(name);
+        return handle;
+    }
+    GLint getUniformLocation(UniformHandle handle) const
+    {
+        return handle.index >= 0 ? handleLocations[handle.index] : -1;
+    }
+    // bit i is set when the vertex shader reads attribute location i, lets meshes drop attributes nobody reads
+    // ------------------------------------------------------------------------
+    unsigned int activeAttributeMask() const
+    {
+        return attributeMask;
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(getUniformLocation(name), (int)value); 
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(getUniformLocation(name), x, y); 
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(getUniformLocation(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(getUniformLocation(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // handle based variants of the setters above, meant for the per-frame hot path
+    // ------------------------------------------------------------------------
+    void setBool(UniformHandle handle, bool value) const
+    {
+        glUniform1i(getUniformLocation(handle), (int)value);
+    }
+    void setInt(UniformHandle handle, int value) const
+    {
+        glUniform1i(getUniformLocation(handle), value);
+    }
+    void setFloat(UniformHandle handle, float value) const
+    {
+        glUniform1f(getUniformLocation(handle), value);
+    }
+    void setVec2(UniformHandle handle, const glm::vec2 &value) const
+    {
+        glUniform2fv(getUniformLocation(handle), 1, &value[0]);
+    }
+    void setVec3(UniformHandle handle, const glm::vec3 &value) const
+    {
+        glUniform3fv(getUniformLocation(handle), 1, &value[0]);
+    }
+    void setVec4(UniformHandle handle, const glm::vec4 &value) const
+    {
+        glUniform4fv(getUniformLocation(handle), 1, &value[0]);
+    }
+    void setMat3(UniformHandle handle, const glm::mat3 &mat) const
+    {
+        glUniformMatrix3fv(getUniformLocation(handle), 1, GL_FALSE, &mat[0][0]);
+    }
+    void setMat4(UniformHandle handle, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(getUniformLocation(handle), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // name -> location for every active uniform of the program
+    mutable std::unordered_map<std::string, GLint> uniformLocations;
+    // locations handed out through getUniformHandle, indexed by UniformHandle::index
+    std::vector<GLint> handleLocations;
+    std::vector<std::string> handleNames;
+    std::vector<std::pair<std::string, GLuint>> blockBindings;
+    unsigned int attributeMask = 0;
+    std::string vertexSourcePath;
+    std::string fragmentSourcePath;
+    std::vector<std::string> defineList;
+    std::vector<std::string> includeList;
+
+    // ------------------------------------------------------------------------
+    void applyUniformBlock(const char *blockName, GLuint binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, blockName);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+
+    // links the sources with the defines injected into `program`, through the program binary cache when the
+    // driver has one. `program` is created either way, true when it linked.
+    // ------------------------------------------------------------------------
+    bool buildProgram(const std::string &vertexSource, const std::string &fragmentSource, unsigned int &program)
+    {
+        includeList.clear();
+        std::string vertexCode = injectDefines(resolveIncludes(vertexSource, includeList), defineList);
+        std::string fragmentCode = injectDefines(resolveIncludes(fragmentSource, includeList), defineList);
+        uint64_t cacheKey = rg::programCacheKey(vertexCode, fragmentCode);
+        program = glCreateProgram();
+        if (rg::loadProgramBinary(program, cacheKey))
+            return true;
+
+        const char* vShaderCode = vertexCode.c_str();
+        const char* fShaderCode = fragmentCode.c_str();
+        unsigned int vertex, fragment;
+        // vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        bool compiled = checkCompileErrors(vertex, "VERTEX");
+        // fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+        compiled = checkCompileErrors(fragment, "FRAGMENT") && compiled;
+        // shader Program
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        rg::markProgramRetrievable(program);
+        glLinkProgram(program);
+        bool linked = checkCompileErrors(program, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessery
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if (compiled && linked)
+            rg::storeProgramBinary(program, cacheKey);
+        return compiled && linked;
+    }
+
+    // walks the active uniforms of the freshly linked program so that no setter has to ask the driver
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        uniformLocations.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> nameBuffer(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data(), length);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            // uniforms inside blocks have no location
+            if (location < 0)
+                continue;
+            uniformLocations[name] = location;
+            // arrays are reported as "name[0]", make the plain name resolve as well
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+                uniformLocations[name.substr(0, name.size() - 3)] = location;
+        }
+    }
+
+    // GLSL has no includes of its own: every `#include "file"` line is replaced by the file, which is read from the
+    // shader folder and added to `included`. An include that can't be read stays and fails the compile
+    // ------------------------------------------------------------------------
+    static std::string resolveIncludes(const std::string &code, std::vector<std::string> &included)
+    {
+        if (code.find("#include") == std::string::npos)
+            return code;
+        std::string resolved;
+        for (size_t start = 0; start < code.size();)
+        {
+            size_t end = code.find('\n', start);
+            end = end == std::string::npos ? code.size() : end + 1;
+            size_t directive = code.find_first_not_of(" \t", start);
+            if (directive < end && code.compare(directive, 8, "#include") == 0)
+            {
+                size_t open = code.find('"', directive);
+                size_t close = open < end ? code.find('"', open + 1) : std::string::npos;
+                std::string path, contents;
+                if (close < end)
+                {
+                    path = code.substr(open + 1, close - open - 1);
+                    appendShaderFolderIfNotPresent(path);
+                }
+                if (!path.empty() && readSource(path, contents))
+                {
+                    included.push_back(path);
+                    resolved += contents;
+                    if (!contents.empty() && contents.back() != '\n')
+                        resolved += '\n';
+                    start = end;
+                    continue;
+                }
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_READ " << code.substr(directive, end - directive) << std::endl;
+            }
+            resolved.append(code, start, end - start);
+            start = end;
+        }
+        return resolved;
+    }
+
+    // the defines have to follow the #version line, which must stay first
+    // ------------------------------------------------------------------------
+    static std::string injectDefines(const std::string &code, const std::vector<std::string> &defines)
+    {
+        if (defines.empty())
+            return code;
+        std::string block;
+        for (const std::string &define : defines)
+            block += "#define " + define + "\n";
+        size_t version = code.find("#version");
+        if (version == std::string::npos)
+            return block + code;
+        size_t lineEnd = code.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return code + "\n" + block;
+        return code.substr(0, lineEnd + 1) + block + code.substr(lineEnd + 1);
+    }
+
+    // ------------------------------------------------------------------------
+    void cacheActiveAttributes()
+    {
+        attributeMask = 0;
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_ATTRIBUTES, &count);
+        glGetProgramiv(ID, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> nameBuffer(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveAttrib(ID, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+            GLint location = glGetAttribLocation(ID, nameBuffer.data());
+            // built-ins like gl_VertexID have no location
+            if (location < 0)
+                continue;
+            // matrices take one location per column
+            int columns = type == GL_FLOAT_MAT4 ? 4 : type == GL_FLOAT_MAT3 ? 3 : type == GL_FLOAT_MAT2 ? 2 : 1;
+            for (int c = 0; c < columns * size; c++)
+                attributeMask |= 1u << (location + c);
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -167,6 +446,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
 #endif
@@ -0,0 +1,342 @@
+//
+// Headless benchmark mode: the camera replays a spline at a fixed timestep instead of following input,
+// and the frame times, GPU time and draw counts of the run are written out as JSON.
+//
+//   project_base --benchmark [--trees N] [--frames N] [--warmup N] [--camera-path file] [--output file.json]
+//                [--foliage alpha-test|prepass|alpha-to-coverage] [--open-world]
+//                [--target-ms ms] [--min-scale s] [--max-scale s] [--capture dir | --capture-video file]
+//                [--scene file.scene] [--trace file.json]
+//
+// --trees overrides the scene's forest, --open-world loads resources/scenes/open_world.scene instead of the
+// arena unless --scene names another one. --trace writes a Chrome trace of startup and the first frames
+// (rg/Trace.h); like the scene, it applies to interactive runs too.
+// --target-ms and the scales set up dynamic resolution, interactive runs take them too. Benchmark runs keep the scale at
+// its maximum unless --target-ms is given, so their numbers stay comparable with each other.
+//
+// The capture options save every measured frame (rg/FrameCapture.h), in interactive runs every frame.
+// --capture-video needs --benchmark: only the fixed timestep gives the video a frame rate, interactive frames
+// take however long they take, so those runs capture images only.
+//
+// A camera path file has one keyframe per line: time x y z yaw pitch, '#' starts a comment.
+//
+
+#ifndef PROJECT_BASE_BENCHMARK_H
+#define PROJECT_BASE_BENCHMARK_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/camera.h>
+#include <rg/DynamicResolution.h>
+#include <rg/Foliage.h>
+#include <rg/FrameCapture.h>
+#include <rg/RenderQueue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+struct BenchmarkOptions {
+    bool enabled = false;
+    // the scene's forest unless treesGiven, set to the count that was placed once the scene is loaded
+    unsigned int trees = 100;
+    bool treesGiven = false;
+    // measured frames, after `warmup` frames that let streaming and caches settle
+    unsigned int frames = 1200;
+    unsigned int warmup = 120;
+    float timestep = 1.0f / 60.0f;
+    std::string cameraPath;
+    // empty writes to stdout
+    std::string output;
+    // starting foliage mode, interactive runs can switch it in the overlay
+    FoliageMode foliage = FOLIAGE_ALPHA_TEST;
+    // streamed chunks of forest without walls instead of the 150x150 arena, --trees is ignored then
+    bool openWorld = false;
+    DynamicResolutionOptions resolution;
+    // its framerate is set from the timestep
+    CaptureOptions capture;
+    // empty picks the arena or the open world
+    std::string scene;
+    // empty records no trace
+    std::string trace;
+};
+
+// false for arguments it doesn't know, after printing why
+inline bool parseBenchmarkOptions(int argc, char **argv, BenchmarkOptions &options) {
+    bool targetGiven = false;
+    for (int i = 1; i < argc; ++i) {
+        const char *argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argument, "--benchmark") == 0) {
+            options.enabled = true;
+        } else if (std::strcmp(argument, "--trees") == 0 && hasValue) {
+            options.trees = (unsigned int)std::max(1, std::atoi(argv[++i]));
+            options.treesGiven = true;
+        } else if (std::strcmp(argument, "--frames") == 0 && hasValue) {
+            options.frames = (unsigned int)std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argument, "--warmup") == 0 && hasValue) {
+            options.warmup = (unsigned int)std::max(0, std::atoi(argv[++i]));
+        } else if (std::strcmp(argument, "--camera-path") == 0 && hasValue) {
+            options.cameraPath = argv[++i];
+        } else if (std::strcmp(argument, "--output") == 0 && hasValue) {
+            options.output = argv[++i];
+        } else if (std::strcmp(argument, "--foliage") == 0 && hasValue && parseFoliageMode(argv[i + 1], options.foliage)) {
+            ++i;
+        } else if (std::strcmp(argument, "--open-world") == 0) {
+            options.openWorld = true;
+        } else if (std::strcmp(argument, "--target-ms") == 0 && hasValue) {
+            options.resolution.targetMs = std::max(0.0f, (float)std::atof(argv[++i]));
+            targetGiven = true;
+        } else if (std::strcmp(argument, "--min-scale") == 0 && hasValue) {
+            options.resolution.minScale = (float)std::atof(argv[++i]);
+        } else if (std::strcmp(argument, "--max-scale") == 0 && hasValue) {
+            options.resolution.maxScale = (float)std::atof(argv[++i]);
+        } else if (std::strcmp(argument, "--scene") == 0 && hasValue) {
+            options.scene = argv[++i];
+        } else if (std::strcmp(argument, "--trace") == 0 && hasValue) {
+            options.trace = argv[++i];
+        } else if (std::strcmp(argument, "--capture") == 0 && hasValue) {
+            options.capture.directory = argv[++i];
+        } else if (std::strcmp(argument, "--capture-video") == 0 && hasValue) {
+            options.capture.video = argv[++i];
+        } else {
+            std::cerr << "unknown or incomplete argument " << argument << "\n"
+                      << "usage: project_base [--benchmark] [--trees N] [--frames N] [--warmup N] "
+                         "[--camera-path file] [--output file.json] [--foliage alpha-test|prepass|alpha-to-coverage] "
+                         "[--open-world] [--target-ms ms] [--min-scale s] [--max-scale s] "
+                         "[--capture dir | --capture-video file] [--scene file.scene] [--trace file.json]"
+                      << std::endl;
+            return false;
+        }
+    }
+    if (options.enabled && !targetGiven)
+        options.resolution.targetMs = 0.0f;
+    if (!options.capture.directory.empty() && !options.capture.video.empty()) {
+        std::cerr << "--capture and --capture-video can't be combined" << std::endl;
+        return false;
+    }
+    if (!options.enabled && !options.capture.video.empty()) {
+        std::cerr << "--capture-video needs --benchmark, use --capture dir in interactive runs" << std::endl;
+        return false;
+    }
+    options.capture.framerate = 1.0f / options.timestep;
+    if (options.scene.empty())
+        options.scene = options.openWorld ? "resources/scenes/open_world.scene" : "resources/scenes/arena.scene";
+    return true;
+}
+
+struct CameraKey {
+    float time;
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+};
+
+// Catmull-Rom spline through camera keyframes, looping back to the first one after the last
+class CameraPath {
+public:
+    bool load(const std::string &path) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "BENCHMARK::CAMERA_PATH::CANNOT_OPEN " << path << std::endl;
+            return false;
+        }
+        m_keys.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            CameraKey key;
+            if (fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+                m_keys.push_back(key);
+        }
+        std::sort(m_keys.begin(), m_keys.end(), [](const CameraKey &a, const CameraKey &b) { return a.time < b.time; });
+        if (m_keys.size() < 2) {
+            std::cerr << "BENCHMARK::CAMERA_PATH::NEEDS_TWO_KEYS " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // a lap around the forest inside the walls, looking in along the way and across at the end
+    void useDefault() {
+        m_keys = {
+                {0.0f, glm::vec3(0.0f, 0.0f, 3.0f), -90.0f, 0.0f},
+                {4.0f, glm::vec3(-40.0f, 0.0f, -30.0f), -45.0f, 5.0f},
+                {8.0f, glm::vec3(-65.0f, 0.0f, 40.0f), 0.0f, 0.0f},
+                {12.0f, glm::vec3(0.0f, 0.0f, 65.0f), -90.0f, -5.0f},
+                {16.0f, glm::vec3(60.0f, 0.0f, 20.0f), -150.0f, 0.0f},
+                {20.0f, glm::vec3(40.0f, 0.0f, -60.0f), 135.0f, 10.0f},
+        };
+        m_loopTime = 24.0f;
+    }
+
+    // moves `camera` to where the path is at `time`
+    void apply(float time, Camera &camera) const {
+        float duration = loopTime();
+        time = std::fmod(time, duration);
+        size_t count = m_keys.size();
+        size_t segment = 0;
+        while (segment + 1 < count && m_keys[segment + 1].time <= time)
+            ++segment;
+        const CameraKey &p1 = m_keys[segment];
+        const CameraKey &p2 = m_keys[(segment + 1) % count];
+        const CameraKey &p0 = m_keys[(segment + count - 1) % count];
+        const CameraKey &p3 = m_keys[(segment + 2) % count];
+        float end = segment + 1 < count ? p2.time : duration;
+        float t = end > p1.time ? (time - p1.time) / (end - p1.time) : 0.0f;
+
+        camera.Position = catmullRom(p0.position, p1.position, p2.position, p3.position, t);
+        // yaw is unwrapped so the spline doesn't spin the long way round
+        float yaw1 = p1.yaw;
+        float yaw0 = yaw1 + wrapDegrees(p0.yaw - yaw1);
+        float yaw2 = yaw1 + wrapDegrees(p2.yaw - yaw1);
+        float yaw3 = yaw2 + wrapDegrees(p3.yaw - yaw2);
+        float yaw = catmullRom(glm::vec3(yaw0), glm::vec3(yaw1), glm::vec3(yaw2), glm::vec3(yaw3), t).x;
+        float pitch = catmullRom(glm::vec3(p0.pitch), glm::vec3(p1.pitch), glm::vec3(p2.pitch), glm::vec3(p3.pitch), t).x;
+        camera.SetOrientation(yaw, pitch);
+    }
+
+private:
+    float loopTime() const {
+        // a loaded path takes as long from its last key back to the first as between its first two
+        return m_loopTime > 0.0f ? m_loopTime : m_keys.back().time + (m_keys[1].time - m_keys[0].time);
+    }
+
+    static float wrapDegrees(float angle) {
+        angle = std::fmod(angle + 180.0f, 360.0f);
+        return (angle < 0.0f ? angle + 360.0f : angle) - 180.0f;
+    }
+
+    static glm::vec3 catmullRom(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3, float t) {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                       (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+
+    std::vector<CameraKey> m_keys;
+    float m_loopTime = 0.0f;
+};
+
+// per-frame measurements of the run. GPU times come from a pair of timestamp queries per frame (elapsed time
+// queries would clash with the profiler's, they can't nest) that are only collected once the run is over, so
+// the measuring itself never waits on the GPU.
+class BenchmarkRecorder {
+public:
+    void beginFrame() {
+        m_queries.push_back(timestamp());
+        renderStats().reset();
+    }
+
+    // call before the swap, the swap itself is part of the next frame's time
+    void endFrame(float resolutionScale = 1.0f) {
+        m_queries.push_back(timestamp());
+        m_resolutionScale.push_back(resolutionScale);
+        const RenderStats &stats = renderStats();
+        m_drawCalls.push_back(stats.drawCalls);
+        m_triangles.push_back(stats.triangles);
+        m_stateChanges.push_back(stats.stateChanges);
+        // frame times run from one end to the next, the first measured frame only starts the clock
+        auto now = std::chrono::steady_clock::now();
+        if (m_hasLastEnd)
+            m_frameMs.push_back(std::chrono::duration<double, std::milli>(now - m_lastEnd).count());
+        m_lastEnd = now;
+        m_hasLastEnd = true;
+    }
+
+    // waits for the outstanding queries and writes the summary
+    void write(std::ostream &out, const BenchmarkOptions &options) {
+        std::vector<double> gpuMs;
+        for (size_t i = 0; i + 1 < m_queries.size(); i += 2) {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(m_queries[i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(m_queries[i + 1], GL_QUERY_RESULT, &end);
+            gpuMs.push_back((end - begin) / 1.0e6);
+        }
+        glDeleteQueries((GLsizei)m_queries.size(), m_queries.data());
+        m_queries.clear();
+
+        out << "{\n"
+            << "  \"trees\": " << options.trees << ",\n"
+            << "  \"frames\": " << m_drawCalls.size() << ",\n"
+            << "  \"timestep\": " << options.timestep << ",\n"
+            << "  \"foliage\": \"" << foliageModeNames()[options.foliage] << "\",\n"
+            << "  \"open_world\": " << (options.openWorld ? "true" : "false") << ",\n"
+            << "  \"target_ms\": " << options.resolution.targetMs << ",\n"
+            << "  \"renderer\": \"" << escape((const char *)glGetString(GL_RENDERER)) << "\",\n"
+            << "  \"frame_ms\": " << summary(m_frameMs) << ",\n"
+            << "  \"gpu_ms\": " << summary(gpuMs) << ",\n"
+            << "  \"draw_calls\": " << summary(toDouble(m_drawCalls)) << ",\n"
+            << "  \"triangles\": " << summary(toDouble(m_triangles)) << ",\n"
+            << "  \"state_changes\": " << summary(toDouble(m_stateChanges)) << ",\n"
+            << "  \"resolution_scale\": " << summary(toDouble(m_resolutionScale)) << "\n"
+            << "}" << std::endl;
+    }
+
+private:
+    static unsigned int timestamp() {
+        unsigned int query;
+        glGenQueries(1, &query);
+        glQueryCounter(query, GL_TIMESTAMP);
+        return query;
+    }
+
+    template<typename T>
+    static std::vector<double> toDouble(const std::vector<T> &values) {
+        return std::vector<double>(values.begin(), values.end());
+    }
+
+    // nearest rank percentile
+    static double percentile(const std::vector<double> &sorted, double fraction) {
+        if (sorted.empty())
+            return 0.0;
+        size_t rank = (size_t)std::ceil(fraction * sorted.size());
+        return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+    }
+
+    static std::string summary(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+        std::ostringstream out;
+        out << "{\"mean\": " << (values.empty() ? 0.0 : sum / values.size())
+            << ", \"min\": " << (values.empty() ? 0.0 : values.front())
+            << ", \"p50\": " << percentile(values, 0.50)
+            << ", \"p95\": " << percentile(values, 0.95)
+            << ", \"p99\": " << percentile(values, 0.99)
+            << ", \"max\": " << (values.empty() ? 0.0 : values.back()) << "}";
+        return out.str();
+    }
+
+    static std::string escape(const char *text) {
+        std::string escaped;
+        for (const char *c = text ? text : ""; *c; ++c) {
+            if (*c == '"' || *c == '\\')
+                escaped += '\\';
+            escaped += *c;
+        }
+        return escaped;
+    }
+
+    std::chrono::steady_clock::time_point m_lastEnd;
+    bool m_hasLastEnd = false;
+    std::vector<double> m_frameMs;
+    std::vector<unsigned int> m_queries;
+    std::vector<unsigned int> m_drawCalls;
+    std::vector<uint64_t> m_triangles;
+    std::vector<unsigned int> m_stateChanges;
+    std::vector<float> m_resolutionScale;
+};
+
+};
+#endif //PROJECT_BASE_BENCHMARK_H
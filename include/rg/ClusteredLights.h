@@ -0,0 +1,276 @@
+//
+// Clustered forward shading of point lights. The view frustum is cut into CLUSTER_X x CLUSTER_Y screen tiles
+// and CLUSTER_Z depth slices spaced logarithmically, every light is assigned to the clusters its sphere
+// touches, and a fragment only loops over the lights of its own cluster, so its cost follows how many lights
+// are near it rather than how many there are. Assignment runs on the CPU, one job per depth slice, into a
+// ClusterFrame that is uploaded once per frame: light data, per-cluster (offset, count) and the light index
+// lists go to three buffer textures, which GL 3.3 has where it lacks storage buffers.
+//
+
+#ifndef PROJECT_BASE_CLUSTEREDLIGHTS_H
+#define PROJECT_BASE_CLUSTEREDLIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <rg/GLExtensions.h>
+#include <rg/JobSystem.h>
+#include <rg/RenderQueue.h>
+#include <rg/Shadows.h>
+#include <rg/StreamBuffer.h>
+#include <rg/UniformBlocks.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace rg {
+
+const unsigned int CLUSTER_X = 16;
+const unsigned int CLUSTER_Y = 9;
+const unsigned int CLUSTER_Z = 24;
+const unsigned int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+// after the shadow map, still out of the queue's reach
+const unsigned int CLUSTER_RANGES_TEXTURE_UNIT = SHADOW_MAP_TEXTURE_UNIT + 1;
+const unsigned int CLUSTER_INDICES_TEXTURE_UNIT = SHADOW_MAP_TEXTURE_UNIT + 2;
+const unsigned int POINT_LIGHTS_TEXTURE_UNIT = SHADOW_MAP_TEXTURE_UNIT + 3;
+
+struct PointLight {
+    glm::vec3 position;
+    // the light reaches zero at this distance
+    float radius;
+    glm::vec3 color;
+    float pad0;
+};
+
+// one frame's light lists, built by ClusteredLights::assign()
+struct ClusterFrame {
+    ClustersBlock block = {};
+    // (first index, count) of every cluster, x fastest, then y, then z
+    std::vector<glm::uvec2> ranges;
+    std::vector<unsigned int> indices;
+    std::vector<PointLight> lights;
+
+    // what the slice jobs fill in before the lists are concatenated
+    struct Bounds {
+        glm::ivec2 tileMin, tileMax;
+        int sliceMin, sliceMax;
+        glm::vec3 center;
+        float radius;
+    };
+    std::vector<Bounds> bounds;
+    std::vector<unsigned int> sliceIndices[CLUSTER_Z];
+    std::vector<unsigned int> sliceCounts[CLUSTER_Z];
+};
+
+// formats of the ranges, indices and lights buffer textures
+const GLenum CLUSTER_TEXTURE_FORMATS[3] = {GL_RG32UI, GL_R32UI, GL_RGBA32F};
+
+class ClusteredLights {
+public:
+    void create(float cameraNear, float cameraFar) {
+        m_near = cameraNear;
+        m_far = cameraFar;
+        // buffer textures that can show a range of the stream buffer read from it, the others get buffers of their own
+        m_streamed = glext::supportsTextureBufferRange();
+        GLint alignment = 16;
+        if (m_streamed)
+            glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        m_textureAlignment = std::max(alignment, 16);
+
+        glGenTextures(3, m_textures);
+        if (!m_streamed) {
+            glGenBuffers(3, m_buffers);
+            for (int i = 0; i < 3; ++i) {
+                glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+                glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+                glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, CLUSTER_TEXTURE_FORMATS[i], m_buffers[i]);
+            }
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+
+    // Sorts `lights` into the clusters of the view, for jobs: it touches no GL state. The slices are assigned
+    // by jobs of their own, which this waits for.
+    void assign(const glm::mat4 &view, const glm::mat4 &projection, const std::vector<PointLight> &lights,
+                ClusterFrame &frame) const {
+        frame.lights = lights;
+        frame.block.grid = glm::uvec4(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, (unsigned int)lights.size());
+        float logRange = std::log(m_far / m_near);
+        frame.block.depth = glm::vec4(CLUSTER_Z / logRange, -CLUSTER_Z * std::log(m_near) / logRange, 0.0f, 0.0f);
+
+        // the screen tiles and depth slices of every light's view space box
+        frame.bounds.clear();
+        for (unsigned int i = 0; i < lights.size(); ++i) {
+            ClusterFrame::Bounds bounds;
+            bounds.center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            bounds.radius = lights[i].radius;
+            float depth = -bounds.center.z;
+            if (depth + bounds.radius < m_near || depth - bounds.radius > m_far) {
+                bounds.sliceMin = 1;
+                bounds.sliceMax = 0;
+            }
+            else {
+                bounds.sliceMin = slice(std::max(depth - bounds.radius, m_near));
+                bounds.sliceMax = slice(std::min(depth + bounds.radius, m_far));
+                tiles(projection, bounds);
+            }
+            frame.bounds.push_back(bounds);
+        }
+
+        JobCounter slices;
+        JobSystem::instance().parallelFor(slices, CLUSTER_Z, 1, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int z = begin; z < end; ++z)
+                assignSlice(projection, z, frame);
+        });
+        JobSystem::instance().wait(slices);
+
+        frame.ranges.resize(CLUSTER_COUNT);
+        frame.indices.clear();
+        for (unsigned int z = 0; z < CLUSTER_Z; ++z) {
+            unsigned int offset = (unsigned int)frame.indices.size();
+            for (unsigned int c = 0; c < CLUSTER_X * CLUSTER_Y; ++c) {
+                unsigned int count = frame.sliceCounts[z][c];
+                frame.ranges[z * CLUSTER_X * CLUSTER_Y + c] = glm::uvec2(offset, count);
+                offset += count;
+            }
+            frame.indices.insert(frame.indices.end(), frame.sliceIndices[z].begin(), frame.sliceIndices[z].end());
+        }
+    }
+
+    // Through the stream buffer where buffer textures can show a range of it. Otherwise the buffers are respecified
+    // every frame, so the driver never waits for the draws still reading last frame's.
+    void upload(const ClusterFrame &frame, StreamBuffer &stream) {
+        stream.uploadUniformBlock(CLUSTERS_BLOCK_BINDING, &frame.block, sizeof(ClustersBlock));
+        const void *data[3] = {frame.ranges.data(), frame.indices.data(), frame.lights.data()};
+        size_t sizes[3] = {frame.ranges.size() * sizeof(glm::uvec2), frame.indices.size() * sizeof(unsigned int),
+                           frame.lights.size() * sizeof(PointLight)};
+        for (int i = 0; i < 3; ++i) {
+            if (m_streamed) {
+                // never empty, a zero sized buffer texture is incomplete
+                StreamRange range = stream.allocate(std::max(sizes[i], (size_t)16), m_textureAlignment);
+                if (!range.data)
+                    continue;
+                std::memcpy(range.data, data[i], sizes[i]);
+                stream.commit(range);
+                glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+                glTexBufferRange(GL_TEXTURE_BUFFER, CLUSTER_TEXTURE_FORMATS[i], stream.buffer(), range.offset, range.size);
+                glBindTexture(GL_TEXTURE_BUFFER, 0);
+                continue;
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+            // never empty, a zero sized buffer texture is incomplete
+            glBufferData(GL_TEXTURE_BUFFER, std::max(sizes[i], (size_t)16), nullptr, GL_STREAM_DRAW);
+            if (sizes[i])
+                glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // the three buffer textures on their units for the lit passes
+    void bind() const {
+        const unsigned int units[3] = {CLUSTER_RANGES_TEXTURE_UNIT, CLUSTER_INDICES_TEXTURE_UNIT, POINT_LIGHTS_TEXTURE_UNIT};
+        for (int i = 0; i < 3; ++i) {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void destroy() {
+        glDeleteTextures(3, m_textures);
+        if (!m_streamed)
+            glDeleteBuffers(3, m_buffers);
+    }
+
+private:
+    int slice(float depth) const {
+        int z = (int)std::floor(std::log(depth / m_near) / std::log(m_far / m_near) * CLUSTER_Z);
+        return std::min(std::max(z, 0), (int)CLUSTER_Z - 1);
+    }
+
+    // screen tiles covered by the corners of the light's view space box, all of them when it reaches the near plane
+    void tiles(const glm::mat4 &projection, ClusterFrame::Bounds &bounds) const {
+        bounds.tileMin = glm::ivec2(0);
+        bounds.tileMax = glm::ivec2(CLUSTER_X - 1, CLUSTER_Y - 1);
+        float nearest = -bounds.center.z - bounds.radius;
+        if (nearest < m_near)
+            return;
+        glm::vec2 ndcMin(INFINITY), ndcMax(-INFINITY);
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec3 offset((corner & 1) ? bounds.radius : -bounds.radius, (corner & 2) ? bounds.radius : -bounds.radius,
+                             (corner & 4) ? bounds.radius : -bounds.radius);
+            glm::vec4 clip = projection * glm::vec4(bounds.center + offset, 1.0f);
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+        glm::vec2 grid((float)CLUSTER_X, (float)CLUSTER_Y);
+        glm::ivec2 low = glm::ivec2(glm::floor((ndcMin * 0.5f + 0.5f) * grid));
+        glm::ivec2 high = glm::ivec2(glm::floor((ndcMax * 0.5f + 0.5f) * grid));
+        bounds.tileMin = glm::max(low, glm::ivec2(0));
+        bounds.tileMax = glm::min(high, glm::ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    }
+
+    // the lights of slice `z`, each one tested against the view space box of every cluster in its tile range
+    void assignSlice(const glm::mat4 &projection, unsigned int z, ClusterFrame &frame) const {
+        std::vector<unsigned int> &indices = frame.sliceIndices[z];
+        std::vector<unsigned int> &counts = frame.sliceCounts[z];
+        counts.assign(CLUSTER_X * CLUSTER_Y, 0);
+        indices.clear();
+        float nearDepth = m_near * std::pow(m_far / m_near, (float)z / CLUSTER_Z);
+        float farDepth = m_near * std::pow(m_far / m_near, (float)(z + 1) / CLUSTER_Z);
+        // view space x = ndc x * depth / projection[0][0], and the same for y
+        glm::vec2 unproject(1.0f / projection[0][0], 1.0f / projection[1][1]);
+
+        // counting first, so each cluster's lights end up next to each other in one pass over the lights
+        std::vector<unsigned int> cursor;
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                cursor.resize(CLUSTER_X * CLUSTER_Y);
+                unsigned int offset = 0;
+                for (unsigned int c = 0; c < counts.size(); ++c) {
+                    cursor[c] = offset;
+                    offset += counts[c];
+                }
+                indices.resize(offset);
+            }
+            for (unsigned int light = 0; light < frame.bounds.size(); ++light) {
+                const ClusterFrame::Bounds &bounds = frame.bounds[light];
+                if ((int)z < bounds.sliceMin || (int)z > bounds.sliceMax)
+                    continue;
+                for (int y = bounds.tileMin.y; y <= bounds.tileMax.y; ++y) {
+                    for (int x = bounds.tileMin.x; x <= bounds.tileMax.x; ++x) {
+                        glm::vec2 ndcMin(x * 2.0f / CLUSTER_X - 1.0f, y * 2.0f / CLUSTER_Y - 1.0f);
+                        glm::vec2 ndcMax((x + 1) * 2.0f / CLUSTER_X - 1.0f, (y + 1) * 2.0f / CLUSTER_Y - 1.0f);
+                        glm::vec3 boxMin(glm::min(ndcMin * nearDepth, ndcMin * farDepth) * unproject, -farDepth);
+                        glm::vec3 boxMax(glm::max(ndcMax * nearDepth, ndcMax * farDepth) * unproject, -nearDepth);
+                        glm::vec3 closest = glm::clamp(bounds.center, boxMin, boxMax);
+                        glm::vec3 away = closest - bounds.center;
+                        if (glm::dot(away, away) > bounds.radius * bounds.radius)
+                            continue;
+                        unsigned int cluster = y * CLUSTER_X + x;
+                        if (pass == 0)
+                            ++counts[cluster];
+                        else
+                            indices[cursor[cluster]++] = light;
+                    }
+                }
+            }
+        }
+    }
+
+    float m_near = 0.1f;
+    float m_far = 250.0f;
+    bool m_streamed = false;
+    GLint m_textureAlignment = 16;
+    // only when the textures can't read from the stream buffer
+    unsigned int m_buffers[3] = {};
+    unsigned int m_textures[3] = {};
+};
+
+};
+#endif //PROJECT_BASE_CLUSTEREDLIGHTS_H
@@ -0,0 +1,51 @@
+//
+// Compute programs of the culling passes, compiled and linked from one file of the shader folder. Needs
+// GL 4.3, see glext::supportsGpuCulling.
+//
+
+#ifndef PROJECT_BASE_COMPUTEPROGRAM_H
+#define PROJECT_BASE_COMPUTEPROGRAM_H
+
+#include <glad/glad.h>
+
+#include <common.h>
+#include <rg/GLExtensions.h>
+
+#include <iostream>
+#include <string>
+
+namespace rg {
+
+// 0 when the shader doesn't compile or link, the log is printed
+inline unsigned int compileComputeProgram(std::string path) {
+    appendShaderFolderIfNotPresent(path);
+    std::string source = readFileContents(path);
+    const char *code = source.c_str();
+    unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+    GLint success;
+    GLchar infoLog[1024];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+        std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: COMPUTE (" << path << ")\n" << infoLog << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 1024, NULL, infoLog);
+        std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: COMPUTE (" << path << ")\n" << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+};
+#endif //PROJECT_BASE_COMPUTEPROGRAM_H
@@ -0,0 +1,229 @@
+//
+// Frustum culling of instanced geometry on the CPU.
+//
+
+#ifndef PROJECT_BASE_CULLING_H
+#define PROJECT_BASE_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// bounding sphere of a local space box after it has been moved by `transform`
+inline BoundingSphere transformBounds(const glm::mat4 &transform, const glm::vec3 &localMin, const glm::vec3 &localMax) {
+    glm::vec3 localCenter = (localMin + localMax) * 0.5f;
+    float localRadius = glm::length(localMax - localMin) * 0.5f;
+    // the largest axis scale keeps the sphere conservative for non-uniform scales too
+    float scale = std::max(glm::length(glm::vec3(transform[0])),
+                           std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    BoundingSphere sphere;
+    sphere.center = glm::vec3(transform * glm::vec4(localCenter, 1.0f));
+    sphere.radius = localRadius * scale;
+    return sphere;
+}
+
+// The six clip planes of a view frustum, pointing inwards, with normalized normals (xyz) and distance (w).
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb-Hartmann plane extraction from a combined projection * view matrix
+    static Frustum fromMatrix(const glm::mat4 &m) {
+        Frustum frustum;
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        frustum.planes[0] = row3 + row0; // left
+        frustum.planes[1] = row3 - row0; // right
+        frustum.planes[2] = row3 + row1; // bottom
+        frustum.planes[3] = row3 - row1; // top
+        frustum.planes[4] = row3 + row2; // near
+        frustum.planes[5] = row3 - row2; // far
+        for (glm::vec4 &plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    bool intersects(const BoundingSphere &sphere) const {
+        for (const glm::vec4 &plane : planes) {
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
+
+    enum BoxResult { OUTSIDE, INTERSECTS, INSIDE };
+
+    // classifies an axis aligned box using its most positive/negative corner against every plane
+    BoxResult classify(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const {
+        BoxResult result = INSIDE;
+        for (const glm::vec4 &plane : planes) {
+            glm::vec3 positive(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+                               plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                               plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            glm::vec3 negative(plane.x >= 0.0f ? boxMin.x : boxMax.x,
+                               plane.y >= 0.0f ? boxMin.y : boxMax.y,
+                               plane.z >= 0.0f ? boxMin.z : boxMax.z);
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+                return OUTSIDE;
+            if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+                result = INTERSECTS;
+        }
+        return result;
+    }
+};
+
+// counters of the last cull, for profiling
+struct CullStats {
+    unsigned int visible = 0;
+    // outside the frustum
+    unsigned int culled = 0;
+    // inside the frustum but hidden behind nearer geometry, counted in neither of the two above
+    unsigned int occluded = 0;
+    unsigned int cellsVisible = 0;
+    unsigned int cellsCulled = 0;
+};
+
+// Uniform grid over the XZ plane bucketing static instances by position. Whole cells are
+// rejected or accepted with one box test, only cells crossing a frustum plane test each instance.
+class InstanceGrid {
+public:
+    void build(const glm::mat4 *transforms, unsigned int count,
+               const glm::vec3 &localMin, const glm::vec3 &localMax, float cellSize) {
+        m_cells.clear();
+        m_transforms.clear();
+        m_spheres.clear();
+        if (count == 0)
+            return;
+
+        std::vector<BoundingSphere> spheres(count);
+        glm::vec2 gridMin(INFINITY), gridMax(-INFINITY);
+        for (unsigned int i = 0; i < count; ++i) {
+            spheres[i] = transformBounds(transforms[i], localMin, localMax);
+            gridMin = glm::min(gridMin, glm::vec2(spheres[i].center.x, spheres[i].center.z));
+            gridMax = glm::max(gridMax, glm::vec2(spheres[i].center.x, spheres[i].center.z));
+        }
+        m_cellSize = cellSize;
+        m_origin = gridMin;
+        m_columns = (int)std::floor((gridMax.x - gridMin.x) / cellSize) + 1;
+        m_rows = (int)std::floor((gridMax.y - gridMin.y) / cellSize) + 1;
+
+        // counting sort of the instances by cell, so every cell owns a contiguous range
+        std::vector<unsigned int> cellOf(count);
+        std::vector<unsigned int> cellStart(m_columns * m_rows + 1, 0);
+        for (unsigned int i = 0; i < count; ++i) {
+            cellOf[i] = cellIndex(spheres[i].center);
+            ++cellStart[cellOf[i] + 1];
+        }
+        for (size_t c = 1; c < cellStart.size(); ++c)
+            cellStart[c] += cellStart[c - 1];
+
+        m_transforms.resize(count);
+        m_spheres.resize(count);
+        std::vector<unsigned int> cursor(cellStart.begin(), cellStart.end() - 1);
+        for (unsigned int i = 0; i < count; ++i) {
+            unsigned int slot = cursor[cellOf[i]]++;
+            m_transforms[slot] = transforms[i];
+            m_spheres[slot] = spheres[i];
+        }
+
+        for (int c = 0; c < m_columns * m_rows; ++c) {
+            if (cellStart[c] == cellStart[c + 1])
+                continue;
+            Cell cell;
+            cell.first = cellStart[c];
+            cell.count = cellStart[c + 1] - cellStart[c];
+            cell.boundsMin = glm::vec3(INFINITY);
+            cell.boundsMax = glm::vec3(-INFINITY);
+            for (unsigned int i = cell.first; i < cell.first + cell.count; ++i) {
+                cell.boundsMin = glm::min(cell.boundsMin, m_spheres[i].center - glm::vec3(m_spheres[i].radius));
+                cell.boundsMax = glm::max(cell.boundsMax, m_spheres[i].center + glm::vec3(m_spheres[i].radius));
+            }
+            m_cells.push_back(cell);
+        }
+    }
+
+    // replaces `visible` with the transforms of every instance that touches the frustum
+    void cull(const Frustum &frustum, std::vector<glm::mat4> &visible, CullStats &stats) const {
+        visible.clear();
+        forEachVisible(frustum, stats, [&](unsigned int first, unsigned int count) {
+            visible.insert(visible.end(), m_transforms.begin() + first, m_transforms.begin() + first + count);
+        });
+    }
+
+    // same as above, but returns indices into transforms()/spheres() so callers can keep per-instance state
+    void cullIndices(const Frustum &frustum, std::vector<unsigned int> &visible, CullStats &stats) const {
+        visible.clear();
+        forEachVisible(frustum, stats, [&](unsigned int first, unsigned int count) {
+            for (unsigned int i = first; i < first + count; ++i)
+                visible.push_back(i);
+        });
+    }
+
+    unsigned int size() const { return (unsigned int)m_transforms.size(); }
+    const std::vector<glm::mat4> &transforms() const { return m_transforms; }
+    const std::vector<BoundingSphere> &spheres() const { return m_spheres; }
+
+private:
+    struct Cell {
+        unsigned int first;
+        unsigned int count;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    // calls emit(first, count) for every run of visible instances
+    template <typename Emit>
+    void forEachVisible(const Frustum &frustum, CullStats &stats, Emit emit) const {
+        stats = CullStats();
+        unsigned int visibleCount = 0;
+        for (const Cell &cell : m_cells) {
+            Frustum::BoxResult result = frustum.classify(cell.boundsMin, cell.boundsMax);
+            if (result == Frustum::OUTSIDE) {
+                ++stats.cellsCulled;
+                continue;
+            }
+            ++stats.cellsVisible;
+            if (result == Frustum::INSIDE) {
+                emit(cell.first, cell.count);
+                visibleCount += cell.count;
+                continue;
+            }
+            for (unsigned int i = cell.first; i < cell.first + cell.count; ++i) {
+                if (frustum.intersects(m_spheres[i])) {
+                    emit(i, 1u);
+                    ++visibleCount;
+                }
+            }
+        }
+        stats.visible = visibleCount;
+        stats.culled = (unsigned int)m_transforms.size() - visibleCount;
+    }
+
+    unsigned int cellIndex(const glm::vec3 &position) const {
+        int column = std::min(m_columns - 1, std::max(0, (int)std::floor((position.x - m_origin.x) / m_cellSize)));
+        int row = std::min(m_rows - 1, std::max(0, (int)std::floor((position.z - m_origin.y) / m_cellSize)));
+        return (unsigned int)(row * m_columns + column);
+    }
+
+    float m_cellSize = 1.0f;
+    glm::vec2 m_origin;
+    int m_columns = 0;
+    int m_rows = 0;
+    std::vector<Cell> m_cells;
+    // instance data reordered so each cell is contiguous
+    std::vector<glm::mat4> m_transforms;
+    std::vector<BoundingSphere> m_spheres;
+};
+
+};
+#endif //PROJECT_BASE_CULLING_H
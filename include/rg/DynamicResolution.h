@@ -0,0 +1,196 @@
+//
+// Dynamic resolution: the scene is drawn into an offscreen target at a fraction of the window size, the
+// fraction following the GPU frame time toward a budget, and then stretched over the window by a pass that
+// sharpens what the upscale blurred. The target is allocated once for the largest scale and the frame only
+// uses its lower left corner, so a change of scale never reallocates anything.
+//
+
+#ifndef PROJECT_BASE_DYNAMICRESOLUTION_H
+#define PROJECT_BASE_DYNAMICRESOLUTION_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/shader_m.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace rg {
+
+struct DynamicResolutionOptions {
+    // GPU milliseconds a frame may take, 0 keeps the scale at maxScale
+    float targetMs = 16.6f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+};
+
+// largest fraction the target is allocated for, above 1 a frame is supersampled
+const float RESOLUTION_SCALE_LIMIT = 2.0f;
+// fraction of the budget aimed at, frames vary and the time measured lags behind
+const float RESOLUTION_HEADROOM = 0.9f;
+// largest change of scale per frame, the timings are a few frames old and would make bigger steps overshoot
+const float RESOLUTION_MAX_STEP = 0.02f;
+// changes smaller than this are ignored, so the scale doesn't flicker around its resting point
+const float RESOLUTION_DEADBAND = 0.01f;
+// strength of the sharpening after an upscale
+const float UPSCALE_SHARPNESS = 0.5f;
+
+class DynamicResolution {
+public:
+    // `samples` of 0 makes a single sampled target
+    void create(const DynamicResolutionOptions &options, int samples) {
+        m_options = options;
+        m_options.maxScale = std::min(std::max(m_options.maxScale, 0.1f), RESOLUTION_SCALE_LIMIT);
+        m_options.minScale = std::min(std::max(m_options.minScale, 0.1f), m_options.maxScale);
+        m_scale = m_options.maxScale;
+        m_samples = samples;
+        glGenFramebuffers(1, &m_sceneFbo);
+        glGenFramebuffers(1, &m_resolveFbo);
+        glGenVertexArrays(1, &m_vao);
+        m_upscaleShader = new Shader("resources/shaders/static_batch_copy.vs", "resources/shaders/upscale.fs");
+        m_upscaleShader->use();
+        m_upscaleShader->setInt("source", 0);
+    }
+
+    // call every frame with the window's framebuffer size, the targets are only reallocated when it changed
+    void resize(int width, int height) {
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+        if (width == m_windowWidth && height == m_windowHeight)
+            return;
+        m_windowWidth = width;
+        m_windowHeight = height;
+        m_targetWidth = (int)std::ceil(width * m_options.maxScale);
+        m_targetHeight = (int)std::ceil(height * m_options.maxScale);
+        releaseTargets();
+
+        glGenRenderbuffers(1, &m_sceneColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_sceneColor);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_RGBA8, m_targetWidth, m_targetHeight);
+        glGenRenderbuffers(1, &m_sceneDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_sceneDepth);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_DEPTH_COMPONENT24, m_targetWidth, m_targetHeight);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_sceneColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_sceneDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION:: scene framebuffer is incomplete" << std::endl;
+
+        // the multisampled scene is resolved into a texture the upscale pass can filter
+        glGenTextures(1, &m_resolved);
+        glBindTexture(GL_TEXTURE_2D, m_resolved);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_targetWidth, m_targetHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_resolved, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION:: resolve framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Moves the scale toward the one that would make the frame take the budget, from the GPU times of a recent
+    // frame: `scaledMs` of the passes drawn at this scale and `fixedMs` of the ones that don't change with it
+    // (shadows, the pyramid, the upscale, the overlay). The scaled time is taken to follow the pixel count, so
+    // that scale is sqrt(what the budget leaves them / their time) of this one.
+    void adjust(float scaledMs, float fixedMs = 0.0f) {
+        if (!m_enabled || m_options.targetMs <= 0.0f) {
+            m_scale = m_options.maxScale;
+            return;
+        }
+        if (scaledMs <= 0.0f)
+            return;
+        // fixed passes that eat the whole budget leave the scene the least there is
+        float budget = std::max(m_options.targetMs * RESOLUTION_HEADROOM - std::max(fixedMs, 0.0f), 0.0f);
+        float ideal = m_scale * std::sqrt(budget / scaledMs);
+        float step = std::min(std::max(ideal - m_scale, -RESOLUTION_MAX_STEP), RESOLUTION_MAX_STEP);
+        if (std::abs(ideal - m_scale) > RESOLUTION_DEADBAND)
+            m_scale = std::min(std::max(m_scale + step, m_options.minScale), m_options.maxScale);
+    }
+
+    // the scene's draws go to the corner of the target this frame's scale covers
+    void begin() {
+        m_width = std::min(std::max((int)std::lround(m_windowWidth * m_scale), 1), m_targetWidth);
+        m_height = std::min(std::max((int)std::lround(m_windowHeight * m_scale), 1), m_targetHeight);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFbo);
+        glViewport(0, 0, m_width, m_height);
+    }
+
+    // resolves the scene and stretches it over the window, which is bound afterwards
+    void end() {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_sceneFbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_resolveFbo);
+        glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, m_windowWidth, m_windowHeight);
+
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        glDisable(GL_DEPTH_TEST);
+        m_upscaleShader->use();
+        m_upscaleShader->setVec2("region", glm::vec2((float)m_width, (float)m_height));
+        // only what was drawn below the window's resolution is sharpened
+        m_upscaleShader->setFloat("sharpness", m_scale < 1.0f ? UPSCALE_SHARPNESS : 0.0f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_resolved);
+        glBindVertexArray(m_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (depthTest)
+            glEnable(GL_DEPTH_TEST);
+    }
+
+    const float &scale() const { return m_scale; }
+    // the scene target and the part of it this frame is drawn to, e.g. to read its depth back
+    unsigned int framebuffer() const { return m_sceneFbo; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    // samples per pixel of the scene target, 0 when it isn't multisampled
+    int samples() const { return m_samples; }
+    // the overlay's switch, off draws every frame at maxScale
+    bool *enabled() { return &m_enabled; }
+
+    void destroy() {
+        releaseTargets();
+        glDeleteFramebuffers(1, &m_sceneFbo);
+        glDeleteFramebuffers(1, &m_resolveFbo);
+        glDeleteVertexArrays(1, &m_vao);
+        if (m_upscaleShader) {
+            glDeleteProgram(m_upscaleShader->ID);
+            delete m_upscaleShader;
+            m_upscaleShader = nullptr;
+        }
+    }
+
+private:
+    void releaseTargets() {
+        if (m_sceneColor)
+            glDeleteRenderbuffers(1, &m_sceneColor);
+        if (m_sceneDepth)
+            glDeleteRenderbuffers(1, &m_sceneDepth);
+        if (m_resolved)
+            glDeleteTextures(1, &m_resolved);
+        m_sceneColor = m_sceneDepth = m_resolved = 0;
+    }
+
+    DynamicResolutionOptions m_options;
+    bool m_enabled = true;
+    float m_scale = 1.0f;
+    int m_samples = 0;
+    int m_windowWidth = 0, m_windowHeight = 0;
+    int m_targetWidth = 0, m_targetHeight = 0;
+    // the part of the target this frame is drawn to
+    int m_width = 0, m_height = 0;
+    unsigned int m_sceneFbo = 0, m_sceneColor = 0, m_sceneDepth = 0;
+    unsigned int m_resolveFbo = 0, m_resolved = 0;
+    unsigned int m_vao = 0;
+    Shader *m_upscaleShader = nullptr;
+};
+
+};
+#endif //PROJECT_BASE_DYNAMICRESOLUTION_H
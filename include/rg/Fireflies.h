@@ -0,0 +1,62 @@
+//
+// Fireflies for the night phase: point lights hovering over the ground around the camera. The ground around
+// the camera is divided into FIREFLY_CELL cells and some cells, picked by a hash, hold one firefly that drifts
+// around its cell and blinks, so the swarm looks the same from frame to frame as the camera walks through it.
+//
+
+#ifndef PROJECT_BASE_FIREFLIES_H
+#define PROJECT_BASE_FIREFLIES_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <rg/ClusteredLights.h>
+#include <rg/Hash.h>
+#include <rg/Terrain.h>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+const float FIREFLY_CELL = 6.0f;
+// fireflies are placed this far around the camera, about 250 of them
+const float FIREFLY_RANGE = 60.0f;
+const float FIREFLY_OCCUPANCY = 0.6f;
+const float FIREFLY_RADIUS = 5.0f;
+
+// replaces `lights` with the fireflies around `eye` at `time`, `night` from 0 (day, none) to 1
+inline void gatherFireflies(const glm::vec3 &eye, float time, float night, const Heightfield &ground,
+                            std::vector<PointLight> &lights, uint32_t seed = 0x5eed1234u) {
+    lights.clear();
+    if (night <= 0.0f)
+        return;
+    int cells = (int)std::ceil(FIREFLY_RANGE / FIREFLY_CELL);
+    int centerX = (int)std::floor(eye.x / FIREFLY_CELL), centerZ = (int)std::floor(eye.z / FIREFLY_CELL);
+    for (int z = centerZ - cells; z <= centerZ + cells; ++z) {
+        for (int x = centerX - cells; x <= centerX + cells; ++x) {
+            uint32_t hash = hashCoords(x, z, seed);
+            if (hashToUnit(hash) >= FIREFLY_OCCUPANCY)
+                continue;
+            float phase = hashToUnit(hashMix(hash ^ 0x9e3779b9u)) * glm::two_pi<float>();
+            float speed = 0.3f + 0.4f * hashToUnit(hashMix(hash ^ 0x7f4a7c15u));
+            // a slow lissajous loop inside the cell, and a blink of its own rate
+            glm::vec2 drift(std::sin(time * speed + phase), std::sin(time * speed * 1.3f + phase * 2.0f));
+            glm::vec2 position = (glm::vec2((float)x, (float)z) + 0.5f + drift * 0.4f) * FIREFLY_CELL;
+            float blink = 0.5f + 0.5f * std::sin(time * speed * 4.0f + phase * 3.0f);
+            float brightness = night * blink * blink;
+            if (brightness < 0.02f)
+                continue;
+            float hover = 0.8f + 1.5f * hashToUnit(hashMix(hash ^ 0x2545f491u)) + 0.3f * std::sin(time * speed * 2.0f + phase);
+            PointLight light = {};
+            light.position = glm::vec3(position.x, ground.height(position.x, position.y) + hover, position.y);
+            light.radius = FIREFLY_RADIUS;
+            light.color = glm::vec3(0.6f, 1.0f, 0.25f) * (1.5f * brightness);
+            lights.push_back(light);
+        }
+    }
+}
+
+};
+#endif //PROJECT_BASE_FIREFLIES_H
@@ -0,0 +1,72 @@
+//
+// How the alpha cut leaves are rasterized. A shader that discards turns early depth testing off, so with plain
+// alpha testing every hidden canopy fragment is lit in full. The two alternatives are switchable at run time so
+// they can be measured against each other on the GPU at hand:
+//   - depth prepass: a depth only pass does the alpha test, then the lit pass runs with GL_EQUAL and no discard
+//   - alpha to coverage: no discard, the (multisampled) framebuffer turns the texel alpha into a coverage mask
+//
+
+#ifndef PROJECT_BASE_FOLIAGE_H
+#define PROJECT_BASE_FOLIAGE_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+namespace rg {
+
+enum FoliageMode { FOLIAGE_ALPHA_TEST, FOLIAGE_DEPTH_PREPASS, FOLIAGE_ALPHA_TO_COVERAGE, FOLIAGE_MODE_COUNT };
+
+// samples of the scene's render target, alpha to coverage needs a multisampled framebuffer
+const int FOLIAGE_MSAA_SAMPLES = 4;
+
+inline const char *const *foliageModeNames() {
+    static const char *const names[FOLIAGE_MODE_COUNT] = {"alpha-test", "prepass", "alpha-to-coverage"};
+    return names;
+}
+
+inline bool parseFoliageMode(const char *name, FoliageMode &mode) {
+    for (int i = 0; i < FOLIAGE_MODE_COUNT; ++i) {
+        if (std::strcmp(name, foliageModeNames()[i]) == 0) {
+            mode = (FoliageMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// multisampled rasterization is only switched on for alpha to coverage, so the other modes are measured without
+// its cost on the same target
+inline void setFoliageMultisample(FoliageMode mode) {
+    if (mode == FOLIAGE_ALPHA_TO_COVERAGE)
+        glEnable(GL_MULTISAMPLE);
+    else
+        glDisable(GL_MULTISAMPLE);
+}
+
+// depth only pass of the prepass mode
+inline void beginFoliageDepthPass() {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
+
+// lit pass of the prepass mode, only the fragments that won the depth pass are shaded
+inline void beginFoliageColorPass() {
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+inline void beginFoliageCoveragePass() {
+    glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+}
+
+// back to the state everything else is drawn with
+inline void endFoliagePasses() {
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+}
+
+};
+#endif //PROJECT_BASE_FOLIAGE_H
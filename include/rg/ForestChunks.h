@@ -0,0 +1,288 @@
+//
+// Streamed open world forest. The world is cut into CHUNK_SIZE tiles, and the tiles around the camera are kept
+// resident in a fixed set of slots: every slot owns TREES_PER_CHUNK instances of one flat instance array, so
+// memory never grows however far the camera walks, and an instance keeps its index for as long as its chunk
+// stays loaded (which is what the level of detail selection remembers per instance). Placements are generated
+// by jobs into the slot's own staging store, and the main thread commits a few finished chunks per frame.
+//
+
+#ifndef PROJECT_BASE_FORESTCHUNKS_H
+#define PROJECT_BASE_FORESTCHUNKS_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Culling.h>
+#include <rg/InstanceTransforms.h>
+#include <rg/JobSystem.h>
+#include <rg/TreePlacement.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+class ForestChunks {
+public:
+    // chunks up to `radius` chunks away from the camera's chunk are loaded, and only dropped once they are
+    // more than radius + 1 away, so walking along a chunk border doesn't load and drop the same row over and over
+    void create(int radius, uint32_t seed, const glm::vec3 &localMin, const glm::vec3 &localMax,
+                const Heightfield *ground = nullptr, unsigned int commitsPerFrame = 4) {
+        m_radius = radius;
+        m_seed = seed;
+        m_ground = ground;
+        m_localMin = localMin;
+        m_localMax = localMax;
+        m_commitsPerFrame = commitsPerFrame;
+
+        // the budget: every chunk the hysteresis ring can hold at once
+        int side = 2 * (radius + 1) + 1;
+        m_slots.clear();
+        m_slots.resize(side * side);
+        for (Slot &slot : m_slots) {
+            slot.staging.reset(new Staging());
+            slot.staging->store.reserve(TREES_PER_CHUNK);
+            slot.staging->transforms.resize(TREES_PER_CHUNK);
+            slot.staging->spheres.resize(TREES_PER_CHUNK);
+        }
+        m_transforms.assign(m_slots.size() * TREES_PER_CHUNK, glm::mat4(0.0f));
+        m_spheres.assign(m_slots.size() * TREES_PER_CHUNK, emptySphere());
+        m_slotOf.clear();
+        m_changed.clear();
+
+        // nearest chunks are asked for first
+        m_offsets.clear();
+        for (int z = -radius; z <= radius; ++z)
+            for (int x = -radius; x <= radius; ++x)
+                m_offsets.push_back(glm::ivec2(x, z));
+        std::stable_sort(m_offsets.begin(), m_offsets.end(), [](const glm::ivec2 &a, const glm::ivec2 &b) {
+            return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y;
+        });
+    }
+
+    // Main thread, while no job reads transforms()/spheres(): commits up to commitsPerFrame generated chunks,
+    // drops the ones that fell behind and starts generating the missing ones.
+    void update(const glm::vec3 &eye) {
+        update(eye, m_commitsPerFrame);
+    }
+
+    // loads everything around `eye` before returning, for the first frame
+    void fill(const glm::vec3 &eye) {
+        update(eye, 0);
+        for (Slot &slot : m_slots) {
+            if (slot.state == LOADING)
+                JobSystem::instance().wait(slot.staging->generated);
+        }
+        update(eye, (unsigned int)m_slots.size());
+    }
+
+    // waits for the generation still running, before the chunks go away
+    void finish() {
+        for (Slot &slot : m_slots) {
+            if (slot.staging)
+                JobSystem::instance().wait(slot.staging->generated);
+        }
+    }
+
+    // indices into transforms()/spheres() of the loaded trees that touch the frustum, chunk boxes first
+    void cullIndices(const Frustum &frustum, std::vector<unsigned int> &visible, CullStats &stats) const {
+        visible.clear();
+        stats = CullStats();
+        for (unsigned int s = 0; s < m_slots.size(); ++s) {
+            const Slot &slot = m_slots[s];
+            if (slot.state != RESIDENT || slot.count == 0)
+                continue;
+            unsigned int first = s * TREES_PER_CHUNK;
+            Frustum::BoxResult result = frustum.classify(slot.boundsMin, slot.boundsMax);
+            if (result == Frustum::OUTSIDE) {
+                ++stats.cellsCulled;
+                stats.culled += slot.count;
+                continue;
+            }
+            ++stats.cellsVisible;
+            for (unsigned int i = first; i < first + slot.count; ++i) {
+                if (result == Frustum::INSIDE || frustum.intersects(m_spheres[i]))
+                    visible.push_back(i);
+                else
+                    ++stats.culled;
+            }
+        }
+        stats.visible = (unsigned int)visible.size();
+    }
+
+    // every loaded tree, for drawing without culling
+    void allIndices(std::vector<unsigned int> &visible, CullStats &stats) const {
+        visible.clear();
+        for (unsigned int s = 0; s < m_slots.size(); ++s) {
+            if (m_slots[s].state != RESIDENT)
+                continue;
+            for (unsigned int i = 0; i < m_slots[s].count; ++i)
+                visible.push_back(s * TREES_PER_CHUNK + i);
+        }
+        stats = CullStats();
+        stats.visible = (unsigned int)visible.size();
+    }
+
+    // slots whose instances changed since clearChanged(), [slot * TREES_PER_CHUNK, +TREES_PER_CHUNK) each;
+    // empty instances have a negative radius, so every frustum test rejects them
+    const std::vector<unsigned int> &changedSlots() const { return m_changed; }
+    void clearChanged() { m_changed.clear(); }
+
+    // instances of all slots, loaded or not, the arrays never reallocate after create()
+    unsigned int size() const { return (unsigned int)m_transforms.size(); }
+    const std::vector<glm::mat4> &transforms() const { return m_transforms; }
+    const std::vector<BoundingSphere> &spheres() const { return m_spheres; }
+
+    unsigned int residentChunks() const { return countSlots(RESIDENT); }
+    unsigned int loadingChunks() const { return countSlots(LOADING); }
+
+private:
+    enum SlotState { FREE, LOADING, RESIDENT };
+
+    // written by the generation job only, read once `generated` is done
+    struct Staging {
+        JobCounter generated;
+        InstanceStore store;
+        std::vector<glm::mat4> transforms;
+        std::vector<BoundingSphere> spheres;
+        unsigned int count = 0;
+    };
+
+    struct Slot {
+        SlotState state = FREE;
+        glm::ivec2 chunk = glm::ivec2(0);
+        unsigned int count = 0;
+        glm::vec3 boundsMin = glm::vec3(0.0f);
+        glm::vec3 boundsMax = glm::vec3(0.0f);
+        std::unique_ptr<Staging> staging;
+    };
+
+    static BoundingSphere emptySphere() {
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(0.0f);
+        sphere.radius = -1.0e9f;
+        return sphere;
+    }
+
+    static uint64_t key(const glm::ivec2 &chunk) {
+        return ((uint64_t)(uint32_t)chunk.x << 32) | (uint32_t)chunk.y;
+    }
+
+    static int chunkDistance(const glm::ivec2 &a, const glm::ivec2 &b) {
+        return std::max(std::abs(a.x - b.x), std::abs(a.y - b.y));
+    }
+
+    unsigned int countSlots(SlotState state) const {
+        unsigned int count = 0;
+        for (const Slot &slot : m_slots)
+            count += slot.state == state;
+        return count;
+    }
+
+    void update(const glm::vec3 &eye, unsigned int commits) {
+        glm::ivec2 center((int)std::floor(eye.x / CHUNK_SIZE), (int)std::floor(eye.z / CHUNK_SIZE));
+
+        for (unsigned int s = 0; s < m_slots.size(); ++s) {
+            Slot &slot = m_slots[s];
+            bool far = chunkDistance(slot.chunk, center) > m_radius + 1;
+            if (slot.state == LOADING && slot.staging->generated.done()) {
+                // a chunk left behind while it was generated is dropped without ever being committed
+                if (far)
+                    release(s);
+                else if (commits > 0) {
+                    commit(s);
+                    --commits;
+                }
+            }
+            else if (slot.state == RESIDENT && far) {
+                release(s);
+            }
+        }
+
+        for (const glm::ivec2 &offset : m_offsets) {
+            glm::ivec2 chunk = center + offset;
+            if (m_slotOf.count(key(chunk)))
+                continue;
+            unsigned int s = 0;
+            while (s < m_slots.size() && m_slots[s].state != FREE)
+                ++s;
+            if (s == m_slots.size())
+                return;
+            generate(s, chunk);
+        }
+    }
+
+    void generate(unsigned int s, const glm::ivec2 &chunk) {
+        Slot &slot = m_slots[s];
+        slot.state = LOADING;
+        slot.chunk = chunk;
+        m_slotOf[key(chunk)] = s;
+        Staging *staging = slot.staging.get();
+        uint32_t seed = m_seed;
+        glm::vec3 localMin = m_localMin, localMax = m_localMax;
+        const Heightfield *ground = m_ground;
+        JobSystem::instance().run(staging->generated, [staging, chunk, seed, ground, localMin, localMax]() {
+            placeChunkTrees(chunk.x, chunk.y, seed, staging->store, ground);
+            staging->count = (unsigned int)staging->store.size();
+            composeTransforms(staging->store, staging->transforms.data());
+            for (unsigned int i = 0; i < staging->count; ++i)
+                staging->spheres[i] = transformBounds(staging->transforms[i], localMin, localMax);
+        });
+    }
+
+    void commit(unsigned int s) {
+        Slot &slot = m_slots[s];
+        const Staging &staging = *slot.staging;
+        unsigned int first = s * TREES_PER_CHUNK;
+        slot.state = RESIDENT;
+        slot.count = staging.count;
+        slot.boundsMin = glm::vec3(INFINITY);
+        slot.boundsMax = glm::vec3(-INFINITY);
+        for (unsigned int i = 0; i < TREES_PER_CHUNK; ++i) {
+            if (i < staging.count) {
+                m_transforms[first + i] = staging.transforms[i];
+                m_spheres[first + i] = staging.spheres[i];
+                slot.boundsMin = glm::min(slot.boundsMin, staging.spheres[i].center - glm::vec3(staging.spheres[i].radius));
+                slot.boundsMax = glm::max(slot.boundsMax, staging.spheres[i].center + glm::vec3(staging.spheres[i].radius));
+            }
+            else {
+                m_transforms[first + i] = glm::mat4(0.0f);
+                m_spheres[first + i] = emptySphere();
+            }
+        }
+        m_changed.push_back(s);
+    }
+
+    void release(unsigned int s) {
+        Slot &slot = m_slots[s];
+        m_slotOf.erase(key(slot.chunk));
+        if (slot.state == RESIDENT) {
+            unsigned int first = s * TREES_PER_CHUNK;
+            std::fill(m_spheres.begin() + first, m_spheres.begin() + first + TREES_PER_CHUNK, emptySphere());
+            m_changed.push_back(s);
+        }
+        slot.state = FREE;
+        slot.count = 0;
+    }
+
+    int m_radius = 0;
+    uint32_t m_seed = 0;
+    // read by the generation jobs, it has no mutable state
+    const Heightfield *m_ground = nullptr;
+    glm::vec3 m_localMin = glm::vec3(0.0f);
+    glm::vec3 m_localMax = glm::vec3(0.0f);
+    unsigned int m_commitsPerFrame = 4;
+    std::vector<Slot> m_slots;
+    std::unordered_map<uint64_t, unsigned int> m_slotOf;
+    std::vector<glm::ivec2> m_offsets;
+    std::vector<glm::mat4> m_transforms;
+    std::vector<BoundingSphere> m_spheres;
+    std::vector<unsigned int> m_changed;
+};
+
+};
+#endif //PROJECT_BASE_FORESTCHUNKS_H
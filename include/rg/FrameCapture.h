@@ -0,0 +1,340 @@
+//
+// Frame capture for offline renders. The window's back buffer is read into one of CAPTURE_BUFFERS pixel pack
+// buffers and fenced; the buffer is only mapped when the ring comes back around to it, CAPTURE_BUFFERS - 1
+// frames later, when the GPU finished the copy long ago, so glReadPixels never stalls the frame. The pixels
+// are flipped and encoded on a thread of the capture's own, in order, either into a numbered PNG per frame
+// or as raw RGB down a pipe into ffmpeg.
+//
+//   project_base --benchmark --capture frames/           frames/frame_000000.png, ...
+//   project_base --benchmark --capture-video forest.mp4  ffmpeg encodes at 1 / the benchmark's timestep
+//
+
+#ifndef PROJECT_BASE_FRAMECAPTURE_H
+#define PROJECT_BASE_FRAMECAPTURE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rg {
+
+// frames between a readback and its map, one more than the frames the GPU may lag behind
+const unsigned int CAPTURE_BUFFERS = 3;
+// frames read back but not encoded yet, the frame loop waits on the encoder past that
+const size_t CAPTURE_QUEUE_LIMIT = 8;
+
+struct CaptureOptions {
+    // a PNG per frame into this directory, which has to exist
+    std::string directory;
+    // or one video, encoded by the ffmpeg on the PATH
+    std::string video;
+    float framerate = 60.0f;
+
+    bool enabled() const { return !directory.empty() || !video.empty(); }
+};
+
+// An uncompressed PNG of `height` rows of `width` RGB pixels, top row first. Deflate's stored blocks keep
+// the encoder tiny and fast, the files are about the size of the pixels; --capture-video is the compact one.
+inline bool writePng(const std::string &path, int width, int height, const std::vector<unsigned char> &rgb) {
+    static uint32_t crcTable[256];
+    static bool tableBuilt = false;
+    if (!tableBuilt) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+        tableBuilt = true;
+    }
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    auto put32 = [](std::vector<unsigned char> &out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((unsigned char)(value >> shift));
+    };
+    // chunks are written whole, the CRC runs over the type and the data
+    auto chunk = [&](const char *type, const std::vector<unsigned char> &data) {
+        std::vector<unsigned char> out;
+        put32(out, (uint32_t)data.size());
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        uint32_t crc = 0xffffffffu;
+        for (size_t i = 4; i < out.size(); ++i)
+            crc = crcTable[(crc ^ out[i]) & 0xff] ^ (crc >> 8);
+        put32(out, crc ^ 0xffffffffu);
+        return std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    };
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    bool written = std::fwrite(signature, 1, 8, file) == 8;
+    std::vector<unsigned char> header;
+    put32(header, (uint32_t)width);
+    put32(header, (uint32_t)height);
+    // 8 bit RGB, deflate, adaptive filtering, not interlaced
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    written = written && chunk("IHDR", header);
+
+    // every row starts with its filter type, 0 leaves it as it is
+    size_t rowSize = (size_t)width * 3;
+    std::vector<unsigned char> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+    }
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+        size_t length = std::min<size_t>(65535, raw.size() - offset);
+        zlib.push_back(offset + length >= raw.size() ? 1 : 0);
+        zlib.push_back((unsigned char)(length & 0xff));
+        zlib.push_back((unsigned char)(length >> 8));
+        zlib.push_back((unsigned char)(~length & 0xff));
+        zlib.push_back((unsigned char)((~length >> 8) & 0xff));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    uint32_t a = 1, b = 0;
+    for (unsigned char byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(zlib, (b << 16) | a);
+    written = written && chunk("IDAT", zlib);
+    written = written && chunk("IEND", {});
+    return std::fclose(file) == 0 && written;
+}
+
+class FrameCapture {
+public:
+    FrameCapture() = default;
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+    ~FrameCapture() { finish(); }
+
+    bool start(const CaptureOptions &options) {
+        if (!options.enabled())
+            return false;
+        m_options = options;
+        // an ffmpeg that quit fails the write instead of killing the process
+        if (!options.video.empty())
+            std::signal(SIGPIPE, SIG_IGN);
+        glGenBuffers(CAPTURE_BUFFERS, m_buffers);
+        m_running = true;
+        m_encoder = std::thread([this]() { encode(); });
+        return true;
+    }
+
+    bool active() const { return m_running; }
+
+    // reads the width x height back buffer of the window, after the frame is drawn and before it is swapped
+    void capture(int width, int height) {
+        if (!m_running || width <= 0 || height <= 0)
+            return;
+        Slot &slot = m_slots[m_next];
+        if (slot.fence)
+            collect(slot);
+        GLint savedFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glReadBuffer(GL_BACK);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[m_next]);
+        GLsizeiptr size = (GLsizeiptr)width * height * 4;
+        if (slot.capacity < size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            slot.capacity = size;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, savedFramebuffer);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.width = width;
+        slot.height = height;
+        slot.frame = m_captured++;
+        m_next = (m_next + 1) % CAPTURE_BUFFERS;
+    }
+
+    // collects the readbacks still in flight, waits for the encoder and closes the video
+    void finish() {
+        if (!m_running)
+            return;
+        for (unsigned int i = 0; i < CAPTURE_BUFFERS; ++i) {
+            Slot &slot = m_slots[(m_next + i) % CAPTURE_BUFFERS];
+            if (slot.fence)
+                collect(slot);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_changed.notify_all();
+        m_encoder.join();
+        if (m_pipe)
+            pclose(m_pipe);
+        m_pipe = nullptr;
+        glDeleteBuffers(CAPTURE_BUFFERS, m_buffers);
+        for (Slot &slot : m_slots)
+            slot = Slot();
+        std::cout << "FRAME_CAPTURE:: " << m_captured << " frames" << std::endl;
+    }
+
+private:
+    struct Slot {
+        GLsync fence = nullptr;
+        GLsizeiptr capacity = 0;
+        int width = 0, height = 0;
+        unsigned int frame = 0;
+    };
+
+    struct Frame {
+        std::vector<unsigned char> rgba;
+        int width, height;
+        unsigned int frame;
+    };
+
+    // maps the slot's buffer, which the GPU filled frames ago, and queues a copy of it for the encoder
+    void collect(Slot &slot) {
+        GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+
+        Frame frame;
+        frame.width = slot.width;
+        frame.height = slot.height;
+        frame.frame = slot.frame;
+        {
+            // a full queue holds the frame loop back, an offline render should not drop frames
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this]() { return m_queue.size() < CAPTURE_QUEUE_LIMIT; });
+            if (!m_spare.empty()) {
+                frame.rgba = std::move(m_spare.back());
+                m_spare.pop_back();
+            }
+        }
+        size_t size = (size_t)slot.width * slot.height * 4;
+        frame.rgba.resize(size);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[&slot - m_slots]);
+        if (void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)size, GL_MAP_READ_BIT)) {
+            std::copy((const unsigned char *)pixels, (const unsigned char *)pixels + size, frame.rgba.begin());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else {
+            std::cout << "ERROR::FRAME_CAPTURE:: cannot map frame " << slot.frame << std::endl;
+            frame.rgba.clear();
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back(std::move(frame));
+        }
+        m_changed.notify_all();
+    }
+
+    void encode() {
+        std::vector<unsigned char> rgb;
+        bool failed = false;
+        while (true) {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_changed.wait(lock, [this]() { return !m_queue.empty() || !m_running; });
+                if (m_queue.empty())
+                    return;
+                frame = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            m_changed.notify_all();
+            if (!frame.rgba.empty() && !failed) {
+                // GL's rows start at the bottom
+                rgb.resize((size_t)frame.width * frame.height * 3);
+                for (int y = 0; y < frame.height; ++y) {
+                    const unsigned char *source = &frame.rgba[(size_t)(frame.height - 1 - y) * frame.width * 4];
+                    unsigned char *target = &rgb[(size_t)y * frame.width * 3];
+                    for (int x = 0; x < frame.width; ++x, source += 4, target += 3) {
+                        target[0] = source[0];
+                        target[1] = source[1];
+                        target[2] = source[2];
+                    }
+                }
+                failed = !write(frame, rgb);
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_spare.push_back(std::move(frame.rgba));
+        }
+    }
+
+    // on the encoder thread, false stops the capture's output for good
+    bool write(const Frame &frame, const std::vector<unsigned char> &rgb) {
+        if (!m_options.directory.empty()) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%06u.png", frame.frame);
+            std::string path = m_options.directory + "/" + name;
+            if (!writePng(path, frame.width, frame.height, rgb)) {
+                std::cout << "ERROR::FRAME_CAPTURE:: cannot write " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+        // the video's size is the first frame's, ffmpeg can't take another one halfway through
+        if (!m_pipe) {
+            m_videoWidth = frame.width;
+            m_videoHeight = frame.height;
+            std::string command = "ffmpeg -loglevel error -y -f rawvideo -pixel_format rgb24 -video_size " +
+                                  std::to_string(frame.width) + "x" + std::to_string(frame.height) +
+                                  " -framerate " + std::to_string(m_options.framerate) +
+                                  " -i - -pix_fmt yuv420p \"" + m_options.video + "\"";
+            m_pipe = popen(command.c_str(), "w");
+            if (!m_pipe) {
+                std::cout << "ERROR::FRAME_CAPTURE:: cannot start " << command << std::endl;
+                return false;
+            }
+        }
+        if (frame.width != m_videoWidth || frame.height != m_videoHeight) {
+            std::cout << "ERROR::FRAME_CAPTURE:: frame " << frame.frame << " is " << frame.width << "x"
+                      << frame.height << ", the video " << m_videoWidth << "x" << m_videoHeight << ", skipped"
+                      << std::endl;
+            return true;
+        }
+        if (std::fwrite(rgb.data(), 1, rgb.size(), m_pipe) != rgb.size()) {
+            std::cout << "ERROR::FRAME_CAPTURE:: ffmpeg stopped taking frames" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    CaptureOptions m_options;
+    unsigned int m_buffers[CAPTURE_BUFFERS] = {};
+    Slot m_slots[CAPTURE_BUFFERS];
+    // the slot the next capture reads into
+    unsigned int m_next = 0;
+    unsigned int m_captured = 0;
+
+    std::thread m_encoder;
+    std::mutex m_mutex;
+    // signals both ways: frames queued for the encoder, and room in the queue for the frame loop
+    std::condition_variable m_changed;
+    std::deque<Frame> m_queue;
+    std::vector<std::vector<unsigned char>> m_spare;
+    bool m_running = false;
+
+    // encoder thread only
+    FILE *m_pipe = nullptr;
+    int m_videoWidth = 0, m_videoHeight = 0;
+};
+
+};
+#endif //PROJECT_BASE_FRAMECAPTURE_H
@@ -0,0 +1,60 @@
+//
+// Frame packets: everything the GL thread needs to draw one frame. The main thread simulates a frame (input,
+// camera, lights) into a packet, jobs prepare it (culling, levels of detail, shadow casters), and the GL thread
+// draws it while the next packet is being simulated and prepared. Two packets are enough for that overlap:
+// a packet is only reused once the frame drawn from it has been submitted.
+//
+
+#ifndef PROJECT_BASE_FRAMEPACKET_H
+#define PROJECT_BASE_FRAMEPACKET_H
+
+#include <glm/glm.hpp>
+
+#include <rg/ClusteredLights.h>
+#include <rg/Culling.h>
+#include <rg/Foliage.h>
+#include <rg/JobSystem.h>
+#include <rg/Lod.h>
+#include <rg/Shadows.h>
+#include <rg/UniformBlocks.h>
+
+#include <vector>
+
+namespace rg {
+
+const unsigned int FRAME_PACKETS = 2;
+
+struct FramePacket {
+    // simulation
+    unsigned int frame = 0;
+    float sceneTime = 0.0f;
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    DirLight dirLight = {};
+    SpotLight spotLight = {};
+    bool flashlightOn = false;
+    std::vector<PointLight> pointLights;
+    // the switches as they were when the frame was simulated, the overlay may change them while it is drawn
+    bool frustumCulling = true;
+    bool treeLods = true;
+    bool treeInstancing = true;
+    bool gpuCulling = false;
+    bool occlusionCulling = true;
+    bool shadows = true;
+    bool wind = true;
+    FoliageMode foliage = FOLIAGE_ALPHA_TEST;
+
+    // render prep, done once `prepared` has no jobs left
+    JobCounter prepared;
+    CullStats treeCullStats;
+    std::vector<unsigned int> visibleTrees;
+    LodBatches trees;
+    ShadowFrame shadowFrame;
+    std::vector<unsigned int> casterIndices[SHADOW_CASCADES];
+    std::vector<glm::mat4> casters[SHADOW_CASCADES];
+    ClusterFrame clusters;
+};
+
+};
+#endif //PROJECT_BASE_FRAMEPACKET_H
@@ -0,0 +1,157 @@
+//
+// Entry points and enums above the GL 3.3 core profile that glad was generated for.
+// They are loaded by hand after context creation and are only valid when the matching check says so.
+//
+
+#ifndef PROJECT_BASE_GLEXTENSIONS_H
+#define PROJECT_BASE_GLEXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// GL 4.0 / 4.2 / 4.3
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_ATOMIC_COUNTER_BUFFER
+#define GL_ATOMIC_COUNTER_BUFFER 0x92C0
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+// GL 4.3 / ARB_texture_buffer_range
+#ifndef GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT
+#define GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT 0x919F
+#endif
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_ATOMIC_COUNTER_BARRIER_BIT 0x00001000
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+namespace rg {
+namespace glext {
+
+typedef void (APIENTRYP PFN_DISPATCHCOMPUTE)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+typedef void (APIENTRYP PFN_MEMORYBARRIER)(GLbitfield barriers);
+typedef void (APIENTRYP PFN_MULTIDRAWELEMENTSINDIRECT)(GLenum mode, GLenum type, const void *indirect, GLsizei drawCount, GLsizei stride);
+typedef void (APIENTRYP PFN_GETPROGRAMBINARY)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFN_PROGRAMBINARY)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFN_PROGRAMPARAMETERI)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFN_TEXBUFFERRANGE)(GLenum target, GLenum internalFormat, GLuint buffer, GLintptr offset, GLsizeiptr size);
+typedef void (APIENTRYP PFN_BUFFERSTORAGE)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void (APIENTRYP PFN_BINDIMAGETEXTURE)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer,
+                                              GLenum access, GLenum format);
+
+inline PFN_DISPATCHCOMPUTE &dispatchComputePtr() { static PFN_DISPATCHCOMPUTE fn = nullptr; return fn; }
+inline PFN_MEMORYBARRIER &memoryBarrierPtr() { static PFN_MEMORYBARRIER fn = nullptr; return fn; }
+inline PFN_MULTIDRAWELEMENTSINDIRECT &multiDrawElementsIndirectPtr() { static PFN_MULTIDRAWELEMENTSINDIRECT fn = nullptr; return fn; }
+inline PFN_GETPROGRAMBINARY &getProgramBinaryPtr() { static PFN_GETPROGRAMBINARY fn = nullptr; return fn; }
+inline PFN_PROGRAMBINARY &programBinaryPtr() { static PFN_PROGRAMBINARY fn = nullptr; return fn; }
+inline PFN_PROGRAMPARAMETERI &programParameteriPtr() { static PFN_PROGRAMPARAMETERI fn = nullptr; return fn; }
+inline PFN_TEXBUFFERRANGE &texBufferRangePtr() { static PFN_TEXBUFFERRANGE fn = nullptr; return fn; }
+inline PFN_BUFFERSTORAGE &bufferStoragePtr() { static PFN_BUFFERSTORAGE fn = nullptr; return fn; }
+inline PFN_BINDIMAGETEXTURE &bindImageTexturePtr() { static PFN_BINDIMAGETEXTURE fn = nullptr; return fn; }
+
+// context version as major * 10 + minor, e.g. 43
+inline int &contextVersion() { static int version = 0; return version; }
+
+inline bool hasExtension(const char *name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// compute shaders, SSBOs, atomic counters and multi draw indirect
+inline bool supportsGpuCulling() {
+    return contextVersion() >= 43 && dispatchComputePtr() && memoryBarrierPtr() && multiDrawElementsIndirectPtr();
+}
+
+// linked programs can be saved and loaded back, which needs at least one binary format from the driver
+inline bool supportsProgramBinary() {
+    if (!getProgramBinaryPtr() || !programBinaryPtr() || !programParameteriPtr())
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// a buffer texture can show part of its buffer
+inline bool supportsTextureBufferRange() {
+    return texBufferRangePtr() != nullptr;
+}
+
+// immutable buffers that stay mapped while the GPU reads them
+inline bool supportsBufferStorage() {
+    return bufferStoragePtr() != nullptr;
+}
+
+// compute shaders that write texture levels through images, e.g. to build a depth pyramid
+inline bool supportsImageLoadStore() {
+    return supportsGpuCulling() && bindImageTexturePtr() != nullptr;
+}
+
+// call once, after gladLoadGLLoader, with the same loader
+inline void load(GLADloadproc loader) {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    contextVersion() = major * 10 + minor;
+
+    if (contextVersion() >= 43) {
+        dispatchComputePtr() = (PFN_DISPATCHCOMPUTE)loader("glDispatchCompute");
+        memoryBarrierPtr() = (PFN_MEMORYBARRIER)loader("glMemoryBarrier");
+        multiDrawElementsIndirectPtr() = (PFN_MULTIDRAWELEMENTSINDIRECT)loader("glMultiDrawElementsIndirect");
+        bindImageTexturePtr() = (PFN_BINDIMAGETEXTURE)loader("glBindImageTexture");
+    }
+    if (contextVersion() >= 41 || hasExtension("GL_ARB_get_program_binary")) {
+        getProgramBinaryPtr() = (PFN_GETPROGRAMBINARY)loader("glGetProgramBinary");
+        programBinaryPtr() = (PFN_PROGRAMBINARY)loader("glProgramBinary");
+        programParameteriPtr() = (PFN_PROGRAMPARAMETERI)loader("glProgramParameteri");
+    }
+    if (contextVersion() >= 43 || hasExtension("GL_ARB_texture_buffer_range"))
+        texBufferRangePtr() = (PFN_TEXBUFFERRANGE)loader("glTexBufferRange");
+    if (contextVersion() >= 44 || hasExtension("GL_ARB_buffer_storage"))
+        bufferStoragePtr() = (PFN_BUFFERSTORAGE)loader("glBufferStorage");
+}
+
+};
+};
+
+#define glDispatchCompute rg::glext::dispatchComputePtr()
+#define glMemoryBarrier rg::glext::memoryBarrierPtr()
+#define glMultiDrawElementsIndirect rg::glext::multiDrawElementsIndirectPtr()
+#define glGetProgramBinary rg::glext::getProgramBinaryPtr()
+#define glProgramBinary rg::glext::programBinaryPtr()
+#define glProgramParameteri rg::glext::programParameteriPtr()
+#define glTexBufferRange rg::glext::texBufferRangePtr()
+#define glBufferStorage rg::glext::bufferStoragePtr()
+#define glBindImageTexture rg::glext::bindImageTexturePtr()
+
+#endif //PROJECT_BASE_GLEXTENSIONS_H
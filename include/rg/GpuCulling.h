@@ -0,0 +1,300 @@
+//
+// GPU driven culling of tree instances: a compute pass picks the level of detail of the visible instances,
+// compacts them per level and fills the indirect draw commands, so the CPU never touches per-instance data.
+// Needs GL 4.3. Given the depth pyramid of the last frame it also drops the instances hidden behind it.
+//
+
+#ifndef PROJECT_BASE_GPUCULLING_H
+#define PROJECT_BASE_GPUCULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <common.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader_m.h>
+#include <rg/Culling.h>
+#include <rg/ComputeProgram.h>
+#include <rg/GLExtensions.h>
+#include <rg/HiZ.h>
+#include <rg/Impostor.h>
+#include <rg/Lod.h>
+#include <rg/RenderQueue.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// switch points tree_cull.comp takes at most, one less than its levels
+const unsigned int MAX_GPU_LOD_DISTANCES = 8;
+
+// layout of the commands consumed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+class GpuInstanceCuller {
+public:
+    // uploads the static instances and creates one draw command per mesh of `model` and level of `lods` but the
+    // last, which is the impostor's and gets a single command
+    bool init(const std::vector<glm::mat4> &transforms, const std::vector<BoundingSphere> &spheres, const Model &model,
+              const LodSelector &lods) {
+        if (lods.distances().size() > MAX_GPU_LOD_DISTANCES) {
+            std::cout << "ERROR::GPU_CULLING:: more than " << MAX_GPU_LOD_DISTANCES << " levels of detail" << std::endl;
+            return false;
+        }
+        m_cullProgram = compileComputeProgram("tree_cull.comp");
+        m_commandsProgram = compileComputeProgram("tree_cull_commands.comp");
+        if (!m_cullProgram || !m_commandsProgram)
+            return false;
+        m_planesLocation = glGetUniformLocation(m_cullProgram, "frustumPlanes");
+        m_instanceCountLocation = glGetUniformLocation(m_cullProgram, "instanceCount");
+        m_occlusionLocation = glGetUniformLocation(m_cullProgram, "occlusionCulling");
+        m_hizViewProjectionLocation = glGetUniformLocation(m_cullProgram, "hizViewProjection");
+        m_eyeLocation = glGetUniformLocation(m_cullProgram, "eye");
+        m_levelsOfDetailLocation = glGetUniformLocation(m_cullProgram, "levelsOfDetail");
+        m_levelCount = lods.levelCount();
+        glUseProgram(m_cullProgram);
+        glUniform1i(glGetUniformLocation(m_cullProgram, "hiz"), 0);
+        glUniform1fv(glGetUniformLocation(m_cullProgram, "lodDistances"), (GLsizei)lods.distances().size(), lods.distances().data());
+        glUniform1ui(glGetUniformLocation(m_cullProgram, "lodDistanceCount"), m_levelCount - 1);
+        glUniform1f(glGetUniformLocation(m_cullProgram, "lodHysteresis"), lods.hysteresis());
+        glUseProgram(0);
+        m_commandCountLocation = glGetUniformLocation(m_commandsProgram, "commandCount");
+        m_meshCountLocation = glGetUniformLocation(m_commandsProgram, "meshCount");
+
+        m_instanceCount = (unsigned int)transforms.size();
+        // std430 { mat4 transform; vec4 sphere; }
+        std::vector<glm::vec4> instances;
+        instances.reserve(m_instanceCount * 5);
+        for (unsigned int i = 0; i < m_instanceCount; ++i) {
+            for (int column = 0; column < 4; ++column)
+                instances.push_back(transforms[i][column]);
+            instances.push_back(glm::vec4(spheres[i].center, spheres[i].radius));
+        }
+        glGenBuffers(1, &m_instanceBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instanceBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(glm::vec4), instances.data(), GL_STATIC_DRAW);
+
+        // room for every instance in every level, level l starts at instance l * m_instanceCount
+        glGenBuffers(1, &m_visibleBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)m_levelCount * m_instanceCount * sizeof(glm::mat4), nullptr, GL_DYNAMIC_COPY);
+        std::vector<GLuint> levels(m_instanceCount, 0);
+        glGenBuffers(1, &m_levelBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_levelBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, levels.size() * sizeof(GLuint), levels.data(), GL_DYNAMIC_COPY);
+
+        // level by level, meshes without as many levels repeat their last one like Mesh::Submit does
+        std::vector<DrawElementsIndirectCommand> commands;
+        for (unsigned int level = 0; level + 1 < m_levelCount; ++level) {
+            for (const Mesh &mesh : model.meshes) {
+                const MeshLod &range = mesh.lods[std::min<size_t>(level, mesh.lods.size() - 1)];
+                DrawElementsIndirectCommand command = {};
+                command.count = range.indexCount;
+                command.firstIndex = mesh.firstIndex + range.firstIndex;
+                command.baseVertex = mesh.baseVertex;
+                commands.push_back(command);
+            }
+        }
+        DrawElementsIndirectCommand impostor = {};
+        impostor.count = Impostor::QUAD_INDEX_COUNT;
+        commands.push_back(impostor);
+        m_meshCount = (unsigned int)model.meshes.size();
+        m_commandCount = (unsigned int)commands.size();
+        glGenBuffers(1, &m_commandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        // the occluded count and the visible count of every level
+        m_counts.assign(1 + m_levelCount, 0);
+        glGenBuffers(1, &m_counterBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, countBytes(), m_counts.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        // the counts are copied aside every frame and fenced, stats() reads them once the GPU is past the copy
+        glGenBuffers(2, m_readbackBuffers);
+        for (unsigned int buffer : m_readbackBuffers) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, countBytes(), m_counts.data(), GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return true;
+    }
+
+    // replaces instances [first, first + count) with the same entries of `transforms` and `spheres`, for
+    // instance sets that stream in and out of fixed ranges
+    void updateInstances(unsigned int first, unsigned int count,
+                         const std::vector<glm::mat4> &transforms, const std::vector<BoundingSphere> &spheres) {
+        std::vector<glm::vec4> instances;
+        instances.reserve(count * 5);
+        for (unsigned int i = first; i < first + count; ++i) {
+            for (int column = 0; column < 4; ++column)
+                instances.push_back(transforms[i][column]);
+            instances.push_back(glm::vec4(spheres[i].center, spheres[i].radius));
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instanceBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * 5 * sizeof(glm::vec4), instances.size() * sizeof(glm::vec4), instances.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // buffer of compacted visible transforms, submit() attaches it to the meshes
+    unsigned int visibleBuffer() const { return m_visibleBuffer; }
+
+    // culls against `frustum`, and against `hiz` when it holds a pyramid, and sorts the survivors into levels
+    // by their distance to `eye`, or all into the first one without `levelsOfDetail`
+    void cull(const Frustum &frustum, const glm::vec3 &eye, bool levelsOfDetail, const HiZBuffer *hiz = nullptr) {
+        m_counts.assign(m_counts.size(), 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counterBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, countBytes(), m_counts.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_instanceBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visibleBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counterBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_levelBuffer);
+
+        glUseProgram(m_cullProgram);
+        glUniform4fv(m_planesLocation, 6, &frustum.planes[0][0]);
+        glUniform3fv(m_eyeLocation, 1, &eye[0]);
+        glUniform1i(m_levelsOfDetailLocation, levelsOfDetail ? 1 : 0);
+        glUniform1ui(m_instanceCountLocation, m_instanceCount);
+        bool occlusion = hiz && hiz->valid();
+        glUniform1i(m_occlusionLocation, occlusion ? 1 : 0);
+        if (occlusion) {
+            glUniformMatrix4fv(m_hizViewProjectionLocation, 1, GL_FALSE, &hiz->viewProjection()[0][0]);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, hiz->texture());
+        }
+        glDispatchCompute((m_instanceCount + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(m_commandsProgram);
+        glUniform1ui(m_commandCountLocation, m_commandCount);
+        glUniform1ui(m_meshCountLocation, m_meshCount);
+        glDispatchCompute(1, 1, 1);
+        // the counters are copied aside below and reset by the next cull, both see the atomics' writes
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        unsigned int readback = m_frame % 2;
+        glBindBuffer(GL_COPY_READ_BUFFER, m_counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffers[readback]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, countBytes());
+        // counts that were never read are simply replaced
+        if (m_readbackFences[readback])
+            glDeleteSync(m_readbackFences[readback]);
+        m_readbackFences[readback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (occlusion)
+            glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        ++m_frame;
+    }
+
+    // one indirect command per mesh and level, with the instance count written by the cull pass. Meshes of the
+    // same state (a packed model with a material array) go out as one multi draw per level
+    void draw(Shader &shader, Model &model) {
+        RenderQueue queue;
+        submit(queue, shader, model);
+        queue.flush();
+    }
+
+    // queues the indirect draws of every level but the impostors', the meshes read their transforms from
+    // their level's range of visibleBuffer()
+    void submit(RenderQueue &queue, Shader &shader, const Model &model) {
+        if (model.meshes.size() != m_meshCount)
+            return;
+        for (unsigned int level = 0; level + 1 < m_levelCount; ++level) {
+            for (unsigned int i = 0; i < m_meshCount; ++i) {
+                DrawItem item = model.meshes[i].MakeDrawItem(shader);
+                item.instanceBuffer = m_visibleBuffer;
+                item.firstInstance = level * m_instanceCount;
+                item.indirectBuffer = m_commandBuffer;
+                item.indirectOffset = (level * m_meshCount + i) * sizeof(DrawElementsIndirectCommand);
+                queue.submit(item);
+            }
+        }
+    }
+
+    // queues the indirect draw of the instances that landed in the last level, as impostors
+    void submitImpostors(RenderQueue &queue, Shader &shader, const Impostor &impostor) {
+        unsigned int level = m_levelCount - 1;
+        impostor.SubmitIndirect(queue, shader, m_commandBuffer, (m_commandCount - 1) * sizeof(DrawElementsIndirectCommand),
+                                m_visibleBuffer, level * m_instanceCount);
+    }
+
+    // counters of the cull one frame back, or the last ones read while the GPU still hasn't got past that copy
+    CullStats stats() {
+        unsigned int readback = m_frame % 2;
+        GLsync &fence = m_readbackFences[readback];
+        if (!fence || glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return m_stats;
+        glDeleteSync(fence);
+        fence = nullptr;
+        glBindBuffer(GL_COPY_READ_BUFFER, m_readbackBuffers[readback]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, countBytes(), m_counts.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        m_stats.occluded = m_counts[0];
+        m_stats.visible = 0;
+        for (unsigned int level = 0; level < m_levelCount; ++level)
+            m_stats.visible += m_counts[1 + level];
+        m_stats.culled = m_instanceCount - m_stats.visible - m_stats.occluded;
+        return m_stats;
+    }
+
+    void destroy() {
+        glDeleteBuffers(1, &m_instanceBuffer);
+        glDeleteBuffers(1, &m_visibleBuffer);
+        glDeleteBuffers(1, &m_levelBuffer);
+        glDeleteBuffers(1, &m_commandBuffer);
+        glDeleteBuffers(1, &m_counterBuffer);
+        glDeleteBuffers(2, m_readbackBuffers);
+        for (GLsync &fence : m_readbackFences) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        glDeleteProgram(m_cullProgram);
+        glDeleteProgram(m_commandsProgram);
+    }
+
+private:
+    size_t countBytes() const { return m_counts.size() * sizeof(GLuint); }
+
+    unsigned int m_cullProgram = 0;
+    unsigned int m_commandsProgram = 0;
+    GLint m_planesLocation = -1;
+    GLint m_instanceCountLocation = -1;
+    GLint m_commandCountLocation = -1;
+    GLint m_occlusionLocation = -1;
+    GLint m_hizViewProjectionLocation = -1;
+    GLint m_eyeLocation = -1;
+    GLint m_levelsOfDetailLocation = -1;
+    GLint m_meshCountLocation = -1;
+    unsigned int m_instanceBuffer = 0;
+    unsigned int m_visibleBuffer = 0;
+    unsigned int m_levelBuffer = 0;
+    unsigned int m_commandBuffer = 0;
+    unsigned int m_counterBuffer = 0;
+    unsigned int m_readbackBuffers[2] = {0, 0};
+    GLsync m_readbackFences[2] = {nullptr, nullptr};
+    CullStats m_stats;
+    // scratch for resetting and reading back the counts
+    std::vector<GLuint> m_counts;
+    unsigned int m_instanceCount = 0;
+    unsigned int m_levelCount = 1;
+    unsigned int m_meshCount = 0;
+    unsigned int m_commandCount = 0;
+    unsigned int m_frame = 0;
+};
+
+};
+#endif //PROJECT_BASE_GPUCULLING_H
@@ -0,0 +1,48 @@
+//
+// Content hashing for the on-disk caches (meshes, program binaries), and integer hashing for procedural placement.
+//
+
+#ifndef PROJECT_BASE_HASH_H
+#define PROJECT_BASE_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace rg {
+
+// 64 bit FNV-1a
+inline uint64_t hashBytes(const unsigned char *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hashString(const std::string &text, uint64_t hash = 14695981039346656037ull) {
+    return hashBytes((const unsigned char *)text.data(), text.size(), hash);
+}
+
+// 32 bit integer mix (the murmur3 finalizer), every input bit flips each output bit about half the time
+inline uint32_t hashMix(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x85ebca6bu;
+    value ^= value >> 13;
+    value *= 0xc2b2ae35u;
+    value ^= value >> 16;
+    return value;
+}
+
+// hash of a pair of grid coordinates under `seed`, the same on every run and platform
+inline uint32_t hashCoords(int x, int z, uint32_t seed) {
+    return hashMix(hashMix(hashMix(seed) ^ (uint32_t)x) ^ (uint32_t)z);
+}
+
+// [0, 1) from the top 24 bits of a hash
+inline float hashToUnit(uint32_t hash) {
+    return (hash >> 8) * (1.0f / 16777216.0f);
+}
+
+};
+#endif //PROJECT_BASE_HASH_H
@@ -0,0 +1,160 @@
+//
+// Hierarchical depth (Hi-Z) of the last frame for occlusion culling on the GPU. The scene's depth is copied
+// out after the frame is drawn, with all its samples, and reduced into a fixed size pyramid whose every texel
+// keeps the farthest depth of the samples it covers: a pixel the alpha-to-coverage foliage only partly
+// covers stays as far as the gap in its leaves. A bounding box projected over a few texels of the right
+// level can be tested with four fetches. Its projection is the one the depth was drawn with: instances are tested where
+// they were on screen last frame, and one that the camera uncovers shows up a frame late.
+//
+
+#ifndef PROJECT_BASE_HIZ_H
+#define PROJECT_BASE_HIZ_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <rg/ComputeProgram.h>
+#include <rg/GLExtensions.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace rg {
+
+// size of level 0, independent of the window and the dynamic resolution so the pyramid is allocated once
+const int HIZ_WIDTH = 512;
+const int HIZ_HEIGHT = 256;
+// down to 1x1
+const int HIZ_LEVELS = 10;
+
+class HiZBuffer {
+public:
+    bool create() {
+        m_reduceProgram = compileComputeProgram("hiz_reduce.comp");
+        if (!m_reduceProgram)
+            return false;
+        m_levelLocation = glGetUniformLocation(m_reduceProgram, "level");
+        m_sourceSizeLocation = glGetUniformLocation(m_reduceProgram, "sourceSize");
+        m_targetSizeLocation = glGetUniformLocation(m_reduceProgram, "targetSize");
+        glUseProgram(m_reduceProgram);
+        m_sampleCountLocation = glGetUniformLocation(m_reduceProgram, "sampleCount");
+        glUniform1i(glGetUniformLocation(m_reduceProgram, "sourceDepth"), 0);
+        glUniform1i(glGetUniformLocation(m_reduceProgram, "sourceDepthSamples"), 1);
+        glUseProgram(0);
+
+        glGenTextures(1, &m_pyramid);
+        glBindTexture(GL_TEXTURE_2D, m_pyramid);
+        for (int level = 0; level < HIZ_LEVELS; ++level)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelWidth(level), levelHeight(level), 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, HIZ_LEVELS - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &m_depthFbo);
+        return true;
+    }
+
+    // Copies the depth of the lower left width x height of `framebuffer`, which is in GL_DEPTH_COMPONENT24 with
+    // `samples` samples (0 when not multisampled) like the scene target and was drawn with `viewProjection`,
+    // and reduces it into the pyramid.
+    void build(unsigned int framebuffer, int width, int height, int samples, const glm::mat4 &viewProjection) {
+        if (!m_reduceProgram || width <= 0 || height <= 0)
+            return;
+        GLint savedFramebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        // The copy has the source's samples, a blit between the two copies them as they are; resolving to one
+        // sample would keep an arbitrary one of them. Its size is kept for the largest frame so far.
+        GLenum target = samples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+        if (width > m_depthWidth || height > m_depthHeight || samples != m_depthSamples) {
+            m_depthWidth = std::max(width, m_depthWidth);
+            m_depthHeight = std::max(height, m_depthHeight);
+            m_depthSamples = samples;
+            if (m_depth)
+                glDeleteTextures(1, &m_depth);
+            glGenTextures(1, &m_depth);
+            glBindTexture(target, m_depth);
+            if (samples > 0) {
+                glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, GL_DEPTH_COMPONENT24, m_depthWidth,
+                                        m_depthHeight, GL_TRUE);
+            }
+            else {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, m_depthWidth, m_depthHeight, 0, GL_DEPTH_COMPONENT,
+                             GL_UNSIGNED_INT, nullptr);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            }
+            glBindTexture(target, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, m_depthFbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, m_depth, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::HIZ:: depth copy framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFbo);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+
+        glUseProgram(m_reduceProgram);
+        glUniform1i(m_sampleCountLocation, samples);
+        glActiveTexture(samples > 0 ? GL_TEXTURE1 : GL_TEXTURE0);
+        glBindTexture(target, m_depth);
+        int sourceWidth = width, sourceHeight = height;
+        for (int level = 0; level < HIZ_LEVELS; ++level) {
+            if (level > 0)
+                glBindImageTexture(0, m_pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, m_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glUniform1i(m_levelLocation, level);
+            glUniform2i(m_sourceSizeLocation, sourceWidth, sourceHeight);
+            glUniform2i(m_targetSizeLocation, levelWidth(level), levelHeight(level));
+            glDispatchCompute((levelWidth(level) + 7) / 8, (levelHeight(level) + 7) / 8, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            sourceWidth = levelWidth(level);
+            sourceHeight = levelHeight(level);
+        }
+        // the cull pass fetches the levels as a texture
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        glBindTexture(target, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glUseProgram(0);
+        m_viewProjection = viewProjection;
+        m_valid = true;
+    }
+
+    // the pyramid holds nothing until the next build(), e.g. after the culling was switched off for a while
+    void invalidate() { m_valid = false; }
+    bool valid() const { return m_valid; }
+
+    unsigned int texture() const { return m_pyramid; }
+    const glm::mat4 &viewProjection() const { return m_viewProjection; }
+
+    void destroy() {
+        glDeleteTextures(1, &m_pyramid);
+        glDeleteTextures(1, &m_depth);
+        glDeleteFramebuffers(1, &m_depthFbo);
+        glDeleteProgram(m_reduceProgram);
+        m_pyramid = m_depth = m_depthFbo = m_reduceProgram = 0;
+        m_depthWidth = m_depthHeight = m_depthSamples = 0;
+        m_valid = false;
+    }
+
+private:
+    static int levelWidth(int level) { return std::max(HIZ_WIDTH >> level, 1); }
+    static int levelHeight(int level) { return std::max(HIZ_HEIGHT >> level, 1); }
+
+    unsigned int m_reduceProgram = 0;
+    GLint m_levelLocation = -1;
+    GLint m_sourceSizeLocation = -1;
+    GLint m_targetSizeLocation = -1;
+    GLint m_sampleCountLocation = -1;
+    unsigned int m_pyramid = 0;
+    // the copy of the scene's depth
+    unsigned int m_depth = 0, m_depthFbo = 0;
+    int m_depthWidth = 0, m_depthHeight = 0, m_depthSamples = 0;
+    glm::mat4 m_viewProjection = glm::mat4(1.0f);
+    bool m_valid = false;
+};
+
+};
+#endif //PROJECT_BASE_HIZ_H
@@ -0,0 +1,202 @@
+//
+// Camera facing billboards standing in for a model far away. The model is rendered from a ring of
+// directions into an atlas once at startup; each instance then shows the view closest to its angle.
+//
+
+#ifndef PROJECT_BASE_IMPOSTOR_H
+#define PROJECT_BASE_IMPOSTOR_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader_m.h>
+#include <rg/RenderQueue.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace rg {
+
+class Impostor {
+public:
+    // indices of the quad, for indirect draws that need an indexed command
+    static const unsigned int QUAD_INDEX_COUNT = 4;
+
+    // renders `frameCount` views of `model` around its up axis into tiles of tileSize x tileSize
+    bool bake(Model &model, unsigned int frameCount = 8, unsigned int tileSize = 256) {
+        m_frameCount = frameCount;
+
+        glm::vec3 extent = model.boundsMax - model.boundsMin;
+        m_center = glm::vec2(model.boundsMin.x + extent.x * 0.5f, model.boundsMin.z + extent.z * 0.5f);
+        float radius = 0.5f * glm::length(glm::vec2(extent.x, extent.z));
+        // a square frame that fits the model from every direction
+        m_size = std::max(2.0f * radius, extent.y);
+        m_bottom = model.boundsMin.y;
+
+        glGenTextures(1, &m_atlas);
+        glBindTexture(GL_TEXTURE_2D, m_atlas);
+        // sRGB storage keeps the precision of the dark bark tones, the bake writes linear albedo
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, tileSize * frameCount, tileSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        unsigned int fbo, depth;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_atlas, 0);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, tileSize * frameCount, tileSize);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (complete) {
+            GLint viewport[4];
+            GLfloat clearColor[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+            Shader bakeShader("resources/shaders/impostor_bake.vs", "resources/shaders/impostor_bake.fs");
+            bakeShader.use();
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_FRAMEBUFFER_SRGB);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            float distance = radius + 1.0f;
+            glm::mat4 projection = glm::ortho(-0.5f * m_size, 0.5f * m_size, m_bottom, m_bottom + m_size, 0.01f, 2.0f * distance);
+            for (unsigned int frame = 0; frame < frameCount; ++frame) {
+                // frame k looks at the model from angle k * 2pi / frameCount around +y, measured from +z
+                float angle = frame * glm::two_pi<float>() / frameCount;
+                glm::vec3 target(m_center.x, 0.0f, m_center.y);
+                glm::vec3 eye = target + glm::vec3(std::sin(angle), 0.0f, std::cos(angle)) * distance;
+                glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+                bakeShader.setMat4("viewProjection", projection * view);
+                glViewport(frame * tileSize, 0, tileSize, tileSize);
+                model.Draw(bakeShader);
+            }
+            glDisable(GL_FRAMEBUFFER_SRGB);
+            glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            glDeleteProgram(bakeShader.ID);
+        }
+        else {
+            std::cout << "ERROR::IMPOSTOR:: bake framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteRenderbuffers(1, &depth);
+        glDeleteFramebuffers(1, &fbo);
+        glBindTexture(GL_TEXTURE_2D, m_atlas);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        createQuad();
+        return complete;
+    }
+
+    // instance transforms are read the same way the model's meshes read them
+    void SetInstanceBuffer(unsigned int instanceVBO, unsigned int firstInstance = 0) {
+        glBindVertexArray(m_quadVAO);
+        attachInstanceBuffer(instanceVBO, firstInstance, INSTANCE_MATRIX_LOCATION);
+        glBindVertexArray(0);
+    }
+
+    // the uniforms describing the atlas, they are program state and only need setting once after bake()
+    void SetUniforms(Shader &shader) {
+        shader.use();
+        shader.setFloat("impostorSize", m_size);
+        shader.setFloat("impostorBottom", m_bottom);
+        shader.setVec2("impostorCenter", m_center);
+        shader.setInt("frameCount", (int)m_frameCount);
+        shader.setInt("impostorAtlas", 0);
+    }
+
+    // expects impostor.vs/fs
+    void DrawInstanced(Shader &shader, unsigned int count) {
+        SetUniforms(shader);
+        RenderQueue queue;
+        Submit(queue, shader, count);
+        queue.flush();
+    }
+
+    // queues `count` impostors, the shader needs SetUniforms() once beforehand
+    void Submit(RenderQueue &queue, Shader &shader, unsigned int count, unsigned int instanceVBO = 0,
+                unsigned int firstInstance = 0) {
+        DrawItem item;
+        item.shader = &shader;
+        item.vertexArray = m_quadVAO;
+        item.addTexture(GL_TEXTURE_2D, m_atlas);
+        item.mode = GL_TRIANGLE_STRIP;
+        item.count = 4;
+        item.instanceCount = count;
+        item.instanceBuffer = instanceVBO;
+        item.firstInstance = firstInstance;
+        item.instanceLocation = INSTANCE_MATRIX_LOCATION;
+        queue.submit(item);
+    }
+
+    // queues the impostors of the indexed indirect command at `indirectOffset`, which draws the QUAD_INDEX_COUNT
+    // indices from 0 and gets its instance count from the GPU
+    void SubmitIndirect(RenderQueue &queue, Shader &shader, unsigned int indirectBuffer, size_t indirectOffset,
+                        unsigned int instanceVBO, unsigned int firstInstance = 0) const {
+        DrawItem item;
+        item.shader = &shader;
+        item.vertexArray = m_quadVAO;
+        item.addTexture(GL_TEXTURE_2D, m_atlas);
+        item.mode = GL_TRIANGLE_STRIP;
+        item.indexType = GL_UNSIGNED_SHORT;
+        item.count = QUAD_INDEX_COUNT;
+        item.instanceBuffer = instanceVBO;
+        item.firstInstance = firstInstance;
+        item.instanceLocation = INSTANCE_MATRIX_LOCATION;
+        item.indirectBuffer = indirectBuffer;
+        item.indirectOffset = indirectOffset;
+        queue.submit(item);
+    }
+
+    void destroy() {
+        glDeleteTextures(1, &m_atlas);
+        glDeleteVertexArrays(1, &m_quadVAO);
+        glDeleteBuffers(1, &m_quadVBO);
+        glDeleteBuffers(1, &m_quadEBO);
+    }
+
+private:
+    void createQuad() {
+        float corners[] = {
+                -1.0f, 0.0f,
+                 1.0f, 0.0f,
+                -1.0f, 1.0f,
+                 1.0f, 1.0f
+        };
+        unsigned short indices[QUAD_INDEX_COUNT] = {0, 1, 2, 3};
+        glGenVertexArrays(1, &m_quadVAO);
+        glGenBuffers(1, &m_quadVBO);
+        glGenBuffers(1, &m_quadEBO);
+        glBindVertexArray(m_quadVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+        glBindVertexArray(0);
+    }
+
+    unsigned int m_atlas = 0;
+    unsigned int m_quadVAO = 0;
+    unsigned int m_quadVBO = 0;
+    unsigned int m_quadEBO = 0;
+    unsigned int m_frameCount = 8;
+    float m_size = 1.0f;
+    float m_bottom = 0.0f;
+    glm::vec2 m_center = glm::vec2(0.0f);
+};
+
+};
+#endif //PROJECT_BASE_IMPOSTOR_H
@@ -0,0 +1,237 @@
+//
+// Structure of arrays store of instance placements (position, yaw, uniform scale) and a batch kernel
+// composing their translate * rotateY * scale matrices. The kernel has SSE, AVX and NEON versions working
+// on 4 or 8 instances at once and a scalar fallback, picked once at runtime by what the CPU supports.
+//
+
+#ifndef PROJECT_BASE_INSTANCETRANSFORMS_H
+#define PROJECT_BASE_INSTANCETRANSFORMS_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RG_TRANSFORMS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define RG_TRANSFORMS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace rg {
+
+// the yaw is kept as its cosine and sine, which is all the matrix needs, so the kernel does no trigonometry
+struct InstanceStore {
+    std::vector<float> x, y, z;
+    std::vector<float> cosYaw, sinYaw;
+    std::vector<float> scale;
+
+    size_t size() const { return x.size(); }
+
+    // keeps the capacity, stores refilled over and over don't allocate
+    void clear() {
+        for (std::vector<float> *array : {&x, &y, &z, &cosYaw, &sinYaw, &scale})
+            array->clear();
+    }
+
+    void reserve(size_t count) {
+        for (std::vector<float> *array : {&x, &y, &z, &cosYaw, &sinYaw, &scale})
+            array->reserve(count);
+    }
+
+    // yaw in radians around +y
+    void add(const glm::vec3 &position, float yaw, float uniformScale) {
+        x.push_back(position.x);
+        y.push_back(position.y);
+        z.push_back(position.z);
+        cosYaw.push_back(std::cos(yaw));
+        sinYaw.push_back(std::sin(yaw));
+        scale.push_back(uniformScale);
+    }
+
+    void setYaw(size_t instance, float yaw) {
+        cosYaw[instance] = std::cos(yaw);
+        sinYaw[instance] = std::sin(yaw);
+    }
+};
+
+namespace transforms {
+
+// matrices [begin, end) of `store` into out[0, end - begin)
+typedef void (*ComposeFunction)(const InstanceStore &store, size_t begin, size_t end, glm::mat4 *out);
+
+// the same matrix glm::scale(glm::rotate(glm::translate(I, p), yaw, y), vec3(s)) builds
+inline void composeScalar(const InstanceStore &store, size_t begin, size_t end, glm::mat4 *out) {
+    for (size_t i = begin; i < end; ++i, ++out) {
+        float s = store.scale[i];
+        float cs = store.cosYaw[i] * s, ss = store.sinYaw[i] * s;
+        (*out)[0] = glm::vec4(cs, 0.0f, -ss, 0.0f);
+        (*out)[1] = glm::vec4(0.0f, s, 0.0f, 0.0f);
+        (*out)[2] = glm::vec4(ss, 0.0f, cs, 0.0f);
+        (*out)[3] = glm::vec4(store.x[i], store.y[i], store.z[i], 1.0f);
+    }
+}
+
+#if RG_TRANSFORMS_X86
+// one matrix from its columns
+inline void storeMatrix(float *out, __m128 c0, __m128 c1, __m128 c2, __m128 c3) {
+    _mm_storeu_ps(out, c0);
+    _mm_storeu_ps(out + 4, c1);
+    _mm_storeu_ps(out + 8, c2);
+    _mm_storeu_ps(out + 12, c3);
+}
+
+// 4 instances per step, lane k of every register belongs to instance k until the shuffles pair them up.
+// SIMD stores may alias anything, so the loop works on local copies of every pointer and counter. The
+// outputs are plain stores: the culling and the bounds read the matrices right back. Every matrix is stored
+// as soon as its columns are shuffled, sixteen live columns would spill to the stack
+inline void composeSse(const InstanceStore &store, size_t begin, size_t end, glm::mat4 *out) {
+    float *matrices = &out[0][0][0];
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const float *xs = store.x.data(), *ys = store.y.data(), *zs = store.z.data();
+    const float *cosYaw = store.cosYaw.data(), *sinYaw = store.sinYaw.data(), *scale = store.scale.data();
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4, matrices += 64) {
+        __m128 s = _mm_loadu_ps(scale + i);
+        __m128 cs = _mm_mul_ps(_mm_loadu_ps(cosYaw + i), s);
+        __m128 ss = _mm_mul_ps(_mm_loadu_ps(sinYaw + i), s);
+        __m128 nss = _mm_sub_ps(zero, ss);
+        // (v0, 0, v1, 0) and (v2, 0, v3, 0)
+        __m128 cs01 = _mm_unpacklo_ps(cs, zero), cs23 = _mm_unpackhi_ps(cs, zero);
+        __m128 ss01 = _mm_unpacklo_ps(ss, zero), ss23 = _mm_unpackhi_ps(ss, zero);
+        __m128 nss01 = _mm_unpacklo_ps(nss, zero), nss23 = _mm_unpackhi_ps(nss, zero);
+        __m128 s01 = _mm_unpacklo_ps(zero, s), s23 = _mm_unpackhi_ps(zero, s);
+        __m128 x = _mm_loadu_ps(xs + i), y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i), w = one;
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        // columns (cs, 0, -ss, 0), (0, s, 0, 0), (ss, 0, cs, 0) and the translation, one instance at a time
+        storeMatrix(matrices, _mm_movelh_ps(cs01, nss01), _mm_movelh_ps(s01, zero), _mm_movelh_ps(ss01, cs01), x);
+        storeMatrix(matrices + 16, _mm_movehl_ps(nss01, cs01), _mm_movehl_ps(zero, s01), _mm_movehl_ps(cs01, ss01), y);
+        storeMatrix(matrices + 32, _mm_movelh_ps(cs23, nss23), _mm_movelh_ps(s23, zero), _mm_movelh_ps(ss23, cs23), z);
+        storeMatrix(matrices + 48, _mm_movehl_ps(nss23, cs23), _mm_movehl_ps(zero, s23), _mm_movehl_ps(cs23, ss23), w);
+    }
+    composeScalar(store, i, end, out + (i - begin));
+}
+
+// the matrices of instance k (low halves) and k + 4 (high halves), out points at instance k's
+__attribute__((target("avx")))
+inline void storeMatrixPair(float *out, __m256 c0, __m256 c1, __m256 c2, __m256 c3) {
+    _mm256_storeu_ps(out, _mm256_permute2f128_ps(c0, c1, 0x20));
+    _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(c2, c3, 0x20));
+    _mm256_storeu_ps(out + 64, _mm256_permute2f128_ps(c0, c1, 0x31));
+    _mm256_storeu_ps(out + 72, _mm256_permute2f128_ps(c2, c3, 0x31));
+}
+
+// 8 instances per step, the same shuffles as the SSE version run on both 128 bit halves: the low half of a
+// column register belongs to instance k, the high half to instance k + 4. Outputs that aren't 32 byte aligned
+// (a std::vector's usually aren't) go through the SSE version instead, every other 32 byte store would
+// split a cache line and make the loop slower than SSE
+__attribute__((target("avx")))
+inline void composeAvx(const InstanceStore &store, size_t begin, size_t end, glm::mat4 *out) {
+    if ((uintptr_t)out & 31) {
+        composeSse(store, begin, end, out);
+        return;
+    }
+    float *matrices = &out[0][0][0];
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const float *xs = store.x.data(), *ys = store.y.data(), *zs = store.z.data();
+    const float *cosYaw = store.cosYaw.data(), *sinYaw = store.sinYaw.data(), *scale = store.scale.data();
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8, matrices += 128) {
+        __m256 s = _mm256_loadu_ps(scale + i);
+        __m256 cs = _mm256_mul_ps(_mm256_loadu_ps(cosYaw + i), s);
+        __m256 ss = _mm256_mul_ps(_mm256_loadu_ps(sinYaw + i), s);
+        __m256 nss = _mm256_sub_ps(zero, ss);
+        __m256 cs01 = _mm256_unpacklo_ps(cs, zero), cs23 = _mm256_unpackhi_ps(cs, zero);
+        __m256 ss01 = _mm256_unpacklo_ps(ss, zero), ss23 = _mm256_unpackhi_ps(ss, zero);
+        __m256 nss01 = _mm256_unpacklo_ps(nss, zero), nss23 = _mm256_unpackhi_ps(nss, zero);
+        __m256 s01 = _mm256_unpacklo_ps(zero, s), s23 = _mm256_unpackhi_ps(zero, s);
+        __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i);
+        __m256 z = _mm256_loadu_ps(zs + i);
+        __m256 xy01 = _mm256_unpacklo_ps(x, y), xy23 = _mm256_unpackhi_ps(x, y);
+        __m256 zw01 = _mm256_unpacklo_ps(z, one), zw23 = _mm256_unpackhi_ps(z, one);
+
+        const int low = _MM_SHUFFLE(1, 0, 1, 0), high = _MM_SHUFFLE(3, 2, 3, 2);
+        storeMatrixPair(matrices, _mm256_shuffle_ps(cs01, nss01, low), _mm256_shuffle_ps(s01, zero, low),
+                        _mm256_shuffle_ps(ss01, cs01, low), _mm256_shuffle_ps(xy01, zw01, low));
+        storeMatrixPair(matrices + 16, _mm256_shuffle_ps(cs01, nss01, high), _mm256_shuffle_ps(s01, zero, high),
+                        _mm256_shuffle_ps(ss01, cs01, high), _mm256_shuffle_ps(xy01, zw01, high));
+        storeMatrixPair(matrices + 32, _mm256_shuffle_ps(cs23, nss23, low), _mm256_shuffle_ps(s23, zero, low),
+                        _mm256_shuffle_ps(ss23, cs23, low), _mm256_shuffle_ps(xy23, zw23, low));
+        storeMatrixPair(matrices + 48, _mm256_shuffle_ps(cs23, nss23, high), _mm256_shuffle_ps(s23, zero, high),
+                        _mm256_shuffle_ps(ss23, cs23, high), _mm256_shuffle_ps(xy23, zw23, high));
+    }
+    composeScalar(store, i, end, out + (i - begin));
+}
+#endif
+
+#if RG_TRANSFORMS_NEON
+inline void composeNeon(const InstanceStore &store, size_t begin, size_t end, glm::mat4 *out) {
+    const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+    const float *xs = store.x.data(), *ys = store.y.data(), *zs = store.z.data();
+    const float *cosYaw = store.cosYaw.data(), *sinYaw = store.sinYaw.data(), *scale = store.scale.data();
+    float *matrices = &out[0][0][0];
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4, matrices += 64) {
+        float32x4_t s = vld1q_f32(scale + i);
+        float32x4_t cs = vmulq_f32(vld1q_f32(cosYaw + i), s);
+        float32x4_t ss = vmulq_f32(vld1q_f32(sinYaw + i), s);
+        // column j of the 4 instances, transposed to one instance per register below
+        float32x4_t rows[4][4] = {
+                {cs, zero, vnegq_f32(ss), zero},
+                {zero, s, zero, zero},
+                {ss, zero, cs, zero},
+                {vld1q_f32(xs + i), vld1q_f32(ys + i), vld1q_f32(zs + i), one},
+        };
+        for (int column = 0; column < 4; ++column) {
+            const float32x4_t *r = rows[column];
+            float32x4x2_t t01 = vtrnq_f32(r[0], r[1]), t23 = vtrnq_f32(r[2], r[3]);
+            vst1q_f32(matrices + column * 4, vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+            vst1q_f32(matrices + 16 + column * 4, vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+            vst1q_f32(matrices + 32 + column * 4, vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+            vst1q_f32(matrices + 48 + column * 4, vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+        }
+    }
+    composeScalar(store, i, end, out + (i - begin));
+}
+#endif
+
+struct Kernel {
+    const char *name;
+    ComposeFunction compose;
+};
+
+// the widest version the CPU runs, the same one on every run on the same machine
+inline Kernel detect() {
+#if RG_TRANSFORMS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+        return {"avx", composeAvx};
+    // x86-64 always has SSE2
+    return {"sse", composeSse};
+#elif RG_TRANSFORMS_NEON
+    return {"neon", composeNeon};
+#else
+    return {"scalar", composeScalar};
+#endif
+}
+
+inline const Kernel &selected() {
+    static const Kernel kernel = detect();
+    return kernel;
+}
+
+};
+
+// all matrices of `store` into `out`
+inline void composeTransforms(const InstanceStore &store, glm::mat4 *out) {
+    transforms::selected().compose(store, 0, store.size(), out);
+}
+
+};
+#endif //PROJECT_BASE_INSTANCETRANSFORMS_H
@@ -0,0 +1,187 @@
+//
+// Work stealing job system. Every worker owns a deque: it pushes and pops jobs at the back and, once it runs
+// dry, steals from the front of the others'. Jobs are tracked by counters; waiting on one runs other jobs
+// in the meantime and only sleeps once there are none left to run, so jobs may start and wait for jobs of
+// their own.
+//
+
+#ifndef PROJECT_BASE_JOBSYSTEM_H
+#define PROJECT_BASE_JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rg {
+
+// jobs started against a counter that haven't finished yet
+class JobCounter {
+public:
+    bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<unsigned int> m_pending{0};
+};
+
+class JobSystem {
+public:
+    static JobSystem &instance() {
+        static JobSystem system;
+        return system;
+    }
+
+    // 0 picks one worker per hardware thread beside the calling one
+    void start(unsigned int workers = 0) {
+        if (!m_threads.empty())
+            return;
+        if (workers == 0)
+            workers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        m_running = true;
+        // queue 0 belongs to the thread that started the system
+        for (unsigned int i = 0; i <= workers; ++i)
+            m_queues.emplace_back(new Queue());
+        for (unsigned int i = 1; i <= workers; ++i)
+            m_threads.emplace_back([this, i]() { work(i); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_running = false;
+        }
+        m_wake.notify_all();
+        for (std::thread &thread : m_threads)
+            thread.join();
+        m_threads.clear();
+        m_queues.clear();
+    }
+
+    unsigned int workerCount() const { return (unsigned int)m_threads.size(); }
+
+    // queues `job` on the calling thread's deque, runs it inline when the system was never started
+    void run(JobCounter &counter, std::function<void()> job) {
+        if (m_queues.empty()) {
+            job();
+            return;
+        }
+        counter.m_pending.fetch_add(1, std::memory_order_relaxed);
+        Queue &queue = *m_queues[currentQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(Job{std::move(job), &counter});
+        }
+        m_queued.fetch_add(1, std::memory_order_release);
+        // taken so a worker can't miss the wake up between checking for work and going to sleep
+        { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+        m_wake.notify_one();
+    }
+
+    // function(begin, end) over [0, count) in chunks of at most `grain`
+    void parallelFor(JobCounter &counter, unsigned int count, unsigned int grain,
+                     const std::function<void(unsigned int, unsigned int)> &function) {
+        grain = std::max(grain, 1u);
+        for (unsigned int begin = 0; begin < count; begin += grain) {
+            unsigned int end = std::min(count, begin + grain);
+            run(counter, [function, begin, end]() { function(begin, end); });
+        }
+    }
+
+    // runs queued jobs until everything started against `counter` has finished, sleeping while the last of
+    // them still run elsewhere and nothing else is queued
+    void wait(JobCounter &counter) {
+        while (!counter.done()) {
+            if (runOne(currentQueue()))
+                continue;
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_wake.wait(lock, [this, &counter]() {
+                return counter.done() || m_queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+    ~JobSystem() { stop(); }
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobCounter *counter;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    JobSystem() = default;
+
+    // index of the worker running this thread, threads outside the pool share queue 0
+    static unsigned int &threadQueue() {
+        static thread_local unsigned int index = 0;
+        return index;
+    }
+
+    unsigned int currentQueue() const { return threadQueue(); }
+
+    // own work first, newest first while it is still in cache, then the oldest job of someone else
+    bool runOne(unsigned int self) {
+        Job job;
+        bool found = false;
+        {
+            Queue &own = *m_queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                found = true;
+            }
+        }
+        for (size_t i = 1; !found && i < m_queues.size(); ++i) {
+            Queue &victim = *m_queues[(self + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                found = true;
+            }
+        }
+        if (!found)
+            return false;
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        job.function();
+        // the last job of a counter wakes whoever waits on it, taking the mutex like run() does
+        if (job.counter->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+            m_wake.notify_all();
+        }
+        return true;
+    }
+
+    void work(unsigned int index) {
+        threadQueue() = index;
+        while (true) {
+            if (runOne(index))
+                continue;
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_wake.wait(lock, [this]() { return !m_running || m_queued.load(std::memory_order_acquire) > 0; });
+            if (!m_running)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<int> m_queued{0};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_running = false;
+};
+
+};
+#endif //PROJECT_BASE_JOBSYSTEM_H
@@ -0,0 +1,201 @@
+//
+// Minimal KTX 1.1 container for block compressed 2D textures with a full mip chain.
+// Written by tools/texture_compressor.cpp, read by the TextureLoader, so it has no GL dependency.
+// The converter stamps every file with the source image it was built from, in a key/value entry.
+//
+
+#ifndef PROJECT_BASE_KTX_H
+#define PROJECT_BASE_KTX_H
+
+#include <rg/MappedFile.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// GL enums of the formats the converter produces (EXT_texture_compression_s3tc, RGTC is core since 3.0)
+enum KtxFormat : uint32_t {
+    KTX_BC1_RGB = 0x83F0,   // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    KTX_BC3_RGBA = 0x83F3,  // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    KTX_BC5_RG = 0x8DBD,    // GL_COMPRESSED_RG_RGTC2
+};
+
+const uint32_t KTX_BASE_RG = 0x8227;
+const uint32_t KTX_BASE_RGB = 0x1907;
+const uint32_t KTX_BASE_RGBA = 0x1908;
+
+// file next to `path` that is preferred over it while its stamp matches `path`, see ktxMatchesSource
+inline std::string compressedTexturePath(const std::string &path) {
+    return path + ".ktx";
+}
+
+inline unsigned int ktxBlockSize(uint32_t format) {
+    return format == KTX_BC1_RGB ? 8 : 16;
+}
+
+struct KtxLevel {
+    uint32_t width;
+    uint32_t height;
+    size_t offset;
+    size_t size;
+};
+
+struct KtxImage {
+    uint32_t internalFormat = 0;
+    uint32_t baseFormat = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // every level back to back, each starting on a 4 byte boundary
+    std::vector<unsigned char> data;
+    std::vector<KtxLevel> levels;
+    // the source image, written when `stamped`. Read back with the byte offset of its mtime in the file
+    bool stamped = false;
+    SourceStamp source;
+    size_t sourceMtimeOffset = 0;
+
+    void addLevel(uint32_t levelWidth, uint32_t levelHeight, const unsigned char *blocks, size_t size) {
+        data.resize((data.size() + 3) & ~size_t(3));
+        levels.push_back({levelWidth, levelHeight, data.size(), size});
+        data.insert(data.end(), blocks, blocks + size);
+    }
+};
+
+const unsigned char KTX_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+
+// key of the source stamp, its value is the mtime, size and hash of the source as three uint64_t
+const char KTX_SOURCE_STAMP_KEY[] = "rgSourceStamp";
+const size_t KTX_SOURCE_STAMP_SIZE = 3 * sizeof(uint64_t);
+
+struct KtxHeader {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+// accepts only what the converter writes: one compressed 2D face, same endianness as the reader
+inline bool readKtx(const std::string &path, KtxImage &image) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    KtxHeader header;
+    if (!in.read((char *)&header, sizeof(header)) ||
+        std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 ||
+        header.endianness != KTX_ENDIANNESS || header.glType != 0 || header.pixelDepth > 1 ||
+        header.numberOfArrayElements > 0 || header.numberOfFaces != 1 || header.numberOfMipmapLevels == 0)
+        return false;
+
+    image = KtxImage();
+    // pairs of a uint32_t size, the key with its terminator and the value, padded to 4 bytes
+    std::vector<unsigned char> keyValues(header.bytesOfKeyValueData);
+    if (!in.read((char *)keyValues.data(), keyValues.size()))
+        return false;
+    for (size_t pair = 0; pair + sizeof(uint32_t) <= keyValues.size();) {
+        uint32_t pairSize;
+        std::memcpy(&pairSize, keyValues.data() + pair, sizeof(pairSize));
+        size_t key = pair + sizeof(pairSize);
+        if (pairSize > keyValues.size() - key)
+            break;
+        if (pairSize == sizeof(KTX_SOURCE_STAMP_KEY) + KTX_SOURCE_STAMP_SIZE &&
+            std::memcmp(keyValues.data() + key, KTX_SOURCE_STAMP_KEY, sizeof(KTX_SOURCE_STAMP_KEY)) == 0) {
+            size_t value = key + sizeof(KTX_SOURCE_STAMP_KEY);
+            std::memcpy(&image.source.mtime, keyValues.data() + value, sizeof(uint64_t));
+            std::memcpy(&image.source.size, keyValues.data() + value + 8, sizeof(uint64_t));
+            std::memcpy(&image.source.hash, keyValues.data() + value + 16, sizeof(uint64_t));
+            image.sourceMtimeOffset = sizeof(KtxHeader) + value;
+            image.stamped = true;
+        }
+        pair = key + ((pairSize + 3) & ~3u);
+    }
+
+
+    image.internalFormat = header.glInternalFormat;
+    image.baseFormat = header.glBaseInternalFormat;
+    image.width = header.pixelWidth;
+    image.height = header.pixelHeight;
+    std::vector<unsigned char> level;
+    for (uint32_t i = 0; i < header.numberOfMipmapLevels; ++i) {
+        uint32_t imageSize;
+        if (!in.read((char *)&imageSize, sizeof(imageSize)))
+            return false;
+        level.resize(imageSize);
+        if (!in.read((char *)level.data(), imageSize))
+            return false;
+        in.seekg((4 - imageSize % 4) % 4, std::ios::cur);
+        uint32_t levelWidth = std::max(1u, image.width >> i);
+        uint32_t levelHeight = std::max(1u, image.height >> i);
+        image.addLevel(levelWidth, levelHeight, level.data(), imageSize);
+    }
+    return true;
+}
+
+inline bool writeKtx(const std::string &path, const KtxImage &image) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+    KtxHeader header = {};
+    std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = KTX_ENDIANNESS;
+    header.glTypeSize = 1;
+    header.glInternalFormat = image.internalFormat;
+    header.glBaseInternalFormat = image.baseFormat;
+    header.pixelWidth = image.width;
+    header.pixelHeight = image.height;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = (uint32_t)image.levels.size();
+    const uint32_t stampSize = (uint32_t)(sizeof(KTX_SOURCE_STAMP_KEY) + KTX_SOURCE_STAMP_SIZE);
+    if (image.stamped)
+        header.bytesOfKeyValueData = sizeof(stampSize) + ((stampSize + 3) & ~3u);
+    out.write((const char *)&header, sizeof(header));
+    const char padding[4] = {0, 0, 0, 0};
+    if (image.stamped) {
+        const uint64_t stamp[3] = {image.source.mtime, image.source.size, image.source.hash};
+        out.write((const char *)&stampSize, sizeof(stampSize));
+        out.write(KTX_SOURCE_STAMP_KEY, sizeof(KTX_SOURCE_STAMP_KEY));
+        out.write((const char *)stamp, sizeof(stamp));
+        out.write(padding, (4 - stampSize % 4) % 4);
+    }
+    for (const KtxLevel &level : image.levels) {
+        uint32_t imageSize = (uint32_t)level.size;
+        out.write((const char *)&imageSize, sizeof(imageSize));
+        out.write((const char *)image.data.data() + level.offset, level.size);
+        out.write(padding, (4 - imageSize % 4) % 4);
+    }
+    return (bool)out;
+}
+
+// Whether the KTX read from `ktxPath` was built from the source image as it is now. An unchanged mtime and size
+// are trusted as is, otherwise the source is hashed, and a touched but identical one gets its new mtime
+// written into the stamp. Files without a stamp are stale; a missing source has nothing to be stale against.
+inline bool ktxMatchesSource(const std::string &ktxPath, const KtxImage &image, const std::string &sourcePath) {
+    SourceStamp source;
+    if (!SourceStamp::stat(sourcePath, source))
+        return true;
+    if (!image.stamped)
+        return false;
+    if (image.source.mtime == source.mtime && image.source.size == source.size)
+        return true;
+    if (image.source.size != source.size || image.source.hash != SourceStamp::hashFile(sourcePath))
+        return false;
+    SourceStamp::restamp(ktxPath, image.sourceMtimeOffset, source.mtime);
+    return true;
+}
+
+};
+#endif //PROJECT_BASE_KTX_H
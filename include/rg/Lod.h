@@ -0,0 +1,82 @@
+//
+// Per-instance level of detail selection by camera distance.
+//
+
+#ifndef PROJECT_BASE_LOD_H
+#define PROJECT_BASE_LOD_H
+
+#include <glm/glm.hpp>
+#include <rg/Culling.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+// visible instances grouped by level: level i occupies transforms[first[i], first[i] + count[i])
+struct LodBatches {
+    std::vector<glm::mat4> transforms;
+    std::vector<unsigned int> first;
+    std::vector<unsigned int> count;
+};
+
+class LodSelector {
+public:
+    // distances[i] is where level i ends, everything past the last distance uses level distances.size().
+    // an instance only changes level once it is `hysteresis` (a fraction of the distance) past the switch
+    // point, so trees standing right at a boundary don't flicker between two levels.
+    LodSelector(std::vector<float> distances, float hysteresis = 0.1f)
+            : m_distances(distances), m_hysteresis(hysteresis) {}
+
+    unsigned int levelCount() const { return (unsigned int)m_distances.size() + 1; }
+
+    // the switch points and their hysteresis, for selecting the same levels on the GPU
+    const std::vector<float> &distances() const { return m_distances; }
+    float hysteresis() const { return m_hysteresis; }
+
+    // sorts the visible instances of `grid` into per-level batches, remembering each instance's level
+    void select(const glm::vec3 &eye, const InstanceGrid &grid, const std::vector<unsigned int> &visible, LodBatches &batches) {
+        select(eye, grid.spheres(), grid.transforms(), visible, batches);
+    }
+
+    // same for any instance set indexed like `spheres` and `transforms`, with indices that stay put between frames
+    void select(const glm::vec3 &eye, const std::vector<BoundingSphere> &spheres, const std::vector<glm::mat4> &transforms,
+                const std::vector<unsigned int> &visible, LodBatches &batches) {
+        m_levels.resize(spheres.size(), 0);
+        m_visibleLevels.resize(visible.size());
+        batches.count.assign(levelCount(), 0);
+        batches.first.assign(levelCount(), 0);
+
+        for (size_t v = 0; v < visible.size(); ++v) {
+            unsigned int instance = visible[v];
+            float distance = glm::length(spheres[instance].center - eye);
+            uint8_t level = m_levels[instance];
+            // move out while the instance is past the far end of its level, and back in while it's before the near end
+            while (level < m_distances.size() && distance > m_distances[level] * (1.0f + m_hysteresis))
+                ++level;
+            while (level > 0 && distance < m_distances[level - 1] * (1.0f - m_hysteresis))
+                --level;
+            m_levels[instance] = level;
+            m_visibleLevels[v] = level;
+            ++batches.count[level];
+        }
+        for (unsigned int level = 1; level < levelCount(); ++level)
+            batches.first[level] = batches.first[level - 1] + batches.count[level - 1];
+
+        batches.transforms.resize(visible.size());
+        m_cursor = batches.first;
+        for (size_t v = 0; v < visible.size(); ++v)
+            batches.transforms[m_cursor[m_visibleLevels[v]]++] = transforms[visible[v]];
+    }
+
+private:
+    std::vector<float> m_distances;
+    float m_hysteresis;
+    // last level of every instance of the grid
+    std::vector<uint8_t> m_levels;
+    std::vector<uint8_t> m_visibleLevels;
+    std::vector<unsigned int> m_cursor;
+};
+
+};
+#endif //PROJECT_BASE_LOD_H
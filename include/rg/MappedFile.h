@@ -0,0 +1,96 @@
+//
+// Read-only memory mappings of whole files and the identity of a source file, which the binary caches built
+// from assets are stamped with to notice when they went stale.
+//
+
+#ifndef PROJECT_BASE_MAPPEDFILE_H
+#define PROJECT_BASE_MAPPEDFILE_H
+
+#include <rg/Hash.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace rg {
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                m_data = (const unsigned char *)mapping;
+                m_size = (size_t)info.st_size;
+            }
+        }
+        ::close(fd);
+        return m_data != nullptr;
+    }
+
+    void close() {
+        if (m_data)
+            munmap((void *)m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const unsigned char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// identity of the source asset the cache was built from
+struct SourceStamp {
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+
+    static bool stat(const std::string &path, SourceStamp &stamp) {
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0)
+            return false;
+        stamp.mtime = (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+        stamp.size = (uint64_t)info.st_size;
+        return true;
+    }
+
+    static uint64_t hashFile(const std::string &path) {
+        MappedFile file;
+        if (!file.open(path))
+            return 0;
+        return hashBytes(file.data(), file.size());
+    }
+
+    // Writes `mtime` over the stamp at byte `offset` of the file built from the source, for sources that were
+    // touched but hashed the same: the next check trusts the mtime again instead of hashing the whole source.
+    static bool restamp(const std::string &stampedPath, size_t offset, uint64_t mtime) {
+        FILE *file = std::fopen(stampedPath.c_str(), "r+b");
+        if (!file)
+            return false;
+        bool written = std::fseek(file, (long)offset, SEEK_SET) == 0 && std::fwrite(&mtime, sizeof(mtime), 1, file) == 1;
+        return std::fclose(file) == 0 && written;
+    }
+};
+
+};
+#endif //PROJECT_BASE_MAPPEDFILE_H
@@ -0,0 +1,187 @@
+//
+// Material textures resampled into the layers of one texture array, so draws of different materials bind the
+// same texture and pick their layer from a vertex attribute instead. The sources are copied in on the GPU
+// once they finished streaming, until then their layers stay grey like the loader's placeholders. The layers
+// take the size of the largest source streamed in so far, only smaller sources are resampled.
+//
+
+#ifndef PROJECT_BASE_MATERIALARRAY_H
+#define PROJECT_BASE_MATERIALARRAY_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/shader_m.h>
+#include <rg/TextureLoader.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace rg {
+
+class MaterialArray {
+public:
+    // registers a texture made by the TextureLoader and returns its layer, the same texture added twice
+    // shares one
+    unsigned int add(unsigned int texture, bool clamp = false) {
+        for (unsigned int i = 0; i < m_layers.size(); ++i)
+            if (m_layers[i].texture == texture && m_layers[i].clamp == clamp)
+                return i;
+        m_layers.push_back({texture, clamp, false});
+        m_dirty = true;
+        return (unsigned int)m_layers.size() - 1;
+    }
+
+    // whether the layer's texture was clamped instead of repeated, which the shader has to emulate
+    bool clamped(unsigned int layer) const { return layer < m_layers.size() && m_layers[layer].clamp; }
+
+    unsigned int layerCount() const { return (unsigned int)m_layers.size(); }
+
+    // whether every source is copied in. From then on the sources can be released, as long as no layer is
+    // added and the array not cleared anymore, which would copy them in again
+    bool complete() const {
+        for (const Layer &layer : m_layers)
+            if (!layer.copied)
+                return false;
+        return !m_dirty;
+    }
+
+    void clear() {
+        m_layers.clear();
+        m_dirty = true;
+    }
+
+    // (re)allocates the array for the layers added so far, they are copied in again by update()
+    void build() {
+        if (!m_copyShader) {
+            glGenVertexArrays(1, &m_copyVao);
+            glGenFramebuffers(1, &m_copyFbo);
+            m_copyShader = new Shader("resources/shaders/static_batch_copy.vs", "resources/shaders/static_batch_copy.fs");
+            m_copyShader->use();
+            m_copyShader->setInt("source", 0);
+        }
+        if (m_array)
+            glDeleteTextures(1, &m_array);
+        glGenTextures(1, &m_array);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_array);
+        GLsizei layers = m_layers.empty() ? 1 : (GLsizei)m_layers.size();
+        std::vector<unsigned char> grey((size_t)m_width * m_height * 4 * layers, 128);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, m_width, m_height, layers, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, grey.data());
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (Layer &layer : m_layers)
+            layer.copied = false;
+        m_dirty = false;
+    }
+
+    // copies the textures that finished streaming into their layers, cheap once all of them are in. A source
+    // larger than the layers grows them first, which copies the sources already in again
+    void update() {
+        GLint width = m_width, height = m_height;
+        for (const Layer &layer : m_layers) {
+            if (layer.copied || TextureLoader::instance().residentBytes(layer.texture) == 0)
+                continue;
+            GLint sourceWidth = 0, sourceHeight = 0;
+            glBindTexture(GL_TEXTURE_2D, layer.texture);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &sourceWidth);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &sourceHeight);
+            width = std::max(width, sourceWidth);
+            height = std::max(height, sourceHeight);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (width != m_width || height != m_height) {
+            m_width = width;
+            m_height = height;
+            m_dirty = true;
+        }
+        if (m_dirty)
+            build();
+        bool copied = false;
+        for (unsigned int i = 0; i < m_layers.size(); ++i) {
+            Layer &layer = m_layers[i];
+            if (layer.copied || TextureLoader::instance().residentBytes(layer.texture) == 0)
+                continue;
+            if (!copied)
+                beginCopy();
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_array, 0, i);
+            glBindTexture(GL_TEXTURE_2D, layer.texture);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            layer.copied = true;
+            copied = true;
+        }
+        if (copied)
+            endCopy();
+    }
+
+    // the array texture, allocated first if layers were added since
+    unsigned int texture() {
+        if (m_dirty)
+            build();
+        return m_array;
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &m_copyVao);
+        glDeleteFramebuffers(1, &m_copyFbo);
+        glDeleteTextures(1, &m_array);
+        if (m_copyShader) {
+            glDeleteProgram(m_copyShader->ID);
+            delete m_copyShader;
+        }
+        m_copyVao = m_copyFbo = m_array = 0;
+        m_copyShader = nullptr;
+        m_dirty = true;
+    }
+
+private:
+    struct Layer {
+        unsigned int texture;
+        bool clamp;
+        bool copied;
+    };
+
+    void beginCopy() {
+        glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+        m_savedDepthTest = glIsEnabled(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_copyFbo);
+        glViewport(0, 0, m_width, m_height);
+        glDisable(GL_DEPTH_TEST);
+        // sRGB sources are linearized by the fetch and encoded again on the write into the sRGB layer
+        glEnable(GL_FRAMEBUFFER_SRGB);
+        m_copyShader->use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(m_copyVao);
+    }
+
+    void endCopy() {
+        glBindVertexArray(0);
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_savedFramebuffer);
+        glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+        if (m_savedDepthTest)
+            glEnable(GL_DEPTH_TEST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_array);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // the layers stay this small until the first source streams in
+    GLint m_width = 4, m_height = 4;
+    std::vector<Layer> m_layers;
+    bool m_dirty = true;
+
+    unsigned int m_array = 0;
+    unsigned int m_copyVao = 0, m_copyFbo = 0;
+    Shader *m_copyShader = nullptr;
+    GLint m_savedViewport[4];
+    GLint m_savedFramebuffer = 0;
+    GLboolean m_savedDepthTest = GL_FALSE;
+};
+
+};
+#endif //PROJECT_BASE_MATERIALARRAY_H
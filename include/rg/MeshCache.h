@@ -0,0 +1,283 @@
+//
+// Binary cache of imported meshes, stored next to the source asset as <asset>.meshcache.
+// The file holds the final Vertex/index arrays, LOD ranges and texture references of every mesh and is
+// memory mapped on load, so vertex and index data go from the page cache straight into glBufferData.
+// It is stamped with the source and the material libraries an .obj names, an edit to any of them rebuilds it.
+//
+
+#ifndef PROJECT_BASE_MESHCACHE_H
+#define PROJECT_BASE_MESHCACHE_H
+
+#include <learnopengl/mesh.h>
+#include <rg/MappedFile.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// bump whenever the layout below or the Vertex struct changes
+const uint32_t MESH_CACHE_VERSION = 3;
+const char MESH_CACHE_MAGIC[4] = {'F', 'S', 'M', 'C'};
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexSize;
+    uint32_t meshCount;
+    uint64_t sourceMtime;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    // files the import read besides the source, each a path (a string like the texture paths) and a stamp
+    uint32_t dependencyCount;
+    uint32_t padding;
+};
+
+struct MeshCacheDependencyStamp {
+    uint64_t mtime;
+    uint64_t size;
+    uint64_t hash;
+};
+
+// the material libraries (mtllib lines) of an .obj, relative to its folder like Assimp resolves them.
+// Other formats keep their materials inside the source.
+inline std::vector<std::string> meshCacheDependencies(const std::string &sourcePath) {
+    std::vector<std::string> dependencies;
+    size_t extension = sourcePath.find_last_of('.');
+    if (extension == std::string::npos || sourcePath.compare(extension, std::string::npos, ".obj") != 0)
+        return dependencies;
+    std::string directory = sourcePath.substr(0, sourcePath.find_last_of('/') + 1);
+    std::ifstream in(sourcePath);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 7, "mtllib ") != 0)
+            continue;
+        size_t start = 7;
+        while ((start = line.find_first_not_of(" \t\r", start)) != std::string::npos) {
+            size_t end = line.find_first_of(" \t\r", start);
+            dependencies.push_back(directory + line.substr(start, end - start));
+            start = end;
+        }
+    }
+    return dependencies;
+}
+
+struct MeshCacheRecord {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t lodCount;
+    uint32_t textureCount;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshCacheTexture {
+    std::string type;
+    std::string path;
+};
+
+// one mesh of a mapped cache file, vertices and indices point into the mapping
+struct MeshCacheEntry {
+    const Vertex *vertices;
+    uint32_t vertexCount;
+    const unsigned int *indices;
+    uint32_t indexCount;
+    std::vector<MeshLod> lods;
+    std::vector<MeshCacheTexture> textures;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+class MeshCacheReader {
+public:
+    // maps the cache and checks it against the source and its dependencies: an unchanged mtime and size is
+    // trusted as is, otherwise the file is hashed so a touched but identical asset still hits the cache, and is
+    // restamped
+    bool open(const std::string &cachePath, const std::string &sourcePath) {
+        m_meshes.clear();
+        if (!m_file.open(cachePath))
+            return false;
+
+        const unsigned char *cursor = m_file.data();
+        const unsigned char *end = cursor + m_file.size();
+        MeshCacheHeader header;
+        if (!read(cursor, end, &header, sizeof(header)))
+            return invalid();
+        if (std::memcmp(header.magic, MESH_CACHE_MAGIC, 4) != 0 || header.version != MESH_CACHE_VERSION ||
+            header.vertexSize != sizeof(Vertex))
+            return invalid();
+        MeshCacheDependencyStamp sourceStamp = {header.sourceMtime, header.sourceSize, header.sourceHash};
+        if (!matches(sourcePath, sourceStamp, cachePath, offsetof(MeshCacheHeader, sourceMtime)))
+            return invalid();
+        for (uint32_t d = 0; d < header.dependencyCount; ++d) {
+            std::string path;
+            MeshCacheDependencyStamp stamp;
+            if (!readString(cursor, end, path))
+                return invalid();
+            size_t offset = (size_t)(cursor - m_file.data()) + offsetof(MeshCacheDependencyStamp, mtime);
+            if (!read(cursor, end, &stamp, sizeof(stamp)) || !matches(path, stamp, cachePath, offset))
+                return invalid();
+        }
+
+        for (uint32_t m = 0; m < header.meshCount; ++m) {
+            MeshCacheRecord record;
+            if (!read(cursor, end, &record, sizeof(record)))
+                return invalid();
+            MeshCacheEntry entry;
+            entry.vertexCount = record.vertexCount;
+            entry.indexCount = record.indexCount;
+            entry.boundsMin = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+            entry.boundsMax = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+            entry.lods.resize(record.lodCount);
+            if (record.lodCount && !read(cursor, end, entry.lods.data(), record.lodCount * sizeof(MeshLod)))
+                return invalid();
+            for (uint32_t t = 0; t < record.textureCount; ++t) {
+                MeshCacheTexture texture;
+                if (!readString(cursor, end, texture.type) || !readString(cursor, end, texture.path))
+                    return invalid();
+                entry.textures.push_back(texture);
+            }
+            entry.vertices = (const Vertex *)cursor;
+            if (!skip(cursor, end, (size_t)record.vertexCount * sizeof(Vertex)))
+                return invalid();
+            entry.indices = (const unsigned int *)cursor;
+            if (!skip(cursor, end, (size_t)record.indexCount * sizeof(unsigned int)))
+                return invalid();
+            m_meshes.push_back(entry);
+        }
+        return true;
+    }
+
+    // valid as long as the reader is alive
+    const std::vector<MeshCacheEntry> &meshes() const { return m_meshes; }
+
+    void close() {
+        m_meshes.clear();
+        m_file.close();
+    }
+
+private:
+    bool invalid() {
+        m_meshes.clear();
+        m_file.close();
+        return false;
+    }
+    // whether `path` is still the file `stamp` was taken of, restamping the mtime at `offset` of the cache
+    static bool matches(const std::string &path, const MeshCacheDependencyStamp &stamp, const std::string &cachePath,
+                        size_t offset) {
+        SourceStamp current;
+        if (!SourceStamp::stat(path, current))
+            return false;
+        if (stamp.mtime == current.mtime && stamp.size == current.size)
+            return true;
+        if (stamp.size != current.size || stamp.hash != SourceStamp::hashFile(path))
+            return false;
+        SourceStamp::restamp(cachePath, offset, current.mtime);
+        return true;
+    }
+    static bool read(const unsigned char *&cursor, const unsigned char *end, void *out, size_t size) {
+        if ((size_t)(end - cursor) < size)
+            return false;
+        std::memcpy(out, cursor, size);
+        cursor += size;
+        return true;
+    }
+    static bool skip(const unsigned char *&cursor, const unsigned char *end, size_t size) {
+        if ((size_t)(end - cursor) < size)
+            return false;
+        cursor += size;
+        return true;
+    }
+    // length prefixed, padded to 4 bytes so the following arrays stay aligned
+    static bool readString(const unsigned char *&cursor, const unsigned char *end, std::string &out) {
+        uint32_t length;
+        if (!read(cursor, end, &length, sizeof(length)) || (size_t)(end - cursor) < length)
+            return false;
+        out.assign((const char *)cursor, length);
+        return skip(cursor, end, (length + 3u) & ~3u);
+    }
+
+    MappedFile m_file;
+    std::vector<MeshCacheEntry> m_meshes;
+};
+
+// writes the CPU data of `meshes` (which must still hold it) to cachePath, stamped with the identity of the source
+// and of its meshCacheDependencies
+inline bool writeMeshCache(const std::string &cachePath, const std::string &sourcePath, const std::vector<Mesh> &meshes) {
+    SourceStamp source;
+    if (!SourceStamp::stat(sourcePath, source))
+        return false;
+    source.hash = SourceStamp::hashFile(sourcePath);
+    // a library the import couldn't read isn't stamped, it only gets picked up with the next edit of the source
+    std::vector<std::string> dependencies;
+    std::vector<MeshCacheDependencyStamp> dependencyStamps;
+    for (const std::string &path : meshCacheDependencies(sourcePath)) {
+        SourceStamp stamp;
+        if (!SourceStamp::stat(path, stamp))
+            continue;
+        dependencies.push_back(path);
+        dependencyStamps.push_back({stamp.mtime, stamp.size, SourceStamp::hashFile(path)});
+    }
+
+    // written to a temporary name first so a crash never leaves a half written cache behind
+    std::string temporaryPath = cachePath + ".tmp";
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+    MeshCacheHeader header;
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.meshCount = (uint32_t)meshes.size();
+    header.sourceMtime = source.mtime;
+    header.sourceSize = source.size;
+    header.sourceHash = source.hash;
+    header.dependencyCount = (uint32_t)dependencies.size();
+    header.padding = 0;
+    out.write((const char *)&header, sizeof(header));
+
+    const char padding[4] = {0, 0, 0, 0};
+    auto writeString = [&](const std::string &value) {
+        uint32_t length = (uint32_t)value.size();
+        out.write((const char *)&length, sizeof(length));
+        out.write(value.data(), length);
+        out.write(padding, ((length + 3u) & ~3u) - length);
+    };
+    for (size_t d = 0; d < dependencies.size(); ++d) {
+        writeString(dependencies[d]);
+        out.write((const char *)&dependencyStamps[d], sizeof(MeshCacheDependencyStamp));
+    }
+    for (const Mesh &mesh : meshes) {
+        MeshCacheRecord record;
+        record.vertexCount = (uint32_t)mesh.vertices.size();
+        record.indexCount = (uint32_t)mesh.indices.size();
+        record.lodCount = (uint32_t)mesh.lods.size();
+        record.textureCount = (uint32_t)mesh.textures.size();
+        for (int i = 0; i < 3; ++i) {
+            record.boundsMin[i] = mesh.boundsMin[i];
+            record.boundsMax[i] = mesh.boundsMax[i];
+        }
+        out.write((const char *)&record, sizeof(record));
+        out.write((const char *)mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+        for (const Texture &texture : mesh.textures) {
+            writeString(texture.type);
+            writeString(texture.path);
+        }
+        out.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        out.write((const char *)mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+    }
+    out.close();
+    if (!out || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+};
+#endif //PROJECT_BASE_MESHCACHE_H
@@ -0,0 +1,267 @@
+//
+// Import time index and vertex buffer optimizations: welding of duplicated vertices, triangle order for the
+// post-transform vertex cache (Forsyth's linear speed algorithm), a cluster sort against overdraw and a vertex
+// order that follows the index buffer for fetch locality.
+//
+
+#ifndef PROJECT_BASE_MESHOPTIMIZE_H
+#define PROJECT_BASE_MESHOPTIMIZE_H
+
+#include <glm/glm.hpp>
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+// entries of the simulated FIFO cache, a conservative size for current GPUs
+const unsigned int VERTEX_CACHE_SIZE = 32;
+
+// average cache miss ratio: transformed vertices per triangle, 0.5 is ideal for a regular grid and 3 the worst
+inline float acmr(const unsigned int *indices, size_t indexCount, size_t vertexCount,
+                  unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+    if (indexCount < 3)
+        return 0.0f;
+    std::vector<unsigned int> insertedAt(vertexCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        unsigned int &stamp = insertedAt[indices[i]];
+        if (time - stamp > cacheSize) {
+            stamp = time++;
+            ++misses;
+        }
+    }
+    return (float)misses / (float)(indexCount / 3);
+}
+
+// merges bitwise identical vertices, returns the number of vertices left
+inline size_t weldVertices(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices) {
+    struct VertexHash {
+        size_t operator()(const Vertex *vertex) const {
+            const unsigned char *bytes = (const unsigned char *)vertex;
+            size_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < sizeof(Vertex); ++i)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            return hash;
+        }
+    };
+    struct VertexEqual {
+        bool operator()(const Vertex *a, const Vertex *b) const { return std::memcmp(a, b, sizeof(Vertex)) == 0; }
+    };
+
+    std::unordered_map<const Vertex *, unsigned int, VertexHash, VertexEqual> unique;
+    unique.reserve(vertices.size());
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        auto inserted = unique.emplace(&vertices[i], (unsigned int)welded.size());
+        if (inserted.second)
+            welded.push_back(vertices[i]);
+        remap[i] = inserted.first->second;
+    }
+    for (unsigned int &index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+    return vertices.size();
+}
+
+// reorders the triangles of `indices` so that consecutive ones share transformed vertices
+inline void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount) {
+    const unsigned int cacheSize = VERTEX_CACHE_SIZE;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles around each vertex
+    std::vector<unsigned int> valence(vertexCount, 0);
+    for (unsigned int index : indices)
+        valence[index]++;
+    std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+    // recently used vertices score high, and so do vertices with few triangles left so none get stranded
+    auto vertexScore = [&](int cachePosition, unsigned int remaining) {
+        if (remaining == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            // the triangle just emitted: using its vertices again would only make a strip
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (float)(cachePosition - 3) / (float)(cacheSize - 3), 1.5f);
+        }
+        return score + 2.0f / std::sqrt((float)remaining);
+    };
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        vertexScores[v] = vertexScore(-1, valence[v]);
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+    std::vector<bool> emitted(triangleCount, false);
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    std::vector<unsigned int> cache, nextCache;
+    cache.reserve(cacheSize + 3);
+    nextCache.reserve(cacheSize + 3);
+    size_t cursor = 0;
+    long best = (long)(std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin());
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+        // nothing in the cache is connected to a pending triangle: continue with the next one in input order
+        if (best < 0) {
+            while (emitted[cursor])
+                ++cursor;
+            best = (long)cursor;
+        }
+        const unsigned int *triangle = &indices[best * 3];
+        emitted[best] = true;
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = triangle[k];
+            result.push_back(v);
+            nextCache.push_back(v);
+            // take the triangle out of the vertex's list of pending ones
+            unsigned int *begin = &adjacency[adjacencyStart[v]];
+            unsigned int *end = begin + valence[v];
+            *std::find(begin, end, (unsigned int)best) = *(end - 1);
+            valence[v]--;
+        }
+        for (unsigned int v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        }
+        // vertices pushed past the end of the cache have to be transformed again when they come back
+        for (size_t i = cacheSize; i < nextCache.size(); ++i)
+            cachePosition[nextCache[i]] = -1;
+        if (nextCache.size() > cacheSize) {
+            for (size_t i = cacheSize; i < nextCache.size(); ++i)
+                vertexScores[nextCache[i]] = vertexScore(-1, valence[nextCache[i]]);
+            nextCache.resize(cacheSize);
+        }
+        cache.swap(nextCache);
+
+        for (size_t i = 0; i < cache.size(); ++i) {
+            cachePosition[cache[i]] = (int)i;
+            vertexScores[cache[i]] = vertexScore((int)i, valence[cache[i]]);
+        }
+        // only triangles around cached vertices changed their score
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : cache) {
+            for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + valence[v]; ++a) {
+                unsigned int t = adjacency[a];
+                float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                triangleScores[t] = score;
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+    }
+    indices.swap(result);
+}
+
+// keeps the cache friendly order inside clusters of triangles but draws outer, outward facing clusters first,
+// so that more of what is behind them fails the depth test. Clusters are only swapped around as long as the
+// ACMR stays within `threshold` of the input order.
+inline void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices,
+                             float threshold = 1.05f) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // a triangle that misses the cache with all three vertices starts a cluster
+    std::vector<size_t> clusterStart;
+    {
+        std::vector<unsigned int> insertedAt(vertices.size(), 0);
+        unsigned int time = VERTEX_CACHE_SIZE + 1;
+        for (size_t t = 0; t < triangleCount; ++t) {
+            int misses = 0;
+            for (int k = 0; k < 3; ++k) {
+                unsigned int &stamp = insertedAt[indices[t * 3 + k]];
+                if (time - stamp > VERTEX_CACHE_SIZE) {
+                    stamp = time++;
+                    ++misses;
+                }
+            }
+            if (t == 0 || misses == 3)
+                clusterStart.push_back(t);
+        }
+    }
+    clusterStart.push_back(triangleCount);
+    size_t clusterCount = clusterStart.size() - 1;
+    if (clusterCount < 2)
+        return;
+
+    glm::vec3 meshCenter(0.0f);
+    for (const Vertex &vertex : vertices)
+        meshCenter += vertex.Position;
+    meshCenter /= (float)vertices.size();
+
+    std::vector<float> sortKey(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t) {
+            const glm::vec3 &a = vertices[indices[t * 3]].Position;
+            const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 &p = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 faceNormal = glm::cross(b - a, p - a);
+            float faceArea = glm::length(faceNormal);
+            centroid += (a + b + p) * (faceArea / 3.0f);
+            normal += faceNormal;
+            area += faceArea;
+        }
+        float normalLength = glm::length(normal);
+        sortKey[c] = area > 0.0f && normalLength > 0.0f ?
+                     glm::dot(centroid / area - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (size_t c : order)
+        sorted.insert(sorted.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+    if (acmr(sorted.data(), sorted.size(), vertices.size()) <= threshold * acmr(indices.data(), indices.size(), vertices.size()))
+        indices.swap(sorted);
+}
+
+// renumbers the vertices in the order the index buffer first uses them and drops unreferenced ones
+inline void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices) {
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int &index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+};
+#endif //PROJECT_BASE_MESHOPTIMIZE_H
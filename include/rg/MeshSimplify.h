@@ -0,0 +1,102 @@
+//
+// Load time decimation of index buffers for mesh LODs.
+//
+
+#ifndef PROJECT_BASE_MESHSIMPLIFY_H
+#define PROJECT_BASE_MESHSIMPLIFY_H
+
+#include <glm/glm.hpp>
+#include <learnopengl/mesh.h>
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+// Vertex clustering: vertices are snapped to a grid of `resolution`^3 cells (further split by the
+// dominant normal direction, so the two sides of a leaf card never merge), every cell keeps the vertex
+// closest to its average and triangles that collapse are dropped. The result indexes the original
+// vertex array, so a LOD is just another index range in the same buffers.
+inline std::vector<unsigned int> clusterIndices(const std::vector<Vertex> &vertices, const unsigned int *indices,
+                                                size_t indexCount, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+                                                int resolution) {
+    glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+    glm::vec3 toCell = glm::vec3((float)resolution) / extent;
+
+    struct Cluster {
+        glm::vec3 sum = glm::vec3(0.0f);
+        unsigned int count = 0;
+        unsigned int representative = 0;
+        float bestDistance = INFINITY;
+    };
+    std::unordered_map<uint64_t, Cluster> clusters;
+    clusters.reserve(vertices.size());
+    std::vector<uint64_t> keys(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        glm::vec3 cell = glm::min((vertices[i].Position - boundsMin) * toCell, glm::vec3((float)resolution - 1.0f));
+        const glm::vec3 &n = vertices[i].Normal;
+        glm::vec3 a = glm::abs(n);
+        uint64_t direction = a.x >= a.y && a.x >= a.z ? (n.x >= 0.0f ? 0 : 1)
+                           : a.y >= a.z ? (n.y >= 0.0f ? 2 : 3) : (n.z >= 0.0f ? 4 : 5);
+        keys[i] = ((((uint64_t)cell.x * (uint64_t)resolution + (uint64_t)cell.y) * (uint64_t)resolution + (uint64_t)cell.z) << 3) | direction;
+        Cluster &cluster = clusters[keys[i]];
+        cluster.sum += vertices[i].Position;
+        ++cluster.count;
+    }
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        Cluster &cluster = clusters[keys[i]];
+        glm::vec3 mean = cluster.sum / (float)cluster.count;
+        float distance = glm::length(vertices[i].Position - mean);
+        if (distance < cluster.bestDistance) {
+            cluster.bestDistance = distance;
+            cluster.representative = (unsigned int)i;
+        }
+    }
+
+    std::vector<unsigned int> result;
+    result.reserve(indexCount);
+    for (size_t t = 0; t + 2 < indexCount; t += 3) {
+        unsigned int a = clusters[keys[indices[t]]].representative;
+        unsigned int b = clusters[keys[indices[t + 1]]].representative;
+        unsigned int c = clusters[keys[indices[t + 2]]].representative;
+        if (a == b || b == c || a == c)
+            continue;
+        result.push_back(a);
+        result.push_back(b);
+        result.push_back(c);
+    }
+    return result;
+}
+
+// searches the cluster grid resolution whose output comes closest to targetRatio of the original triangles
+inline std::vector<unsigned int> simplifyIndices(const std::vector<Vertex> &vertices, const unsigned int *indices,
+                                                 size_t indexCount, float targetRatio) {
+    std::vector<unsigned int> best;
+    if (vertices.empty() || indexCount == 0)
+        return best;
+    glm::vec3 boundsMin = vertices[0].Position, boundsMax = vertices[0].Position;
+    for (const Vertex &vertex : vertices) {
+        boundsMin = glm::min(boundsMin, vertex.Position);
+        boundsMax = glm::max(boundsMax, vertex.Position);
+    }
+    size_t target = (size_t)(indexCount * targetRatio);
+    // the triangle count grows with the resolution, so a binary search finds the largest grid under the target
+    int low = 1, high = 1024;
+    while (low <= high) {
+        int resolution = (low + high) / 2;
+        std::vector<unsigned int> candidate = clusterIndices(vertices, indices, indexCount, boundsMin, boundsMax, resolution);
+        if (candidate.size() <= target) {
+            best.swap(candidate);
+            low = resolution + 1;
+        }
+        else {
+            high = resolution - 1;
+        }
+    }
+    return best;
+}
+
+};
+#endif //PROJECT_BASE_MESHSIMPLIFY_H
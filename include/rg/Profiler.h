@@ -0,0 +1,236 @@
+//
+// Frame profiler: CPU and GPU time of named passes, the render counters of the frame and a rolling
+// frame time history, shown as an ImGui overlay. GPU times come from GL_TIME_ELAPSED queries that are
+// read a few frames later, so measuring never stalls the pipeline.
+//
+
+#ifndef PROJECT_BASE_PROFILER_H
+#define PROJECT_BASE_PROFILER_H
+
+#include <glad/glad.h>
+#include <imgui.h>
+
+#include <rg/Culling.h>
+#include <rg/Foliage.h>
+#include <rg/RenderQueue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// switches the overlay offers, a null pointer hides the switch
+struct ProfilerToggles {
+    bool *frustumCulling = nullptr;
+    bool *lod = nullptr;
+    bool *instancing = nullptr;
+    bool *gpuCulling = nullptr;
+    bool *occlusionCulling = nullptr;
+    // counters of the tree culling, shown under the render counters
+    const CullStats *treeCulling = nullptr;
+    FoliageMode *foliage = nullptr;
+    bool *shadows = nullptr;
+    bool *pointLights = nullptr;
+    bool *wind = nullptr;
+    bool *dynamicResolution = nullptr;
+    // shown next to the dynamic resolution switch
+    const float *resolutionScale = nullptr;
+};
+
+class Profiler {
+public:
+    // frames a GPU query has to finish in before its slot is reused
+    static const unsigned int QUERY_FRAMES = 4;
+    static const unsigned int HISTORY_SIZE = 240;
+
+    // times a pass from construction to destruction
+    class Scope {
+    public:
+        Scope(Profiler &profiler, unsigned int pass) : m_profiler(profiler), m_pass(pass) { m_profiler.begin(m_pass); }
+        ~Scope() { m_profiler.end(m_pass); }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Profiler &m_profiler;
+        unsigned int m_pass;
+    };
+
+    // registers a pass and returns the index begin()/end()/Scope take
+    unsigned int addPass(const std::string &name) {
+        Pass pass;
+        pass.name = name;
+        glGenQueries(QUERY_FRAMES, pass.queries);
+        m_passes.push_back(pass);
+        return (unsigned int)m_passes.size() - 1;
+    }
+
+    // call once at the start of every frame with the time the previous one took
+    void beginFrame(float frameSeconds) {
+        m_frameTimes[m_historyCursor] = frameSeconds * 1000.0f;
+        m_historyCursor = (m_historyCursor + 1) % HISTORY_SIZE;
+        m_historyCount = std::min(m_historyCount + 1, (unsigned int)HISTORY_SIZE);
+        ++m_frame;
+        // results of the frames that finished since, without waiting for the ones still in flight
+        for (Pass &pass : m_passes) {
+            for (unsigned int slot = 0; slot < QUERY_FRAMES; ++slot) {
+                if (!pass.issued[slot])
+                    continue;
+                GLint available = 0;
+                glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &nanoseconds);
+                pass.gpuMs = smooth(pass.gpuMs, nanoseconds / 1.0e6f);
+                pass.issued[slot] = false;
+            }
+        }
+    }
+
+    // call after the last draw counted in the overlay
+    void endFrame() { m_stats = renderStats(); }
+
+    void begin(unsigned int index) {
+        Pass &pass = m_passes[index];
+        pass.cpuStart = std::chrono::steady_clock::now();
+        unsigned int slot = m_frame % QUERY_FRAMES;
+        // a query that didn't finish in QUERY_FRAMES frames is dropped instead of waited for
+        glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+        pass.issued[slot] = true;
+    }
+
+    void end(unsigned int index) {
+        Pass &pass = m_passes[index];
+        glEndQuery(GL_TIME_ELAPSED);
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - pass.cpuStart;
+        pass.cpuMs = smooth(pass.cpuMs, elapsed.count());
+    }
+
+    void drawOverlay(const ProfilerToggles &toggles) {
+        ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowBgAlpha(0.8f);
+        if (!ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+            ImGui::End();
+            return;
+        }
+        std::vector<float> history(m_historyCount);
+        float average = 0.0f, worst = 0.0f;
+        for (unsigned int i = 0; i < m_historyCount; ++i) {
+            // oldest first
+            history[i] = m_frameTimes[(m_historyCursor + HISTORY_SIZE - m_historyCount + i) % HISTORY_SIZE];
+            average += history[i];
+            worst = std::max(worst, history[i]);
+        }
+        average /= std::max(m_historyCount, 1u);
+        char label[64];
+        std::snprintf(label, sizeof(label), "avg %.2f ms  max %.2f ms", average, worst);
+        ImGui::Text("%.1f fps", average > 0.0f ? 1000.0f / average : 0.0f);
+        ImGui::PlotLines("##frame times", history.data(), (int)history.size(), 0, label, 0.0f,
+                         std::max(worst * 1.2f, 16.7f), ImVec2(320.0f, 80.0f));
+
+        ImGui::Separator();
+        ImGui::Columns(3, "passes", false);
+        ImGui::Text("pass");
+        ImGui::NextColumn();
+        ImGui::Text("CPU ms");
+        ImGui::NextColumn();
+        ImGui::Text("GPU ms");
+        ImGui::NextColumn();
+        for (const Pass &pass : m_passes) {
+            ImGui::Text("%s", pass.name.c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%.3f", pass.cpuMs);
+            ImGui::NextColumn();
+            ImGui::Text("%.3f", pass.gpuMs);
+            ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+
+        ImGui::Separator();
+        ImGui::Text("draw calls     %u", m_stats.drawCalls);
+        ImGui::Text("triangles      %llu", (unsigned long long)m_stats.triangles);
+        ImGui::Text("state changes  %u (%u redundant skipped)", m_stats.stateChanges, m_stats.redundantStateChanges);
+        if (toggles.treeCulling)
+            ImGui::Text("trees          %u visible, %u culled, %u occluded", toggles.treeCulling->visible,
+                        toggles.treeCulling->culled, toggles.treeCulling->occluded);
+
+        ImGui::Separator();
+        if (toggles.frustumCulling)
+            ImGui::Checkbox("frustum culling", toggles.frustumCulling);
+        if (toggles.gpuCulling)
+            ImGui::Checkbox("GPU culling", toggles.gpuCulling);
+        if (toggles.occlusionCulling)
+            ImGui::Checkbox("occlusion culling", toggles.occlusionCulling);
+        if (toggles.lod)
+            ImGui::Checkbox("levels of detail", toggles.lod);
+        // the GPU culled trees always draw instanced, from their indirect commands
+        if (toggles.instancing && !(toggles.gpuCulling && *toggles.gpuCulling))
+            ImGui::Checkbox("instancing", toggles.instancing);
+        if (toggles.shadows)
+            ImGui::Checkbox("shadows", toggles.shadows);
+        if (toggles.pointLights)
+            ImGui::Checkbox("point lights", toggles.pointLights);
+        if (toggles.wind)
+            ImGui::Checkbox("wind", toggles.wind);
+        if (toggles.dynamicResolution) {
+            ImGui::Checkbox("dynamic resolution", toggles.dynamicResolution);
+            if (toggles.resolutionScale) {
+                ImGui::SameLine();
+                ImGui::Text("%.0f%%", *toggles.resolutionScale * 100.0f);
+            }
+        }
+        if (toggles.foliage) {
+            int mode = *toggles.foliage;
+            if (ImGui::Combo("foliage", &mode, foliageModeNames(), FOLIAGE_MODE_COUNT))
+                *toggles.foliage = (FoliageMode)mode;
+        }
+        ImGui::End();
+    }
+
+    // GPU time of the pass, a few frames old
+    float gpuMs(unsigned int index) const { return m_passes[index].gpuMs; }
+    float cpuMs(unsigned int index) const { return m_passes[index].cpuMs; }
+    // GPU time of all passes together
+    float gpuFrameMs() const {
+        float total = 0.0f;
+        for (const Pass &pass : m_passes)
+            total += pass.gpuMs;
+        return total;
+    }
+
+    void destroy() {
+        for (Pass &pass : m_passes)
+            glDeleteQueries(QUERY_FRAMES, pass.queries);
+        m_passes.clear();
+    }
+
+private:
+    struct Pass {
+        std::string name;
+        unsigned int queries[QUERY_FRAMES] = {};
+        bool issued[QUERY_FRAMES] = {};
+        std::chrono::steady_clock::time_point cpuStart;
+        float cpuMs = 0.0f;
+        float gpuMs = 0.0f;
+    };
+
+    // exponential moving average, so the numbers stay readable at high frame rates
+    static float smooth(float average, float sample) {
+        return average == 0.0f ? sample : average * 0.9f + sample * 0.1f;
+    }
+
+    std::vector<Pass> m_passes;
+    float m_frameTimes[HISTORY_SIZE] = {};
+    unsigned int m_historyCursor = 0;
+    unsigned int m_historyCount = 0;
+    unsigned int m_frame = 0;
+    RenderStats m_stats;
+};
+
+};
+#endif //PROJECT_BASE_PROFILER_H
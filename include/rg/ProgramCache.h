@@ -0,0 +1,115 @@
+//
+// On-disk cache of linked shader programs. A program is stored as the driver's own binary under a key made
+// of its preprocessed sources and the driver identity, so an edited shader, a new define or a driver update
+// simply misses and the program is compiled from source (and stored again) as before.
+//
+
+#ifndef PROJECT_BASE_PROGRAMCACHE_H
+#define PROJECT_BASE_PROGRAMCACHE_H
+
+#include <glad/glad.h>
+
+#include <rg/GLExtensions.h>
+#include <rg/Hash.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// bump whenever the file layout below changes
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+const char PROGRAM_CACHE_MAGIC[4] = {'F', 'S', 'P', 'B'};
+
+// where the binaries go, one <key>.progbin per program
+inline std::string &programCacheDirectory() {
+    static std::string directory = "resources/shaders/.cache";
+    return directory;
+}
+
+struct ProgramCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+// needs the context, the driver strings are part of the key
+inline uint64_t programCacheKey(const std::string &vertexCode, const std::string &fragmentCode) {
+    static const std::string driver = std::string((const char *)glGetString(GL_VENDOR)) + "\n" +
+                                      (const char *)glGetString(GL_RENDERER) + "\n" +
+                                      (const char *)glGetString(GL_VERSION);
+    return hashString(fragmentCode, hashString(vertexCode, hashString(driver)));
+}
+
+inline std::string programCachePath(uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.progbin", (unsigned long long)key);
+    return programCacheDirectory() + name;
+}
+
+// fills `program` (fresh from glCreateProgram) from the cache, false when there is no usable binary,
+// drivers are free to reject one they wrote themselves
+inline bool loadProgramBinary(unsigned int program, uint64_t key) {
+    if (!glext::supportsProgramBinary())
+        return false;
+    std::ifstream file(programCachePath(key), std::ios::binary);
+    ProgramCacheHeader header;
+    if (!file.read((char *)&header, sizeof(header)) || std::string(header.magic, 4) != std::string(PROGRAM_CACHE_MAGIC, 4) ||
+        header.version != PROGRAM_CACHE_VERSION || header.key != key)
+        return false;
+    std::vector<char> binary(header.length);
+    if (!file.read(binary.data(), binary.size()))
+        return false;
+    glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked != 0;
+}
+
+// call before linking a program that is going to be stored
+inline void markProgramRetrievable(unsigned int program) {
+    if (glext::supportsProgramBinary())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+inline void storeProgramBinary(unsigned int program, uint64_t key) {
+    if (!glext::supportsProgramBinary())
+        return;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    ::mkdir(programCacheDirectory().c_str(), 0755);
+    // written next to the final name and renamed, so a crash never leaves a truncated binary behind
+    std::string path = programCachePath(key);
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    ProgramCacheHeader header = {};
+    std::copy(PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_MAGIC + 4, header.magic);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = (uint32_t)length;
+    file.write((const char *)&header, sizeof(header));
+    file.write(binary.data(), length);
+    file.close();
+    if (file)
+        std::rename(temporary.c_str(), path.c_str());
+    else
+        std::remove(temporary.c_str());
+}
+
+};
+#endif //PROJECT_BASE_PROGRAMCACHE_H
@@ -0,0 +1,387 @@
+//
+// Draw submission through a sorted queue. Draw items are collected per pass, sorted by program, vertex
+// array and textures, and submitted through a shadow copy of the GL binding state so that a run of draws
+// sharing state binds it once instead of once per draw.
+//
+
+#ifndef PROJECT_BASE_RENDERQUEUE_H
+#define PROJECT_BASE_RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader_m.h>
+#include <rg/GLExtensions.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+// counted since the last reset(), which the frame loop does once per frame
+struct RenderStats {
+    unsigned int drawCalls = 0;
+    uint64_t triangles = 0;
+    // GL binding calls that were issued and the ones the shadow state found redundant
+    unsigned int stateChanges = 0;
+    unsigned int redundantStateChanges = 0;
+
+    void reset() { *this = RenderStats(); }
+};
+
+inline RenderStats &renderStats() {
+    static RenderStats stats;
+    return stats;
+}
+
+const unsigned int MAX_DRAW_TEXTURES = 8;
+
+// points the mat4 attribute at `location` of the bound VAO (4 locations, one per column) at the transforms in
+// `buffer`, the first instance read is `firstInstance`
+inline void attachInstanceBuffer(unsigned int buffer, unsigned int firstInstance, unsigned int location) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    size_t base = firstInstance * sizeof(glm::mat4);
+    for (unsigned int i = 0; i < 4; i++) {
+        glEnableVertexAttribArray(location + i);
+        glVertexAttribPointer(location + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(base + i * sizeof(glm::vec4)));
+        // advance once per instance instead of once per vertex
+        glVertexAttribDivisor(location + i, 1);
+    }
+}
+
+// shadow of the bindings the queue touches. It is invalidated at the start of every flush because code
+// outside the queue (loaders, bakes, setup) binds things behind its back.
+class GLStateCache {
+public:
+    static GLStateCache &instance() {
+        static GLStateCache cache;
+        return cache;
+    }
+
+    void invalidate() {
+        m_program = UNKNOWN;
+        m_vertexArray = UNKNOWN;
+        m_activeUnit = UNKNOWN;
+        m_indirectBuffer = UNKNOWN;
+        m_blend = -1;
+        for (unsigned int unit = 0; unit < MAX_DRAW_TEXTURES; ++unit)
+            m_textures[unit] = UNKNOWN;
+        m_instanceBindings.clear();
+    }
+
+    void useProgram(unsigned int program) {
+        if (changed(m_program, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(unsigned int vertexArray) {
+        if (changed(m_vertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    void bindTexture(unsigned int unit, GLenum target, unsigned int texture) {
+        // a texture name has one target for its whole life, so the name alone identifies the binding
+        if (!changed(m_textures[unit], texture))
+            return;
+        if (m_activeUnit != unit) {
+            m_activeUnit = unit;
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+        glBindTexture(target, texture);
+    }
+
+    void bindIndirectBuffer(unsigned int buffer) {
+        if (changed(m_indirectBuffer, buffer))
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    }
+
+    void setBlend(bool enabled) {
+        if (m_blend == (int)enabled) {
+            renderStats().redundantStateChanges++;
+            return;
+        }
+        renderStats().stateChanges++;
+        m_blend = enabled;
+        if (enabled) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        } else {
+            glDisable(GL_BLEND);
+        }
+    }
+
+    // attachInstanceBuffer() on `vertexArray`, skipped when it already points there
+    void setInstanceBuffer(unsigned int vertexArray, unsigned int buffer, unsigned int firstInstance, unsigned int location) {
+        InstanceBinding binding = {buffer, firstInstance};
+        auto it = m_instanceBindings.find(vertexArray);
+        if (it != m_instanceBindings.end() && it->second.buffer == buffer && it->second.firstInstance == firstInstance) {
+            renderStats().redundantStateChanges++;
+            return;
+        }
+        m_instanceBindings[vertexArray] = binding;
+        renderStats().stateChanges++;
+        bindVertexArray(vertexArray);
+        attachInstanceBuffer(buffer, firstInstance, location);
+    }
+
+private:
+    static const unsigned int UNKNOWN = ~0u;
+
+    struct InstanceBinding {
+        unsigned int buffer;
+        unsigned int firstInstance;
+    };
+
+    GLStateCache() { invalidate(); }
+
+    static bool changed(unsigned int &current, unsigned int wanted) {
+        if (current == wanted) {
+            renderStats().redundantStateChanges++;
+            return false;
+        }
+        renderStats().stateChanges++;
+        current = wanted;
+        return true;
+    }
+
+    unsigned int m_program, m_vertexArray, m_activeUnit, m_indirectBuffer;
+    unsigned int m_textures[MAX_DRAW_TEXTURES];
+    int m_blend;
+    std::unordered_map<unsigned int, InstanceBinding> m_instanceBindings;
+};
+
+struct DrawItem {
+    Shader *shader = nullptr;
+    unsigned int vertexArray = 0;
+
+    unsigned int textureCount = 0;
+    GLenum textureTargets[MAX_DRAW_TEXTURES];
+    unsigned int textures[MAX_DRAW_TEXTURES];
+    // sampler uniform of each texture, texture i goes to unit i
+    const std::vector<std::string> *samplerNames = nullptr;
+
+    // blended items are drawn after the opaque ones, back to front by `depth`
+    bool blend = false;
+    float depth = 0.0f;
+
+    GLenum mode = GL_TRIANGLES;
+    // 0 for glDrawArrays, GL_UNSIGNED_SHORT/INT for indexed draws
+    GLenum indexType = 0;
+    // first vertex, or byte offset of the first index
+    size_t first = 0;
+    unsigned int count = 0;
+    // added to every index, for meshes that share their vertex array's buffers with others
+    GLint baseVertex = 0;
+    // 0 draws without instancing
+    unsigned int instanceCount = 0;
+    // per-instance transforms, attached at instanceLocation when instanceBuffer isn't 0
+    unsigned int instanceBuffer = 0;
+    unsigned int firstInstance = 0;
+    unsigned int instanceLocation = 0;
+    // set for a glMultiDrawElementsIndirect of the command at indirectOffset in this buffer, the queue merges
+    // items of the same state reading consecutive commands into one call
+    unsigned int indirectBuffer = 0;
+    size_t indirectOffset = 0;
+
+    void addTexture(GLenum target, unsigned int texture) {
+        if (textureCount < MAX_DRAW_TEXTURES) {
+            textureTargets[textureCount] = target;
+            textures[textureCount++] = texture;
+        }
+    }
+};
+
+// bytes of one DrawElementsIndirectCommand
+const size_t INDIRECT_COMMAND_SIZE = 5 * sizeof(GLuint);
+
+class RenderQueue {
+public:
+    void submit(const DrawItem &item) { m_items.push_back(item); }
+
+    bool empty() const { return m_items.empty(); }
+
+    // sorts and draws everything submitted since the last flush
+    void flush() {
+        if (m_items.empty())
+            return;
+        m_order.resize(m_items.size());
+        for (size_t i = 0; i < m_items.size(); ++i)
+            m_order[i] = {sortKey(m_items[i]), (unsigned int)i};
+        std::stable_sort(m_order.begin(), m_order.end(),
+                         [](const SortEntry &a, const SortEntry &b) { return a.key < b.key; });
+
+        GLStateCache &state = GLStateCache::instance();
+        state.invalidate();
+        // sampler uniforms are program state, they only need setting when a program meets new names
+        m_samplersSet.clear();
+        for (size_t i = 0; i < m_order.size();) {
+            // neighbours that only differ in their index range go out as one glMultiDrawElementsBaseVertex, and
+            // indirect ones reading consecutive commands as one glMultiDrawElementsIndirect
+            size_t end = i + 1;
+            while (end < m_order.size() && mergeable(m_items[m_order[i].index], m_items[m_order[end].index], end - i))
+                ++end;
+            if (end - i > 1)
+                drawMerged(i, end, state);
+            else
+                draw(m_items[m_order[i].index], state);
+            i = end;
+        }
+        m_items.clear();
+
+        // always good practice to set everything back to defaults once configured.
+        state.bindVertexArray(0);
+        state.bindIndirectBuffer(0);
+        glActiveTexture(GL_TEXTURE0);
+        state.invalidate();
+    }
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        unsigned int index;
+    };
+
+    // blend | program | vertex array | textures, blended ones ordered by decreasing depth instead
+    static uint64_t sortKey(const DrawItem &item) {
+        if (item.blend) {
+            // positive floats order like their bit patterns
+            float depth = std::max(item.depth, 0.0f);
+            uint32_t bits;
+            std::memcpy(&bits, &depth, sizeof(bits));
+            return 1ull << 63 | (uint64_t)(~bits);
+        }
+        uint64_t textureHash = 0;
+        for (unsigned int i = 0; i < item.textureCount; ++i)
+            textureHash = textureHash * 31 + item.textures[i];
+        return (uint64_t)(item.shader->ID & 0x7FFF) << 48 | (uint64_t)(item.vertexArray & 0xFFFF) << 32 |
+               (textureHash & 0xFFFFFFFF);
+    }
+
+    // whether `b`, `run` items after `a`, can be drawn in the same call as `a`: indexed, with the same state and
+    // either not instanced or indirect from the command right after the one before
+    static bool mergeable(const DrawItem &a, const DrawItem &b, size_t run) {
+        if (a.blend || b.blend || !a.indexType)
+            return false;
+        if (a.indirectBuffer || b.indirectBuffer) {
+            if (a.indirectBuffer != b.indirectBuffer || b.indirectOffset != a.indirectOffset + run * INDIRECT_COMMAND_SIZE ||
+                a.instanceBuffer != b.instanceBuffer || a.firstInstance != b.firstInstance ||
+                a.instanceLocation != b.instanceLocation)
+                return false;
+        }
+        else if (a.instanceCount || b.instanceCount || a.instanceBuffer || b.instanceBuffer)
+            return false;
+        if (a.shader != b.shader || a.vertexArray != b.vertexArray || a.mode != b.mode ||
+            a.indexType != b.indexType || a.textureCount != b.textureCount || a.samplerNames != b.samplerNames)
+            return false;
+        for (unsigned int i = 0; i < a.textureCount; ++i)
+            if (a.textures[i] != b.textures[i] || a.textureTargets[i] != b.textureTargets[i])
+                return false;
+        return true;
+    }
+
+    void bindState(const DrawItem &item, GLStateCache &state) {
+        state.useProgram(item.shader->ID);
+        state.setBlend(item.blend);
+        if (item.samplerNames) {
+            auto set = m_samplersSet.find(item.shader->ID);
+            if (set == m_samplersSet.end() || (set->second != item.samplerNames && *set->second != *item.samplerNames)) {
+                const std::vector<UniformHandle> &handles = samplerHandles(item);
+                for (unsigned int i = 0; i < handles.size() && i < item.textureCount; ++i)
+                    item.shader->setInt(handles[i], i);
+                m_samplersSet[item.shader->ID] = item.samplerNames;
+            }
+        }
+        for (unsigned int i = 0; i < item.textureCount; ++i)
+            state.bindTexture(i, item.textureTargets[i], item.textures[i]);
+        if (item.instanceBuffer)
+            state.setInstanceBuffer(item.vertexArray, item.instanceBuffer, item.firstInstance, item.instanceLocation);
+        state.bindVertexArray(item.vertexArray);
+    }
+
+    // the handles of the item's sampler names in its program, resolved the first time the two meet; a mesh's
+    // names live as long as the mesh and are only changed before it is first drawn
+    const std::vector<UniformHandle> &samplerHandles(const DrawItem &item) {
+        std::vector<UniformHandle> &handles = m_samplerHandles[std::make_pair(item.shader, item.samplerNames)];
+        if (handles.size() != item.samplerNames->size()) {
+            handles.clear();
+            for (const std::string &name : *item.samplerNames)
+                handles.push_back(item.shader->getUniformHandle(name));
+        }
+        return handles;
+    }
+
+    void draw(const DrawItem &item, GLStateCache &state) {
+        bindState(item, state);
+
+        RenderStats &stats = renderStats();
+        stats.drawCalls++;
+        if (item.indirectBuffer) {
+            // the instance count is only known to the GPU
+            state.bindIndirectBuffer(item.indirectBuffer);
+            glMultiDrawElementsIndirect(item.mode, item.indexType, (void *)item.indirectOffset, 1, 0);
+            return;
+        }
+        unsigned int instances = item.instanceCount ? item.instanceCount : 1;
+        stats.triangles += (uint64_t)(item.mode == GL_TRIANGLES ? item.count / 3 : item.count >= 2 ? item.count - 2 : 0) * instances;
+        if (item.indexType && item.baseVertex) {
+            if (item.instanceCount)
+                glDrawElementsInstancedBaseVertex(item.mode, item.count, item.indexType, (void *)item.first,
+                                                  item.instanceCount, item.baseVertex);
+            else
+                glDrawElementsBaseVertex(item.mode, item.count, item.indexType, (void *)item.first, item.baseVertex);
+        } else if (item.indexType) {
+            if (item.instanceCount)
+                glDrawElementsInstanced(item.mode, item.count, item.indexType, (void *)item.first, item.instanceCount);
+            else
+                glDrawElements(item.mode, item.count, item.indexType, (void *)item.first);
+        } else {
+            if (item.instanceCount)
+                glDrawArraysInstanced(item.mode, (GLint)item.first, item.count, item.instanceCount);
+            else
+                glDrawArrays(item.mode, (GLint)item.first, item.count);
+        }
+    }
+
+    // the items m_order[begin, end) of mergeable() state, in one call
+    void drawMerged(size_t begin, size_t end, GLStateCache &state) {
+        const DrawItem &first = m_items[m_order[begin].index];
+        bindState(first, state);
+        RenderStats &stats = renderStats();
+        stats.drawCalls++;
+        if (first.indirectBuffer) {
+            state.bindIndirectBuffer(first.indirectBuffer);
+            glMultiDrawElementsIndirect(first.mode, first.indexType, (void *)first.indirectOffset, (GLsizei)(end - begin), 0);
+            return;
+        }
+        m_multiCounts.clear();
+        m_multiOffsets.clear();
+        m_multiBaseVertices.clear();
+        for (size_t i = begin; i < end; ++i) {
+            const DrawItem &item = m_items[m_order[i].index];
+            m_multiCounts.push_back((GLsizei)item.count);
+            m_multiOffsets.push_back((const void *)item.first);
+            m_multiBaseVertices.push_back(item.baseVertex);
+            stats.triangles += item.mode == GL_TRIANGLES ? item.count / 3 : item.count >= 2 ? item.count - 2 : 0;
+        }
+        glMultiDrawElementsBaseVertex(first.mode, m_multiCounts.data(), first.indexType, m_multiOffsets.data(),
+                                      (GLsizei)m_multiCounts.size(), m_multiBaseVertices.data());
+    }
+
+    std::vector<DrawItem> m_items;
+    std::vector<SortEntry> m_order;
+    std::unordered_map<unsigned int, const std::vector<std::string> *> m_samplersSet;
+    std::map<std::pair<Shader *, const std::vector<std::string> *>, std::vector<UniformHandle>> m_samplerHandles;
+    // arguments of drawMerged(), kept to not allocate per call
+    std::vector<GLsizei> m_multiCounts;
+    std::vector<const void *> m_multiOffsets;
+    std::vector<GLint> m_multiBaseVertices;
+};
+
+};
+#endif //PROJECT_BASE_RENDERQUEUE_H
@@ -0,0 +1,446 @@
+//
+// Scene description: the tree model, the textures and vertex arrays of the static geometry, where that
+// geometry and the trees stand, and the lights. Scenes are written as text and compiled into <scene>bin
+// next to it (arena.scene -> arena.scenebin), which is rebuilt whenever the text changes. Loading maps the
+// binary and hands out pointers into it; nothing is parsed, the arrays are used where they lie.
+//
+// The text has one statement per line, '#' starts a comment, angles are in degrees:
+//
+//   model <path>                                     the tree model
+//   terrain <path>                                   the texture of the ground
+//   texture <name> <path> [clamp]                    clamp for textures that must not repeat
+//   mesh <name>                                      followed by its triangles' vertices, up to "end":
+//   v <x y z> <nx ny nz> <u v>
+//   end
+//   static <mesh> <texture> <x y z> <yaw> <scale> [tree <index>] [repeat <count> <spacing>]
+//                                                    merged into the static batch; "tree" places it relative
+//                                                    to the ground under that tree of the forest, "repeat"
+//                                                    tiles it count x count times, centred on the position
+//   forest <count>                                   trees on the square grid of rg/TreePlacement.h
+//   tree <x z> <yaw> <scale>                         one more tree, on the ground
+//   bounds <half extent>                             how far the camera may go from the centre
+//   sun ambient <r g b> diffuse <r g b> specular <r g b>
+//                                                    diffuse and specular at noon
+//   flashlight ambient <r g b> diffuse <r g b> specular <r g b> attenuation <c l q> cone <inner outer>
+//
+
+#ifndef PROJECT_BASE_SCENE_H
+#define PROJECT_BASE_SCENE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <rg/MappedFile.h>
+#include <rg/Trace.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// bump whenever the layout below changes
+const uint32_t SCENE_VERSION = 1;
+const char SCENE_MAGIC[4] = {'F', 'S', 'S', 'C'};
+// sections start on multiples of this
+const uint32_t SCENE_ALIGNMENT = 16;
+
+enum SceneSectionId {
+    SCENE_STRINGS,
+    SCENE_TEXTURES,
+    SCENE_VERTICES,
+    SCENE_MESHES,
+    SCENE_STATICS,
+    SCENE_TREES,
+    SCENE_SECTION_COUNT
+};
+
+// `count` records from `offset` bytes into the file
+struct SceneSection {
+    uint32_t offset;
+    uint32_t count;
+};
+
+// strings are offsets into the NUL terminated strings of SCENE_STRINGS
+struct SceneTexture {
+    uint32_t path;
+    uint32_t clamp;
+};
+
+// the layout StaticBatch::addTriangles reads
+struct SceneVertex {
+    float position[3];
+    float normal[3];
+    float texCoords[2];
+};
+
+// a range of SCENE_VERTICES, three per triangle
+struct SceneMesh {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+};
+
+struct SceneStatic {
+    uint32_t mesh;
+    uint32_t texture;
+    // index into the forest's grid the transform is relative to, -1 for world space
+    int32_t tree;
+    uint32_t pad;
+    // column major, like glm::mat4
+    float transform[16];
+};
+
+struct SceneTree {
+    float x, z;
+    // radians
+    float yaw;
+    float scale;
+};
+
+struct SceneLight {
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    // x, y, z: constant, linear and quadratic attenuation
+    float attenuation[4];
+    // x, y: cosines of the inner and outer cone
+    float cone[4];
+};
+
+struct SceneHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceMtime;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    SceneSection sections[SCENE_SECTION_COUNT];
+    uint32_t model;
+    uint32_t terrainTexture;
+    uint32_t forestTrees;
+    // 0 leaves the camera's bounds alone
+    float bounds;
+    SceneLight sun;
+    SceneLight flashlight;
+};
+
+static_assert(sizeof(SceneVertex) == 8 * sizeof(float), "SceneVertex has to match StaticBatch's vertices");
+static_assert(sizeof(SceneStatic) == 80 && sizeof(SceneHeader) % 16 == 0, "scene records have to stay aligned");
+
+// the text at `sourcePath` compiled into `binaryPath`, false after printing what is wrong with it
+inline bool compileScene(const std::string &sourcePath, const std::string &binaryPath) {
+    TraceScope trace("scene compile", sourcePath);
+    std::ifstream file(sourcePath);
+    if (!file) {
+        std::cerr << "SCENE::CANNOT_OPEN " << sourcePath << std::endl;
+        return false;
+    }
+    SceneHeader header = {};
+    std::memcpy(header.magic, SCENE_MAGIC, 4);
+    header.version = SCENE_VERSION;
+    // offset 0 is the empty string
+    std::string strings(1, '\0');
+    auto addString = [&](const std::string &value) {
+        uint32_t offset = (uint32_t)strings.size();
+        strings += value;
+        strings += '\0';
+        return offset;
+    };
+    std::vector<SceneTexture> textures;
+    std::vector<SceneVertex> vertices;
+    std::vector<SceneMesh> meshes;
+    std::vector<SceneStatic> statics;
+    std::vector<SceneTree> trees;
+    std::map<std::string, uint32_t> textureNames, meshNames;
+    // the light defaults are the original scene's
+    SceneLight sun = {{0.01f, 0.01f, 0.01f, 0.0f}, {0.5f, 0.5f, 0.5f, 0.0f}, {0.5f, 0.5f, 0.5f, 0.0f},
+                      {1.0f, 0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 0.0f, 0.0f}};
+    SceneLight flashlight = {{0.0f, 0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 1.0f, 0.0f},
+                             {1.0f, 0.09f, 0.032f, 0.0f}, {12.5f, 15.0f, 0.0f, 0.0f}};
+    bool inMesh = false;
+
+    std::string line;
+    int lineNumber = 0;
+    auto fail = [&](const std::string &message) {
+        std::cerr << "SCENE::PARSE_ERROR " << sourcePath << ":" << lineNumber << ": " << message << std::endl;
+        return false;
+    };
+    auto readLight = [](std::istringstream &fields, SceneLight &light) {
+        std::string key;
+        while (fields >> key) {
+            float *target = key == "ambient" ? light.ambient : key == "diffuse" ? light.diffuse :
+                            key == "specular" ? light.specular : key == "attenuation" ? light.attenuation :
+                            key == "cone" ? light.cone : nullptr;
+            int components = key == "cone" ? 2 : 3;
+            if (!target)
+                return false;
+            for (int i = 0; i < components; ++i)
+                if (!(fields >> target[i]))
+                    return false;
+        }
+        return true;
+    };
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string keyword;
+        if (!(fields >> keyword))
+            continue;
+        if (inMesh) {
+            if (keyword == "end") {
+                inMesh = false;
+                if (meshes.back().vertexCount % 3 != 0)
+                    return fail("a mesh needs three vertices per triangle");
+                continue;
+            }
+            float values[8];
+            if (keyword != "v")
+                return fail("expected a vertex or end");
+            for (float &value : values)
+                if (!(fields >> value))
+                    return fail("a vertex has a position, a normal and texture coordinates");
+            SceneVertex vertex;
+            std::memcpy(&vertex, values, sizeof(vertex));
+            vertices.push_back(vertex);
+            ++meshes.back().vertexCount;
+        }
+        else if (keyword == "model") {
+            std::string path;
+            if (!(fields >> path))
+                return fail("model needs a path");
+            header.model = addString(path);
+        }
+        else if (keyword == "terrain") {
+            std::string path;
+            if (!(fields >> path))
+                return fail("terrain needs a texture path");
+            header.terrainTexture = addString(path);
+        }
+        else if (keyword == "texture") {
+            std::string name, path, option;
+            if (!(fields >> name >> path))
+                return fail("texture needs a name and a path");
+            SceneTexture texture = {addString(path), fields >> option && option == "clamp" ? 1u : 0u};
+            textureNames[name] = (uint32_t)textures.size();
+            textures.push_back(texture);
+        }
+        else if (keyword == "mesh") {
+            std::string name;
+            if (!(fields >> name))
+                return fail("mesh needs a name");
+            meshNames[name] = (uint32_t)meshes.size();
+            meshes.push_back({(uint32_t)vertices.size(), 0});
+            inMesh = true;
+        }
+        else if (keyword == "static") {
+            std::string mesh, texture, option;
+            glm::vec3 position;
+            float yaw, scale;
+            if (!(fields >> mesh >> texture >> position.x >> position.y >> position.z >> yaw >> scale))
+                return fail("static needs a mesh, a texture, a position, a yaw and a scale");
+            if (!meshNames.count(mesh) || !textureNames.count(texture))
+                return fail("unknown mesh or texture, they are declared before they are placed");
+            int tree = -1, repeat = 1;
+            float spacing = 0.0f;
+            while (fields >> option) {
+                if (option == "tree" && fields >> tree && tree >= 0)
+                    continue;
+                if (option == "repeat" && fields >> repeat >> spacing && repeat > 0)
+                    continue;
+                return fail("unknown or incomplete option " + option);
+            }
+            for (int z = 0; z < repeat; ++z) {
+                for (int x = 0; x < repeat; ++x) {
+                    glm::vec3 offset((x - (repeat - 1) * 0.5f) * spacing, 0.0f, (z - (repeat - 1) * 0.5f) * spacing);
+                    glm::mat4 transform = glm::translate(glm::mat4(1.0f), position + offset);
+                    transform = glm::rotate(transform, glm::radians(yaw), glm::vec3(0.0f, 1.0f, 0.0f));
+                    transform = glm::scale(transform, glm::vec3(scale));
+                    SceneStatic placed = {meshNames[mesh], textureNames[texture], tree, 0, {}};
+                    std::memcpy(placed.transform, &transform[0][0], sizeof(placed.transform));
+                    statics.push_back(placed);
+                }
+            }
+        }
+        else if (keyword == "forest") {
+            int count;
+            if (!(fields >> count) || count < 0)
+                return fail("forest needs a tree count");
+            header.forestTrees = (uint32_t)count;
+        }
+        else if (keyword == "tree") {
+            SceneTree tree;
+            if (!(fields >> tree.x >> tree.z >> tree.yaw >> tree.scale))
+                return fail("tree needs x, z, a yaw and a scale");
+            tree.yaw = glm::radians(tree.yaw);
+            trees.push_back(tree);
+        }
+        else if (keyword == "bounds") {
+            if (!(fields >> header.bounds) || header.bounds <= 0.0f)
+                return fail("bounds needs a positive half extent");
+        }
+        else if (keyword == "sun") {
+            if (!readLight(fields, sun))
+                return fail("sun takes ambient, diffuse and specular colours");
+        }
+        else if (keyword == "flashlight") {
+            if (!readLight(fields, flashlight))
+                return fail("flashlight takes colours, attenuation and a cone");
+        }
+        else {
+            return fail("unknown statement " + keyword);
+        }
+    }
+    if (inMesh)
+        return fail("the last mesh has no end");
+    // the shaders compare against cosines
+    for (SceneLight *light : {&sun, &flashlight}) {
+        light->cone[0] = std::cos(glm::radians(light->cone[0]));
+        light->cone[1] = std::cos(glm::radians(light->cone[1]));
+    }
+    header.sun = sun;
+    header.flashlight = flashlight;
+
+    SourceStamp source;
+    if (SourceStamp::stat(sourcePath, source)) {
+        header.sourceMtime = source.mtime;
+        header.sourceSize = source.size;
+        header.sourceHash = SourceStamp::hashFile(sourcePath);
+    }
+    // laid out in order after the header, each section aligned
+    std::vector<std::pair<const void *, size_t>> payloads(SCENE_SECTION_COUNT);
+    payloads[SCENE_STRINGS] = {strings.data(), strings.size()};
+    payloads[SCENE_TEXTURES] = {textures.data(), textures.size() * sizeof(SceneTexture)};
+    payloads[SCENE_VERTICES] = {vertices.data(), vertices.size() * sizeof(SceneVertex)};
+    payloads[SCENE_MESHES] = {meshes.data(), meshes.size() * sizeof(SceneMesh)};
+    payloads[SCENE_STATICS] = {statics.data(), statics.size() * sizeof(SceneStatic)};
+    payloads[SCENE_TREES] = {trees.data(), trees.size() * sizeof(SceneTree)};
+    const uint32_t counts[SCENE_SECTION_COUNT] = {(uint32_t)strings.size(), (uint32_t)textures.size(),
+                                                  (uint32_t)vertices.size(), (uint32_t)meshes.size(),
+                                                  (uint32_t)statics.size(), (uint32_t)trees.size()};
+    uint32_t offset = sizeof(SceneHeader);
+    for (int section = 0; section < SCENE_SECTION_COUNT; ++section) {
+        header.sections[section] = {offset, counts[section]};
+        offset += (uint32_t)((payloads[section].second + SCENE_ALIGNMENT - 1) / SCENE_ALIGNMENT * SCENE_ALIGNMENT);
+    }
+
+    // written to a temporary name first so a crash never leaves a half written scene behind
+    std::string temporaryPath = binaryPath + ".tmp";
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "SCENE::CANNOT_WRITE " << binaryPath << std::endl;
+        return false;
+    }
+    out.write((const char *)&header, sizeof(header));
+    const char padding[SCENE_ALIGNMENT] = {};
+    for (const std::pair<const void *, size_t> &payload : payloads) {
+        out.write((const char *)payload.first, payload.second);
+        out.write(padding, (SCENE_ALIGNMENT - payload.second % SCENE_ALIGNMENT) % SCENE_ALIGNMENT);
+    }
+    out.close();
+    if (!out || std::rename(temporaryPath.c_str(), binaryPath.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        std::cerr << "SCENE::CANNOT_WRITE " << binaryPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// a compiled scene, mapped for as long as it is open
+class Scene {
+public:
+    // Maps the binary of the scene text at `path`, compiling it first if it is missing or was built from
+    // another version of the text. A binary shipped without its text is used as it is.
+    bool load(const std::string &path) {
+        TraceScope trace("scene load", path);
+        std::string binaryPath = path + "bin";
+        SourceStamp source;
+        bool hasSource = SourceStamp::stat(path, source);
+        if (open(binaryPath) && (!hasSource || current(path, binaryPath, source)))
+            return true;
+        return hasSource && compileScene(path, binaryPath) && open(binaryPath);
+    }
+
+    const SceneHeader &header() const { return *m_header; }
+    const char *string(uint32_t offset) const { return (const char *)section(SCENE_STRINGS) + offset; }
+    const char *model() const { return string(m_header->model); }
+
+    uint32_t count(SceneSectionId id) const { return m_header->sections[id].count; }
+    const SceneTexture *textures() const { return (const SceneTexture *)section(SCENE_TEXTURES); }
+    const SceneMesh *meshes() const { return (const SceneMesh *)section(SCENE_MESHES); }
+    const SceneStatic *statics() const { return (const SceneStatic *)section(SCENE_STATICS); }
+    const SceneTree *trees() const { return (const SceneTree *)section(SCENE_TREES); }
+    const SceneVertex *vertices(const SceneMesh &mesh) const {
+        return (const SceneVertex *)section(SCENE_VERTICES) + mesh.firstVertex;
+    }
+
+    void close() {
+        m_file.close();
+        m_header = nullptr;
+    }
+
+private:
+    // checks the header, that every section lies within the file and that the records only refer to what is
+    // there, a pass over the small arrays without converting anything
+    bool open(const std::string &binaryPath) {
+        close();
+        if (!m_file.open(binaryPath) || m_file.size() < sizeof(SceneHeader))
+            return false;
+        const SceneHeader *header = (const SceneHeader *)m_file.data();
+        if (std::memcmp(header->magic, SCENE_MAGIC, 4) != 0 || header->version != SCENE_VERSION)
+            return invalid();
+        const size_t recordSizes[SCENE_SECTION_COUNT] = {1, sizeof(SceneTexture), sizeof(SceneVertex), sizeof(SceneMesh),
+                                                         sizeof(SceneStatic), sizeof(SceneTree)};
+        for (int id = 0; id < SCENE_SECTION_COUNT; ++id) {
+            const SceneSection &section = header->sections[id];
+            if (section.offset % SCENE_ALIGNMENT != 0 ||
+                (uint64_t)section.offset + (uint64_t)section.count * recordSizes[id] > m_file.size())
+                return invalid();
+        }
+        // strings are read up to their NUL, the section has to end in one
+        const SceneSection &strings = header->sections[SCENE_STRINGS];
+        if (strings.count == 0 || m_file.data()[strings.offset + strings.count - 1] != '\0' ||
+            header->model >= strings.count || header->terrainTexture >= strings.count)
+            return invalid();
+        m_header = header;
+        for (uint32_t i = 0; i < count(SCENE_TEXTURES); ++i)
+            if (textures()[i].path >= strings.count)
+                return invalid();
+        for (uint32_t i = 0; i < count(SCENE_MESHES); ++i)
+            if ((uint64_t)meshes()[i].firstVertex + meshes()[i].vertexCount > count(SCENE_VERTICES))
+                return invalid();
+        for (uint32_t i = 0; i < count(SCENE_STATICS); ++i)
+            if (statics()[i].mesh >= count(SCENE_MESHES) || statics()[i].texture >= count(SCENE_TEXTURES))
+                return invalid();
+        return true;
+    }
+
+    // an unchanged mtime and size is trusted as is, otherwise the text is hashed and restamped like MeshCache does
+    bool current(const std::string &path, const std::string &binaryPath, const SourceStamp &source) const {
+        if (m_header->sourceMtime == source.mtime && m_header->sourceSize == source.size)
+            return true;
+        if (m_header->sourceSize != source.size || m_header->sourceHash != SourceStamp::hashFile(path))
+            return false;
+        SourceStamp::restamp(binaryPath, offsetof(SceneHeader, sourceMtime), source.mtime);
+        return true;
+    }
+
+    bool invalid() {
+        close();
+        return false;
+    }
+
+    const unsigned char *section(SceneSectionId id) const { return m_file.data() + m_header->sections[id].offset; }
+
+    MappedFile m_file;
+    const SceneHeader *m_header = nullptr;
+};
+
+};
+#endif //PROJECT_BASE_SCENE_H
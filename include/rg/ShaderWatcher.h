@@ -0,0 +1,140 @@
+//
+// Shader hot reload. A background thread polls the modification times of the watched shaders' sources and
+// reads the ones that changed; the frame loop then compiles them on the GL thread and swaps the programs in
+// between two frames, so a draw never sees a half replaced shader.
+//
+
+#ifndef PROJECT_BASE_SHADERWATCHER_H
+#define PROJECT_BASE_SHADERWATCHER_H
+
+#include <learnopengl/shader_m.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rg {
+
+class ShaderWatcher {
+public:
+    ShaderWatcher() = default;
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+    ~ShaderWatcher() { stop(); }
+
+    // call before start(). The files the shader includes are watched too, an edit to one rebuilds the shader
+    void watch(Shader &shader) {
+        Entry entry;
+        entry.shader = &shader;
+        entry.paths.push_back(shader.vertexPath());
+        entry.paths.push_back(shader.fragmentPath());
+        entry.paths.insert(entry.paths.end(), shader.includes().begin(), shader.includes().end());
+        for (const std::string &path : entry.paths)
+            entry.stamps.push_back(modificationTime(path));
+        m_entries.push_back(entry);
+    }
+
+    void start(std::chrono::milliseconds interval = std::chrono::milliseconds(250)) {
+        if (m_thread.joinable())
+            return;
+        m_running = true;
+        m_thread = std::thread([this, interval]() { poll(interval); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_wake.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    // compiles the changed sources read since the last call and replaces the programs that built, call on the GL
+    // thread between frames. True when any program was replaced, its plain uniforms then need setting again
+    // (uniform handles and block bindings are carried over by the shader).
+    bool applyChanges() {
+        std::vector<Change> changes;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            changes.swap(m_changes);
+        }
+        bool replaced = false;
+        for (const Change &change : changes) {
+            if (change.shader->rebuild(change.vertexSource, change.fragmentSource)) {
+                std::cout << "SHADER::RELOADED " << change.shader->vertexPath() << " + " << change.shader->fragmentPath() << std::endl;
+                replaced = true;
+            } else {
+                std::cout << "SHADER::RELOAD_FAILED, keeping the previous program" << std::endl;
+            }
+        }
+        return replaced;
+    }
+
+private:
+    // the vertex and the fragment stage first, then the includes
+    struct Entry {
+        Shader *shader;
+        std::vector<std::string> paths;
+        std::vector<uint64_t> stamps;
+    };
+
+    struct Change {
+        Shader *shader;
+        std::string vertexSource, fragmentSource;
+    };
+
+    static uint64_t modificationTime(const std::string &path) {
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0)
+            return 0;
+        return (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+    }
+
+    // background thread, only it touches m_entries once started
+    void poll(std::chrono::milliseconds interval) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_running) {
+            m_wake.wait_for(lock, interval, [this]() { return !m_running; });
+            lock.unlock();
+            std::vector<Change> changes;
+            for (Entry &entry : m_entries) {
+                std::vector<uint64_t> stamps;
+                for (const std::string &path : entry.paths)
+                    stamps.push_back(modificationTime(path));
+                // a file that is missing for a moment (editors saving through a rename) is left for the next poll
+                if (std::find(stamps.begin(), stamps.end(), 0) != stamps.end() || stamps == entry.stamps)
+                    continue;
+                Change change;
+                change.shader = entry.shader;
+                if (!Shader::readSource(entry.paths[0], change.vertexSource) ||
+                    !Shader::readSource(entry.paths[1], change.fragmentSource))
+                    continue;
+                entry.stamps = stamps;
+                changes.push_back(change);
+            }
+            lock.lock();
+            for (Change &change : changes)
+                m_changes.push_back(change);
+        }
+    }
+
+    std::vector<Entry> m_entries;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_running = false;
+    std::vector<Change> m_changes;
+};
+
+};
+#endif //PROJECT_BASE_SHADERWATCHER_H
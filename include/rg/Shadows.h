@@ -0,0 +1,252 @@
+//
+// Cascaded shadow maps for the sun. The view frustum is split in SHADOW_CASCADES slices, each fitted with a
+// bounding sphere (its size doesn't change when the camera turns) and rendered into one layer of a depth texture
+// array, through a light projection snapped to texels so standing still never makes the edges crawl.
+// Everything that casts is static, so a cascade is rendered once and kept until the sun has turned past
+// SHADOW_REFRESH_ANGLE or the slice has moved out of the padded area the cascade covers. The nearest cascade is
+// refreshed whenever it needs it, the farther ones at most one per frame, the stalest first.
+//
+
+#ifndef PROJECT_BASE_SHADOWS_H
+#define PROJECT_BASE_SHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <rg/RenderQueue.h>
+#include <rg/UniformBlocks.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+const unsigned int SHADOW_MAP_SIZE = 2048;
+// past the queue's units, so drawing never rebinds it
+const unsigned int SHADOW_MAP_TEXTURE_UNIT = MAX_DRAW_TEXTURES;
+// the sun turns 0.1 rad/s, this refreshes the cascades about 6 times a second
+const float SHADOW_REFRESH_ANGLE = glm::radians(1.0f);
+// cascades cover their slice's sphere plus this much of its radius, the slack the camera can move in
+const float SHADOW_CASCADE_MARGIN = 0.2f;
+// how far towards the sun casters outside the slice are still picked up
+const float SHADOW_CASTER_DISTANCE = 100.0f;
+
+// what update() decided for one frame, kept apart from the cascades so a frame can be prepared while the
+// previous one is still being drawn
+struct ShadowFrame {
+    ShadowsBlock block = {};
+    // cascades to render before the block is used
+    std::vector<unsigned int> cascades;
+};
+
+class CascadedShadows {
+public:
+
+    // `distance` is how far from the camera shadows reach
+    void create(float distance, float cameraNear) {
+        glGenTextures(1, &m_texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // sampler2DArrayShadow, linear filtering then gives 2x2 PCF per tap for free
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(1, &m_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // practical split scheme, three quarters logarithmic and one quarter uniform
+        m_near = cameraNear;
+        float start = cameraNear;
+        for (unsigned int i = 0; i < SHADOW_CASCADES; ++i) {
+            float fraction = (i + 1) / (float)SHADOW_CASCADES;
+            float logarithmic = cameraNear * std::pow(distance / cameraNear, fraction);
+            float uniform = cameraNear + (distance - cameraNear) * fraction;
+            m_cascades[i].start = start;
+            m_cascades[i].end = 0.75f * logarithmic + 0.25f * uniform;
+            m_block.cascadeEnd[i] = m_cascades[i].end;
+            start = m_cascades[i].end;
+        }
+    }
+
+    // decides which cascades get rendered this frame. `viewProjection` is the camera's, `cameraFar` the far plane
+    // of its projection, `sunDirection` points from the sun into the scene (zero turns shadows off).
+    // Touches no GL state, so it can run on any thread, one frame at a time.
+    void update(const glm::mat4 &viewProjection, float cameraFar, glm::vec3 sunDirection, bool enabled, ShadowFrame &frame) {
+        m_render = &frame.cascades;
+        m_render->clear();
+        ++m_frame;
+        float length = glm::length(sunDirection);
+        m_block.shadowsOn = enabled && length > 0.0001f;
+        frame.block = m_block;
+        if (!m_block.shadowsOn)
+            return;
+        sunDirection /= length;
+        glm::mat4 rotation = lightRotation(sunDirection);
+
+        // the far and near corners of the four frustum edges
+        glm::mat4 inverse = glm::inverse(viewProjection);
+        glm::vec3 nearCorners[4], farCorners[4];
+        for (int i = 0; i < 4; ++i) {
+            glm::vec2 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+            glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+            glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+            nearCorners[i] = glm::vec3(nearPoint) / nearPoint.w;
+            farCorners[i] = glm::vec3(farPoint) / farPoint.w;
+        }
+
+        int farthestStale = -1;
+        for (unsigned int i = 0; i < SHADOW_CASCADES; ++i) {
+            Cascade &cascade = m_cascades[i];
+            if (m_retry[i].exchange(false, std::memory_order_acq_rel))
+                cascade.rendered = false;
+            // view depth is linear along every edge, so the slice corners are plain interpolations
+            glm::vec3 corners[8];
+            for (int c = 0; c < 4; ++c) {
+                float t0 = (cascade.start - m_near) / (cameraFar - m_near);
+                float t1 = (cascade.end - m_near) / (cameraFar - m_near);
+                corners[c] = glm::mix(nearCorners[c], farCorners[c], t0);
+                corners[c + 4] = glm::mix(nearCorners[c], farCorners[c], t1);
+            }
+            glm::vec3 center(0.0f);
+            for (const glm::vec3 &corner : corners)
+                center += corner / 8.0f;
+            float radius = 0.0f;
+            for (const glm::vec3 &corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+
+            if (!cascade.stale(sunDirection, rotation, center, radius))
+                continue;
+            cascade.wantedCenter = center;
+            cascade.wantedRadius = radius;
+            // the first frame fills every cascade, after that the far ones take turns
+            if (i == 0 || !cascade.rendered) {
+                fit(i, sunDirection, rotation);
+            } else if (farthestStale < 0 || cascade.frame < m_cascades[farthestStale].frame) {
+                farthestStale = (int)i;
+            }
+        }
+        if (farthestStale >= 0)
+            fit((unsigned int)farthestStale, sunDirection, rotation);
+        frame.block = m_block;
+    }
+
+    // the block of `frame` for the lit passes, its cascades are drawn before, each between beginCascade() and endCascade()
+    void upload(const ShadowFrame &frame, StreamBuffer &stream) {
+        stream.uploadUniformBlock(SHADOWS_BLOCK_BINDING, &frame.block, sizeof(ShadowsBlock));
+    }
+
+    void beginCascade(unsigned int cascade) {
+        glGetIntegerv(GL_VIEWPORT, m_viewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, (GLint)cascade);
+        glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        // slope scaled, so the leaves facing away from the sun don't shadow themselves
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+    }
+
+    void endCascade() {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_savedFramebuffer);
+        glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+    }
+
+    // for a cascade whose casters couldn't be drawn: the next update() counts it as never rendered and fits it
+    // again right away. Safe to call while a job runs update() for the next frame, that one may miss it.
+    void retry(unsigned int cascade) {
+        m_retry[cascade].store(true, std::memory_order_release);
+    }
+
+    // the shadow map on SHADOW_MAP_TEXTURE_UNIT for the lit passes
+    void bind() const {
+        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void destroy() {
+        glDeleteFramebuffers(1, &m_framebuffer);
+        glDeleteTextures(1, &m_texture);
+        m_framebuffer = m_texture = 0;
+    }
+
+private:
+    struct Cascade {
+        // view depths of the slice
+        float start = 0.0f, end = 0.0f;
+        // what the layer was rendered with
+        bool rendered = false;
+        unsigned int frame = 0;
+        glm::vec3 direction = glm::vec3(0.0f);
+        glm::vec3 lightCenter = glm::vec3(0.0f);
+        float halfSize = 0.0f;
+        // sphere of the current slice while it waits for its turn
+        glm::vec3 wantedCenter = glm::vec3(0.0f);
+        float wantedRadius = 0.0f;
+
+        bool stale(const glm::vec3 &sunDirection, const glm::mat4 &rotation, const glm::vec3 &center, float radius) const {
+            if (!rendered || glm::dot(direction, sunDirection) < std::cos(SHADOW_REFRESH_ANGLE))
+                return true;
+            glm::vec3 offset = glm::abs(glm::vec3(rotation * glm::vec4(center, 1.0f)) - lightCenter);
+            return std::max(offset.x, std::max(offset.y, offset.z)) + radius > halfSize;
+        }
+    };
+
+    // rotation into light space around the origin, the snapping grid is fixed in it
+    static glm::mat4 lightRotation(const glm::vec3 &sunDirection) {
+        glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        return glm::lookAt(glm::vec3(0.0f), sunDirection, up);
+    }
+
+    void fit(unsigned int index, const glm::vec3 &sunDirection, const glm::mat4 &rotation) {
+        Cascade &cascade = m_cascades[index];
+        // the size is rounded up so that it only changes in steps and the texel grid stays put in between
+        float halfSize = std::ceil(cascade.wantedRadius * (1.0f + SHADOW_CASCADE_MARGIN));
+        float texel = 2.0f * halfSize / SHADOW_MAP_SIZE;
+        glm::vec3 lightCenter = glm::vec3(rotation * glm::vec4(cascade.wantedCenter, 1.0f));
+        lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+        lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+
+        // light space looks down -z, the box reaches SHADOW_CASTER_DISTANCE further towards the sun
+        glm::mat4 projection = glm::ortho(lightCenter.x - halfSize, lightCenter.x + halfSize,
+                                          lightCenter.y - halfSize, lightCenter.y + halfSize,
+                                          -lightCenter.z - halfSize - SHADOW_CASTER_DISTANCE, -lightCenter.z + halfSize);
+        m_block.lightViewProjection[index] = projection * rotation;
+        m_block.cascadeTexel[index] = texel;
+
+        cascade.rendered = true;
+        cascade.frame = m_frame;
+        cascade.direction = sunDirection;
+        cascade.lightCenter = lightCenter;
+        cascade.halfSize = halfSize;
+        m_render->push_back(index);
+    }
+
+    Cascade m_cascades[SHADOW_CASCADES];
+    std::atomic<bool> m_retry[SHADOW_CASCADES] = {};
+    ShadowsBlock m_block = {};
+    std::vector<unsigned int> *m_render = nullptr;
+    float m_near = 0.1f;
+    unsigned int m_frame = 0;
+    unsigned int m_texture = 0, m_framebuffer = 0;
+    GLint m_viewport[4] = {};
+    GLint m_savedFramebuffer = 0;
+};
+
+};
+#endif //PROJECT_BASE_SHADOWS_H
@@ -0,0 +1,196 @@
+//
+// Occlusion culling on the CPU, for the paths without compute shaders: a few nearby occluders are rasterized
+// into a small depth buffer, which is reduced into a pyramid keeping the farthest depth of every block, and
+// instance bounds are tested against it before they are batched. The buffer stores 1 / w, which is linear in
+// screen space and needs no near or far plane, and is 0 where nothing was drawn, which hides nothing.
+//
+
+#ifndef PROJECT_BASE_SOFTWAREOCCLUSION_H
+#define PROJECT_BASE_SOFTWAREOCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Culling.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+// size of the depth buffer, about a fifth of the window in each direction
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 128;
+// clip space w below which geometry counts as touching the eye
+const float OCCLUSION_NEAR_W = 0.05f;
+
+class SoftwareOcclusion {
+public:
+    SoftwareOcclusion() {
+        for (int width = OCCLUSION_WIDTH, height = OCCLUSION_HEIGHT;; width = std::max(width / 2, 1), height = std::max(height / 2, 1)) {
+            m_levels.push_back({width, height, std::vector<float>((size_t)width * height, 0.0f)});
+            if (width == 1 && height == 1)
+                break;
+        }
+    }
+
+    // clears the buffer for occluders seen through `viewProjection`
+    void begin(const glm::mat4 &viewProjection) {
+        m_viewProjection = viewProjection;
+        std::fill(m_levels[0].depth.begin(), m_levels[0].depth.end(), 0.0f);
+    }
+
+    // a world space triangle, the part of it in front of the near plane
+    void addTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+        glm::vec4 clip[3] = {m_viewProjection * glm::vec4(a, 1.0f), m_viewProjection * glm::vec4(b, 1.0f),
+                             m_viewProjection * glm::vec4(c, 1.0f)};
+        // clipped against w = OCCLUSION_NEAR_W, a triangle becomes a quad at most
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; ++i) {
+            const glm::vec4 &from = clip[i], &to = clip[(i + 1) % 3];
+            bool fromInside = from.w >= OCCLUSION_NEAR_W, toInside = to.w >= OCCLUSION_NEAR_W;
+            if (fromInside)
+                polygon[count++] = from;
+            if (fromInside != toInside)
+                polygon[count++] = from + (to - from) * ((OCCLUSION_NEAR_W - from.w) / (to.w - from.w));
+        }
+        for (int i = 2; i < count; ++i)
+            rasterize(polygon[0], polygon[i - 1], polygon[i]);
+    }
+
+    // the box [localMin, localMax] placed with `transform`
+    void addBox(const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform) {
+        glm::vec3 corners[8];
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 local(i & 1 ? localMax.x : localMin.x, i & 2 ? localMax.y : localMin.y, i & 4 ? localMax.z : localMin.z);
+            corners[i] = glm::vec3(transform * glm::vec4(local, 1.0f));
+        }
+        // two triangles per face, the faces facing away are hidden by the ones in front anyway
+        static const int faces[6][4] = {{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}};
+        for (const int *face : faces) {
+            addTriangle(corners[face[0]], corners[face[1]], corners[face[2]]);
+            addTriangle(corners[face[0]], corners[face[2]], corners[face[3]]);
+        }
+    }
+
+    // builds the pyramid, after the last occluder
+    void finish() {
+        for (size_t level = 1; level < m_levels.size(); ++level) {
+            const Level &below = m_levels[level - 1];
+            Level &above = m_levels[level];
+            for (int y = 0; y < above.height; ++y) {
+                for (int x = 0; x < above.width; ++x) {
+                    // odd sizes fold their last row or column into the texel before
+                    int x1 = x == above.width - 1 ? below.width - 1 : 2 * x + 1;
+                    int y1 = y == above.height - 1 ? below.height - 1 : 2 * y + 1;
+                    float farthest = INFINITY;
+                    for (int sy = std::min(2 * y, below.height - 1); sy <= y1; ++sy)
+                        for (int sx = std::min(2 * x, below.width - 1); sx <= x1; ++sx)
+                            farthest = std::min(farthest, below.depth[(size_t)sy * below.width + sx]);
+                    above.depth[(size_t)y * above.width + x] = farthest;
+                }
+            }
+        }
+    }
+
+    // whether the box around `sphere` is behind the occluders everywhere it covers
+    bool occluded(const BoundingSphere &sphere) const {
+        float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+        float nearest = 0.0f;
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 corner = sphere.center + glm::vec3(i & 1 ? sphere.radius : -sphere.radius,
+                                                         i & 2 ? sphere.radius : -sphere.radius,
+                                                         i & 4 ? sphere.radius : -sphere.radius);
+            glm::vec4 clip = m_viewProjection * glm::vec4(corner, 1.0f);
+            if (clip.w < OCCLUSION_NEAR_W)
+                return false;
+            float x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+            float y = (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::max(nearest, 1.0f / clip.w);
+        }
+        int x0 = std::max((int)std::floor(minX), 0), x1 = std::min((int)std::floor(maxX), OCCLUSION_WIDTH - 1);
+        int y0 = std::max((int)std::floor(minY), 0), y1 = std::min((int)std::floor(maxY), OCCLUSION_HEIGHT - 1);
+        if (x0 > x1 || y0 > y1)
+            return false;
+        // the level where the box covers two texels at most in each direction
+        int extent = std::max(x1 - x0, y1 - y0) + 1;
+        int level = 0;
+        while ((1 << level) < extent && level + 1 < (int)m_levels.size())
+            ++level;
+        const Level &texels = m_levels[level];
+        float farthest = INFINITY;
+        for (int y = std::min(y0 >> level, texels.height - 1); y <= std::min(y1 >> level, texels.height - 1); ++y)
+            for (int x = std::min(x0 >> level, texels.width - 1); x <= std::min(x1 >> level, texels.width - 1); ++x)
+                farthest = std::min(farthest, texels.depth[(size_t)y * texels.width + x]);
+        return nearest < farthest;
+    }
+
+    // drops the occluded ones of `visible`, indices into `spheres`, and moves them from stats.visible to
+    // stats.occluded
+    void cullIndices(const std::vector<BoundingSphere> &spheres, std::vector<unsigned int> &visible, CullStats &stats) const {
+        size_t kept = 0;
+        for (unsigned int index : visible) {
+            if (!occluded(spheres[index]))
+                visible[kept++] = index;
+        }
+        unsigned int occludedCount = (unsigned int)(visible.size() - kept);
+        visible.resize(kept);
+        stats.occluded += occludedCount;
+        stats.visible -= std::min(stats.visible, occludedCount);
+    }
+
+private:
+    struct Level {
+        int width, height;
+        std::vector<float> depth;
+    };
+
+    // a clip space triangle, all of it in front of the near plane
+    void rasterize(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c) {
+        glm::vec3 screen[3];
+        const glm::vec4 *clip[3] = {&a, &b, &c};
+        for (int i = 0; i < 3; ++i) {
+            float inverseW = 1.0f / clip[i]->w;
+            screen[i] = glm::vec3((clip[i]->x * inverseW * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+                                  (clip[i]->y * inverseW * 0.5f + 0.5f) * OCCLUSION_HEIGHT, inverseW);
+        }
+        float area = edge(screen[0], screen[1], screen[2]);
+        if (std::abs(area) < 1e-6f)
+            return;
+        // either winding, both sides of an occluder hide what is behind it
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        int x0 = std::max((int)std::floor(std::min({screen[0].x, screen[1].x, screen[2].x})), 0);
+        int x1 = std::min((int)std::ceil(std::max({screen[0].x, screen[1].x, screen[2].x})), OCCLUSION_WIDTH - 1);
+        int y0 = std::max((int)std::floor(std::min({screen[0].y, screen[1].y, screen[2].y})), 0);
+        int y1 = std::min((int)std::ceil(std::max({screen[0].y, screen[1].y, screen[2].y})), OCCLUSION_HEIGHT - 1);
+        std::vector<float> &depth = m_levels[0].depth;
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                glm::vec3 center(x + 0.5f, y + 0.5f, 0.0f);
+                float w0 = edge(screen[1], screen[2], center) * sign;
+                float w1 = edge(screen[2], screen[0], center) * sign;
+                float w2 = edge(screen[0], screen[1], center) * sign;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+                float inverseW = (w0 * screen[0].z + w1 * screen[1].z + w2 * screen[2].z) / (area * sign);
+                float &texel = depth[(size_t)y * OCCLUSION_WIDTH + x];
+                texel = std::max(texel, inverseW);
+            }
+        }
+    }
+
+    static float edge(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &p) {
+        return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+    }
+
+    glm::mat4 m_viewProjection = glm::mat4(1.0f);
+    std::vector<Level> m_levels;
+};
+
+};
+#endif //PROJECT_BASE_SOFTWAREOCCLUSION_H
@@ -0,0 +1,119 @@
+//
+// World-static geometry merged into one vertex buffer and drawn with a single call. Quads are transformed
+// to world space once when the batch is built, and their textures are resampled into the layers of one
+// MaterialArray, so the draw needs neither a model matrix nor a texture switch.
+//
+
+#ifndef PROJECT_BASE_STATICBATCH_H
+#define PROJECT_BASE_STATICBATCH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader_m.h>
+#include <rg/MaterialArray.h>
+#include <rg/RenderQueue.h>
+
+#include <vector>
+
+namespace rg {
+
+struct StaticBatchVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+    // layer in the texture array, and 1 for textures that were clamped instead of repeated
+    glm::vec2 material;
+};
+
+class StaticBatch {
+public:
+    // registers a texture made by the TextureLoader and returns its layer
+    unsigned int addTexture(unsigned int texture, bool clamp = false) {
+        return m_materials.add(texture, clamp);
+    }
+
+    // appends the triangles of `vertices` (6 floats of position and normal, 2 of texture coordinates per
+    // vertex, as the scene arrays are laid out) moved to world space with `transform`
+    void addTriangles(const float *vertices, unsigned int vertexCount, const glm::mat4 &transform, unsigned int layer) {
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+        for (unsigned int i = 0; i < vertexCount; ++i) {
+            const float *v = vertices + i * 8;
+            StaticBatchVertex vertex;
+            vertex.position = glm::vec3(transform * glm::vec4(v[0], v[1], v[2], 1.0f));
+            vertex.normal = glm::normalize(normalMatrix * glm::vec3(v[3], v[4], v[5]));
+            vertex.texCoords = glm::vec2(v[6], v[7]);
+            vertex.material = glm::vec2((float)layer, m_materials.clamped(layer) ? 1.0f : 0.0f);
+            m_vertices.push_back(vertex);
+        }
+        m_dirty = true;
+    }
+
+    // throws away the geometry and textures, to be followed by the add calls and build() of the changed scene
+    void clear() {
+        m_vertices.clear();
+        m_materials.clear();
+        m_dirty = true;
+    }
+
+    // uploads the geometry and allocates the texture array, only needed again after the scene changed
+    void build() {
+        if (!m_vao) {
+            glGenVertexArrays(1, &m_vao);
+            glGenBuffers(1, &m_vbo);
+        }
+        glBindVertexArray(m_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+        glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(StaticBatchVertex), m_vertices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), (void *)offsetof(StaticBatchVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), (void *)offsetof(StaticBatchVertex, normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), (void *)offsetof(StaticBatchVertex, texCoords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), (void *)offsetof(StaticBatchVertex, material));
+        glBindVertexArray(0);
+        m_vertexCount = (unsigned int)m_vertices.size();
+        m_materials.build();
+        m_dirty = false;
+    }
+
+    // copies the textures that finished streaming into their layers, cheap once all of them are in
+    void update() { m_materials.update(); }
+
+    // the whole batch in one draw, `shader` is omnishader built with TEXTURE_ARRAY and static_batch.vs
+    void draw(Shader &shader) {
+        RenderQueue queue;
+        submit(queue, shader);
+        queue.flush();
+    }
+
+    void submit(RenderQueue &queue, Shader &shader) {
+        if (m_dirty)
+            build();
+        DrawItem item;
+        item.shader = &shader;
+        item.vertexArray = m_vao;
+        item.addTexture(GL_TEXTURE_2D_ARRAY, m_materials.texture());
+        item.count = m_vertexCount;
+        queue.submit(item);
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &m_vao);
+        glDeleteBuffers(1, &m_vbo);
+        m_materials.destroy();
+        m_vao = m_vbo = 0;
+    }
+
+private:
+    std::vector<StaticBatchVertex> m_vertices;
+    MaterialArray m_materials;
+    bool m_dirty = true;
+
+    unsigned int m_vao = 0, m_vbo = 0, m_vertexCount = 0;
+};
+
+};
+#endif //PROJECT_BASE_STATICBATCH_H
@@ -0,0 +1,194 @@
+//
+// Streaming buffer for the data every frame uploads: instance transforms, uniform blocks and the light lists.
+// Everything is written straight into one buffer the GPU reads from, without a driver side copy or an
+// implicit sync:
+//   - with buffer storage, the buffer is mapped once for good (persistent and coherent) and split into
+//     STREAM_REGIONS regions, one per frame in flight. A frame only writes its own region, after waiting on
+//     the fence of the frame that used it last.
+//   - without, the buffer is used as one ring of two frames. Every range is mapped unsynchronized, as nothing
+//     before it in the buffer is written twice, and the buffer is orphaned at the start of a frame that would
+//     not fit before the end, so the draws still reading the old storage keep it. A frame never wraps in its
+//     middle: the uniform blocks bound at its start stay in the storage its later draws read.
+//
+
+#ifndef PROJECT_BASE_STREAMBUFFER_H
+#define PROJECT_BASE_STREAMBUFFER_H
+
+#include <glad/glad.h>
+
+#include <rg/GLExtensions.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace rg {
+
+// frames the CPU may be ahead of the GPU, one more than the frame packets, which the GPU lags behind
+const unsigned int STREAM_REGIONS = 3;
+
+// a range of the buffer, `data` is where it is written, null when it didn't fit
+struct StreamRange {
+    void *data = nullptr;
+    GLintptr offset = 0;
+    GLsizeiptr size = 0;
+};
+
+class StreamBuffer {
+public:
+    // `frameSize` bytes can be allocated per frame
+    void create(GLsizeiptr frameSize) {
+        m_frameSize = frameSize;
+        m_persistent = glext::supportsBufferStorage();
+        m_size = m_persistent ? frameSize * STREAM_REGIONS : frameSize * 2;
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        if (m_persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, m_size, nullptr, flags);
+            m_mapped = (unsigned char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, m_size, flags);
+            if (!m_mapped) {
+                std::cout << "ERROR::STREAM_BUFFER:: persistent mapping failed, streaming through glMapBufferRange" << std::endl;
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                glDeleteBuffers(1, &m_buffer);
+                glGenBuffers(1, &m_buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+                m_persistent = false;
+                m_size = frameSize * 2;
+            }
+        }
+        if (!m_persistent)
+            glBufferData(GL_COPY_WRITE_BUFFER, m_size, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        m_cursor = 0;
+        m_frameStart = 0;
+        m_region = 0;
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        m_uniformAlignment = alignment;
+    }
+
+    // before the frame's first allocation: moves on to the next region once the GPU is done with it, or on
+    // through the ring, orphaning it when the frame could run past its end
+    void beginFrame() {
+        if (!m_persistent) {
+            if (m_cursor + m_frameSize > m_size) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, m_size, nullptr, GL_STREAM_DRAW);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                m_cursor = 0;
+            }
+            m_frameStart = m_cursor;
+            return;
+        }
+        m_region = (m_region + 1) % STREAM_REGIONS;
+        GLsync &fence = m_fences[m_region];
+        if (fence) {
+            GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        m_cursor = 0;
+    }
+
+    // Space for `size` bytes at a multiple of `alignment`, to be written and then handed to commit() before
+    // the next allocation. A frame that asks for more than frameSize bytes gets empty ranges.
+    StreamRange allocate(GLsizeiptr size, GLsizeiptr alignment = 16) {
+        StreamRange range;
+        GLsizeiptr offset = (m_cursor + alignment - 1) / alignment * alignment;
+        if (size <= 0 || offset + size > (m_persistent ? m_frameSize : m_frameStart + m_frameSize)) {
+            if (size > 0 && !m_overflowReported) {
+                std::cout << "ERROR::STREAM_BUFFER:: " << size << " bytes don't fit the " << m_frameSize
+                          << " byte frame" << std::endl;
+                m_overflowReported = true;
+            }
+            return range;
+        }
+        m_cursor = offset + size;
+        range.size = size;
+        if (m_persistent) {
+            range.offset = m_region * m_frameSize + offset;
+            range.data = m_mapped + range.offset;
+        }
+        else {
+            range.offset = offset;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+            range.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT |
+                                          GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        return range;
+    }
+
+    // the range is written, the draws after this may read it
+    void commit(const StreamRange &range) {
+        if (m_persistent || !range.data)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // allocate(), a copy of `data` and commit() in one
+    StreamRange upload(const void *data, GLsizeiptr size, GLsizeiptr alignment = 16) {
+        StreamRange range = allocate(size, alignment);
+        if (range.data) {
+            std::memcpy(range.data, data, size);
+            commit(range);
+        }
+        return range;
+    }
+
+    // `size` bytes of `block` for the uniform block at `binding`, until the next upload to it
+    StreamRange uploadUniformBlock(GLuint binding, const void *block, GLsizeiptr size) {
+        StreamRange range = upload(block, size, m_uniformAlignment);
+        if (range.data)
+            glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_buffer, range.offset, range.size);
+        return range;
+    }
+
+    // after the frame's last draw that reads the buffer
+    void endFrame() {
+        if (m_persistent)
+            m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    unsigned int buffer() const { return m_buffer; }
+    bool persistent() const { return m_persistent; }
+
+    void destroy() {
+        for (GLsync &fence : m_fences) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (m_persistent && m_buffer) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+        m_mapped = nullptr;
+    }
+
+private:
+    unsigned int m_buffer = 0;
+    bool m_persistent = false;
+    bool m_overflowReported = false;
+    GLsizeiptr m_frameSize = 0;
+    GLsizeiptr m_size = 0;
+    // offset of the next allocation, inside the frame's region or the ring
+    GLsizeiptr m_cursor = 0;
+    // where the ring's current frame began
+    GLsizeiptr m_frameStart = 0;
+    unsigned int m_region = 0;
+    GLsizeiptr m_uniformAlignment = 256;
+    unsigned char *m_mapped = nullptr;
+    GLsync m_fences[STREAM_REGIONS] = {};
+};
+
+};
+#endif //PROJECT_BASE_STREAMBUFFER_H
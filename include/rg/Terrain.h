@@ -0,0 +1,268 @@
+//
+// Heightfield terrain drawn with geometry clipmaps. One (TERRAIN_GRID + 1)^2 vertex grid is reused for every
+// level: level 0 is drawn whole around the camera, every coarser level at twice the spacing as a ring around
+// the one inside it. Heights come from a R32F texture array with a layer per level, addressed toroidally, so
+// when the camera moves a level only uploads the rows and columns it scrolled onto. The grid vertices morph
+// into the next coarser level near a level's border, which keeps neighbouring levels crack free.
+//
+// The heights are point samples of a procedural heightfield on a TERRAIN_SPACING lattice, and the CPU queries
+// the same lattice: trees and the camera stand on the level 0 surface wherever they are.
+//
+
+#ifndef PROJECT_BASE_TERRAIN_H
+#define PROJECT_BASE_TERRAIN_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader_m.h>
+#include <rg/Hash.h>
+#include <rg/RenderQueue.h>
+#include <rg/StreamBuffer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// world units between the lattice points of level 0
+const float TERRAIN_SPACING = 1.0f;
+// quads along each side of the grid, a multiple of 4 so the ring holes line up with the level inside
+const int TERRAIN_GRID = 64;
+const unsigned int TERRAIN_LEVELS = 5;
+// texels along each side of a level's layer, enough for the grid and a texel around it for the normals
+const int TERRAIN_TEXELS = 128;
+// the flat floor the scene was built on, hills rise and fall around it
+const float TERRAIN_BASE = -3.0f;
+
+// Sum of five octaves of value noise on the integer lattice, the same for a given seed everywhere.
+class Heightfield {
+public:
+    explicit Heightfield(uint32_t seed = 20201115u, float relief = 4.0f) : m_seed(seed), m_relief(relief) {}
+
+    // ground height at lattice point (x, z), at (x, z) * TERRAIN_SPACING in the world
+    float sample(int x, int z) const {
+        float height = 0.0f;
+        float amplitude = m_relief;
+        float wavelength = 96.0f;
+        for (uint32_t octave = 0; octave < 5; ++octave) {
+            height += amplitude * (valueNoise(x / wavelength, z / wavelength, m_seed + octave) * 2.0f - 1.0f);
+            amplitude *= 0.5f;
+            wavelength *= 0.5f;
+        }
+        return TERRAIN_BASE + height;
+    }
+
+    // ground height at world (x, z), bilinear between the four lattice points around it
+    float height(float x, float z) const {
+        float fx = x / TERRAIN_SPACING, fz = z / TERRAIN_SPACING;
+        int ix = (int)std::floor(fx), iz = (int)std::floor(fz);
+        float tx = fx - ix, tz = fz - iz;
+        float near = sample(ix, iz) + (sample(ix + 1, iz) - sample(ix, iz)) * tx;
+        float far = sample(ix, iz + 1) + (sample(ix + 1, iz + 1) - sample(ix, iz + 1)) * tx;
+        return near + (far - near) * tz;
+    }
+
+private:
+    // smoothly interpolated hash values of the integer points around (x, z), in [0, 1]
+    static float valueNoise(float x, float z, uint32_t seed) {
+        int ix = (int)std::floor(x), iz = (int)std::floor(z);
+        float tx = x - ix, tz = z - iz;
+        tx = tx * tx * (3.0f - 2.0f * tx);
+        tz = tz * tz * (3.0f - 2.0f * tz);
+        float a = hashToUnit(hashCoords(ix, iz, seed)), b = hashToUnit(hashCoords(ix + 1, iz, seed));
+        float c = hashToUnit(hashCoords(ix, iz + 1, seed)), d = hashToUnit(hashCoords(ix + 1, iz + 1, seed));
+        return (a + (b - a) * tx) + ((c + (d - c) * tx) - (a + (b - a) * tx)) * tz;
+    }
+
+    uint32_t m_seed;
+    float m_relief;
+};
+
+class TerrainClipmap {
+public:
+    void create(const Heightfield &heightfield) {
+        m_heightfield = &heightfield;
+
+        std::vector<glm::vec2> vertices;
+        for (int z = 0; z <= TERRAIN_GRID; ++z)
+            for (int x = 0; x <= TERRAIN_GRID; ++x)
+                vertices.push_back(glm::vec2((float)x, (float)z));
+        // the whole grid for level 0, then one ring per position the hole of the level inside can take:
+        // a quarter of the grid in, or one more quad along either axis
+        std::vector<unsigned short> indices;
+        addQuads(indices, -1, -1);
+        m_fullCount = (unsigned int)indices.size();
+        for (int variant = 0; variant < 4; ++variant) {
+            size_t first = indices.size();
+            m_ringFirst[variant] = first * sizeof(unsigned short);
+            addQuads(indices, TERRAIN_GRID / 4 + (variant & 1), TERRAIN_GRID / 4 + (variant >> 1));
+            m_ringCount = (unsigned int)(indices.size() - first);
+        }
+
+        glGenVertexArrays(1, &m_vao);
+        glGenBuffers(1, &m_vbo);
+        glGenBuffers(1, &m_ebo);
+        glBindVertexArray(m_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void *)0);
+        glBindVertexArray(0);
+
+        glGenTextures(1, &m_heights);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_heights);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, TERRAIN_TEXELS, TERRAIN_TEXELS, TERRAIN_LEVELS, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (Level &level : m_levels)
+            level.valid = false;
+    }
+
+    // moves every level's grid with the camera and uploads the heights it scrolled onto
+    void update(const glm::vec3 &eye) {
+        for (unsigned int l = 0; l < TERRAIN_LEVELS; ++l) {
+            Level &level = m_levels[l];
+            float spacing = TERRAIN_SPACING * (float)(1 << l);
+            // an even origin puts the grid's border on the lattice of the level around it
+            glm::ivec2 origin(2 * (int)std::floor((eye.x / spacing - TERRAIN_GRID / 2) * 0.5f),
+                              2 * (int)std::floor((eye.z / spacing - TERRAIN_GRID / 2) * 0.5f));
+            scroll(l, origin);
+
+            glm::mat4 &p = m_placement[l];
+            p = glm::mat4(0.0f);
+            p[0] = glm::vec4((float)origin.x, (float)origin.y, spacing, (float)l);
+            // morphs into level l + 1 over the outer eighth of the grid, the coarsest level has nothing to morph into
+            p[1] = glm::vec4(l + 1 < TERRAIN_LEVELS ? 1.0f : 0.0f, TERRAIN_GRID / 8, 0.0f, 0.0f);
+            level.origin = origin;
+        }
+        // where the hole of each ring sits, relative to its grid
+        for (unsigned int l = 1; l < TERRAIN_LEVELS; ++l) {
+            glm::ivec2 inner = m_levels[l - 1].origin / 2 - m_levels[l].origin;
+            m_variant[l] = (inner.x - TERRAIN_GRID / 4) | (inner.y - TERRAIN_GRID / 4) << 1;
+        }
+    }
+
+    // One draw per level, the same number of vertices however large the world is. The levels' placement is
+    // read per draw through the instance attribute, from `stream`.
+    void submit(RenderQueue &queue, Shader &shader, unsigned int diffuseTexture, StreamBuffer &stream) {
+        static const std::vector<std::string> samplers = {"material.texture_diffuse1", "heights"};
+        StreamRange range = stream.upload(m_placement, sizeof(m_placement), sizeof(glm::mat4));
+        if (!range.data)
+            return;
+        unsigned int firstInstance = (unsigned int)(range.offset / sizeof(glm::mat4));
+        for (unsigned int l = 0; l < TERRAIN_LEVELS; ++l) {
+            DrawItem item;
+            item.shader = &shader;
+            item.vertexArray = m_vao;
+            item.addTexture(GL_TEXTURE_2D, diffuseTexture);
+            item.addTexture(GL_TEXTURE_2D_ARRAY, m_heights);
+            item.samplerNames = &samplers;
+            item.indexType = GL_UNSIGNED_SHORT;
+            item.first = l == 0 ? 0 : m_ringFirst[m_variant[l]];
+            item.count = l == 0 ? m_fullCount : m_ringCount;
+            item.instanceCount = 1;
+            item.instanceBuffer = stream.buffer();
+            item.firstInstance = firstInstance + l;
+            item.instanceLocation = 3;
+            queue.submit(item);
+        }
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &m_vao);
+        glDeleteBuffers(1, &m_vbo);
+        glDeleteBuffers(1, &m_ebo);
+        glDeleteTextures(1, &m_heights);
+        m_vao = m_vbo = m_ebo = m_heights = 0;
+    }
+
+private:
+    struct Level {
+        glm::ivec2 origin;
+        bool valid = false;
+    };
+
+    // two triangles per grid quad, leaving out the half grid wide hole at (holeX, holeZ) when there is one
+    static void addQuads(std::vector<unsigned short> &indices, int holeX, int holeZ) {
+        for (int z = 0; z < TERRAIN_GRID; ++z) {
+            for (int x = 0; x < TERRAIN_GRID; ++x) {
+                if (holeX >= 0 && x >= holeX && x < holeX + TERRAIN_GRID / 2 && z >= holeZ && z < holeZ + TERRAIN_GRID / 2)
+                    continue;
+                unsigned short corner = (unsigned short)(z * (TERRAIN_GRID + 1) + x);
+                unsigned short below = (unsigned short)(corner + TERRAIN_GRID + 1);
+                indices.insert(indices.end(), {corner, below, (unsigned short)(corner + 1)});
+                indices.insert(indices.end(), {(unsigned short)(corner + 1), below, (unsigned short)(below + 1)});
+            }
+        }
+    }
+
+    // uploads what the texel window [origin - 1, origin + TERRAIN_GRID + 2) of level `l` gained since the last frame
+    void scroll(unsigned int l, const glm::ivec2 &origin) {
+        const int window = TERRAIN_GRID + 3;
+        Level &level = m_levels[l];
+        glm::ivec2 first = origin - glm::ivec2(1);
+        glm::ivec2 moved = origin - level.origin;
+        if (!level.valid || std::abs(moved.x) >= window || std::abs(moved.y) >= window) {
+            refresh(l, first.x, first.y, window, window);
+            level.valid = true;
+            return;
+        }
+        if (moved.x != 0)
+            refresh(l, moved.x > 0 ? first.x + window - moved.x : first.x, first.y, std::abs(moved.x), window);
+        if (moved.y != 0)
+            refresh(l, first.x, moved.y > 0 ? first.y + window - moved.y : first.y, window, std::abs(moved.y));
+    }
+
+    // heights of level `l` lattice points [x, x + width) x [z, z + depth) into their toroidal texels
+    void refresh(unsigned int l, int x, int z, int width, int depth) {
+        m_staging.resize(width * depth);
+        int step = 1 << l;
+        for (int row = 0; row < depth; ++row)
+            for (int column = 0; column < width; ++column)
+                m_staging[row * width + column] = m_heightfield->sample((x + column) * step, (z + row) * step);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_heights);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+        // split where the rectangle wraps around the layer's edges
+        for (int row = 0; row < depth;) {
+            int texelZ = (z + row) & (TERRAIN_TEXELS - 1);
+            int rows = std::min(depth - row, TERRAIN_TEXELS - texelZ);
+            for (int column = 0; column < width;) {
+                int texelX = (x + column) & (TERRAIN_TEXELS - 1);
+                int columns = std::min(width - column, TERRAIN_TEXELS - texelX);
+                glPixelStorei(GL_UNPACK_SKIP_PIXELS, column);
+                glPixelStorei(GL_UNPACK_SKIP_ROWS, row);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, texelX, texelZ, (GLint)l, columns, rows, 1, GL_RED, GL_FLOAT, m_staging.data());
+                column += columns;
+            }
+            row += rows;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    const Heightfield *m_heightfield = nullptr;
+    unsigned int m_vao = 0, m_vbo = 0, m_ebo = 0;
+    unsigned int m_heights = 0;
+    unsigned int m_fullCount = 0;
+    unsigned int m_ringCount = 0;
+    size_t m_ringFirst[4] = {};
+    unsigned int m_variant[TERRAIN_LEVELS] = {};
+    glm::mat4 m_placement[TERRAIN_LEVELS];
+    Level m_levels[TERRAIN_LEVELS];
+    std::vector<float> m_staging;
+};
+
+};
+#endif //PROJECT_BASE_TERRAIN_H
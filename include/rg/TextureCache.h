@@ -0,0 +1,110 @@
+//
+// Process wide, reference counted texture cache. Textures are keyed by their canonical path and colour
+// space, so every Model and the scene setup share one GL texture per file no matter how it was spelled.
+//
+
+#ifndef PROJECT_BASE_TEXTURECACHE_H
+#define PROJECT_BASE_TEXTURECACHE_H
+
+#include <rg/TextureLoader.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+struct CachedTexture {
+    unsigned int id = 0;
+    std::string path;
+    bool gamma = false;
+    unsigned int references = 0;
+};
+
+class TextureCache {
+public:
+    static TextureCache &instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    // shared texture for the file, loaded on first use; every acquire needs a matching release
+    unsigned int acquire(const std::string &path, bool gamma, bool clampAlpha = false) {
+        std::string canonical = canonicalPath(path);
+        // the wrap mode is texture state too, so a clamped and a repeated copy are separate entries
+        std::string key = canonical + (gamma ? "|srgb" : "|linear") + (clampAlpha ? "|clamp" : "");
+        auto it = m_byKey.find(key);
+        if (it == m_byKey.end()) {
+            CachedTexture texture;
+            texture.id = TextureLoader::instance().load(canonical, gamma, clampAlpha);
+            texture.path = canonical;
+            texture.gamma = gamma;
+            it = m_byKey.emplace(key, texture).first;
+            m_keyById[texture.id] = key;
+        }
+        it->second.references++;
+        return it->second.id;
+    }
+
+    // deletes the texture once nobody holds it anymore
+    void release(unsigned int id) {
+        auto key = m_keyById.find(id);
+        if (key == m_keyById.end())
+            return;
+        auto it = m_byKey.find(key->second);
+        if (--it->second.references == 0) {
+            TextureLoader::instance().destroy(id);
+            m_byKey.erase(it);
+            m_keyById.erase(key);
+        }
+    }
+
+    std::vector<CachedTexture> entries() const {
+        std::vector<CachedTexture> result;
+        for (const auto &entry : m_byKey)
+            result.push_back(entry.second);
+        return result;
+    }
+
+    size_t residentBytes() const {
+        size_t total = 0;
+        for (const auto &entry : m_byKey)
+            total += TextureLoader::instance().residentBytes(entry.second.id);
+        return total;
+    }
+
+    // one line per texture with its estimated video memory
+    void report(std::ostream &out) const {
+        out << "textures: " << m_byKey.size() << ", " << std::fixed << std::setprecision(1)
+            << residentBytes() / (1024.0 * 1024.0) << " MiB resident" << std::endl;
+        for (const auto &entry : m_byKey) {
+            const CachedTexture &texture = entry.second;
+            out << "  " << std::setw(8) << TextureLoader::instance().residentBytes(texture.id) / 1024.0 << " KiB  x"
+                << texture.references << "  " << (texture.gamma ? "srgb   " : "linear ") << texture.path << std::endl;
+        }
+    }
+
+private:
+    TextureCache() = default;
+
+    static std::string canonicalPath(const std::string &path) {
+        char *resolved = realpath(path.c_str(), nullptr);
+        if (!resolved)
+            return path;
+        std::string canonical(resolved);
+        std::free(resolved);
+        return canonical;
+    }
+
+    std::unordered_map<std::string, CachedTexture> m_byKey;
+    std::unordered_map<unsigned int, std::string> m_keyById;
+};
+
+};
+#endif //PROJECT_BASE_TEXTURECACHE_H
@@ -0,0 +1,386 @@
+//
+// Asynchronous texture loading. Image files are decoded by a pool of worker threads while the GL thread
+// keeps rendering; a texture name is handed out right away and shows a 1x1 placeholder until pump()
+// streams the decoded pixels in through pixel unpack buffers. A block compressed <file>.ktx written by
+// tools/texture_compressor is preferred over the source image when the GL supports its format.
+//
+
+#ifndef PROJECT_BASE_TEXTURELOADER_H
+#define PROJECT_BASE_TEXTURELOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+#include <rg/GLExtensions.h>
+#include <rg/Ktx.h>
+#include <rg/Trace.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+struct TextureRequest {
+    unsigned int id = 0;
+    // tells apart requests for a texture name that was deleted and generated again
+    unsigned long long serial = 0;
+    std::string path;
+    bool gamma = false;
+    // textures with an alpha channel are clamped so their transparent borders don't bleed in
+    bool clampAlpha = false;
+};
+
+struct DecodedImage {
+    TextureRequest request;
+    unsigned char *data = nullptr;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    // set instead of data when the compressed file was used
+    bool isCompressed = false;
+    KtxImage compressed;
+};
+
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+class TextureLoader {
+public:
+    // upload budget of a single pump(), large images are never split so one may go over it
+    static const size_t DEFAULT_UPLOAD_BUDGET = 16u << 20;
+
+    static TextureLoader &instance() {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader &operator=(const TextureLoader &) = delete;
+
+    // creates the texture with a placeholder and queues the file for decoding, must be called on the GL thread
+    unsigned int load(const std::string &path, bool gamma, bool clampAlpha = false) {
+        startWorkers();
+
+        TextureRequest request;
+        glGenTextures(1, &request.id);
+        request.path = path;
+        request.gamma = gamma;
+        request.clampAlpha = clampAlpha;
+
+        const unsigned char placeholder[4] = {128, 128, 128, 255};
+        glBindTexture(GL_TEXTURE_2D, request.id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            request.serial = ++m_nextSerial;
+            m_jobs.push_back(request);
+            m_pending[request.id] = request.serial;
+        }
+        m_jobReady.notify_one();
+        return request.id;
+    }
+
+    // uploads decoded images until `budget` bytes went to the GPU, call once per frame on the GL thread
+    void pump(size_t budget = DEFAULT_UPLOAD_BUDGET) {
+        size_t uploaded = 0;
+        while (uploaded < budget) {
+            DecodedImage image;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_decoded.empty())
+                    return;
+                image = std::move(m_decoded.front());
+                m_decoded.pop_front();
+            }
+            uploaded += upload(image);
+        }
+    }
+
+    // blocks until the given textures are uploaded, e.g. before they are baked into something else
+    void finish(const std::vector<unsigned int> &ids) {
+        for (;;) {
+            pump(~size_t(0));
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool waiting = false;
+            for (unsigned int id : ids)
+                waiting = waiting || m_pending.count(id) != 0;
+            if (!waiting)
+                return;
+            m_imageReady.wait(lock, [this] { return !m_decoded.empty(); });
+        }
+    }
+
+    void finishAll() {
+        std::vector<unsigned int> ids;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto &entry : m_pending)
+                ids.push_back(entry.first);
+        }
+        finish(ids);
+    }
+
+    // number of textures that still show their placeholder
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending.size();
+    }
+
+    // estimated video memory of an uploaded texture including its mip chain, 0 while it is a placeholder
+    size_t residentBytes(unsigned int id) const {
+        auto it = m_resident.find(id);
+        return it == m_resident.end() ? 0 : it->second;
+    }
+
+    // deletes a texture made by load(), it may still be waiting for its decode
+    void destroy(unsigned int id) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_pending.find(id);
+            if (it != m_pending.end()) {
+                m_cancelled.insert(it->second);
+                m_pending.erase(it);
+            }
+        }
+        m_resident.erase(id);
+        glDeleteTextures(1, &id);
+    }
+
+    // stops the workers and releases the unpack buffers, must be called while the context is alive
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_jobs.clear();
+        }
+        m_jobReady.notify_all();
+        for (std::thread &worker : m_workers)
+            worker.join();
+        m_workers.clear();
+        for (DecodedImage &image : m_decoded)
+            stbi_image_free(image.data);
+        m_decoded.clear();
+        m_pending.clear();
+        m_cancelled.clear();
+        m_resident.clear();
+        if (m_unpackBuffers[0]) {
+            glDeleteBuffers(UNPACK_BUFFER_COUNT, m_unpackBuffers);
+            std::fill(m_unpackBuffers, m_unpackBuffers + UNPACK_BUFFER_COUNT, 0u);
+        }
+        m_stopping = false;
+    }
+
+private:
+    // a small ring so the driver can still be copying out of one buffer while the next is filled
+    static const unsigned int UNPACK_BUFFER_COUNT = 3;
+
+    TextureLoader() = default;
+    ~TextureLoader() {
+        // the GL objects are gone with the context by now, only the threads are left to stop
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_jobReady.notify_all();
+        for (std::thread &worker : m_workers)
+            worker.join();
+    }
+
+    void startWorkers() {
+        if (!m_workers.empty())
+            return;
+        // the workers only read these, so they are queried here on the GL thread before any of them runs
+        m_s3tc = glext::hasExtension("GL_EXT_texture_compression_s3tc");
+        m_s3tcSrgb = m_s3tc && glext::hasExtension("GL_EXT_texture_sRGB");
+        // leave a core to the GL thread
+        unsigned int count = std::max(1u, std::min(4u, std::thread::hardware_concurrency() - 1));
+        for (unsigned int i = 0; i < count; ++i)
+            m_workers.emplace_back(&TextureLoader::work, this);
+    }
+
+    void work() {
+        for (;;) {
+            DecodedImage image;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_jobReady.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+                if (m_stopping)
+                    return;
+                image.request = m_jobs.front();
+                m_jobs.pop_front();
+            }
+            {
+                TraceScope trace("texture decode", image.request.path);
+                // a KTX the source image was edited after is ignored until the converter runs again
+                const std::string ktxPath = compressedTexturePath(image.request.path);
+                image.isCompressed = readKtx(ktxPath, image.compressed) &&
+                                     ktxMatchesSource(ktxPath, image.compressed, image.request.path) &&
+                                     compressedFormat(image.compressed.internalFormat, image.request.gamma) != 0;
+                if (!image.isCompressed) {
+                    image.compressed = KtxImage();
+                    image.data = stbi_load(image.request.path.c_str(), &image.width, &image.height, &image.components, 0);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_decoded.push_back(std::move(image));
+            }
+            m_imageReady.notify_all();
+        }
+    }
+
+    // GL format a KTX file is uploaded as, 0 if this context can't sample it
+    GLenum compressedFormat(uint32_t format, bool gamma) const {
+        switch (format) {
+            case KTX_BC1_RGB:
+                return !m_s3tc ? 0 : gamma ? (m_s3tcSrgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : 0) : format;
+            case KTX_BC3_RGBA:
+                return !m_s3tc ? 0 : gamma ? (m_s3tcSrgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : 0) : format;
+            case KTX_BC5_RG:
+                // two channel data (normal maps) is never colour, so the gamma flag does not apply
+                return format;
+            default:
+                return 0;
+        }
+    }
+
+    // copies `size` bytes into the next unpack buffer and leaves it bound, the returned pointer is what
+    // the glTexImage calls take: an offset into the buffer, or the client memory if mapping failed
+    const unsigned char *stage(const unsigned char *data, size_t size) {
+        if (!m_unpackBuffers[0])
+            glGenBuffers(UNPACK_BUFFER_COUNT, m_unpackBuffers);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_unpackBuffers[m_nextBuffer]);
+        m_nextBuffer = (m_nextBuffer + 1) % UNPACK_BUFFER_COUNT;
+        // orphaning gives fresh storage instead of waiting for the previous copy out of this buffer
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return data;
+        }
+        std::memcpy(mapped, data, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        return nullptr;
+    }
+
+    size_t uploadCompressed(DecodedImage &image) {
+        const KtxImage &ktx = image.compressed;
+        GLenum format = compressedFormat(ktx.internalFormat, image.request.gamma);
+        const unsigned char *base = stage(ktx.data.data(), ktx.data.size());
+        glBindTexture(GL_TEXTURE_2D, image.request.id);
+        for (size_t level = 0; level < ktx.levels.size(); ++level) {
+            const KtxLevel &mip = ktx.levels[level];
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, format, mip.width, mip.height, 0, (GLsizei)mip.size,
+                                   base + mip.offset);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        // the chain is baked offline and may stop before 1x1
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)ktx.levels.size() - 1);
+
+        GLint wrap = image.request.clampAlpha && ktx.internalFormat == KTX_BC3_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        size_t size = ktx.data.size();
+        m_resident[image.request.id] = size;
+        image.compressed = KtxImage();
+        return size;
+    }
+
+    size_t upload(DecodedImage &image) {
+        unsigned int id = image.request.id;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // the name may have been deleted and handed out again in the meantime
+            if (m_cancelled.erase(image.request.serial)) {
+                stbi_image_free(image.data);
+                return 0;
+            }
+            m_pending.erase(id);
+        }
+        if (image.isCompressed)
+            return uploadCompressed(image);
+        if (!image.data) {
+            std::cout << "Texture failed to load at path: " << image.request.path << std::endl;
+            return 0;
+        }
+
+        GLenum dataFormat = GL_RGBA;
+        GLenum internalFormat = GL_RGBA;
+        if (image.components == 1)
+            internalFormat = dataFormat = GL_RED;
+        else if (image.components == 2)
+            internalFormat = dataFormat = GL_RG;
+        else if (image.components == 3) {
+            internalFormat = image.request.gamma ? GL_SRGB : GL_RGB;
+            dataFormat = GL_RGB;
+        } else {
+            internalFormat = image.request.gamma ? GL_SRGB_ALPHA : GL_RGBA;
+            dataFormat = GL_RGBA;
+        }
+        size_t size = (size_t)image.width * image.height * image.components;
+
+        const unsigned char *pixels = stage(image.data, size);
+
+        // decoded rows are tightly packed
+        GLint alignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, dataFormat, GL_UNSIGNED_BYTE, pixels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        GLint wrap = image.request.clampAlpha && dataFormat == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // drivers pad RGB to four bytes per texel, a full mip chain adds a third
+        size_t texelBytes = image.components == 3 ? 4 : image.components;
+        m_resident[id] = (size_t)image.width * image.height * texelBytes * 4 / 3;
+
+        stbi_image_free(image.data);
+        image.data = nullptr;
+        return size;
+    }
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_jobReady;
+    std::condition_variable m_imageReady;
+    std::deque<TextureRequest> m_jobs;
+    std::deque<DecodedImage> m_decoded;
+    // texture name -> serial of the request still being decoded for it
+    std::unordered_map<unsigned int, unsigned long long> m_pending;
+    std::unordered_set<unsigned long long> m_cancelled;
+    unsigned long long m_nextSerial = 0;
+    // only touched on the GL thread
+    std::unordered_map<unsigned int, size_t> m_resident;
+    std::vector<std::thread> m_workers;
+    bool m_stopping = false;
+    bool m_s3tc = false;
+    bool m_s3tcSrgb = false;
+
+    unsigned int m_unpackBuffers[UNPACK_BUFFER_COUNT] = {0, 0, 0};
+    unsigned int m_nextBuffer = 0;
+};
+
+};
+#endif //PROJECT_BASE_TEXTURELOADER_H
@@ -0,0 +1,151 @@
+//
+// Chrome trace of where the time goes, at startup above all: while recording, every TraceScope of any thread
+// becomes one complete event, and write() saves them as the JSON chrome://tracing and Perfetto open.
+//
+//   project_base --trace startup.json    startup and the first TRACE_FRAMES frames
+//
+
+#ifndef PROJECT_BASE_TRACE_H
+#define PROJECT_BASE_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// frames recorded after startup, enough to see the first frame and the ones streaming textures in
+const unsigned int TRACE_FRAMES = 120;
+
+class Trace {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static Trace &instance() {
+        static Trace trace;
+        return trace;
+    }
+
+    // starts recording into the file at `path`, the events are written by finish()
+    void start(const std::string &path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_path = path;
+        m_origin = Clock::now();
+        m_events.clear();
+        m_recording.store(true, std::memory_order_release);
+    }
+
+    bool recording() const { return m_recording.load(std::memory_order_acquire); }
+
+    // a complete event on the calling thread, `detail` shows up as its argument
+    void add(const char *name, const std::string &detail, Clock::time_point begin, Clock::time_point end) {
+        if (!recording())
+            return;
+        Event event = {name, detail, microseconds(begin), microseconds(end) - microseconds(begin), threadId()};
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.push_back(std::move(event));
+    }
+
+    // stops recording and writes the file, once
+    void finish() {
+        if (!m_recording.exchange(false, std::memory_order_acq_rel))
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::ofstream out(m_path);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        for (size_t i = 0; i < m_events.size(); ++i) {
+            const Event &event = m_events[i];
+            out << (i ? ",\n" : "\n") << "{\"name\": \"" << escape(event.name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                << event.thread << ", \"ts\": " << event.begin << ", \"dur\": " << event.duration;
+            if (!event.detail.empty())
+                out << ", \"args\": {\"detail\": \"" << escape(event.detail) << "\"}";
+            out << "}";
+        }
+        out << "\n]}\n";
+        if (!out)
+            std::cout << "ERROR::TRACE:: cannot write " << m_path << std::endl;
+        else
+            std::cout << "TRACE:: " << m_events.size() << " events written to " << m_path << std::endl;
+        m_events.clear();
+    }
+
+private:
+    struct Event {
+        const char *name;
+        std::string detail;
+        int64_t begin, duration;
+        unsigned int thread;
+    };
+
+    Trace() = default;
+
+    int64_t microseconds(Clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time - m_origin).count();
+    }
+
+    // small numbers instead of the platform's ids, the thread that records first is 1
+    static unsigned int threadId() {
+        static std::atomic<unsigned int> next{1};
+        static thread_local unsigned int id = next.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    static std::string escape(const std::string &text) {
+        std::string escaped;
+        escaped.reserve(text.size());
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if ((unsigned char)c < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            }
+            else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    std::atomic<bool> m_recording{false};
+    std::mutex m_mutex;
+    std::string m_path;
+    Clock::time_point m_origin;
+    std::vector<Event> m_events;
+};
+
+// records its lifetime as an event named `name`, which has to outlive the trace (a string literal)
+class TraceScope {
+public:
+    explicit TraceScope(const char *name, std::string detail = std::string())
+        : m_name(name), m_active(Trace::instance().recording()) {
+        if (m_active) {
+            m_detail = std::move(detail);
+            m_begin = Trace::Clock::now();
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    ~TraceScope() {
+        if (m_active)
+            Trace::instance().add(m_name, m_detail, m_begin, Trace::Clock::now());
+    }
+
+private:
+    const char *m_name;
+    std::string m_detail;
+    Trace::Clock::time_point m_begin;
+    bool m_active;
+};
+
+};
+#endif //PROJECT_BASE_TRACE_H
@@ -0,0 +1,97 @@
+//
+// Where the forest's trees stand: one tree per cell of a square grid over the 150x150 floor, moved off the
+// cell centre by a deterministic jitter, rotated and scaled the same way for every run. The open world places
+// its trees chunk by chunk instead, from a seeded hash of the chunk and cell, so any chunk can be generated on
+// its own, in any order, on any thread, and always comes out the same.
+//
+
+#ifndef PROJECT_BASE_TREEPLACEMENT_H
+#define PROJECT_BASE_TREEPLACEMENT_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <rg/Hash.h>
+#include <rg/InstanceTransforms.h>
+#include <rg/Terrain.h>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace rg {
+
+// trees along each side of the grid holding `treeCount` trees
+inline int treesPerSide(int treeCount) {
+    return (int)std::ceil(std::sqrt((float)treeCount));
+}
+
+// ground position of `tree`, moved off its cell centre by up to a quarter cell (the original 10x10 forest at 100 trees)
+inline glm::vec3 treePosition(int tree, int perSide) {
+    float cell = 150.0f / perSide;
+    float jitter = cell * 0.25f;
+    return glm::vec3((tree % perSide) * cell - 75.0f + cell * 0.5f + std::cos(glm::radians(10.0f * tree) * tree) * jitter,
+                     0.0f,
+                     (tree / perSide) * cell - 75.0f + cell * 0.5f + std::sin(glm::radians(10.0f * tree) * tree) * jitter);
+}
+
+// how far a tree's origin is sunk into the ground under it, so its roots don't float on slopes
+const float TREE_SINK = 0.2f;
+
+// ground under (x, z): the heightfield when there is one, the flat floor otherwise
+inline float groundHeight(const Heightfield *ground, float x, float z) {
+    return ground ? ground->height(x, z) : TERRAIN_BASE;
+}
+
+// placements of the `treeCount` trees, sunk slightly into the ground and scaled up to size
+inline void placeTrees(int treeCount, InstanceStore &store, const Heightfield *ground = nullptr) {
+    int perSide = treesPerSide(treeCount);
+    store.reserve(store.size() + treeCount);
+    for (int i = 0; i < treeCount; ++i) {
+        glm::vec3 position = treePosition(i, perSide);
+        position.y = groundHeight(ground, position.x, position.z) - TREE_SINK;
+        store.add(position, glm::radians(15.0f * i), 4.5f);
+    }
+}
+
+// model matrices of the `treeCount` trees
+inline void buildTreeTransforms(int treeCount, glm::mat4 *transforms, const Heightfield *ground = nullptr) {
+    InstanceStore store;
+    placeTrees(treeCount, store, ground);
+    composeTransforms(store, transforms);
+}
+
+// open world chunks: square tiles of CHUNK_CELLS x CHUNK_CELLS cells, at the arena's density of one tree per 15x15
+const float TREE_CELL_SIZE = 15.0f;
+const int CHUNK_CELLS = 4;
+const float CHUNK_SIZE = TREE_CELL_SIZE * CHUNK_CELLS;
+const unsigned int TREES_PER_CHUNK = CHUNK_CELLS * CHUNK_CELLS;
+// share of the cells left empty, so the forest has clearings instead of a visible grid
+const float CHUNK_CLEARING = 0.1f;
+
+// replaces `store` with the placements of chunk (chunkX, chunkZ), at most TREES_PER_CHUNK of them
+inline void placeChunkTrees(int chunkX, int chunkZ, uint32_t seed, InstanceStore &store, const Heightfield *ground = nullptr) {
+    store.clear();
+    for (int row = 0; row < CHUNK_CELLS; ++row) {
+        for (int column = 0; column < CHUNK_CELLS; ++column) {
+            int cellX = chunkX * CHUNK_CELLS + column;
+            int cellZ = chunkZ * CHUNK_CELLS + row;
+            // one hash per cell, the rest of its numbers are derived from it
+            uint32_t hash = hashCoords(cellX, cellZ, seed);
+            if (hashToUnit(hash) < CHUNK_CLEARING)
+                continue;
+            uint32_t jitterX = hashMix(hash ^ 0x68e31da4u), jitterZ = hashMix(hash ^ 0xb5297a4du);
+            uint32_t yaw = hashMix(hash ^ 0x1b56c4e9u), scale = hashMix(hash ^ 0x7f4a7c15u);
+            // up to a quarter cell off the centre like the arena's trees, sunk into the ground the same way
+            glm::vec3 position((cellX + 0.5f + (hashToUnit(jitterX) - 0.5f) * 0.5f) * TREE_CELL_SIZE,
+                               0.0f,
+                               (cellZ + 0.5f + (hashToUnit(jitterZ) - 0.5f) * 0.5f) * TREE_CELL_SIZE);
+            position.y = groundHeight(ground, position.x, position.z) - TREE_SINK;
+            store.add(position, hashToUnit(yaw) * glm::two_pi<float>(), 4.5f * (0.9f + 0.2f * hashToUnit(scale)));
+        }
+    }
+}
+
+};
+#endif //PROJECT_BASE_TREEPLACEMENT_H
@@ -0,0 +1,135 @@
+//
+// Per-frame uniform blocks shared by every program that declares them.
+//
+
+#ifndef PROJECT_BASE_UNIFORMBLOCKS_H
+#define PROJECT_BASE_UNIFORMBLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <rg/StreamBuffer.h>
+
+#include <cstddef>
+
+namespace rg {
+
+// binding points of the blocks, every shader declaring a block gets it bound to the same point
+enum UniformBlockBinding : GLuint {
+    PER_FRAME_BLOCK_BINDING = 0,
+    LIGHTS_BLOCK_BINDING = 1,
+    SHADOWS_BLOCK_BINDING = 2,
+    CLUSTERS_BLOCK_BINDING = 3,
+    WIND_BLOCK_BINDING = 4
+};
+
+// has to match SHADOW_CASCADES in omnishader.fs, at most 4 (the per-cascade values are packed in vec4s)
+const unsigned int SHADOW_CASCADES = 3;
+
+// C++ mirrors of the std140 blocks in the shaders: vec3 members are aligned to 16 bytes,
+// so the explicit padding floats keep the structs byte-for-byte equal to the GLSL side.
+
+// layout (std140) uniform PerFrame
+struct PerFrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPosition;
+    float pad0;
+};
+
+struct DirLight {
+    glm::vec3 direction;
+    float pad0;
+
+    glm::vec3 ambient;
+    float pad1;
+    glm::vec3 diffuse;
+    float pad2;
+    glm::vec3 specular;
+    float pad3;
+};
+
+struct SpotLight {
+    glm::vec3 position;
+    float pad0;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;
+    float pad1;
+    glm::vec3 diffuse;
+    float pad2;
+    glm::vec3 specular;
+    float pad3;
+};
+
+// layout (std140) uniform Lights
+struct LightsBlock {
+    DirLight dirLight;
+    SpotLight spotLight;
+    int spotLightOn;
+    int pad0[3];
+};
+
+// layout (std140) uniform Shadows, owned by CascadedShadows
+struct ShadowsBlock {
+    glm::mat4 lightViewProjection[SHADOW_CASCADES];
+    // view distance each cascade reaches to
+    glm::vec4 cascadeEnd;
+    // world size of one shadow map texel in each cascade
+    glm::vec4 cascadeTexel;
+    int shadowsOn;
+    int pad0[3];
+};
+
+// layout (std140) uniform Clusters, owned by ClusteredLights
+struct ClustersBlock {
+    // clusters along x, y and z, and the number of point lights this frame
+    glm::uvec4 grid;
+    // slice = log(view depth) * x + y
+    glm::vec4 depth;
+};
+
+// layout (std140) uniform Wind, filled by animateWind
+struct WindBlock {
+    // direction on the ground in x and z, w: how far the top of a tree leans, in world units
+    glm::vec4 direction;
+    // x: time, y: sway frequency in rad/s, z: how far the canopy flutters, in world units
+    glm::vec4 motion;
+    // x: the model's lowest local y, where the bend starts, y: 1 / its local height
+    glm::vec4 shape;
+};
+
+static_assert(offsetof(PerFrameBlock, viewPosition) == 128, "PerFrame does not match std140");
+static_assert(sizeof(DirLight) == 64, "DirLight does not match std140");
+static_assert(offsetof(SpotLight, cutOff) == 28 && offsetof(SpotLight, ambient) == 48 && sizeof(SpotLight) == 96,
+              "SpotLight does not match std140");
+static_assert(offsetof(LightsBlock, spotLight) == 64 && offsetof(LightsBlock, spotLightOn) == 160,
+              "Lights does not match std140");
+static_assert(offsetof(ShadowsBlock, cascadeEnd) == 64 * SHADOW_CASCADES &&
+              offsetof(ShadowsBlock, shadowsOn) == 64 * SHADOW_CASCADES + 32, "Shadows does not match std140");
+static_assert(offsetof(ClustersBlock, depth) == 16 && sizeof(ClustersBlock) == 32, "Clusters does not match std140");
+static_assert(sizeof(WindBlock) == 48, "Wind does not match std140");
+
+// The camera, light and wind blocks, written into the frame's stream buffer once per frame.
+class FrameUniformBuffer {
+public:
+    PerFrameBlock perFrame;
+    LightsBlock lights;
+    WindBlock wind;
+
+    // copies the blocks to the GPU and binds them for the rest of the frame
+    void upload(StreamBuffer &stream) {
+        stream.uploadUniformBlock(PER_FRAME_BLOCK_BINDING, &perFrame, sizeof(PerFrameBlock));
+        stream.uploadUniformBlock(LIGHTS_BLOCK_BINDING, &lights, sizeof(LightsBlock));
+        stream.uploadUniformBlock(WIND_BLOCK_BINDING, &wind, sizeof(WindBlock));
+    }
+};
+
+};
+#endif //PROJECT_BASE_UNIFORMBLOCKS_H
@@ -0,0 +1,46 @@
+//
+// Wind for the trees, animated entirely in the vertex shaders that draw them (WIND in omnishader_instanced.vs
+// and shadow_depth.vs): a tree bends away from the wind more the higher up a vertex is, swaying with a phase
+// hashed from where it stands, and its canopy flutters on top. The CPU only fills one small uniform block per
+// frame, the instance transforms are never touched.
+//
+
+#ifndef PROJECT_BASE_WIND_H
+#define PROJECT_BASE_WIND_H
+
+#include <glm/glm.hpp>
+
+#include <rg/UniformBlocks.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace rg {
+
+struct WindSettings {
+    // where the wind blows to, on the ground
+    glm::vec2 direction = glm::vec2(0.93f, 0.37f);
+    // lean of a tree top in world units, small enough to stay inside the culling bounds
+    float strength = 0.35f;
+    // sway in rad/s
+    float frequency = 1.3f;
+    // 0 blows steadily, 1 lets the gusts drop the wind to nothing and double it
+    float gustiness = 0.5f;
+    float flutter = 0.03f;
+};
+
+// the block for `time`, for a model whose local y runs from `modelBottom` over `modelHeight`
+inline WindBlock animateWind(const WindSettings &settings, float time, float modelBottom, float modelHeight) {
+    // gusts come and go over tens of seconds, two slow waves so they don't repeat noticeably
+    float gust = 0.6f * std::sin(time * 0.21f) + 0.4f * std::sin(time * 0.53f + 1.7f);
+    float strength = settings.strength * std::max(1.0f + settings.gustiness * gust, 0.0f);
+    glm::vec2 direction = glm::length(settings.direction) > 0.0f ? glm::normalize(settings.direction) : glm::vec2(1.0f, 0.0f);
+    WindBlock block;
+    block.direction = glm::vec4(direction.x, 0.0f, direction.y, strength);
+    block.motion = glm::vec4(time, settings.frequency, settings.flutter * std::max(1.0f + gust, 0.0f), 0.0f);
+    block.shape = glm::vec4(modelBottom, modelHeight > 0.0f ? 1.0f / modelHeight : 0.0f, 0.0f, 0.0f);
+    return block;
+}
+
+};
+#endif //PROJECT_BASE_WIND_H
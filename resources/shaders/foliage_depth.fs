@@ -0,0 +1,26 @@
+#version 330 core
+// depth only pass of the foliage prepass, the one place the leaves are alpha tested
+in vec2 TexCoords;
+#ifdef TEXTURE_ARRAY
+flat in vec2 MaterialLayer;
+#endif
+
+struct Material {
+#ifdef TEXTURE_ARRAY
+    sampler2DArray texture_diffuse1;
+#else
+    sampler2D texture_diffuse1;
+#endif
+};
+uniform Material material;
+
+void main()
+{
+#ifdef TEXTURE_ARRAY
+    float alpha = texture(material.texture_diffuse1, vec3(TexCoords, MaterialLayer.x)).a;
+#else
+    float alpha = texture(material.texture_diffuse1, TexCoords).a;
+#endif
+    if(alpha < 0.1)
+        discard;
+}
@@ -0,0 +1,52 @@
+#version 330 core
+out vec4 FragColor;
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform sampler2D impostorAtlas;
+
+layout (std140) uniform Lights {
+    DirLight dirLight;
+    SpotLight spotLight;
+    int spotLightOn;
+};
+
+// impostors are only used far away, where the flashlight's attenuation has already faded it out,
+// so only the directional light is applied
+void main()
+{
+    vec4 albedo = texture(impostorAtlas, TexCoords);
+    if(albedo.a < 0.5)
+        discard;
+    vec3 normal = normalize(Normal);
+    float diff = max(dot(normal, normalize(-dirLight.direction)), 0.0);
+    vec3 result = dirLight.ambient * albedo.rgb + dirLight.diffuse * diff * albedo.rgb;
+    //gamma correction
+    result = pow(result, vec3(1.0/2.2));
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,43 @@
+#version 330 core
+// x in [-1, 1] across the billboard, y in [0, 1] from bottom to top
+layout (location = 0) in vec2 aCorner;
+layout (location = 5) in mat4 aInstanceModel;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+
+layout (std140) uniform PerFrame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+};
+
+// square the views were baked into, in model space: side length, bottom edge and xz center
+uniform float impostorSize;
+uniform float impostorBottom;
+uniform vec2 impostorCenter;
+uniform int frameCount;
+
+void main()
+{
+    vec3 origin = vec3(aInstanceModel * vec4(impostorCenter.x, 0.0, impostorCenter.y, 1.0));
+    float scale = length(aInstanceModel[0].xyz);
+
+    // cylindrical billboard, rotates around the up axis only
+    vec3 toCamera = vec3(viewPosition.x - origin.x, 0.0, viewPosition.z - origin.z);
+    vec3 forward = length(toCamera) > 0.0001 ? normalize(toCamera) : vec3(0.0, 0.0, 1.0);
+    vec3 right = cross(vec3(0.0, 1.0, 0.0), forward);
+
+    // pick the baked view closest to the direction the camera sees this instance from
+    float yaw = atan(aInstanceModel[2].x, aInstanceModel[2].z);
+    float viewAngle = atan(forward.x, forward.z) - yaw;
+    float frame = mod(floor(viewAngle / (6.28318530718 / float(frameCount)) + 0.5), float(frameCount));
+
+    FragPos = origin + right * (aCorner.x * 0.5 * impostorSize * scale)
+            + vec3(0.0, (impostorBottom + aCorner.y * impostorSize) * scale, 0.0);
+    TexCoords = vec2((frame + aCorner.x * 0.5 + 0.5) / float(frameCount), aCorner.y);
+    // a far away canopy reads best lit as a rough dome
+    Normal = normalize(forward + vec3(0.0, 1.0, 0.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
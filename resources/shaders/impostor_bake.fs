@@ -0,0 +1,18 @@
+#version 330 core
+out vec4 FragColor;
+
+struct Material {
+    sampler2D texture_diffuse1;
+};
+in vec2 TexCoords;
+
+uniform Material material;
+
+// unlit albedo, lighting is applied when the impostor is drawn
+void main()
+{
+    vec4 albedo = texture(material.texture_diffuse1, TexCoords);
+    if(albedo.a < 0.1)
+        discard;
+    FragColor = vec4(albedo.rgb, 1.0);
+}
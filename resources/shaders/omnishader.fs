@@ -25,7 +25,11 @@ struct SpotLight {
 };
 
 struct Material {
+#ifdef TEXTURE_ARRAY
+    sampler2DArray texture_diffuse1;
+#else
     sampler2D texture_diffuse1;
+#endif
     sampler2D texture_specular1;
 
     float shininess;
@@ -33,15 +37,77 @@ struct Material {
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
+#ifdef TEXTURE_ARRAY
+// layer in the material array and its clamp flag
+flat in vec2 MaterialLayer;
+#endif
 
 uniform Material material;
-uniform DirLight dirLight;
-uniform SpotLight spotLight;
-uniform int spotLightOn;
 
-uniform vec3 viewPosition;
+layout (std140) uniform PerFrame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+};
+
+layout (std140) uniform Lights {
+    DirLight dirLight;
+    SpotLight spotLight;
+    int spotLightOn;
+};
+
+// has to match rg::SHADOW_CASCADES
+#define SHADOW_CASCADES 3
+layout (std140) uniform Shadows {
+    mat4 lightViewProjection[SHADOW_CASCADES];
+    vec4 cascadeEnd;
+    vec4 cascadeTexel;
+    int shadowsOn;
+};
+uniform sampler2DArrayShadow shadowMap;
+
+// clustered point lights, has to match rg::ClustersBlock
+layout (std140) uniform Clusters {
+    // clusters along x, y and z, and the number of lights
+    uvec4 clusterGrid;
+    // slice = log(view depth) * x + y
+    vec4 clusterDepth;
+};
+// (first index, count) per cluster, the light indices they point into, and two texels per light:
+// position and radius, then color
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterLightIndices;
+uniform samplerBuffer pointLights;
+
+vec4 diffuseTexel;
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+// 1 where the sun reaches the fragment, 0 in full shadow
+float CalcShadow(vec3 fragPos, vec3 normal)
+{
+    if(shadowsOn == 0)
+        return 1.0;
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int cascade = 0;
+    while(cascade < SHADOW_CASCADES && depth > cascadeEnd[cascade])
+        cascade++;
+    if(cascade == SHADOW_CASCADES)
+        return 1.0;
+    // pushed out along the normal by about a texel, which keeps the surface from shadowing itself
+    vec4 lightPos = lightViewProjection[cascade] * vec4(fragPos + normal * cascadeTexel[cascade] * 1.5, 1.0);
+    vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+    if(any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0))))
+        return 1.0;
+    // four bilinear compares one texel apart, a 3x3 texel footprint in the end
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for(int i = 0; i < 4; i++) {
+        vec2 offset = (vec2(i & 1, i >> 1) - 0.5) * texel;
+        lit += texture(shadowMap, vec4(coords.xy + offset, float(cascade), coords.z));
+    }
+    return lit * 0.25;
+}
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
@@ -52,10 +118,10 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 halfwayDir = normalize(viewDir + lightDir);
     float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_diffuse1, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 ambient = light.ambient * vec3(diffuseTexel);
+    vec3 diffuse = light.diffuse * diff * vec3(diffuseTexel);
+    vec3 specular = light.specular * spec * vec3(diffuseTexel);
+    return (ambient + shadow * (diffuse + specular));
 }
 
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
@@ -76,26 +142,80 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_diffuse1, TexCoords));
+    vec3 ambient = light.ambient * vec3(diffuseTexel);
+    vec3 diffuse = light.diffuse * diff * vec3(diffuseTexel);
+    vec3 specular = light.specular * spec * vec3(diffuseTexel);
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
 }
 
+// the point lights of the fragment's cluster, lit two sided like the flashlight
+vec3 CalcPointLights(vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    if(clusterGrid.w == 0u)
+        return vec3(0.0);
+    vec4 clip = projection * view * vec4(fragPos, 1.0);
+    ivec3 cell = ivec3(ivec2((clip.xy / clip.w * 0.5 + 0.5) * vec2(clusterGrid.xy)),
+                       int(log(clip.w) * clusterDepth.x + clusterDepth.y));
+    cell = clamp(cell, ivec3(0), ivec3(clusterGrid.xyz) - 1);
+    int cluster = (cell.z * int(clusterGrid.y) + cell.y) * int(clusterGrid.x) + cell.x;
+    uvec2 range = texelFetch(clusterRanges, cluster).xy;
+    vec3 result = vec3(0.0);
+    for(uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(clusterLightIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(pointLights, 2 * light);
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        if(distance >= positionRadius.w)
+            continue;
+        vec3 lightDir = toLight / distance;
+        float diff = max(dot(normal, lightDir), max(dot(-normal, lightDir), 0.0));
+        vec3 halfwayDir = normalize(viewDir + lightDir);
+        float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+        // inverse square, windowed to reach zero at the radius so the cluster bounds are exact
+        float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (1.0 + distance * distance);
+        result += texelFetch(pointLights, 2 * light + 1).rgb * attenuation * (diff + spec) * vec3(diffuseTexel);
+    }
+    return result;
+}
+
 void main()
 {
-    vec4 blendTexture = texture(material.texture_diffuse1, TexCoords);
+#ifdef TEXTURE_ARRAY
+    vec2 uv = TexCoords;
+    if(MaterialLayer.y > 0.5) {
+        // stands in for GL_CLAMP_TO_EDGE, the array has one wrap mode for all layers
+        vec2 halfTexel = 0.5 / vec2(textureSize(material.texture_diffuse1, 0).xy);
+        uv = clamp(uv, halfTexel, 1.0 - halfTexel);
+    }
+    diffuseTexel = texture(material.texture_diffuse1, vec3(uv, MaterialLayer.x));
+#else
+    diffuseTexel = texture(material.texture_diffuse1, TexCoords);
+#endif
+    vec4 blendTexture = diffuseTexel;
+#if defined(DEPTH_EQUAL)
+    // the depth prepass already cut the leaves, only its surviving fragments get here
+#elif defined(ALPHA_TO_COVERAGE)
+    // the cutoff turned into a coverage ramp about one pixel wide, so the edge keeps the alpha test's shape
+    float coverage = (blendTexture.a - 0.1) / max(fwidth(blendTexture.a), 0.0001) + 0.5;
+#else
     if(blendTexture.a < 0.1)
         discard;
+#endif
     vec3 normal = normalize(Normal);
     vec3 viewDir = normalize(viewPosition - FragPos);
-    vec3 result = CalcDirLight(dirLight, normal, viewDir);
+    vec3 result = CalcDirLight(dirLight, normal, viewDir, CalcShadow(FragPos, normal));
     if(spotLightOn > 0)
         result += CalcSpotLight(spotLight, normal, FragPos, viewDir);
+    result += CalcPointLights(normal, FragPos, viewDir);
     //gamma correction
     result = pow(result,vec3(1.0/2.2));
+#ifdef ALPHA_TO_COVERAGE
+    FragColor = vec4(result, clamp(coverage, 0.0, 1.0));
+#else
     FragColor = vec4(result, 1.0);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,49 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per-instance model matrix, occupies locations 5-8. Its scale has to be uniform unless the shader is
+// built with NON_UNIFORM_SCALE
+layout (location = 5) in mat4 aInstanceModel;
+#ifdef TEXTURE_ARRAY
+// x: layer of the material texture array, y: 1 for textures that must not repeat
+layout (location = 9) in vec2 aMaterial;
+flat out vec2 MaterialLayer;
+#endif
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+// the foliage prepass and the GL_EQUAL pass after it must compute bit identical depths
+invariant gl_Position;
+
+layout (std140) uniform PerFrame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+};
+
+#ifdef WIND
+#include "wind.glsl"
+#endif
+
+void main()
+{
+    FragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+#ifdef WIND
+    // the normals keep the rest pose, the lean is too small to change the shading
+    FragPos += windOffset(aPos, vec3(aInstanceModel[3]));
+#endif
+#ifdef NON_UNIFORM_SCALE
+    Normal = mat3(transpose(inverse(aInstanceModel))) * aNormal;
+#else
+    // for a rotation times a uniform scale the inverse transpose is the matrix itself up to a factor,
+    // which the fragment shader normalizes away
+    Normal = mat3(aInstanceModel) * aNormal;
+#endif
+    TexCoords = aTexCoords;
+#ifdef TEXTURE_ARRAY
+    MaterialLayer = aMaterial;
+#endif
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,32 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCoords;
+// per-instance model matrix, occupies locations 5-8
+layout (location = 5) in mat4 aInstanceModel;
+#ifdef TEXTURE_ARRAY
+// x: layer of the material texture array
+layout (location = 9) in vec2 aMaterial;
+flat out vec2 MaterialLayer;
+#endif
+
+out vec2 TexCoords;
+
+// the cascade being rendered
+uniform mat4 lightViewProjection;
+
+#ifdef WIND
+#include "wind.glsl"
+#endif
+
+void main()
+{
+    TexCoords = aTexCoords;
+#ifdef TEXTURE_ARRAY
+    MaterialLayer = aMaterial;
+#endif
+    vec4 worldPos = aInstanceModel * vec4(aPos, 1.0);
+#ifdef WIND
+    worldPos.xyz += windOffset(aPos, vec3(aInstanceModel[3]));
+#endif
+    gl_Position = lightViewProjection * worldPos;
+}
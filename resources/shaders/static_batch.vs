@@ -0,0 +1,27 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// x: layer of the material texture array, y: 1 for textures that must not repeat
+layout (location = 3) in vec2 aMaterial;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+flat out vec2 MaterialLayer;
+
+layout (std140) uniform PerFrame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+};
+
+void main()
+{
+    // the batch is already in world space
+    FragPos = aPos;
+    Normal = aNormal;
+    TexCoords = aTexCoords;
+    MaterialLayer = aMaterial;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
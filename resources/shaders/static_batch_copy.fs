@@ -0,0 +1,12 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+
+// resamples a texture of any size or format (compressed ones included) into a layer of the material array
+void main()
+{
+    FragColor = texture(source, TexCoords);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+out vec2 TexCoords;
+
+// a triangle covering the whole viewport, no vertex buffer needed
+void main()
+{
+    vec2 corner = vec2(gl_VertexID == 1 ? 2.0 : 0.0, gl_VertexID == 2 ? 2.0 : 0.0);
+    TexCoords = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,70 @@
+#version 330 core
+// grid coordinates, 0 to TERRAIN_GRID along both axes
+layout (location = 0) in vec2 aGrid;
+// placement of the level being drawn, one "instance" per draw:
+// [0] = lattice origin of the grid x, z (in the level's own spacing), spacing, layer
+// [1] = 1 when it morphs into the next level, width of the morph band in quads
+layout (location = 3) in mat4 aLevel;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+
+layout (std140) uniform PerFrame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+};
+
+// one layer of heights per level, addressed by lattice point modulo the layer size
+uniform sampler2DArray heights;
+
+// has to match rg::TERRAIN_GRID and rg::TERRAIN_TEXELS
+#define TERRAIN_GRID 64
+#define TERRAIN_TEXELS 128
+
+float fetchHeight(ivec2 point, int layer)
+{
+    return texelFetch(heights, ivec3(point & (TERRAIN_TEXELS - 1), layer), 0).r;
+}
+
+// the height and normal of `point` on `layer`, from the four lattice points around it one step away
+vec3 fetchNormal(ivec2 point, int layer, float spacing)
+{
+    float left = fetchHeight(point - ivec2(1, 0), layer);
+    float right = fetchHeight(point + ivec2(1, 0), layer);
+    float back = fetchHeight(point - ivec2(0, 1), layer);
+    float front = fetchHeight(point + ivec2(0, 1), layer);
+    return normalize(vec3(left - right, 2.0 * spacing, back - front));
+}
+
+void main()
+{
+    ivec2 origin = ivec2(aLevel[0].xy);
+    float spacing = aLevel[0].z;
+    int layer = int(aLevel[0].w);
+    ivec2 point = origin + ivec2(aGrid);
+
+    float height = fetchHeight(point, layer);
+    vec3 normal = fetchNormal(point, layer, spacing);
+    // toward the border the vertex slides onto the coarser level's surface, so where two levels meet the
+    // finer one's edge vertices lie on the coarser one's edges
+    vec2 fromCenter = abs(aGrid - vec2(TERRAIN_GRID / 2));
+    float band = aLevel[1].y;
+    float morph = aLevel[1].x * clamp((max(fromCenter.x, fromCenter.y) - (TERRAIN_GRID / 2 - band)) / band, 0.0, 1.0);
+    if (morph > 0.0) {
+        // the coarser lattice points on either side, the same one twice where the point is on the coarser lattice
+        ivec2 low = point >> 1;
+        ivec2 high = (point + 1) >> 1;
+        float coarse = 0.25 * (fetchHeight(low, layer + 1) + fetchHeight(ivec2(high.x, low.y), layer + 1) +
+                               fetchHeight(ivec2(low.x, high.y), layer + 1) + fetchHeight(high, layer + 1));
+        height = mix(height, coarse, morph);
+        normal = normalize(mix(normal, fetchNormal(low, layer + 1, 2.0 * spacing), morph));
+    }
+
+    FragPos = vec3(vec2(point) * spacing, height).xzy;
+    Normal = normal;
+    // the arena floor's tiling, 20 repeats over its 150 units
+    TexCoords = FragPos.xz / 7.5;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,39 @@
+#version 330 core
+out vec4 FragColor;
+
+// 0 to 1 over the window
+in vec2 TexCoords;
+
+// the resolved scene, only its lower left `region` texels were drawn this frame
+uniform sampler2D source;
+uniform vec2 region;
+// 0 is a plain bilinear stretch
+uniform float sharpness;
+
+vec3 fetch(vec2 texel, vec2 size)
+{
+    // never filters in texels outside what this frame drew
+    texel = clamp(texel, vec2(0.5), region - 0.5);
+    return texture(source, texel / size).rgb;
+}
+
+// bilinear upscale, then an unsharp mask over the cross of neighbours one source texel away, clamped to their
+// range so edges don't ring
+void main()
+{
+    vec2 size = vec2(textureSize(source, 0));
+    vec2 texel = TexCoords * region;
+    vec3 center = fetch(texel, size);
+    if (sharpness <= 0.0) {
+        FragColor = vec4(center, 1.0);
+        return;
+    }
+    vec3 left = fetch(texel - vec2(1.0, 0.0), size);
+    vec3 right = fetch(texel + vec2(1.0, 0.0), size);
+    vec3 down = fetch(texel - vec2(0.0, 1.0), size);
+    vec3 up = fetch(texel + vec2(0.0, 1.0), size);
+    vec3 low = min(center, min(min(left, right), min(down, up)));
+    vec3 high = max(center, max(max(left, right), max(down, up)));
+    vec3 sharpened = center + sharpness * (4.0 * center - left - right - down - up) * 0.25;
+    FragColor = vec4(clamp(sharpened, low, high), 1.0);
+}
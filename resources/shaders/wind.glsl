@@ -0,0 +1,30 @@
+// The wind sway of the trees, included by every vertex shader that draws them (the shadow and depth passes
+// too) so that all of them move the same vertex the same way. They include it under #ifdef WIND.
+
+// filled by rg::animateWind
+layout (std140) uniform Wind {
+    vec4 windDirection;
+    vec4 windMotion;
+    vec4 windShape;
+};
+
+// How far the wind moves the vertex at model space `localPos` of the instance standing at `origin`
+vec3 windOffset(vec3 localPos, vec3 origin)
+{
+    // the phase comes from where the tree stands, the instance index changes whenever the culling does
+    uvec2 cell = uvec2(ivec2(floor(origin.xz * 4.0)));
+    uint seed = cell.x * 73856093u ^ cell.y * 19349663u;
+    seed = (seed ^ (seed >> 16)) * 0x45d9f3bu;
+    float phase = float(seed & 0xffffu) * (6.2831853 / 65536.0);
+    // the trunk stays rooted, the bend grows with the square of the height
+    float h = clamp((localPos.y - windShape.x) * windShape.y, 0.0, 1.0);
+    float time = windMotion.x;
+    float sway = 0.75 + 0.25 * sin(time * windMotion.y + phase);
+    vec3 offset = windDirection.xyz * (windDirection.w * h * h * sway);
+    // the top dips a little as it leans
+    offset.y = -0.3 * windDirection.w * h * h * sway * sway;
+    // leaves flutter faster, out of step across the canopy
+    float flutter = sin(time * windMotion.y * 5.3 + phase + dot(localPos, vec3(3.1, 1.7, 2.3)));
+    offset += vec3(0.6, 0.3, -0.5) * (windMotion.z * h * flutter);
+    return offset;
+}
@@ -15,6 +15,38 @@
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
 #include <rg/Error.h>
+#include <rg/UniformBlocks.h>
+#include <rg/Culling.h>
+#include <rg/GLExtensions.h>
+#include <rg/GpuCulling.h>
+#include <rg/HiZ.h>
+#include <rg/SoftwareOcclusion.h>
+#include <rg/Impostor.h>
+#include <rg/Lod.h>
+#include <rg/TextureLoader.h>
+#include <rg/TextureCache.h>
+#include <rg/StaticBatch.h>
+#include <rg/MaterialArray.h>
+#include <rg/RenderQueue.h>
+#include <rg/Profiler.h>
+#include <rg/Benchmark.h>
+#include <rg/TreePlacement.h>
+#include <rg/ForestChunks.h>
+#include <rg/Terrain.h>
+#include <rg/ShaderWatcher.h>
+#include <rg/Foliage.h>
+#include <rg/Wind.h>
+#include <rg/Shadows.h>
+#include <rg/ClusteredLights.h>
+#include <rg/Fireflies.h>
+#include <rg/DynamicResolution.h>
+#include <rg/FrameCapture.h>
+#include <rg/StreamBuffer.h>
+#include <rg/JobSystem.h>
+#include <rg/FramePacket.h>
+#include <rg/Scene.h>
+#include <rg/Trace.h>
+#include <algorithm>
 #include <iostream>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -38,29 +70,23 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 //flashlight on/off
 bool flashlightOn = false;
-
-struct DirLight {
-    glm::vec3 direction;
-
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
-
-struct SpotLight {
-    glm::vec3 position;
-    glm::vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
+// tree culling counters of the last frame
+rg::CullStats treeCullStats;
+// cull trees in a compute shader and draw them indirectly, only when the context is 4.3+
+bool gpuCullingSupported = false;
+bool gpuCulling = false;
+// switches of the profiler overlay, to see what each optimization is worth
+bool frustumCulling = true;
+bool treeLodsOn = true;
+bool treeInstancing = true;
+bool shadowsEnabled = true;
+bool pointLightsEnabled = true;
+// trees hidden behind nearer ones (and the hills) are dropped after the frustum culling
+bool occlusionCulling = true;
+// the trees sway in the wind, in their vertex shaders
+bool windEnabled = true;
+// profiler overlay, F1 shows it and frees the cursor to use it
+bool showProfiler = false;
 
 // Code so we can swap to and from fullscreen
 GLFWmonitor *monitor;
@@ -68,14 +94,27 @@ const GLFWvidmode *mode;
 GLFWwindow* window;
 bool isFullScreen = false;
 
-int main()
+int main(int argc, char **argv)
 {
+    rg::BenchmarkOptions benchmark;
+    if (!rg::parseBenchmarkOptions(argc, argv, benchmark))
+        return 1;
+    if (!benchmark.trace.empty())
+        rg::Trace::instance().start(benchmark.trace);
+    const rg::Trace::Clock::time_point startupBegin = rg::Trace::Clock::now();
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // benchmark runs render to a window that is never shown
+    if (benchmark.enabled)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    // a 4.3 context enables the GPU culling path, everything else only needs 3.3
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // the scene is drawn into a target of its own, the window only receives the upscaled frame and the overlay
+    glfwWindowHint(GLFW_SAMPLES, 0);
 
     // getting the monitor and mode so we can use it to enter fullscreen mode
     // -----------------------------
@@ -86,6 +125,12 @@ int main()
     // --------------------
     window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Forest Simulation", NULL, NULL);
     if (window == NULL)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Forest Simulation", NULL, NULL);
+    }
+    if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -93,10 +138,16 @@ int main()
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetKeyCallback(window, key_callback);
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (benchmark.enabled) {
+        // the camera path drives the camera and frames are not held back by vsync
+        glfwSwapInterval(0);
+    }
+    else {
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetKeyCallback(window, key_callback);
+        // tell GLFW to capture our mouse
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
     // glad: load all OpenGL function pointers
     // ---------------------------------------
@@ -105,131 +156,55 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
-
-    //floor
-    float planeVertices[] = {
-            // positions                normals       texture coords
-             5.0f, -0.2f,  5.0f,   0.0f, 1.0f, 0.0f,   20.0f, 0.0f,
-            -5.0f, -0.2f,  5.0f,   0.0f, 1.0f, 0.0f,   0.0f, 0.0f,
-            -5.0f, -0.2f, -5.0f,   0.0f, 1.0f, 0.0f,   0.0f, 20.0f,
-
-             5.0f, -0.2f,  5.0f,   0.0f, 1.0f, 0.0f,   20.0f, 0.0f,
-            -5.0f, -0.2f, -5.0f,   0.0f, 1.0f, 0.0f,   0.0f, 20.0f,
-             5.0f, -0.2f, -5.0f,   0.0f, 1.0f, 0.0f,   20.0f, 20.0f
-    };
-    //sky
-    float skyVertices[] = {
-            // positions                normals       texture coords
-             5.0f, -0.2f,  5.0f,   0.0f, 1.0f, 0.0f,   5.0f, 0.0f,
-            -5.0f, -0.2f,  5.0f,   0.0f, 1.0f, 0.0f,   0.0f, 0.0f,
-            -5.0f, -0.2f, -5.0f,   0.0f, 1.0f, 0.0f,   0.0f, 5.0f,
-            
-             5.0f, -0.2f,  5.0f,   0.0f, 1.0f, 0.0f,   5.0f, 0.0f,
-            -5.0f, -0.2f, -5.0f,   0.0f, 1.0f, 0.0f,   0.0f, 5.0f,
-             5.0f, -0.2f, -5.0f,   0.0f, 1.0f, 0.0f,   5.0f, 5.0f
-    };
-    //wall
-    float wallVertices[] = {
-            // positions                normals       texture coords
-             1.0f,  0.25f, 0.0f,   0.0f, 0.0f, 1.0f,   1.0f, 0.0f,
-            -1.0f,  0.25f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,
-            -1.0f, -0.25f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 1.0f,
-
-             1.0f,  0.25f, 0.0f,   0.0f, 0.0f, 1.0f,   1.0f, 0.0f,
-            -1.0f, -0.25f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 1.0f,
-             1.0f, -0.25f, 0.0f,   0.0f, 0.0f, 1.0f,   1.0f, 1.0f
-    };
-    //notes
-    float transparentVertices[] = {
-            // positions               normals        texture Coords (swapped y coordinates because texture is flipped upside down)
-            -0.5f,  0.5f,  0.0f,   0.0f, 0.0f, 1.0f,   0.0f,  0.0f,
-            -0.5f, -0.5f,  0.0f,   0.0f, 0.0f, 1.0f,   0.0f,  1.0f,
-             0.5f, -0.5f,  0.0f,   0.0f, 0.0f, 1.0f,   1.0f,  1.0f,
-
-            -0.5f,  0.5f,  0.0f,   0.0f, 0.0f, 1.0f,   0.0f,  0.0f,
-             0.5f, -0.5f,  0.0f,   0.0f, 0.0f, 1.0f,   1.0f,  1.0f,
-             0.5f,  0.5f,  0.0f,   0.0f, 0.0f, 1.0f,   1.0f,  0.0f
-    };
-
-    // calculating tree positions
-    int amount = 100;
-    glm::mat4 *treeModelMatrices;
-    treeModelMatrices = new glm::mat4[amount];
-    for(int i = 0; i < amount; ++i){
-        glm::mat4 tmpMat = glm::mat4(1.0f);
-        tmpMat = glm::translate(tmpMat,glm::vec3((glm::mod((float)i,10.0f) * 15.0f - 75.0f + 7.5f + cos(glm::radians(10.0f*i)*i)*3.75f),
-                                                 -3.2f,
-                                                 (glm::floor(i/10.0f)) * 15.0f - 75.0f + 7.5f + sin(glm::radians(10.0f*i)*i)*3.75f));
-        tmpMat = glm::rotate(tmpMat,glm::radians(15.0f*i),glm::vec3(0.0f,1.0f,0.0f));
-        tmpMat = glm::scale(tmpMat,glm::vec3(4.5f));
-        treeModelMatrices[i] = tmpMat;
+    rg::glext::load((GLADloadproc)glfwGetProcAddress);
+    rg::Trace::instance().add("window and context", "", startupBegin, rg::Trace::Clock::now());
+
+    // the imgui backends chain to the callbacks set above
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGui::StyleColorsDark();
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init("#version 330 core");
+
+    // what the scene holds comes from its file: the tree model, the static geometry and its textures, the
+    // trees and the lights
+    rg::Scene scene;
+    if (!scene.load(benchmark.scene))
+    {
+        std::cout << "Failed to load scene " << benchmark.scene << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    const rg::SceneHeader &sceneHeader = scene.header();
+
+    // calculating tree positions: the scene's grid and its single trees, the open world streams its trees in
+    // chunks instead
+    int amount = benchmark.openWorld ? 0 : (int)(benchmark.treesGiven ? benchmark.trees : sceneHeader.forestTrees);
+    int treesPerSide = rg::treesPerSide(amount);
+    // the ground everything stands on, the terrain draws it and the trees and the camera query it
+    rg::Heightfield ground;
+    rg::InstanceStore treePlacements;
+    rg::placeTrees(amount, treePlacements, &ground);
+    for (uint32_t i = 0; i < scene.count(rg::SCENE_TREES) && !benchmark.openWorld; ++i) {
+        const rg::SceneTree &tree = scene.trees()[i];
+        glm::vec3 position(tree.x, rg::groundHeight(&ground, tree.x, tree.z) - rg::TREE_SINK, tree.z);
+        treePlacements.add(position, tree.yaw, tree.scale);
     }
+    const int treeCount = (int)treePlacements.size();
+    if (!benchmark.openWorld)
+        benchmark.trees = (unsigned int)treeCount;
+    glm::mat4 *treeModelMatrices;
+    treeModelMatrices = new glm::mat4[treeCount];
+    rg::composeTransforms(treePlacements, treeModelMatrices);
+    camera.EyeHeight = [&ground](float x, float z) { return ground.height(x, z) - rg::TERRAIN_BASE; };
+    camera.Position.y = camera.EyeHeight(camera.Position.x, camera.Position.z);
+    if (sceneHeader.bounds > 0.0f)
+        camera.Bounds = sceneHeader.bounds;
 
-    // plane VAO
-    unsigned int planeVAO, planeVBO;
-    glGenVertexArrays(1, &planeVAO);
-    glGenBuffers(1, &planeVBO);
-    glBindVertexArray(planeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2,GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-
-    // sky VAO
-    unsigned int skyVAO, skyVBO;
-    glGenVertexArrays(1, &skyVAO);
-    glGenBuffers(1, &skyVBO);
-    glBindVertexArray(skyVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyVertices), &skyVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2,GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-
-
-    // wall VAO
-    unsigned int wallVAO, wallVBO;
-    glGenVertexArrays(1, &wallVAO);
-    glGenBuffers(1, &wallVBO);
-    glBindVertexArray(wallVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, wallVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(wallVertices), &wallVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-
-    // transparent VAO
-    unsigned int transparentVAO, transparentVBO;
-    glGenVertexArrays(1, &transparentVAO);
-    glGenBuffers(1, &transparentVBO);
-    glBindVertexArray(transparentVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, transparentVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(transparentVertices), transparentVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2,GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glBindVertexArray(0);
-    
-    unsigned int noteTexture1 = loadTexture("resources/textures/its3.png",true);
-    unsigned int noteTexture2 = loadTexture("resources/textures/not3.png",true);
-    unsigned int noteTexture3 = loadTexture("resources/textures/real3.png",true);
-
-    unsigned int floorTexture = loadTexture("resources/textures/floor.jpeg",true);
-    unsigned int skyTexture = loadTexture("resources/textures/cloud.jpeg",true);
-    unsigned int wallTexture = loadTexture("resources/textures/mountain.jpeg",true);
+    std::vector<unsigned int> sceneTextures;
+    for (uint32_t i = 0; i < scene.count(rg::SCENE_TEXTURES); ++i)
+        sceneTextures.push_back(loadTexture(scene.string(scene.textures()[i].path), true));
+    unsigned int floorTexture = loadTexture(scene.string(sceneHeader.terrainTexture), true);
 
 
     // configure global opengl state
@@ -238,196 +213,685 @@ int main()
 
     // build and compile shaders
     // -------------------------
-    Shader modelShader("resources/shaders/omnishader.vs", "resources/shaders/omnishader.fs");
+    // the environment is one static batch sampling a texture array
+    Shader staticShader("resources/shaders/static_batch.vs", "resources/shaders/omnishader.fs", {"TEXTURE_ARRAY"});
+    // the tree's materials are layers of a texture array too, and every pass drawing it sways it in the wind the
+    // same way, so the prepass, the GL_EQUAL pass and the shadows line up
+    Shader treeShader("resources/shaders/omnishader_instanced.vs", "resources/shaders/omnishader.fs", {"TEXTURE_ARRAY", "WIND"});
+    Shader impostorShader("resources/shaders/impostor.vs", "resources/shaders/impostor.fs");
+    // the other foliage modes: depth only alpha test + lit GL_EQUAL pass, and alpha to coverage
+    Shader treeDepthShader("resources/shaders/omnishader_instanced.vs", "resources/shaders/foliage_depth.fs", {"TEXTURE_ARRAY", "WIND"});
+    Shader treeEqualShader("resources/shaders/omnishader_instanced.vs", "resources/shaders/omnishader.fs", {"TEXTURE_ARRAY", "WIND", "DEPTH_EQUAL"});
+    Shader treeCoverageShader("resources/shaders/omnishader_instanced.vs", "resources/shaders/omnishader.fs", {"TEXTURE_ARRAY", "WIND", "ALPHA_TO_COVERAGE"});
+    // the trees into the sun's shadow cascades, alpha tested like the foliage prepass
+    Shader treeShadowShader("resources/shaders/shadow_depth.vs", "resources/shaders/foliage_depth.fs", {"TEXTURE_ARRAY", "WIND"});
+    // the clipmap terrain, lit like everything else
+    Shader terrainShader("resources/shaders/terrain.vs", "resources/shaders/omnishader.fs");
+    Shader *const programs[] = {&staticShader, &treeShader, &impostorShader, &treeDepthShader, &treeEqualShader,
+                                &treeCoverageShader, &treeShadowShader, &terrainShader};
+
+    // camera, light and wind state lives in uniform blocks shared by all programs
+    rg::FrameUniformBuffer frameUniforms;
+    for (Shader *shader : programs) {
+        shader->bindUniformBlock("PerFrame", rg::PER_FRAME_BLOCK_BINDING);
+        shader->bindUniformBlock("Lights", rg::LIGHTS_BLOCK_BINDING);
+        shader->bindUniformBlock("Shadows", rg::SHADOWS_BLOCK_BINDING);
+        shader->bindUniformBlock("Clusters", rg::CLUSTERS_BLOCK_BINDING);
+        shader->bindUniformBlock("Wind", rg::WIND_BLOCK_BINDING);
+    }
+    rg::WindSettings windSettings;
+    // shadows reach 150 of the 250 units the camera sees
+    rg::CascadedShadows shadows;
+    shadows.create(150.0f, 0.1f);
+    // the fireflies of the night, sorted into clusters over the camera's depth range
+    rg::ClusteredLights clusteredLights;
+    clusteredLights.create(0.1f, 250.0f);
+
+    // the scene's static geometry never moves: it is moved to world space once and merged into one buffer
+    rg::StaticBatch environment;
+    std::vector<unsigned int> sceneLayers;
+    for (uint32_t i = 0; i < scene.count(rg::SCENE_TEXTURES); ++i)
+        sceneLayers.push_back(environment.addTexture(sceneTextures[i], scene.textures()[i].clamp != 0));
+    for (uint32_t i = 0; i < scene.count(rg::SCENE_STATICS); ++i) {
+        const rg::SceneStatic &placed = scene.statics()[i];
+        glm::mat4 model;
+        std::memcpy(&model[0][0], placed.transform, sizeof(placed.transform));
+        // hung on a tree of the grid (the notes), whose ground height is only known here
+        if (placed.tree >= 0) {
+            if (placed.tree >= amount)
+                continue;
+            glm::vec3 position = rg::treePosition(placed.tree, treesPerSide);
+            position.y = ground.height(position.x, position.z) - rg::TERRAIN_BASE;
+            model = glm::translate(glm::mat4(1.0f), position) * model;
+        }
+        const rg::SceneMesh &mesh = scene.meshes()[placed.mesh];
+        environment.addTriangles(scene.vertices(mesh)->position, mesh.vertexCount, model, sceneLayers[placed.texture]);
+    }
+    environment.build();
+    rg::TerrainClipmap terrain;
+    terrain.create(ground);
 
     // load tree model
-    Model treeModel("resources/objects/Tree/Tree.obj", true);
+    // nothing drawing the tree reads the bitangent (the impostor bake only reads positions and UVs),
+    // so its meshes upload the packed vertex layout
+    Model treeModel(scene.model(), true, treeShader.activeAttributeMask());
     treeModel.SetShaderTextureNamePrefix("material.");
+    // two decimated levels at half and a fifth of the triangles, and a billboard past the last one
+    {
+        rg::TraceScope trace("lod generation");
+        treeModel.GenerateLods({0.5f, 0.2f});
+    }
+    // nothing reads the tree's vertices on the CPU after this, only the GPU buffers are drawn from
+    treeModel.ReleaseCpuData();
+    // all meshes of the tree in one vertex and index buffer, so its draws don't rebind buffers in between
+    bool treePacked = treeModel.PackBuffers();
+    // the impostor atlas is rendered once, so it has to wait for the real tree textures
+    std::vector<unsigned int> treeTextures;
+    for (const Texture &texture : treeModel.textures_loaded)
+        treeTextures.push_back(texture.id);
+    rg::Impostor treeImpostor;
+    {
+        rg::TraceScope trace("wait for tree textures");
+        rg::TextureLoader::instance().finish(treeTextures);
+    }
+    {
+        rg::TraceScope trace("impostor bake");
+        treeImpostor.bake(treeModel);
+    }
+    // after the bake, which still samples the meshes' own textures: the meshes of the tree then bind one
+    // texture between them, so their draws only differ in their ranges and the queue merges them
+    rg::MaterialArray treeMaterials;
+    if (treePacked && treeModel.UseMaterialArray(treeMaterials)) {
+        treeMaterials.update();
+        // the bake is done and the layers hold copies, nothing samples the meshes' own textures anymore
+        if (treeMaterials.complete())
+            treeModel.ReleaseTextures();
+    }
+    else {
+        // the meshes kept their own 2D textures, which the TEXTURE_ARRAY variants can't sample
+        std::cout << "MODEL:: the tree keeps its own textures, its programs are rebuilt without TEXTURE_ARRAY" << std::endl;
+        for (Shader *shader : {&treeShader, &treeDepthShader, &treeEqualShader, &treeCoverageShader, &treeShadowShader}) {
+            std::vector<std::string> defines = shader->defines();
+            defines.erase(std::remove(defines.begin(), defines.end(), std::string("TEXTURE_ARRAY")), defines.end());
+            if (!shader->rebuildWithDefines(defines))
+                std::cout << "ERROR::SHADER:: cannot rebuild " << shader->vertexPath() << " without TEXTURE_ARRAY" << std::endl;
+        }
+    }
+    // uniforms that never change are program state, they are set once and again whenever a program is reloaded
+    auto setProgramConstants = [&]() {
+        for (Shader *shader : programs) {
+            shader->use();
+            shader->setFloat("material.shininess", 32.0f);
+            shader->setInt("shadowMap", rg::SHADOW_MAP_TEXTURE_UNIT);
+            shader->setInt("clusterRanges", rg::CLUSTER_RANGES_TEXTURE_UNIT);
+            shader->setInt("clusterLightIndices", rg::CLUSTER_INDICES_TEXTURE_UNIT);
+            shader->setInt("pointLights", rg::POINT_LIGHTS_TEXTURE_UNIT);
+        }
+        // the texture array is on unit 0
+        staticShader.use();
+        staticShader.setInt("material.texture_diffuse1", 0);
+        treeImpostor.SetUniforms(impostorShader);
+    };
+    setProgramConstants();
+    // edited shaders are picked up while the scene runs, benchmark runs keep the programs they started with
+    rg::ShaderWatcher shaderWatcher;
+    if (!benchmark.enabled) {
+        for (Shader *shader : programs)
+            shaderWatcher.watch(*shader);
+        shaderWatcher.start();
+    }
+    rg::LodSelector treeLods({35.0f, 70.0f, 120.0f});
+    const unsigned int impostorLevel = treeLods.levelCount() - 1;
+    // same levels with the switch points out of reach, for drawing every tree at full detail
+    rg::LodSelector fullDetail(std::vector<float>(impostorLevel, INFINITY));
+
+    // trees are bucketed into the same 15 unit cells they were placed in, and culled cell by cell every frame
+    rg::InstanceGrid treeGrid;
+    treeGrid.build(treeModelMatrices, treeCount, treeModel.boundsMin, treeModel.boundsMax, 15.0f);
+    // the open world keeps the chunks out to the far plane loaded, they are generated by jobs
+    rg::JobSystem &jobs = rg::JobSystem::instance();
+    jobs.start();
+    rg::ForestChunks forest;
+    if (benchmark.openWorld) {
+        forest.create((int)std::ceil(250.0f / rg::CHUNK_SIZE), 20201115u, treeModel.boundsMin, treeModel.boundsMax, &ground);
+        forest.fill(camera.Position);
+        forest.clearChanged();
+    }
+    // whichever of the two the trees come from, indices into these stay valid from frame to frame
+    const std::vector<glm::mat4> &treeTransforms = benchmark.openWorld ? forest.transforms() : treeGrid.transforms();
+    const std::vector<rg::BoundingSphere> &treeSpheres = benchmark.openWorld ? forest.spheres() : treeGrid.spheres();
+    const unsigned int treeCapacity = (unsigned int)treeTransforms.size();
+    auto cullTrees = [&](const rg::Frustum &frustum, std::vector<unsigned int> &visible, rg::CullStats &stats) {
+        if (benchmark.openWorld)
+            forest.cullIndices(frustum, visible, stats);
+        else
+            treeGrid.cullIndices(frustum, visible, stats);
+    };
+    // Occlusion culling without compute shaders: the terrain around the camera and the trees nearest to it are
+    // rasterized on the CPU, and the frustum's survivors behind them are dropped. A tree stands in with a box
+    // around the dense core of its canopy and trunk, the edges of the canopy let too much through to hide
+    // anything. Only the tree job of the frame prep uses these, one packet after the other.
+    rg::SoftwareOcclusion treeOcclusion;
+    std::vector<unsigned int> treeOccluders;
+    const unsigned int treeOccluderCount = 64;
+    const glm::vec3 treeExtent = treeModel.boundsMax - treeModel.boundsMin;
+    const glm::vec3 treeCenter = (treeModel.boundsMin + treeModel.boundsMax) * 0.5f;
+    const glm::vec3 treeOccluderMin(treeCenter.x - 0.2f * treeExtent.x, treeModel.boundsMin.y + 0.35f * treeExtent.y,
+                                    treeCenter.z - 0.2f * treeExtent.z);
+    const glm::vec3 treeOccluderMax(treeCenter.x + 0.2f * treeExtent.x, treeModel.boundsMin.y + 0.8f * treeExtent.y,
+                                    treeCenter.z + 0.2f * treeExtent.z);
+    auto occludeTrees = [&](const glm::mat4 &viewProjection, const glm::vec3 &eye, std::vector<unsigned int> &visible,
+                            rg::CullStats &stats) {
+        treeOcclusion.begin(viewProjection);
+        // lowered a little, the coarse grid cuts corners where the ground curves up
+        const float step = 4.0f, range = 64.0f, margin = 1.0f;
+        const float startX = std::floor((eye.x - range) / step) * step, startZ = std::floor((eye.z - range) / step) * step;
+        for (float z = startZ; z < eye.z + range; z += step) {
+            for (float x = startX; x < eye.x + range; x += step) {
+                glm::vec3 a(x, ground.height(x, z) - margin, z), b(x + step, ground.height(x + step, z) - margin, z);
+                glm::vec3 c(x, ground.height(x, z + step) - margin, z + step);
+                glm::vec3 d(x + step, ground.height(x + step, z + step) - margin, z + step);
+                treeOcclusion.addTriangle(a, b, d);
+                treeOcclusion.addTriangle(a, d, c);
+            }
+        }
+        treeOccluders = visible;
+        size_t count = std::min(treeOccluders.size(), (size_t)treeOccluderCount);
+        auto distance = [&](unsigned int tree) {
+            glm::vec3 offset = treeSpheres[tree].center - eye;
+            return glm::dot(offset, offset);
+        };
+        std::nth_element(treeOccluders.begin(), treeOccluders.begin() + count, treeOccluders.end(),
+                         [&](unsigned int a, unsigned int b) { return distance(a) < distance(b); });
+        for (size_t i = 0; i < count; ++i)
+            treeOcclusion.addBox(treeOccluderMin, treeOccluderMax, treeTransforms[treeOccluders[i]]);
+        treeOcclusion.finish();
+        treeOcclusion.cullIndices(treeSpheres, visible, stats);
+    };
+
+    // Everything uploaded per frame goes through one stream buffer: the transforms of the visible trees grouped
+    // by level of detail (every mesh of the tree reads them per instance), the casters of every cascade, the
+    // terrain's placement, the uniform blocks and the light lists. A frame holds one set of each at most.
+    rg::StreamBuffer stream;
+    stream.create((1 + rg::SHADOW_CASCADES) * treeCapacity * sizeof(glm::mat4) + (2 << 20));
+    treeModel.SetInstanceBuffer(stream.buffer());
+
+    rg::GpuInstanceCuller gpuTreeCuller;
+    gpuCullingSupported = rg::glext::supportsGpuCulling() &&
+                          gpuTreeCuller.init(treeTransforms, treeSpheres, treeModel, treeLods);
+    gpuCulling = gpuCullingSupported;
+    // the GPU culling's occlusion test reads the depth of the frame before, reduced in compute
+    rg::HiZBuffer hiz;
+    const bool hizSupported = gpuCullingSupported && rg::glext::supportsImageLoadStore() && hiz.create();
 
     // directional light
-    DirLight dirLight;
-    dirLight.ambient = glm::vec3(0.01f);
-    dirLight.diffuse = glm::vec3(0.5f);
+    rg::DirLight dirLight = {};
+    // the scene's colours are the sun's at noon, the day-night cycle scales them
+    const rg::SceneLight &sun = sceneHeader.sun;
+    const glm::vec3 sunDiffuse(sun.diffuse[0], sun.diffuse[1], sun.diffuse[2]);
+    const glm::vec3 sunSpecular(sun.specular[0], sun.specular[1], sun.specular[2]);
+    dirLight.ambient = glm::vec3(sun.ambient[0], sun.ambient[1], sun.ambient[2]);
+    dirLight.diffuse = sunDiffuse;
     dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
-    dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
-
-    SpotLight spotLight;
-    spotLight.ambient = glm::vec3(0.0f);
-    spotLight.diffuse = glm::vec3(1.0f);
-    spotLight.specular = glm::vec3(1.0f);
-    spotLight.constant = 1.0f;
-    spotLight.linear = 0.09f;
-    spotLight.quadratic = 0.032f;
-    spotLight.cutOff = glm::cos(glm::radians(12.5f));
-    spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+    dirLight.specular = sunSpecular;
+
+    rg::SpotLight spotLight = {};
+    const rg::SceneLight &flashlight = sceneHeader.flashlight;
+    spotLight.ambient = glm::vec3(flashlight.ambient[0], flashlight.ambient[1], flashlight.ambient[2]);
+    spotLight.diffuse = glm::vec3(flashlight.diffuse[0], flashlight.diffuse[1], flashlight.diffuse[2]);
+    spotLight.specular = glm::vec3(flashlight.specular[0], flashlight.specular[1], flashlight.specular[2]);
+    spotLight.constant = flashlight.attenuation[0];
+    spotLight.linear = flashlight.attenuation[1];
+    spotLight.quadratic = flashlight.attenuation[2];
+    spotLight.cutOff = flashlight.cone[0];
+    spotLight.outerCutOff = flashlight.cone[1];
+
+    bool texturesReported = false;
+    // time of the scene (day-night cycle, camera bobbing), a fixed step per frame in benchmark runs
+    float sceneTime = 0.0f;
+    unsigned int frameIndex = 0;
+    rg::CameraPath cameraPath;
+    rg::BenchmarkRecorder recorder;
+    if (benchmark.enabled) {
+        if (benchmark.cameraPath.empty() || !cameraPath.load(benchmark.cameraPath))
+            cameraPath.useDefault();
+        // every run starts from the same fully loaded scene
+        rg::TextureLoader::instance().finishAll();
+    }
+    rg::RenderQueue renderQueue;
+
+    rg::Profiler profiler;
+    const unsigned int environmentPass = profiler.addPass("terrain + environment");
+    const unsigned int treePass = profiler.addPass("trees");
+    const unsigned int shadowPass = profiler.addPass("shadow cascades");
+    const unsigned int overlayPass = profiler.addPass("overlay");
+    const unsigned int prepWaitPass = profiler.addPass("wait for frame prep");
+    const unsigned int upscalePass = profiler.addPass("upscale");
+    const unsigned int hizPass = profiler.addPass("hi-z");
+    const unsigned int capturePass = profiler.addPass("capture");
+    // offline renders save the frames read back a few frames late, without the overlay
+    rg::FrameCapture capture;
+    capture.start(benchmark.capture);
+    // the scene at a scale that keeps the GPU time in budget, multisampled so the foliage can use alpha to coverage
+    rg::DynamicResolution dynamicResolution;
+    dynamicResolution.create(benchmark.resolution, rg::FOLIAGE_MSAA_SAMPLES);
+    rg::ProfilerToggles toggles;
+    toggles.frustumCulling = &frustumCulling;
+    toggles.lod = &treeLodsOn;
+    toggles.instancing = &treeInstancing;
+    toggles.gpuCulling = gpuCullingSupported ? &gpuCulling : nullptr;
+    toggles.occlusionCulling = &occlusionCulling;
+    toggles.treeCulling = &treeCullStats;
+    rg::FoliageMode foliageMode = benchmark.foliage;
+    toggles.foliage = &foliageMode;
+    toggles.shadows = &shadowsEnabled;
+    toggles.pointLights = &pointLightsEnabled;
+    toggles.wind = &windEnabled;
+    toggles.dynamicResolution = dynamicResolution.enabled();
+    toggles.resolutionScale = &dynamicResolution.scale();
+
+    // culling, levels of detail and shadow casters are prepared by jobs while the GL thread draws the frame before
+    rg::FramePacket packets[rg::FRAME_PACKETS];
+
+    // simulation of frame `frame`: input, camera and lights. It stays on the main thread, GLFW's input does.
+    auto simulate = [&](rg::FramePacket &packet, unsigned int frame) {
+        if (benchmark.enabled) {
+            sceneTime = frame * benchmark.timestep;
+            cameraPath.apply(sceneTime, camera);
+            // the path's heights are over the ground
+            camera.Position.y += camera.EyeHeight(camera.Position.x, camera.Position.z);
+        }
+        else {
+            sceneTime = glfwGetTime();
+            processInput(window);
+        }
+        camera.Clock = sceneTime;
+        packet.frame = frame;
+        packet.sceneTime = sceneTime;
+        // the window's aspect, which fullscreen changes; the render target is always scaled along both axes
+        int framebufferWidth = 0, framebufferHeight = 0;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        float aspect = framebufferWidth > 0 && framebufferHeight > 0 ? (float)framebufferWidth / framebufferHeight
+                                                                     : (float)SCR_WIDTH / (float)SCR_HEIGHT;
+        packet.projection = glm::perspective(45.0f, aspect, 0.1f, 250.0f);
+        packet.view = camera.GetViewMatrix();
+        packet.cameraPosition = camera.Position;
+
+        // calculating day-night cycle
+        float time = sceneTime;
+        float sin_time = sin(time/10);
+        float cos_time = cos(time/10);
+        if(sin_time > 0.0f) {
+            dirLight.diffuse = sunDiffuse * sin_time;
+            dirLight.specular = sunSpecular * sin_time;
+            dirLight.direction = glm::vec3(-cos_time, -sin_time, -1+cos_time);
+        }
+        else {
+            dirLight.direction = glm::vec3(0, 0, 0);
+        }
+        spotLight.direction = camera.Front;
+        spotLight.position = camera.Position;
+        packet.dirLight = dirLight;
+        packet.spotLight = spotLight;
+        packet.flashlightOn = flashlightOn;
+        // fireflies come out as the sun goes down
+        float night = glm::smoothstep(0.0f, 0.3f, -sin_time);
+        if (pointLightsEnabled)
+            rg::gatherFireflies(camera.Position, sceneTime, night, ground, packet.pointLights);
+        else
+            packet.pointLights.clear();
+
+        packet.frustumCulling = frustumCulling;
+        packet.treeLods = treeLodsOn;
+        packet.treeInstancing = treeInstancing;
+        packet.gpuCulling = gpuCulling;
+        packet.occlusionCulling = occlusionCulling;
+        packet.shadows = shadowsEnabled;
+        packet.wind = windEnabled;
+        packet.foliage = foliageMode;
+    };
+
+    // render prep of a simulated packet, on the job system. The tree selection and the shadow cascades keep state
+    // from frame to frame, so the packet before has to be prepared before this one starts.
+    auto prepare = [&](rg::FramePacket &packet) {
+        rg::FramePacket *prepared = &packet;
+        if (!packet.gpuCulling) {
+            // the trees inside the view frustum, sorted into instanced batches per level of detail
+            jobs.run(packet.prepared, [&, prepared]() {
+                rg::FramePacket &p = *prepared;
+                if (p.frustumCulling) {
+                    cullTrees(rg::Frustum::fromMatrix(p.projection * p.view), p.visibleTrees, p.treeCullStats);
+                    if (p.occlusionCulling)
+                        occludeTrees(p.projection * p.view, p.cameraPosition, p.visibleTrees, p.treeCullStats);
+                }
+                else if (benchmark.openWorld) {
+                    forest.allIndices(p.visibleTrees, p.treeCullStats);
+                }
+                else {
+                    p.visibleTrees.resize(treeGrid.size());
+                    for (unsigned int i = 0; i < treeGrid.size(); ++i)
+                        p.visibleTrees[i] = i;
+                    p.treeCullStats = rg::CullStats();
+                    p.treeCullStats.visible = treeGrid.size();
+                }
+                (p.treeLods ? treeLods : fullDetail).select(p.cameraPosition, treeSpheres, treeTransforms, p.visibleTrees, p.trees);
+            });
+        }
+        // the sun's cascades that went stale, each one's casters culled against its light box by a job of its own
+        jobs.run(packet.prepared, [&, prepared]() {
+            rg::FramePacket &p = *prepared;
+            shadows.update(p.projection * p.view, 250.0f, p.dirLight.direction, p.shadows, p.shadowFrame);
+            for (unsigned int cascade : p.shadowFrame.cascades) {
+                jobs.run(p.prepared, [&, prepared, cascade]() {
+                    rg::FramePacket &p = *prepared;
+                    rg::CullStats casterStats;
+                    cullTrees(rg::Frustum::fromMatrix(p.shadowFrame.block.lightViewProjection[cascade]),
+                              p.casterIndices[cascade], casterStats);
+                    p.casters[cascade].clear();
+                    for (unsigned int tree : p.casterIndices[cascade])
+                        p.casters[cascade].push_back(treeTransforms[tree]);
+                });
+            }
+        });
+        // the point lights into the clusters of the view
+        jobs.run(packet.prepared, [&, prepared]() {
+            rg::FramePacket &p = *prepared;
+            clusteredLights.assign(p.view, p.projection, p.pointLights, p.clusters);
+        });
+    };
 
     // render loop
     // -----------
 
-    while (!glfwWindowShouldClose(window))
+    simulate(packets[0], 0);
+    prepare(packets[0]);
+    rg::Trace::instance().add("startup", "", startupBegin, rg::Trace::Clock::now());
+    for (unsigned int frame = 0; !glfwWindowShouldClose(window); ++frame)
     {
+        // the first frames are traced too, the first one shows the work startup left behind
+        if (frame == rg::TRACE_FRAMES)
+            rg::Trace::instance().finish();
+        rg::TraceScope frameTrace(frame == 0 ? "first frame" : "frame",
+                                  rg::Trace::instance().recording() ? std::to_string(frame) : std::string());
         // per-frame time logic
         // --------------------
         float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
+        float frameSeconds = currentFrame - lastFrame;
         lastFrame = currentFrame;
-
-        // input
-        // -----
-        processInput(window);
+        deltaTime = benchmark.enabled ? benchmark.timestep : frameSeconds;
+
+        profiler.beginFrame(frameSeconds);
+        bool measured = benchmark.enabled && frameIndex >= benchmark.warmup;
+        if (measured)
+            recorder.beginFrame();
+
+        // this frame's packet has to be ready, then the next one is simulated and handed to the jobs, which
+        // prepare it while this one is drawn
+        rg::FramePacket &packet = packets[frame % rg::FRAME_PACKETS];
+        {
+            rg::Profiler::Scope scope(profiler, prepWaitPass);
+            rg::TraceScope trace("wait for frame prep");
+            jobs.wait(packet.prepared);
+        }
+        rg::FramePacket &next = packets[(frame + 1) % rg::FRAME_PACKETS];
+        const rg::Trace::Clock::time_point simulateBegin = rg::Trace::Clock::now();
+        simulate(next, frame + 1);
+        // chunks are committed while no job reads the forest, the GPU copy only receives the slots that changed
+        if (benchmark.openWorld) {
+            forest.update(next.cameraPosition);
+            if (gpuCullingSupported) {
+                for (unsigned int slot : forest.changedSlots())
+                    gpuTreeCuller.updateInstances(slot * rg::TREES_PER_CHUNK, rg::TREES_PER_CHUNK, treeTransforms, treeSpheres);
+            }
+            forest.clearChanged();
+        }
+        prepare(next);
+        rg::Trace::instance().add("simulate", "", simulateBegin, rg::Trace::Clock::now());
+
+        // programs rebuilt from edited sources are swapped in before anything of this frame is drawn
+        if (shaderWatcher.applyChanges())
+            setProgramConstants();
+
+        // textures that finished decoding replace their placeholders
+        rg::TextureLoader::instance().pump();
+        if (!texturesReported && rg::TextureLoader::instance().pending() == 0) {
+            rg::TextureCache::instance().report(std::cout);
+            texturesReported = true;
+        }
 
 
         // render
         // ------
+        // the scale follows the GPU time of the frames that just finished, into the window's current size
+        int windowWidth = 0, windowHeight = 0;
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+        dynamicResolution.resize(windowWidth, windowHeight);
+        // only the scene passes are drawn at the scaled resolution, the rest of the frame costs the same at any scale
+        float scaledMs = profiler.gpuMs(environmentPass) + profiler.gpuMs(treePass);
+        dynamicResolution.adjust(scaledMs, profiler.gpuFrameMs() - scaledMs);
+        dynamicResolution.begin();
+        rg::setFoliageMultisample(packet.foliage);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glm::mat4 projection = glm::perspective(45.0f, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 250.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-
 
-        // enabling shader before setting uniforms
-        modelShader.use();
+        // one upload of the camera, light and wind blocks serves every program for the whole frame
+        frameUniforms.perFrame.view = packet.view;
+        frameUniforms.perFrame.projection = packet.projection;
+        frameUniforms.perFrame.viewPosition = packet.cameraPosition;
+        frameUniforms.lights.dirLight = packet.dirLight;
+        frameUniforms.lights.spotLight = packet.spotLight;
+        frameUniforms.lights.spotLightOn = packet.flashlightOn;
+        // a calm frame still runs the WIND shaders, just without moving anything
+        rg::WindSettings frameWind = windSettings;
+        if (!packet.wind)
+            frameWind.strength = frameWind.flutter = 0.0f;
+        frameUniforms.wind = rg::animateWind(frameWind, packet.sceneTime, treeModel.boundsMin.y,
+                                             treeModel.boundsMax.y - treeModel.boundsMin.y);
+        stream.beginFrame();
+        frameUniforms.upload(stream);
+
+        // every pass is queued first and then drawn sorted by state in one flush
+        rg::renderStats().reset();
+
+        // the sun's cascades that went stale, the rest keep what they were rendered with
+        {
+            rg::Profiler::Scope scope(profiler, shadowPass);
+            for (unsigned int cascade : packet.shadowFrame.cascades) {
+                // the cascade is cleared even without casters: its refit matrix is published below and must not
+                // project the depths of what it covered before
+                shadows.beginCascade(cascade);
+                const std::vector<glm::mat4> &casters = packet.casters[cascade];
+                rg::StreamRange casterRange;
+                if (!casters.empty())
+                    casterRange = stream.upload(casters.data(), casters.size() * sizeof(glm::mat4), sizeof(glm::mat4));
+                if (casterRange.data) {
+                    treeShadowShader.use();
+                    treeShadowShader.setMat4("lightViewProjection", packet.shadowFrame.block.lightViewProjection[cascade]);
+                    // farther cascades have bigger texels, the coarser levels of detail are enough there
+                    treeModel.Submit(renderQueue, treeShadowShader, (unsigned int)casters.size(),
+                                     std::min(cascade, impostorLevel - 1), stream.buffer(),
+                                     (unsigned int)(casterRange.offset / sizeof(glm::mat4)));
+                    renderQueue.flush();
+                }
+                shadows.endCascade();
+                // casters that didn't fit in the stream buffer are drawn again by a later frame
+                if (!casters.empty() && !casterRange.data)
+                    shadows.retry(cascade);
+            }
+            shadows.upload(packet.shadowFrame, stream);
+            shadows.bind();
+        }
+        clusteredLights.upload(packet.clusters, stream);
+        clusteredLights.bind();
+
+        // rendering the terrain, sky, walls and notes
+        {
+            rg::Profiler::Scope scope(profiler, environmentPass);
+            terrain.update(packet.cameraPosition);
+            terrain.submit(renderQueue, terrainShader, floorTexture, stream);
+            environment.update();
+            environment.submit(renderQueue, staticShader);
+            renderQueue.flush();
+        }
 
-        // calculating day-night cycle
-        float time = currentFrame;
-        float sin_time = sin(time/10);
-        float cos_time = cos(time/10);
-        if(sin_time > 0.0f) {
-            dirLight.diffuse = glm::vec3(0.5f * sin_time);
-            dirLight.specular = glm::vec3( 0.5f * sin_time);
-            dirLight.direction = glm::vec3(-cos_time, -sin_time, -1+cos_time);
+        {
+            rg::Profiler::Scope scope(profiler, treePass);
+            const rg::LodBatches &treeLodBatches = packet.trees;
+            // instance of the stream buffer the batches start at
+            unsigned int treeBase = 0;
+            // the CPU path's trees only draw when their transforms made it into the stream buffer
+            bool treesUploaded = packet.gpuCulling;
+            if (packet.gpuCulling) {
+                // rendering the trees, culled, counted and sorted into levels of detail on the GPU, one indirect
+                // command per mesh and level
+                gpuTreeCuller.cull(rg::Frustum::fromMatrix(packet.projection * packet.view), packet.cameraPosition,
+                                   packet.treeLods, packet.occlusionCulling ? &hiz : nullptr);
+                treeCullStats = gpuTreeCuller.stats();
+            }
+            else {
+                // rendering the trees, only the ones inside the view frustum, one instanced draw per mesh and level of detail
+                treeCullStats = packet.treeCullStats;
+                if (!treeLodBatches.transforms.empty()) {
+                    rg::StreamRange range = stream.upload(treeLodBatches.transforms.data(), treeLodBatches.transforms.size() * sizeof(glm::mat4),
+                                                          sizeof(glm::mat4));
+                    treeBase = (unsigned int)(range.offset / sizeof(glm::mat4));
+                    treesUploaded = range.data != nullptr;
+                }
+            }
+            // the tree meshes drawn with `shader`, the prepass queues them twice
+            auto submitTreeMeshes = [&](Shader &shader) {
+                if (packet.gpuCulling) {
+                    gpuTreeCuller.submit(renderQueue, shader, treeModel);
+                    return;
+                }
+                if (!treesUploaded)
+                    return;
+                for (unsigned int level = 0; level < impostorLevel; ++level) {
+                    if (treeLodBatches.count[level] == 0)
+                        continue;
+                    if (packet.treeInstancing) {
+                        treeModel.Submit(renderQueue, shader, treeLodBatches.count[level], level,
+                                         stream.buffer(), treeBase + treeLodBatches.first[level]);
+                        continue;
+                    }
+                    // one draw per tree, still reading its transform from the instance buffer
+                    for (unsigned int i = 0; i < treeLodBatches.count[level]; ++i)
+                        treeModel.Submit(renderQueue, shader, 1, level, stream.buffer(), treeBase + treeLodBatches.first[level] + i);
+                }
+            };
+            // impostors keep their own alpha test, they are few and far away
+            auto submitImpostors = [&]() {
+                if (packet.gpuCulling)
+                    gpuTreeCuller.submitImpostors(renderQueue, impostorShader, treeImpostor);
+                else if (treesUploaded && treeLodBatches.count[impostorLevel] > 0)
+                    treeImpostor.Submit(renderQueue, impostorShader, treeLodBatches.count[impostorLevel],
+                                        stream.buffer(), treeBase + treeLodBatches.first[impostorLevel]);
+            };
+            if (packet.foliage == rg::FOLIAGE_DEPTH_PREPASS) {
+                rg::beginFoliageDepthPass();
+                submitTreeMeshes(treeDepthShader);
+                renderQueue.flush();
+                rg::beginFoliageColorPass();
+                submitTreeMeshes(treeEqualShader);
+                renderQueue.flush();
+                rg::endFoliagePasses();
+                submitImpostors();
+            }
+            else {
+                if (packet.foliage == rg::FOLIAGE_ALPHA_TO_COVERAGE)
+                    rg::beginFoliageCoveragePass();
+                submitTreeMeshes(packet.foliage == rg::FOLIAGE_ALPHA_TO_COVERAGE ? treeCoverageShader : treeShader);
+                renderQueue.flush();
+                rg::endFoliagePasses();
+                submitImpostors();
+            }
+            renderQueue.flush();
+        }
+        // the depth of this frame for the occlusion test of the next one
+        if (hizSupported && packet.gpuCulling && packet.occlusionCulling) {
+            rg::Profiler::Scope scope(profiler, hizPass);
+            hiz.build(dynamicResolution.framebuffer(), dynamicResolution.width(), dynamicResolution.height(),
+                      dynamicResolution.samples(), packet.projection * packet.view);
         }
         else {
-            dirLight.direction = glm::vec3(0, 0, 0);
+            hiz.invalidate();
         }
-        modelShader.setVec3("dirLight.direction", dirLight.direction);
-        modelShader.setVec3("dirLight.ambient", dirLight.ambient);
-        modelShader.setVec3("dirLight.diffuse", dirLight.diffuse);
-        modelShader.setVec3("dirLight.specular", dirLight.specular);
-
-        spotLight.direction = camera.Front;
-        spotLight.position = camera.Position;
-        modelShader.setBool("spotLightOn", flashlightOn);
-        modelShader.setVec3("spotLight.position", spotLight.position);
-        modelShader.setVec3("spotLight.direction", spotLight.direction);
-        modelShader.setVec3("spotLight.ambient", spotLight.ambient);
-        modelShader.setVec3("spotLight.diffuse", spotLight.diffuse);
-        modelShader.setVec3("spotLight.specular", spotLight.specular);
-        modelShader.setFloat("spotLight.constant", spotLight.constant);
-        modelShader.setFloat("spotLight.linear", spotLight.linear);
-        modelShader.setFloat("spotLight.quadratic", spotLight.quadratic);
-        modelShader.setFloat("spotLight.cutOff", spotLight.cutOff);
-        modelShader.setFloat("spotLight.outerCutOff", spotLight.outerCutOff);
-
-        modelShader.setVec3("viewPosition", camera.Position);
-        modelShader.setFloat("material.shininess", 32.0f);
-        // view/projection transformations
-
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
-
-        // rendering the floor
-        glActiveTexture(GL_TEXTURE0);
-        glBindVertexArray(planeVAO);
-        glUniform1i(glGetUniformLocation(modelShader.ID, "material.texture_diffuse1"), 0);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::scale(model, glm::vec3(15.0f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        //rendering the sky
-        glBindVertexArray(skyVAO);
-        glUniform1i(glGetUniformLocation(modelShader.ID, "material.texture_diffuse1"), 0);
-        glBindTexture(GL_TEXTURE_2D, skyTexture);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 35.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(15.0f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        //rendering the walls
-        glBindVertexArray(wallVAO);
-        glUniform1i(glGetUniformLocation(modelShader.ID, "material.texture_diffuse1"), 0);
-        glBindTexture(GL_TEXTURE_2D, wallTexture);
-        //front wall
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 15.0f, -75.0f));
-        model = glm::scale(model, glm::vec3(75.0f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        //back wall
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 15.0f, 75.0f));
-        model = glm::rotate(model, glm::radians(180.0f),glm::vec3(0.0f,1.0f,0.0f));
-        model = glm::scale(model, glm::vec3(75.0f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        //right wall
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(75.0f, 15.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(-90.0f),glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(75.0f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        //left wall
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-75.0f, 15.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(90.0f),glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(75.0f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        // rendering notes
-        glBindVertexArray(transparentVAO);
-        glUniform1i(glGetUniformLocation(modelShader.ID, "material.texture_diffuse1"), 0);
-        glBindTexture(GL_TEXTURE_2D, noteTexture1);
-
-        model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        model = glm::translate(model, glm::vec3(glm::vec3((glm::mod((float)14,10.0f) * 15.0f - 75.0f + 7.5f + cos(glm::radians(10.0f*14)*14)*3.75f),
-                                                          0.0f,
-                                                          (glm::floor(14/10.0f)) * 15.0f - 75.0f + 7.5f + sin(glm::radians(10.0f*14)*14)*3.75f)) + glm::vec3(-0.07f, 1.0f, 0.65f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        glBindTexture(GL_TEXTURE_2D, noteTexture2);
-        model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        model = glm::translate(model, glm::vec3((glm::mod((float)72,10.0f) * 15.0f - 75.0f + 7.5f + cos(glm::radians(10.0f*72)*72)*3.75f),
-                                                0.0f,
-                                                (glm::floor(72/10.0f)) * 15.0f - 75.0f + 7.5f + sin(glm::radians(10.0f*72)*72)*3.75f)+ glm::vec3(0.03f, 1.0f, 0.65f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        glBindTexture(GL_TEXTURE_2D, noteTexture3);
-        model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        model = glm::translate(model, glm::vec3((glm::mod((float)87,10.0f) * 15.0f - 75.0f + 7.5f + cos(glm::radians(10.0f*87)*87)*3.75f),
-                                                0.0f,
-                                                (glm::floor(87/10.0f)) * 15.0f - 75.0f + 7.5f + sin(glm::radians(10.0f*87)*87)*3.75f) + glm::vec3 (-0.05f, 1.0f, 0.65f));
-        modelShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        // rendering the trees
-        for(int i = 0; i < amount; ++i) {
-            modelShader.setMat4("model", treeModelMatrices[i]);
-            treeModel.Draw(modelShader);
+        {
+            rg::Profiler::Scope scope(profiler, upscalePass);
+            dynamicResolution.end();
+        }
+        if (capture.active() && (measured || !benchmark.enabled)) {
+            rg::Profiler::Scope scope(profiler, capturePass);
+            capture.capture(windowWidth, windowHeight);
         }
+        profiler.endFrame();
+
+        if (showProfiler) {
+            rg::Profiler::Scope scope(profiler, overlayPass);
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            profiler.drawOverlay(toggles);
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+
+        if (measured)
+            recorder.endFrame(dynamicResolution.scale());
+        if (benchmark.enabled && ++frameIndex >= benchmark.warmup + benchmark.frames)
+            glfwSetWindowShouldClose(window, true);
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
+        stream.endFrame();
+        {
+            rg::TraceScope trace("swap");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
+    // the packet prepared last is never drawn, its jobs still have to finish before anything they read goes away
+    for (rg::FramePacket &packet : packets)
+        jobs.wait(packet.prepared);
+    forest.finish();
+    jobs.stop();
+    capture.finish();
+    // runs shorter than TRACE_FRAMES
+    rg::Trace::instance().finish();
+    if (benchmark.enabled) {
+        if (benchmark.output.empty()) {
+            recorder.write(std::cout, benchmark);
+        }
+        else {
+            std::ofstream output(benchmark.output);
+            recorder.write(output, benchmark);
+        }
+    }
     // Cleanup
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
-    glDeleteVertexArrays(1, &planeVAO);
-    glDeleteBuffers(1, &planeVBO);
-    glDeleteVertexArrays(1, &skyVAO);
-    glDeleteBuffers(1, &skyVBO);
-    glDeleteVertexArrays(1, &wallVAO);
-    glDeleteBuffers(1, &wallVBO);
-    glDeleteVertexArrays(1, &transparentVAO);
-    glDeleteBuffers(1, &transparentVBO);
+    shaderWatcher.stop();
+    profiler.destroy();
+    dynamicResolution.destroy();
+    shadows.destroy();
+    clusteredLights.destroy();
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+    environment.destroy();
+    treeMaterials.destroy();
+    terrain.destroy();
+    stream.destroy();
+    if (gpuCullingSupported)
+        gpuTreeCuller.destroy();
+    hiz.destroy();
+    treeImpostor.destroy();
+    for (unsigned int texture : sceneTextures)
+        rg::TextureCache::instance().release(texture);
+    rg::TextureCache::instance().release(floorTexture);
+    treeModel.ReleaseTextures();
+    treeModel.ReleaseBuffers();
+    rg::TextureLoader::instance().shutdown();
     glfwTerminate();
     return 0;
 }
@@ -462,6 +926,9 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 // -------------------------------------------------------
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
+    // the cursor belongs to the overlay while it's shown
+    if (showProfiler)
+        return;
     if (firstMouse)
     {
         lastX = xpos;
@@ -490,6 +957,16 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if(key == GLFW_KEY_F && action == GLFW_PRESS){
         flashlightOn = !flashlightOn;
     }
+    // profiler overlay, the camera stops following the mouse while it's open
+    if(key == GLFW_KEY_F1 && action == GLFW_PRESS){
+        showProfiler = !showProfiler;
+        glfwSetInputMode(window, GLFW_CURSOR, showProfiler ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
+        firstMouse = true;
+    }
+    // switching between GPU and CPU tree culling
+    if(key == GLFW_KEY_G && action == GLFW_PRESS && gpuCullingSupported){
+        gpuCulling = !gpuCulling;
+    }
     // fullscreen control
     if(key == GLFW_KEY_F11 && action == GLFW_PRESS){
         if(!isFullScreen) {
@@ -503,44 +980,9 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     }
 }
 
+// shared through the texture cache, decoding happens on the loader's worker threads and the texture is
+// filled in by a later pump()
 unsigned int loadTexture(char const * path, bool gamma)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum dataFormat;
-        GLenum internalFormat;
-        if (nrComponents == 1)
-            internalFormat = dataFormat = GL_RED;
-        else if (nrComponents == 3) {
-            internalFormat = gamma ? GL_SRGB : GL_RGB;
-            dataFormat = GL_RGB;
-        }
-        else if (nrComponents == 4){
-            internalFormat = gamma ? GL_SRGB_ALPHA : GL_RGBA;
-            dataFormat = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, dataFormat == GL_RGBA ? GL_CLAMP_TO_EDGE :GL_REPEAT); // for this tutorial: use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, dataFormat == GL_RGBA ? GL_CLAMP_TO_EDGE :GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
-}
\ No newline at end of file
+    return rg::TextureCache::instance().acquire(path, gamma, true);
+}
@@ -0,0 +1,313 @@
+//
+// Offline converter from .png/.jpg/.jpeg images to block compressed KTX files with a full mip chain.
+// Every image gets a <image>.ktx next to it, stamped with the image it was built from, which the TextureLoader
+// then prefers over the original as long as the stamp matches:
+//   colour without alpha -> BC1, colour with alpha -> BC3, normal maps (*_NRM*, *normal*) -> BC5
+//
+// usage: texture_compressor [--force] <file or directory>...
+//
+
+#include <stb_image.h>
+#include <rg/Ktx.h>
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Level {
+    int width;
+    int height;
+    // linear RGBA in [0, 1]
+    std::vector<float> pixels;
+};
+
+float srgbToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+unsigned char toByte(float c) {
+    return (unsigned char)std::lround(std::min(std::max(c, 0.0f), 1.0f) * 255.0f);
+}
+
+// 2x2 box filter, odd sizes repeat their last row/column
+Level downsample(const Level &level) {
+    Level next;
+    next.width = std::max(1, level.width / 2);
+    next.height = std::max(1, level.height / 2);
+    next.pixels.resize((size_t)next.width * next.height * 4);
+    for (int y = 0; y < next.height; ++y) {
+        for (int x = 0; x < next.width; ++x) {
+            for (int c = 0; c < 4; ++c) {
+                float sum = 0.0f;
+                for (int dy = 0; dy < 2; ++dy) {
+                    for (int dx = 0; dx < 2; ++dx) {
+                        int sx = std::min(2 * x + dx, level.width - 1);
+                        int sy = std::min(2 * y + dy, level.height - 1);
+                        sum += level.pixels[((size_t)sy * level.width + sx) * 4 + c];
+                    }
+                }
+                next.pixels[((size_t)y * next.width + x) * 4 + c] = sum * 0.25f;
+            }
+        }
+    }
+    return next;
+}
+
+// the 4x4 block at (bx, by) as 8 bit RGBA, edge pixels repeat past the border
+void fetchBlock(const Level &level, bool srgb, int bx, int by, unsigned char block[16][4]) {
+    for (int i = 0; i < 16; ++i) {
+        int x = std::min(bx * 4 + i % 4, level.width - 1);
+        int y = std::min(by * 4 + i / 4, level.height - 1);
+        const float *pixel = &level.pixels[((size_t)y * level.width + x) * 4];
+        for (int c = 0; c < 3; ++c)
+            block[i][c] = toByte(srgb ? linearToSrgb(pixel[c]) : pixel[c]);
+        block[i][3] = toByte(pixel[3]);
+    }
+}
+
+uint16_t pack565(const int color[3]) {
+    return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+}
+
+void unpack565(uint16_t packed, int color[3]) {
+    int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+}
+
+// BC1 colour block with the endpoints on the inset bounding box of the block's colours, 4 colour mode
+void encodeColorBlock(const unsigned char block[16][4], unsigned char *out) {
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            lo[c] = std::min(lo[c], (int)block[i][c]);
+            hi[c] = std::max(hi[c], (int)block[i][c]);
+        }
+    }
+    // the box diagonal runs the wrong way when the green channel falls while red/blue rise
+    int covarianceRG = 0, covarianceBG = 0;
+    for (int i = 0; i < 16; ++i) {
+        int g = block[i][1] - (lo[1] + hi[1]) / 2;
+        covarianceRG += (block[i][0] - (lo[0] + hi[0]) / 2) * g;
+        covarianceBG += (block[i][2] - (lo[2] + hi[2]) / 2) * g;
+    }
+    if (covarianceRG < 0)
+        std::swap(lo[0], hi[0]);
+    if (covarianceBG < 0)
+        std::swap(lo[2], hi[2]);
+    // pulling the endpoints in by 1/16 of the range lowers the error of the interpolated entries
+    for (int c = 0; c < 3; ++c) {
+        int inset = (hi[c] - lo[c]) / 16;
+        hi[c] -= inset;
+        lo[c] += inset;
+    }
+
+    uint16_t color0 = pack565(hi), color1 = pack565(lo);
+    if (color0 < color1)
+        std::swap(color0, color1);
+    int palette[4][3];
+    unpack565(color0, palette[0]);
+    unpack565(color1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; ++p) {
+                int error = 0;
+                for (int c = 0; c < 3; ++c)
+                    error += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    out[0] = color0 & 0xFF;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF;
+    out[3] = color1 >> 8;
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// BC4 block of one channel of the block, 8 value mode
+void encodeChannelBlock(const unsigned char block[16][4], int channel, unsigned char *out) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; ++i) {
+        lo = std::min(lo, (int)block[i][channel]);
+        hi = std::max(hi, (int)block[i][channel]);
+    }
+    int palette[8] = {hi, lo};
+    for (int p = 1; p < 7; ++p)
+        palette[p + 1] = ((7 - p) * hi + p * lo) / 7;
+
+    uint64_t indices = 0;
+    if (hi != lo) {
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 8; ++p) {
+                int error = std::abs(block[i][channel] - palette[p]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    out[0] = (unsigned char)hi;
+    out[1] = (unsigned char)lo;
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+std::vector<unsigned char> encodeLevel(const Level &level, uint32_t format, bool srgb) {
+    int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+    unsigned int blockSize = rg::ktxBlockSize(format);
+    std::vector<unsigned char> encoded((size_t)blocksX * blocksY * blockSize);
+    unsigned char block[16][4];
+    unsigned char *out = encoded.data();
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx, out += blockSize) {
+            fetchBlock(level, srgb, bx, by, block);
+            if (format == rg::KTX_BC1_RGB) {
+                encodeColorBlock(block, out);
+            } else if (format == rg::KTX_BC3_RGBA) {
+                encodeChannelBlock(block, 3, out);
+                encodeColorBlock(block, out + 8);
+            } else {
+                encodeChannelBlock(block, 0, out);
+                encodeChannelBlock(block, 1, out + 8);
+            }
+        }
+    }
+    return encoded;
+}
+
+std::string lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return text;
+}
+
+bool endsWith(const std::string &text, const std::string &suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool isImage(const std::string &path) {
+    std::string name = lowercase(path);
+    return endsWith(name, ".png") || endsWith(name, ".jpg") || endsWith(name, ".jpeg");
+}
+
+bool isNormalMap(const std::string &path) {
+    std::string name = lowercase(path.substr(path.find_last_of('/') + 1));
+    return name.find("_nrm") != std::string::npos || name.find("normal") != std::string::npos;
+}
+
+// the same check the TextureLoader makes before it uses the target
+bool isUpToDate(const std::string &source, const std::string &target) {
+    rg::KtxImage image;
+    return rg::readKtx(target, image) && image.stamped && rg::ktxMatchesSource(target, image, source);
+}
+
+bool convert(const std::string &path, bool force) {
+    std::string target = rg::compressedTexturePath(path);
+    if (!force && isUpToDate(path, target))
+        return true;
+
+    int width, height, components;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &components, 4);
+    if (!data) {
+        std::cerr << "failed to load " << path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    bool hasAlpha = false;
+    for (size_t i = 0; i < (size_t)width * height && !hasAlpha; ++i)
+        hasAlpha = data[i * 4 + 3] != 255;
+
+    uint32_t format = isNormalMap(path) ? rg::KTX_BC5_RG : hasAlpha ? rg::KTX_BC3_RGBA : rg::KTX_BC1_RGB;
+    // colour is filtered in linear space, the loader picks the sRGB variant of the format when asked to
+    bool srgb = format != rg::KTX_BC5_RG;
+    Level level;
+    level.width = width;
+    level.height = height;
+    level.pixels.resize((size_t)width * height * 4);
+    for (size_t i = 0; i < level.pixels.size(); ++i) {
+        float value = data[i] / 255.0f;
+        level.pixels[i] = srgb && i % 4 != 3 ? srgbToLinear(value) : value;
+    }
+    stbi_image_free(data);
+
+    rg::KtxImage image;
+    image.stamped = rg::SourceStamp::stat(path, image.source);
+    image.source.hash = rg::SourceStamp::hashFile(path);
+    image.internalFormat = format;
+    image.baseFormat = format == rg::KTX_BC5_RG ? rg::KTX_BASE_RG : hasAlpha ? rg::KTX_BASE_RGBA : rg::KTX_BASE_RGB;
+    image.width = width;
+    image.height = height;
+    for (;;) {
+        std::vector<unsigned char> blocks = encodeLevel(level, format, srgb);
+        image.addLevel(level.width, level.height, blocks.data(), blocks.size());
+        if (level.width == 1 && level.height == 1)
+            break;
+        level = downsample(level);
+    }
+    if (!rg::writeKtx(target, image)) {
+        std::cerr << "failed to write " << target << std::endl;
+        return false;
+    }
+    std::cout << path << " -> " << target << " (" << image.levels.size() << " levels, "
+              << image.data.size() / 1024 << " KiB)" << std::endl;
+    return true;
+}
+
+bool convertTree(const std::string &path, bool force) {
+    DIR *directory = opendir(path.c_str());
+    if (!directory)
+        return isImage(path) ? convert(path, force) : true;
+    bool ok = true;
+    while (dirent *entry = readdir(directory)) {
+        if (entry->d_name[0] != '.')
+            ok = convertTree(path + '/' + entry->d_name, force) && ok;
+    }
+    closedir(directory);
+    return ok;
+}
+
+}
+
+int main(int argc, char **argv) {
+    bool force = false;
+    bool ok = true;
+    // the loader expects top row first, which is how stb_image returns it by default
+    stbi_set_flip_vertically_on_load(false);
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--force") == 0)
+            force = true;
+        else
+            ok = convertTree(argv[i], force) && ok;
+    }
+    if (argc < 2)
+        std::cerr << "usage: texture_compressor [--force] <file or directory>..." << std::endl;
+    return ok && argc >= 2 ? 0 : 1;
+}